@@ -169,8 +169,11 @@ sub build_pgprobackup
 		'restore.c',
 		'show.c',
 		'stream.c',
+		'throttle.c',
 		'util.c',
 		'validate.c',
+		'walsummary.c',
+		'filelist.c',
 		'checkdb.c',
 		'ptrack.c'
 		);
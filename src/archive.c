@@ -19,6 +19,7 @@ static bool get_wal_file(const char *filename, const char *from_path, const char
 													bool prefetch_mode);
 static int get_wal_file_internal(const char *from_path, const char *to_path, FILE *out,
 								 bool is_decompress);
+static int get_wal_file_frame(const char *from_fullpath, const char *to_fullpath, FILE *out);
 #ifdef HAVE_LIBZ
 static const char *get_gz_error(gzFile gzf, int errnum);
 #endif
@@ -50,12 +51,15 @@ typedef struct
 	bool        compress;
 	bool        no_sync;
 	bool        no_ready_rename;
+	bool        block_summary;
 	uint32      archive_timeout;
+	uint32      wal_seg_size;
 
 	CompressAlg compress_alg;
 	int         compress_level;
 	int         thread_num;
 
+	ForkJoin   *fork_join;
 	parray     *files;
 
 	uint32      n_pushed;
@@ -75,6 +79,7 @@ typedef struct
 	const char *prefetch_dir;
 	const char *archive_dir;
 	int         thread_num;
+	ForkJoin   *fork_join;
 	parray     *files;
 	uint32      n_fetched;
 } archive_get_arg;
@@ -82,14 +87,17 @@ typedef struct
 typedef struct WALSegno
 {
 	char        name[MAXFNAMELEN];
-	volatile    pg_atomic_flag lock;
 	volatile	pg_atomic_uint32 done;
 	struct WALSegno* prev;
 } WALSegno;
 
-static int push_file_internal_uncompressed(WALSegno *wal_file_name, const char *pg_xlog_dir,
-								  const char *archive_dir, bool overwrite, bool no_sync,
-								  uint32 archive_timeout);
+static int push_file_internal(WALSegno *wal_file_name, const char *pg_xlog_dir,
+							  const char *archive_dir, bool overwrite, bool no_sync,
+							  CompressAlg compress_alg, int compress_level,
+							  uint32 archive_timeout);
+static void push_wal_frame(WALSegno *wal_file, FILE *in, const char *from_fullpath,
+						   int out, const char *to_fullpath_part,
+						   CompressAlg compress_alg, int compress_level);
 #ifdef HAVE_LIBZ
 static int push_file_internal_gz(WALSegno *wal_file_name, const char *pg_xlog_dir,
 									 const char *archive_dir, bool overwrite, bool no_sync,
@@ -100,7 +108,8 @@ static int push_file(WALSegno *xlogfile, const char *archive_status_dir,
 								   const char *pg_xlog_dir, const char *archive_dir,
 								   bool overwrite, bool no_sync, uint32 archive_timeout,
 								   bool no_ready_rename, bool is_compress,
-								   int compress_level);
+								   CompressAlg compress_alg, int compress_level,
+								   bool block_summary, uint32 wal_seg_size);
 
 static parray *setup_push_filelist(const char *archive_status_dir,
 								   const char *first_file, int batch_size);
@@ -118,15 +127,15 @@ static parray *setup_push_filelist(const char *archive_status_dir,
 void
 do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg_xlog_dir,
 				char *wal_file_name, int batch_size, bool overwrite,
-				bool no_sync, bool no_ready_rename)
+				bool no_sync, bool no_ready_rename, bool block_summary)
 {
 	uint64		i;
 	/* usually instance pgdata/pg_wal/archive_status, empty if no_ready_rename or batch_size == 1 */
 	char		archive_status_dir[MAXPGPATH] = "";
 	bool		is_compress = false;
 
-	/* arrays with meta info for multi threaded backup */
-	pthread_t	*threads;
+	/* meta info for multi threaded push */
+	ForkJoin   *fork_join;
 	archive_push_arg *threads_args;
 	bool		push_isok = true;
 
@@ -149,6 +158,9 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 	if (instance->compress_alg == ZLIB_COMPRESS)
 		is_compress = true;
 #endif
+	/* zstd and lz4 are available if this build supports them */
+	if (compress_frame_bound(XLOG_BLCKSZ, instance->compress_alg) > 0)
+		is_compress = true;
 
 	/*  Setup filelist and locks */
 	batch_files = setup_push_filelist(archive_status_dir, wal_file_name, batch_size);
@@ -161,7 +173,7 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 					"threads: %i/%i, batch: %lu/%i, compression: %s",
 						wal_file_name, n_threads, num_threads,
 						parray_num(batch_files), batch_size,
-						is_compress ? "zlib" : "none");
+						is_compress ? deparse_compress_alg(instance->compress_alg) : "none");
 
 	num_threads = n_threads;
 
@@ -190,7 +202,8 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 						   instance->archive_timeout,
 						   no_ready_rename || first_wal,
 						   is_compress && IsXLogFileName(xlogfile->name) ? true : false,
-						   instance->compress_level);
+						   instance->compress_alg, instance->compress_level,
+						   block_summary, instance->xlog_seg_size);
 			if (rc == 0)
 				n_total_pushed++;
 			else
@@ -202,7 +215,7 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 	}
 
 	/* init thread args with its own segno */
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	fork_join = fork_join_create(num_threads, parray_num(batch_files));
 	threads_args = (archive_push_arg *) palloc(sizeof(archive_push_arg) * num_threads);
 
 	for (i = 0; i < num_threads; i++)
@@ -217,7 +230,9 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 		arg->compress = is_compress;
 		arg->no_sync = no_sync;
 		arg->no_ready_rename = no_ready_rename;
+		arg->block_summary = block_summary;
 		arg->archive_timeout = instance->archive_timeout;
+		arg->wal_seg_size = instance->xlog_seg_size;
 
 		arg->compress_alg = instance->compress_alg;
 		arg->compress_level = instance->compress_level;
@@ -226,6 +241,7 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 		arg->n_pushed = 0;
 		arg->n_skipped = 0;
 
+		arg->fork_join = fork_join;
 		arg->thread_num = i+1;
 		/* By default there are some error */
 		arg->ret = 1;
@@ -233,16 +249,10 @@ do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg
 
 	/* Run threads */
 	INSTR_TIME_SET_CURRENT(start_time);
-	for (i = 0; i < num_threads; i++)
-	{
-		archive_push_arg *arg = &(threads_args[i]);
-		pthread_create(&threads[i], NULL, push_files, arg);
-	}
+	fork_join_run(fork_join, push_files, threads_args, sizeof(archive_push_arg));
 
-	/* Wait threads */
 	for (i = 0; i < num_threads; i++)
 	{
-		pthread_join(threads[i], NULL);
 		if (threads_args[i].ret == 1)
 		{
 			push_isok = false;
@@ -285,20 +295,17 @@ push_done:
 static void *
 push_files(void *arg)
 {
-	int		i;
+	size_t	i;
 	int		rc;
 	archive_push_arg *args = (archive_push_arg *) arg;
 
 	my_thread_num = args->thread_num;
 
-	for (i = 0; i < parray_num(args->files); i++)
+	while (fork_join_next_task(args->fork_join, args->thread_num - 1, &i))
 	{
 		bool      no_ready_rename = args->no_ready_rename;
 		WALSegno *xlogfile = (WALSegno *) parray_get(args->files, i);
 
-		if (!pg_atomic_test_set_flag(&xlogfile->lock))
-			continue;
-
 		/* Do not rename ready file of the first file,
 		 * we do this to avoid flooding PostgreSQL log with
 		 * warnings about ready file been missing.
@@ -312,7 +319,8 @@ push_files(void *arg)
 					   args->archive_timeout, no_ready_rename,
 					   /* do not compress .backup, .partial and .history files */
 					   args->compress && IsXLogFileName(xlogfile->name) ? true : false,
-					   args->compress_level);
+					   args->compress_alg, args->compress_level,
+					   args->block_summary, args->wal_seg_size);
 
 		if (rc == 0)
 			args->n_pushed++;
@@ -332,7 +340,8 @@ push_file(WALSegno *xlogfile, const char *archive_status_dir,
 		  const char *pg_xlog_dir, const char *archive_dir,
 		  bool overwrite, bool no_sync, uint32 archive_timeout,
 		  bool no_ready_rename, bool is_compress,
-		  int compress_level)
+		  CompressAlg compress_alg, int compress_level,
+		  bool block_summary, uint32 wal_seg_size)
 {
 	int     rc;
 
@@ -340,18 +349,28 @@ push_file(WALSegno *xlogfile, const char *archive_status_dir,
 
 	/* If compression is not required, then just copy it as is */
 	if (!is_compress)
-		rc = push_file_internal_uncompressed(xlogfile, pg_xlog_dir,
-											 archive_dir, overwrite, no_sync,
-											 archive_timeout);
+		rc = push_file_internal(xlogfile, pg_xlog_dir,
+								archive_dir, overwrite, no_sync,
+								NONE_COMPRESS, 0, archive_timeout);
 #ifdef HAVE_LIBZ
-	else
+	else if (compress_alg == ZLIB_COMPRESS)
 		rc = push_file_internal_gz(xlogfile, pg_xlog_dir, archive_dir,
 								   overwrite, no_sync, compress_level,
 								   archive_timeout);
 #endif
+	/* zstd and lz4 compress the segment as a single frame */
+	else
+		rc = push_file_internal(xlogfile, pg_xlog_dir,
+								archive_dir, overwrite, no_sync,
+								compress_alg, compress_level, archive_timeout);
 
 	pg_atomic_write_u32(&xlogfile->done, 1);
 
+	/* summarize blocks changed in WAL segment, for PAGE backups */
+	if (block_summary && IsXLogFileName(xlogfile->name))
+		write_block_summary(pg_xlog_dir, archive_dir, xlogfile->name,
+							wal_seg_size, overwrite, no_sync);
+
 	/* take '--no-ready-rename' flag into account */
 	if (!no_ready_rename && archive_status_dir != NULL)
 	{
@@ -378,17 +397,97 @@ push_file(WALSegno *xlogfile, const char *archive_status_dir,
 }
 
 /*
- * Copy non WAL file, such as .backup or .history file, into WAL archive.
- * Such files are not compressed.
+ * Compress WAL segment as a single zstd or lz4 frame and write the frame
+ * into temp file in archive. The segment is read and compressed in chunks
+ * of OUT_BUF_SIZE, the same way zlib compresses it.
+ */
+static void
+push_wal_frame(WALSegno *wal_file, FILE *in, const char *from_fullpath,
+			   int out, const char *to_fullpath_part, char *buf,
+			   CompressAlg compress_alg, int compress_level)
+{
+	struct stat	st;
+	FrameCompressor *fc;
+	size_t		total_len = 0;
+	const char *errormsg = NULL;
+
+	if (fstat(fileno(in), &st) < 0)
+	{
+		fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+		pg_atomic_write_u32(&wal_file->done, 1);
+		elog(ERROR, "Cannot stat source file \"%s\": %s",
+					from_fullpath, strerror(errno));
+	}
+
+	fc = frame_compressor_create(compress_alg, compress_level, st.st_size,
+								 OUT_BUF_SIZE, &errormsg);
+	if (fc == NULL)
+	{
+		fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+		pg_atomic_write_u32(&wal_file->done, 1);
+		elog(ERROR, "Cannot compress source file \"%s\": %s",
+					from_fullpath, errormsg);
+	}
+
+	errno = 0;
+	for (;;)
+	{
+		size_t		read_len;
+		char	   *frame;
+		int64		z_len;
+		bool		last;
+
+		read_len = fread(buf, 1, OUT_BUF_SIZE, in);
+
+		if (ferror(in))
+		{
+			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+			pg_atomic_write_u32(&wal_file->done, 1);
+			elog(ERROR, "Cannot read source file \"%s\": %s",
+						from_fullpath, strerror(errno));
+		}
+
+		total_len += read_len;
+		last = feof(in) || total_len >= st.st_size;
+
+		z_len = frame_compressor_next(fc, buf, read_len, last, &frame, &errormsg);
+		if (z_len < 0)
+		{
+			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+			pg_atomic_write_u32(&wal_file->done, 1);
+			elog(ERROR, "Cannot compress source file \"%s\": %s",
+						from_fullpath, errormsg);
+		}
+
+		if (z_len > 0 && fio_write_async(out, frame, z_len) != z_len)
+		{
+			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+			pg_atomic_write_u32(&wal_file->done, 1);
+			elog(ERROR, "Cannot write to destination temp file \"%s\": %s",
+						to_fullpath_part, strerror(errno));
+		}
+
+		if (last)
+			break;
+	}
+
+	frame_compressor_free(fc);
+}
+
+/*
+ * Copy file into WAL archive as is, or compress WAL segment with zstd or lz4.
+ * Non WAL files, such as .backup or .history file, are not compressed.
+ * Unlike zlib, zstd and lz4 compress the whole segment as a single frame.
  * Returns:
  *  0 - file was successfully pushed
  *  1 - push was skipped because file already exists in the archive and
  *      has the same checksum
  */
 int
-push_file_internal_uncompressed(WALSegno *wal_file, const char *pg_xlog_dir,
-								const char *archive_dir, bool overwrite, bool no_sync,
-								uint32 archive_timeout)
+push_file_internal(WALSegno *wal_file, const char *pg_xlog_dir,
+				   const char *archive_dir, bool overwrite, bool no_sync,
+				   CompressAlg compress_alg, int compress_level,
+				   uint32 archive_timeout)
 {
 	FILE	   *in = NULL;
 	int			out = -1;
@@ -404,6 +503,8 @@ push_file_internal_uncompressed(WALSegno *wal_file, const char *pg_xlog_dir,
 	bool		partial_is_stale = true;
 	/* remote agent error message */
 	char       *errmsg = NULL;
+	/* suffix of compressed file, NULL if file is copied as is */
+	const char *suffix = compress_alg_wal_suffix(compress_alg);
 
 	/* from path */
 	join_path_components(from_fullpath, pg_xlog_dir, wal_file_name);
@@ -412,6 +513,10 @@ push_file_internal_uncompressed(WALSegno *wal_file, const char *pg_xlog_dir,
 	join_path_components(to_fullpath, archive_dir, wal_file_name);
 	canonicalize_path(to_fullpath);
 
+	/* destination file with .zst or .lz4 suffix */
+	if (suffix)
+		strlcat(to_fullpath, suffix, sizeof(to_fullpath));
+
 	/* Open source file for read */
 	in = fopen(from_fullpath, PG_BINARY_R);
 	if (in == NULL)
@@ -537,7 +642,7 @@ part_opened:
 		pg_crc32 crc32_dst;
 
 		crc32_src = fio_get_crc32(from_fullpath, FIO_DB_HOST, false, false);
-		crc32_dst = fio_get_crc32(to_fullpath, FIO_BACKUP_HOST, false, false);
+		crc32_dst = fio_get_crc32(to_fullpath, FIO_BACKUP_HOST, suffix != NULL, false);
 
 		if (crc32_src == crc32_dst)
 		{
@@ -567,32 +672,39 @@ part_opened:
 		}
 	}
 
-	/* copy content */
-	errno = 0;
-	for (;;)
+	/* compress the segment and write it as a single frame */
+	if (suffix)
+		push_wal_frame(wal_file, in, from_fullpath, out, to_fullpath_part,
+					   buf, compress_alg, compress_level);
+	else
 	{
-		size_t  read_len = 0;
+		/* copy content */
+		errno = 0;
+		for (;;)
+		{
+			size_t  read_len = 0;
 
-		read_len = fread(buf, 1, OUT_BUF_SIZE, in);
+			read_len = fread(buf, 1, OUT_BUF_SIZE, in);
 
-		if (ferror(in))
-		{
-			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
-			pg_atomic_write_u32(&wal_file->done, 1);
-			elog(ERROR, "Cannot read source file \"%s\": %s",
-						from_fullpath, strerror(errno));
-		}
+			if (ferror(in))
+			{
+				fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+				pg_atomic_write_u32(&wal_file->done, 1);
+				elog(ERROR, "Cannot read source file \"%s\": %s",
+							from_fullpath, strerror(errno));
+			}
 
-		if (read_len > 0 && fio_write_async(out, buf, read_len) != read_len)
-		{
-			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
-			pg_atomic_write_u32(&wal_file->done, 1);
-			elog(ERROR, "Cannot write to destination temp file \"%s\": %s",
-						to_fullpath_part, strerror(errno));
-		}
+			if (read_len > 0 && fio_write_async(out, buf, read_len) != read_len)
+			{
+				fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+				pg_atomic_write_u32(&wal_file->done, 1);
+				elog(ERROR, "Cannot write to destination temp file \"%s\": %s",
+							to_fullpath_part, strerror(errno));
+			}
 
-		if (feof(in))
-			break;
+			if (feof(in))
+				break;
+		}
 	}
 
 	/* close source file */
@@ -1015,7 +1127,6 @@ setup_push_filelist(const char *archive_status_dir, const char *first_file,
 
 	/* guarantee that first filename is in batch list */
 	xlogfile = palloc0(sizeof(WALSegno));
-	pg_atomic_init_flag(&xlogfile->lock);
 	pg_atomic_init_u32(&xlogfile->done, 0);
 	snprintf(xlogfile->name, MAXFNAMELEN, "%s", first_file);
 	parray_append(batch_files, xlogfile);
@@ -1048,7 +1159,6 @@ setup_push_filelist(const char *archive_status_dir, const char *first_file,
 			continue;
 
 		xlogfile = palloc0(sizeof(WALSegno));
-		pg_atomic_init_flag(&xlogfile->lock);
 		pg_atomic_init_u32(&xlogfile->done, 0);
 
 		snprintf(xlogfile->name, MAXFNAMELEN, "%s", filename);
@@ -1315,7 +1425,6 @@ uint32 run_wal_prefetch(const char *prefetch_dir, const char *archive_dir,
 	for (segno = first_segno; segno < (first_segno + batch_size); segno++)
 	{
 		WALSegno *xlogfile = palloc(sizeof(WALSegno));
-		pg_atomic_init_flag(&xlogfile->lock);
 
 		/* construct filename for WAL segment */
 		GetXLogFileName(xlogfile->name, tli, segno, wal_seg_size);
@@ -1350,12 +1459,12 @@ uint32 run_wal_prefetch(const char *prefetch_dir, const char *archive_dir,
 	}
 	else
 	{
-		/* arrays with meta info for multi threaded archive-get */
-		pthread_t        *threads;
+		/* meta info for multi threaded archive-get */
+		ForkJoin   *fork_join;
 		archive_get_arg  *threads_args;
 
 		/* init thread args */
-		threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+		fork_join = fork_join_create(num_threads, parray_num(batch_files));
 		threads_args = (archive_get_arg *) palloc(sizeof(archive_get_arg) * num_threads);
 
 		for (i = 0; i < num_threads; i++)
@@ -1366,23 +1475,17 @@ uint32 run_wal_prefetch(const char *prefetch_dir, const char *archive_dir,
 			arg->archive_dir = archive_dir;
 
 			arg->thread_num = i+1;
+			arg->fork_join = fork_join;
 			arg->files = batch_files;
 			arg->n_fetched = 0;
 		}
 
-		/* Run threads */
-		for (i = 0; i < num_threads; i++)
-		{
-			archive_get_arg *arg = &(threads_args[i]);
-			pthread_create(&threads[i], NULL, get_files, arg);
-		}
+		fork_join_run(fork_join, get_files, threads_args, sizeof(archive_get_arg));
 
-		/* Wait threads */
 		for (i = 0; i < num_threads; i++)
-		{
-			pthread_join(threads[i], NULL);
 			n_total_fetched += threads_args[i].n_fetched;
-		}
+
+		fork_join_free(fork_join);
 	}
 	/* TODO: free batch_files */
 	return n_total_fetched;
@@ -1394,23 +1497,20 @@ uint32 run_wal_prefetch(const char *prefetch_dir, const char *archive_dir,
 static void *
 get_files(void *arg)
 {
-	int		i;
+	size_t	i;
 	char    to_fullpath[MAXPGPATH];
 	char    from_fullpath[MAXPGPATH];
 	archive_get_arg *args = (archive_get_arg *) arg;
 
 	my_thread_num = args->thread_num;
 
-	for (i = 0; i < parray_num(args->files); i++)
+	while (fork_join_next_task(args->fork_join, args->thread_num - 1, &i))
 	{
 		WALSegno *xlogfile = (WALSegno *) parray_get(args->files, i);
 
 		if (prefetch_stop)
 			break;
 
-		if (!pg_atomic_test_set_flag(&xlogfile->lock))
-			continue;
-
 		join_path_components(from_fullpath, args->archive_dir, xlogfile->name);
 		join_path_components(to_fullpath, args->prefetch_dir, xlogfile->name);
 
@@ -1481,8 +1581,11 @@ get_wal_file(const char *filename, const char *from_fullpath,
 		/* If requested file is regular WAL segment, then try to open it with '.gz' suffix... */
 		if (IsXLogFileName(filename))
 			rc = fio_send_file_gz(from_fullpath_gz, out, &errmsg);
-		if (rc == FILE_MISSING)
 #endif
+		/* ... then with '.zst' or '.lz4' suffix ... */
+		if (rc == FILE_MISSING && IsXLogFileName(filename))
+			rc = get_wal_file_frame(from_fullpath, to_fullpath, out);
+		if (rc == FILE_MISSING)
 			/* ... failing that, use uncompressed */
 			rc = fio_send_file(from_fullpath, out, false, NULL, &errmsg);
 
@@ -1523,8 +1626,11 @@ get_wal_file(const char *filename, const char *from_fullpath,
 		/* If requested file is regular WAL segment, then try to open it with '.gz' suffix... */
 		if (IsXLogFileName(filename))
 			rc = get_wal_file_internal(from_fullpath_gz, to_fullpath, out, true);
-		if (rc == FILE_MISSING)
 #endif
+		/* ... then with '.zst' or '.lz4' suffix ... */
+		if (rc == FILE_MISSING && IsXLogFileName(filename))
+			rc = get_wal_file_frame(from_fullpath, to_fullpath, out);
+		if (rc == FILE_MISSING)
 			/* ... failing that, use uncompressed */
 			rc = get_wal_file_internal(from_fullpath, to_fullpath, out, false);
 
@@ -1723,6 +1829,55 @@ cleanup:
 	return exit_code;
 }
 
+/*
+ * Copy WAL segment compressed with zstd or lz4 from archive, which may
+ * be located on remote host. The whole segment is decompressed in memory.
+ * Return codes are the same as for get_wal_file_internal().
+ */
+int
+get_wal_file_frame(const char *from_fullpath, const char *to_fullpath, FILE *out)
+{
+	CompressAlg	algs[] = {ZSTD_COMPRESS, LZ4_COMPRESS};
+	int			rc = FILE_MISSING;
+	int			i;
+
+	for (i = 0; i < lengthof(algs) && rc == FILE_MISSING; i++)
+	{
+		char		from_path[MAXPGPATH];
+		char	   *content = NULL;
+		size_t		size = 0;
+		const char *errormsg = NULL;
+
+		snprintf(from_path, sizeof(from_path), "%s%s", from_fullpath,
+				 compress_alg_wal_suffix(algs[i]));
+
+		rc = read_compressed_frame(from_path, algs[i], FIO_BACKUP_HOST,
+								   &content, &size, &errormsg);
+
+		if (rc == SEND_OK)
+		{
+			elog(LOG, "Decompressed WAL file '%s'", from_path);
+
+			if (fwrite(content, 1, size, out) != size)
+			{
+				elog(WARNING, "Cannot write to WAL file '%s': %s",
+					to_fullpath, strerror(errno));
+				rc = WRITE_FAILED;
+			}
+		}
+		else if (rc == ZLIB_ERROR)
+			elog(WARNING, "Cannot decompress WAL file \"%s\": %s",
+					from_path, errormsg);
+		else if (rc != FILE_MISSING)
+			elog(WARNING, "Cannot read compressed WAL file \"%s\": %s",
+					from_path, strerror(errno));
+
+		pg_free(content);
+	}
+
+	return rc;
+}
+
 bool next_wal_segment_exists(TimeLineID tli, XLogSegNo segno, const char *prefetch_dir, uint32 wal_seg_size)
 {
 	char        next_wal_filename[MAXFNAMELEN];
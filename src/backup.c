@@ -32,9 +32,6 @@
 /* list of files contained in backup */
 parray *backup_files_list = NULL;
 
-/* We need critical section for datapagemap_add() in case of using threads */
-static pthread_mutex_t backup_pagemap_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 // TODO: move to PGnodeInfo
 bool exclusive_backup = false;
 
@@ -72,9 +69,14 @@ static void rewind_and_mark_cfs_datafiles(parray *files, const char *root, char
 static bool remove_excluded_files_criterion(void *value, void *exclude_args);
 static void backup_cfs_segment(int i, pgFile *file, backup_files_arg *arguments);
 static void process_file(int i, pgFile *file, backup_files_arg *arguments);
+static parray *split_large_data_files(parray *files_list, parray *prev_filelist);
+static bool process_file_range(pgFileRange *range, backup_files_arg *arguments);
 
 static StopBackupCallbackParams stop_callback_params;
 
+/* ranges of large data files, whose part files are removed on failure */
+static parray *cleanup_ranges_list = NULL;
+
 static void
 backup_stopbackup_callback(bool fatal, void *userdata)
 {
@@ -103,13 +105,14 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	char		label[1024];
 	XLogRecPtr	prev_backup_start_lsn = InvalidXLogRecPtr;
 
-	/* arrays with meta info for multi threaded backup */
-	pthread_t	*threads;
+	/* meta info for multi threaded backup */
+	ForkJoin   *fork_join;
 	backup_files_arg *threads_args;
 	bool		backup_isok = true;
 
 	pgBackup   *prev_backup = NULL;
 	parray	   *prev_backup_filelist = NULL;
+	parray	   *backup_ranges_list = NULL;
 	parray	   *backup_list = NULL;
 	parray	   *external_dirs = NULL;
 	parray	   *database_map = NULL;
@@ -367,14 +370,18 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		if (current.backup_mode == BACKUP_MODE_DIFF_PAGE)
 		{
 			/*
-			 * Build the page map. Obtain information about changed pages
-			 * reading WAL segments present in archives up to the point
-			 * where this backup has started.
+			 * Build the page map. Take changed pages from WAL summaries
+			 * of the server, if they cover the range, otherwise obtain
+			 * information about changed pages reading WAL segments present
+			 * in archives up to the point where this backup has started.
 			 */
-			pagemap_isok = extractPageMap(instanceState->instance_wal_subdir_path,
-						   instance_config.xlog_seg_size,
-						   prev_backup->start_lsn, prev_backup->tli,
-						   current.start_lsn, current.tli, tli_list);
+			if (!make_pagemap_from_wal_summaries(backup_conn,
+												 prev_backup->start_lsn, prev_backup->tli,
+												 current.start_lsn, current.tli))
+				pagemap_isok = extractPageMap(instanceState->instance_wal_subdir_path,
+							   instance_config.xlog_seg_size,
+							   prev_backup->start_lsn, prev_backup->tli,
+							   current.start_lsn, current.tli, tli_list);
 		}
 		else if (current.backup_mode == BACKUP_MODE_DIFF_PTRACK)
 		{
@@ -444,25 +451,34 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		src_pg_control_file = (pgFile *)parray_get(backup_files_list, control_file_elem_index);
 	}
 
-	/* setup thread locks */
-	pfilearray_clear_locks(backup_files_list);
-
 	/* Sort by size for load balancing */
 	parray_qsort(backup_files_list, pgFileCompareSize);
 	/* Sort the array for binary search */
 	if (prev_backup_filelist)
 		parray_qsort(prev_backup_filelist, pgFileCompareRelPathWithExternal);
 
-	/* write initial backup_content.control file and update backup.control  */
+	/* Let several threads back up the largest data files at once */
+	backup_ranges_list = split_large_data_files(backup_files_list,
+												prev_backup_filelist);
+	cleanup_ranges_list = backup_ranges_list;
+
+	/* write initial file list and update backup.control  */
 	write_backup_filelist(&current, backup_files_list,
 						  instance_config.pgdata, external_dirs, true);
 	write_backup(&current, true);
 
+	/* files are added to the journal as they are copied */
+	filelist_journal_open(&current);
+
 	/* Init backup page header map */
 	init_header_map(&current);
 
+	/* ranges of large data files go first, then all the files */
+	fork_join = fork_join_create(num_threads,
+								 (backup_ranges_list ? parray_num(backup_ranges_list) : 0) +
+								 parray_num(backup_files_list));
+
 	/* init thread args with own file lists */
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	threads_args = (backup_files_arg *) palloc(sizeof(backup_files_arg)*num_threads);
 
 	for (i = 0; i < num_threads; i++)
@@ -475,9 +491,11 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		arg->external_prefix = external_prefix;
 		arg->external_dirs = external_dirs;
 		arg->files_list = backup_files_list;
+		arg->ranges_list = backup_ranges_list;
 		arg->prev_filelist = prev_backup_filelist;
 		arg->prev_start_lsn = prev_backup_start_lsn;
 		arg->hdr_map = &(current.hdr_map);
+		arg->fork_join = fork_join;
 		arg->thread_num = i+1;
 		/* By default there are some error */
 		arg->ret = 1;
@@ -487,21 +505,16 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	thread_interrupted = false;
 	elog(INFO, "Start transferring data files");
 	time(&start_time);
-	for (i = 0; i < num_threads; i++)
-	{
-		backup_files_arg *arg = &(threads_args[i]);
+	throttle_start(backup_conn);
+	fork_join_run(fork_join, backup_files, threads_args, sizeof(backup_files_arg));
+	throttle_stop();
 
-		elog(VERBOSE, "Start thread num: %i", i);
-		pthread_create(&threads[i], NULL, backup_files, arg);
-	}
-
-	/* Wait threads */
 	for (i = 0; i < num_threads; i++)
 	{
-		pthread_join(threads[i], NULL);
 		if (threads_args[i].ret == 1)
 			backup_isok = false;
 	}
+	fork_join_free(fork_join);
 
 	/* copy pg_control at very end */
 	if (backup_isok)
@@ -533,6 +546,11 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 		elog(ERROR, "Data files transferring failed, time elapsed: %s",
 			pretty_time);
 
+	/* ranges are owned by their files */
+	cleanup_ranges_list = NULL;
+	if (backup_ranges_list)
+		parray_free(backup_ranges_list);
+
 	/* clean previous backup file list */
 	if (prev_backup_filelist)
 	{
@@ -561,7 +579,7 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 	}
 
 	/* close and sync page header map */
-	if (current.hdr_map.fp)
+	if (pg_atomic_read_u32(&current.hdr_map.is_open))
 	{
 		cleanup_header_map(&(current.hdr_map));
 
@@ -591,6 +609,7 @@ do_backup_pg(InstanceState *instanceState, PGconn *backup_conn,
 						  external_dirs, true);
 	/* update backup control file to update size info */
 	write_backup(&current, true);
+	filelist_journal_close(&current);
 
 	/* Sync all copied files unless '--no-sync' flag is used */
 	if (no_sync)
@@ -1346,9 +1365,14 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 				timeout;
 	char		*wal_delivery_str = in_stream_dir ? "streamed":"archived";
 
+	char		compressed_wal_segment_path[MAXPGPATH];
+	/* algorithms archive-push could compress WAL segment with */
+	CompressAlg	wal_compress_algs[] = {
 #ifdef HAVE_LIBZ
-	char		gz_wal_segment_path[MAXPGPATH];
+		ZLIB_COMPRESS,
 #endif
+		ZSTD_COMPRESS, LZ4_COMPRESS
+	};
 
 	/* Compute the name of the WAL file containing requested LSN */
 	GetXLogSegNo(target_lsn, targetSegNo, instance_config.xlog_seg_size);
@@ -1378,11 +1402,6 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 		elog(LOG, "Looking for LSN %X/%X in segment: %s",
 			 (uint32) (target_lsn >> 32), (uint32) target_lsn, wal_segment);
 
-#ifdef HAVE_LIBZ
-	snprintf(gz_wal_segment_path, sizeof(gz_wal_segment_path), "%s.gz",
-			 wal_segment_path);
-#endif
-
 	/* Wait until target LSN is archived or streamed */
 	while (true)
 	{
@@ -1393,11 +1412,18 @@ wait_wal_lsn(const char *wal_segment_dir, XLogRecPtr target_lsn, bool is_start_l
 			/* Try to find compressed WAL file */
 			if (!file_exists)
 			{
-#ifdef HAVE_LIBZ
-				file_exists = fileExists(gz_wal_segment_path, FIO_BACKUP_HOST);
+				int			i;
+
+				for (i = 0; i < lengthof(wal_compress_algs) && !file_exists; i++)
+				{
+					snprintf(compressed_wal_segment_path, sizeof(compressed_wal_segment_path),
+							 "%s%s", wal_segment_path,
+							 compress_alg_wal_suffix(wal_compress_algs[i]));
+					file_exists = fileExists(compressed_wal_segment_path, FIO_BACKUP_HOST);
+				}
+
 				if (file_exists)
-					elog(LOG, "Found compressed WAL segment: %s", wal_segment_path);
-#endif
+					elog(LOG, "Found compressed WAL segment: %s", compressed_wal_segment_path);
 			}
 			else
 				elog(LOG, "Found WAL segment: %s", wal_segment_path);
@@ -2077,6 +2103,16 @@ backup_cleanup(bool fatal, void *userdata)
 		current.end_time = time(NULL);
 		current.status = BACKUP_STATUS_ERROR;
 		write_backup(&current, true);
+
+		/* part files of ranges are never read, do not keep them */
+		if (cleanup_ranges_list)
+		{
+			size_t		i;
+
+			for (i = 0; i < parray_num(cleanup_ranges_list); i++)
+				remove_range_part((pgFileRange *) parray_get(cleanup_ranges_list, i),
+								  current.database_dir);
+		}
 	}
 }
 
@@ -2092,17 +2128,36 @@ static void *
 backup_files(void *arg)
 {
 	int			i;
+	size_t		task;
 	static time_t prev_time;
 
 	backup_files_arg *arguments = (backup_files_arg *) arg;
 	int 		n_backup_files_list = parray_num(arguments->files_list);
+	int			n_ranges = arguments->ranges_list ? parray_num(arguments->ranges_list) : 0;
 
 	prev_time = current.start_time;
 
-	/* backup a file */
-	for (i = 0; i < n_backup_files_list; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &task))
 	{
-		pgFile	*file = (pgFile *) parray_get(arguments->files_list, i);
+		pgFile	   *file;
+		pgFileRange *range;
+
+		/* backup a range of large data file */
+		if (task < (size_t) n_ranges)
+		{
+			/* check for interrupt */
+			if (interrupted || thread_interrupted)
+				elog(ERROR, "Interrupted during backup");
+
+			range = (pgFileRange *) parray_get(arguments->ranges_list, task);
+			if (process_file_range(range, arguments))
+				filelist_journal_append(range->file);
+			continue;
+		}
+
+		/* backup a file */
+		i = task - n_ranges;
+		file = (pgFile *) parray_get(arguments->files_list, i);
 
 		/* We have already copied all directories */
 		if (S_ISDIR(file->mode))
@@ -2117,11 +2172,10 @@ backup_files(void *arg)
 
 		if (arguments->thread_num == 1)
 		{
-			/* update backup_content.control every 60 seconds */
+			/* flush the journal of copied files every 60 seconds */
 			if ((difftime(time(NULL), prev_time)) > 60)
 			{
-				write_backup_filelist(&current, arguments->files_list, arguments->from_root,
-									  arguments->external_dirs, false);
+				filelist_journal_flush(&current);
 				/* update backup control file to update size info */
 				write_backup(&current, true);
 
@@ -2132,7 +2186,8 @@ backup_files(void *arg)
 		if (file->skip_cfs_nested)
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
+		/* backed up by ranges */
+		if (file->n_ranges > 0)
 			continue;
 
 		/* check for interrupt */
@@ -2144,17 +2199,25 @@ backup_files(void *arg)
 
 		if (file->is_cfs)
 		{
+			pgFile	   *cfs_file;
+
 			backup_cfs_segment(i, file, arguments);
+			for (cfs_file = file; cfs_file; cfs_file = cfs_file->cfs_chain)
+				filelist_journal_append(cfs_file);
 		}
 		else
 		{
 			process_file(i, file, arguments);
+			filelist_journal_append(file);
 		}
 	}
 
 	/* ssh connection to longer needed */
 	fio_disconnect();
 
+	header_arena_free();
+	async_read_ring_free();
+
 	/* Data files transferring is successful */
 	arguments->ret = 0;
 
@@ -2251,6 +2314,127 @@ process_file(int i, pgFile *file, backup_files_arg *arguments)
 
 }
 
+/*
+ * Split large data files into ranges of BACKUP_RANGE_BLOCKS blocks,
+ * so that several threads can back up the same file at once.
+ * Otherwise a single huge relation keeps one thread busy long after
+ * the others have run out of files.
+ * Returns list of ranges or NULL, if no file was split.
+ */
+static parray *
+split_large_data_files(parray *files_list, parray *prev_filelist)
+{
+	parray	   *ranges_list = NULL;
+	int			i;
+
+	/* ranges are supported only by local send_pages() */
+	if (num_threads < 2 || fio_is_remote(FIO_DB_HOST))
+		return NULL;
+
+	for (i = 0; i < parray_num(files_list); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files_list, i);
+		BlockNumber	n_blocks;
+		int			j;
+
+		if (!S_ISREG(file->mode) || !file->is_datafile || file->is_cfs ||
+			file->external_dir_num != 0 || file->size % BLCKSZ != 0)
+			continue;
+
+		n_blocks = file->size / BLCKSZ;
+		if (n_blocks < 2 * BACKUP_RANGE_BLOCKS)
+			continue;
+
+		/* Check that file exist in previous backup */
+		if (current.backup_mode != BACKUP_MODE_FULL &&
+			parray_bsearch(prev_filelist, file, pgFileCompareRelPathWithExternal))
+			file->exists_in_prev = true;
+
+		/* unchanged file is skipped by backup_data_file() at once */
+		if ((current.backup_mode == BACKUP_MODE_DIFF_PAGE ||
+			 current.backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
+			file->pagemap.bitmapsize == PageBitmapIsEmpty &&
+			file->exists_in_prev && !file->pagemap_isabsent)
+			continue;
+
+		if (!ranges_list)
+			ranges_list = parray_new();
+
+		file->n_blocks = n_blocks;
+		file->n_ranges = (n_blocks + BACKUP_RANGE_BLOCKS - 1) / BACKUP_RANGE_BLOCKS;
+		file->ranges = (pgFileRange *) pgut_malloc0(file->n_ranges * sizeof(pgFileRange));
+		pg_atomic_init_u32(&file->n_ranges_done, 0);
+
+		for (j = 0; j < file->n_ranges; j++)
+		{
+			pgFileRange *range = &file->ranges[j];
+
+			range->file = file;
+			range->file_num = i;
+			range->part = *file;
+			range->range_num = j;
+			range->start_blknum = j * BACKUP_RANGE_BLOCKS;
+			range->end_blknum = Min(n_blocks, (j + 1) * BACKUP_RANGE_BLOCKS);
+
+			parray_append(ranges_list, range);
+		}
+
+		elog(LOG, "File \"%s\" is split into %i ranges", file->rel_path,
+			 file->n_ranges);
+	}
+
+	return ranges_list;
+}
+
+/*
+ * Back up a range of a large data file.
+ * Returns true if the file is complete.
+ */
+static bool
+process_file_range(pgFileRange *range, backup_files_arg *arguments)
+{
+	char		from_fullpath[MAXPGPATH];
+	char		to_fullpath[MAXPGPATH];
+	pgFile	   *file = range->file;
+
+	/* progress is reported per file, as for files backed up whole */
+	if (range->range_num == 0)
+		elog(progress ? INFO : LOG, "Progress: (%d/%d). Process file \"%s\"",
+			 range->file_num + 1, (int) parray_num(arguments->files_list),
+			 file->rel_path);
+
+	elog(LOG, "Process range %d/%d of file \"%s\", blocks %u-%u",
+		 range->range_num + 1, file->n_ranges, file->rel_path,
+		 range->start_blknum, range->end_blknum - 1);
+
+	join_path_components(from_fullpath, arguments->from_root, file->rel_path);
+	join_path_components(to_fullpath, arguments->to_root, file->rel_path);
+
+	/* the file is not complete yet */
+	if (!backup_data_file_range(range, from_fullpath, to_fullpath,
+								arguments->prev_start_lsn,
+								current.backup_mode,
+								instance_config.compress_alg,
+								instance_config.compress_level,
+								arguments->nodeInfo->checksum_version,
+								arguments->hdr_map))
+		return false;
+
+	if (file->write_size == FILE_NOT_FOUND)
+		return true;
+
+	if (file->write_size == BYTES_INVALID)
+	{
+		elog(LOG, "Skipping the unchanged file: \"%s\"", from_fullpath);
+		return true;
+	}
+
+	elog(LOG, "File \"%s\". Copied "INT64_FORMAT " bytes",
+		 				from_fullpath, file->write_size);
+
+	return true;
+}
+
 static void
 backup_cfs_segment(int i, pgFile *file, backup_files_arg *arguments) {
 	pgFile	*data_file = file;
@@ -2506,16 +2690,14 @@ rewind_and_mark_cfs_datafiles(parray *files, const char *root, char *relative, s
 }
 
 /*
- * Find pgfile by given rnode in the backup_files_list
- * and add given blkno to its pagemap.
+ * Find pgfile of the given segment of the relation in the backup_files_list
+ * and move to its pagemap the blocks, collected from WAL by a reader thread.
  */
 void
-process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
+process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber segno,
+					 datapagemap_t *pagemap)
 {
-//	char	   *path;
 	char	   *rel_path;
-	BlockNumber blkno_inseg;
-	int			segno;
 	pgFile	  **file_item;
 	pgFile		f;
 #if PG_VERSION_NUM >= 180000
@@ -2525,9 +2707,6 @@ process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
 		rel_path = relpathperm(rnode, forknum);
 #endif
 
-	segno = blkno / RELSEG_SIZE;
-	blkno_inseg = blkno % RELSEG_SIZE;
-
 	if (segno > 0)
 		f.rel_path = psprintf("%s.%u", rel_path, segno);
 	else
@@ -2546,23 +2725,13 @@ process_block_change(ForkNumber forknum, RelFileNode rnode, BlockNumber blkno)
 	 * backup would simply copy it as-is.
 	 */
 	if (file_item)
-	{
-		/* We need critical section only we use more than one threads */
-		if (num_threads > 1)
-			pthread_lock(&backup_pagemap_mutex);
-
-		datapagemap_add(&(*file_item)->pagemap, blkno_inseg);
-
-		if (num_threads > 1)
-			pthread_mutex_unlock(&backup_pagemap_mutex);
-	}
+		datapagemap_merge(&(*file_item)->pagemap, pagemap);
 
 	if (segno > 0)
 		pg_free(f.rel_path);
 #if PG_VERSION_NUM < 180000
 	pg_free(rel_path);
 #endif
-
 }
 
 void
@@ -23,6 +23,9 @@ static pgBackup* get_closest_backup(timelineInfo *tlinfo);
 static pgBackup* get_oldest_backup(timelineInfo *tlinfo);
 static const char *backupModes[] = {"", "PAGE", "PTRACK", "DELTA", "FULL"};
 static pgBackup *readBackupControlFile(const char *path);
+static pgFile *parse_file_list_line(const char *buf);
+static parray *read_text_filelist(pgBackup *backup, pg_crc32 *content_crc);
+static void apply_filelist_journal(pgBackup *backup, parray *files);
 static int create_backup_dir(pgBackup *backup, const char *backup_instance_path);
 
 static bool backup_lock_exit_hook_registered = false;
@@ -1039,17 +1042,181 @@ err_proc:
 }
 
 /*
- * Get list of files in the backup from the DATABASE_FILE_LIST.
+ * Parse the line of DATABASE_FILE_LIST into pgFile.
+ */
+static pgFile *
+parse_file_list_line(const char *buf)
+{
+	char		path[MAXPGPATH];
+	char		linked[MAXPGPATH];
+	char		compress_alg_string[MAXPGPATH];
+	int64		write_size,
+				uncompressed_size,
+				mode,		/* bit length of mode_t depends on platforms */
+				is_datafile,
+				is_cfs,
+				external_dir_num,
+				crc,
+				segno,
+				n_blocks,
+				n_headers,
+				dbOid,		/* used for partial restore */
+				hdr_crc,
+				hdr_off,
+				hdr_size;
+	pgFile	   *file;
+
+	get_control_value_str(buf, "path", path, sizeof(path),true);
+	get_control_value_int64(buf, "size", &write_size, true);
+	get_control_value_int64(buf, "mode", &mode, true);
+	get_control_value_int64(buf, "is_datafile", &is_datafile, true);
+	get_control_value_int64(buf, "is_cfs", &is_cfs, false);
+	get_control_value_int64(buf, "crc", &crc, true);
+	get_control_value_str(buf, "compress_alg", compress_alg_string, sizeof(compress_alg_string), false);
+	get_control_value_int64(buf, "external_dir_num", &external_dir_num, false);
+	get_control_value_int64(buf, "dbOid", &dbOid, false);
+
+	file = pgFileInit(path);
+	file->write_size = (int64) write_size;
+	file->mode = (mode_t) mode;
+	file->is_datafile = is_datafile ? true : false;
+	file->is_cfs = is_cfs ? true : false;
+	file->crc = (pg_crc32) crc;
+	file->compress_alg = parse_compress_alg(compress_alg_string);
+	file->external_dir_num = external_dir_num;
+	file->dbOid = dbOid ? dbOid : 0;
+
+	/*
+	 * Optional fields
+	 */
+	if (get_control_value_str(buf, "linked", linked, sizeof(linked), false) && linked[0])
+	{
+		file->linked = pgut_strdup(linked);
+		canonicalize_path(file->linked);
+	}
+
+	if (get_control_value_int64(buf, "segno", &segno, false))
+		file->segno = (int) segno;
+
+	if (get_control_value_int64(buf, "n_blocks", &n_blocks, false))
+		file->n_blocks = (int) n_blocks;
+
+	if (get_control_value_int64(buf, "n_headers", &n_headers, false))
+		file->n_headers = (int) n_headers;
+
+	if (get_control_value_int64(buf, "hdr_crc", &hdr_crc, false))
+		file->hdr_crc = (pg_crc32) hdr_crc;
+
+	if (get_control_value_int64(buf, "hdr_off", &hdr_off, false))
+		file->hdr_off = hdr_off;
+
+	if (get_control_value_int64(buf, "hdr_size", &hdr_size, false))
+		file->hdr_size = (int) hdr_size;
+
+	if (get_control_value_int64(buf, "full_size", &uncompressed_size, false))
+		file->uncompressed_size = uncompressed_size;
+	else
+		file->uncompressed_size = write_size;
+
+	return file;
+}
+
+/*
+ * Complete pgFile, read from the file list of any format.
+ */
+void
+finish_file_list_entry(pgFile *file)
+{
+	if (!file->is_datafile || file->is_cfs)
+		file->size = file->uncompressed_size;
+
+	if (file->external_dir_num == 0 &&
+			(file->dbOid != 0 ||
+			 path_is_prefix_of_path("global", file->rel_path)) &&
+			S_ISREG(file->mode))
+	{
+		bool is_datafile = file->is_datafile;
+		set_forkname(file);
+		if (is_datafile != file->is_datafile)
+		{
+			if (is_datafile)
+				elog(WARNING, "File '%s' was stored as datafile, but looks like it is not",
+					 file->rel_path);
+			else
+				elog(WARNING, "File '%s' was stored as non-datafile, but looks like it is",
+					 file->rel_path);
+			/* Lets fail in tests */
+			Assert(file->is_datafile == file->is_datafile);
+			file->is_datafile = is_datafile;
+		}
+	}
+}
+
+/*
+ * Get list of files in the backup from the DATABASE_FILE_INDEX,
+ * or from the DATABASE_FILE_LIST of a backup taken by older version.
  */
 parray *
 get_backup_filelist(pgBackup *backup, bool strict)
+{
+	parray		*files = NULL;
+	char		backup_filelist_path[MAXPGPATH];
+	FileListIndex *index;
+	pg_crc32 content_crc = 0;
+
+	join_path_components(backup_filelist_path, backup->root_dir, DATABASE_FILE_INDEX);
+
+	index = file_list_index_open(backup_filelist_path, WARNING);
+	if (index)
+	{
+		content_crc = file_list_index_crc(index);
+		files = file_list_index_get_files(index);
+		file_list_index_close(index);
+	}
+	else if (errno == ENOENT)
+	{
+		join_path_components(backup_filelist_path, backup->root_dir, DATABASE_FILE_LIST);
+		files = read_text_filelist(backup, &content_crc);
+	}
+
+	if (files &&
+		backup->content_crc != 0 &&
+		backup->content_crc != content_crc)
+	{
+		elog(WARNING, "Invalid CRC of backup control file '%s': %u. Expected: %u",
+					 backup_filelist_path, content_crc, backup->content_crc);
+		parray_free(files);
+		files = NULL;
+
+	}
+
+	/* redundant sanity? */
+	if (!files)
+		elog(strict ? ERROR : WARNING, "Failed to get file list for backup %s", backup_id_of(backup));
+	else
+	{
+		size_t		i;
+
+		for (i = 0; i < parray_num(files); i++)
+			finish_file_list_entry((pgFile *) parray_get(files, i));
+
+		apply_filelist_journal(backup, files);
+	}
+
+	return files;
+}
+
+/*
+ * Read DATABASE_FILE_LIST in the text format of older versions.
+ */
+static parray *
+read_text_filelist(pgBackup *backup, pg_crc32 *content_crc)
 {
 	parray		*files = NULL;
 	char		backup_filelist_path[MAXPGPATH];
 	FILE    *fp;
 	char     buf[BLCKSZ];
 	char     stdio_buf[STDIO_BUFSIZE];
-	pg_crc32 content_crc = 0;
 
 	join_path_components(backup_filelist_path, backup->root_dir, DATABASE_FILE_LIST);
 
@@ -1063,131 +1230,81 @@ get_backup_filelist(pgBackup *backup, bool strict)
 
 	files = parray_new();
 
-	INIT_FILE_CRC32(true, content_crc);
+	INIT_FILE_CRC32(true, *content_crc);
 
 	while (fgets(buf, lengthof(buf), fp))
 	{
-		char		path[MAXPGPATH];
-		char		linked[MAXPGPATH];
-		char		compress_alg_string[MAXPGPATH];
-		int64		write_size,
-					uncompressed_size,
-					mode,		/* bit length of mode_t depends on platforms */
-					is_datafile,
-					is_cfs,
-					external_dir_num,
-					crc,
-					segno,
-					n_blocks,
-					n_headers,
-					dbOid,		/* used for partial restore */
-					hdr_crc,
-					hdr_off,
-					hdr_size;
-		pgFile	   *file;
-
-		COMP_FILE_CRC32(true, content_crc, buf, strlen(buf));
-
-        get_control_value_str(buf, "path", path, sizeof(path),true);
-        get_control_value_int64(buf, "size", &write_size, true);
-        get_control_value_int64(buf, "mode", &mode, true);
-        get_control_value_int64(buf, "is_datafile", &is_datafile, true);
-        get_control_value_int64(buf, "is_cfs", &is_cfs, false);
-        get_control_value_int64(buf, "crc", &crc, true);
-        get_control_value_str(buf, "compress_alg", compress_alg_string, sizeof(compress_alg_string), false);
-        get_control_value_int64(buf, "external_dir_num", &external_dir_num, false);
-        get_control_value_int64(buf, "dbOid", &dbOid, false);
-
-		file = pgFileInit(path);
-		file->write_size = (int64) write_size;
-		file->mode = (mode_t) mode;
-		file->is_datafile = is_datafile ? true : false;
-		file->is_cfs = is_cfs ? true : false;
-		file->crc = (pg_crc32) crc;
-		file->compress_alg = parse_compress_alg(compress_alg_string);
-		file->external_dir_num = external_dir_num;
-		file->dbOid = dbOid ? dbOid : 0;
-
-		/*
-		 * Optional fields
-		 */
-		if (get_control_value_str(buf, "linked", linked, sizeof(linked), false) && linked[0])
-		{
-			file->linked = pgut_strdup(linked);
-			canonicalize_path(file->linked);
-		}
+		COMP_FILE_CRC32(true, *content_crc, buf, strlen(buf));
 
-		if (get_control_value_int64(buf, "segno", &segno, false))
-			file->segno = (int) segno;
+		parray_append(files, parse_file_list_line(buf));
+	}
 
-		if (get_control_value_int64(buf, "n_blocks", &n_blocks, false))
-			file->n_blocks = (int) n_blocks;
+	FIN_FILE_CRC32(true, *content_crc);
 
-		if (get_control_value_int64(buf, "n_headers", &n_headers, false))
-			file->n_headers = (int) n_headers;
+	if (ferror(fp))
+		elog(ERROR, "Failed to read from file: \"%s\"", backup_filelist_path);
 
-		if (get_control_value_int64(buf, "hdr_crc", &hdr_crc, false))
-			file->hdr_crc = (pg_crc32) hdr_crc;
+	fio_close_stream(fp);
 
-		if (get_control_value_int64(buf, "hdr_off", &hdr_off, false))
-			file->hdr_off = hdr_off;
+	return files;
+}
 
-		if (get_control_value_int64(buf, "hdr_size", &hdr_size, false))
-			file->hdr_size = (int) hdr_size;
+/*
+ * If the backup was interrupted, the journal holds the records of files
+ * it has copied. They supersede the records of the file list,
+ * which was written before copying.
+ */
+static void
+apply_filelist_journal(pgBackup *backup, parray *files)
+{
+	char		journal_path[MAXPGPATH];
+	FILE	   *fp;
+	char		buf[BLCKSZ];
+	parray	   *sorted;
 
-		if (get_control_value_int64(buf, "full_size", &uncompressed_size, false))
-			file->uncompressed_size = uncompressed_size;
-		else
-			file->uncompressed_size = write_size;
-		if (!file->is_datafile || file->is_cfs)
-			file->size = file->uncompressed_size;
-
-		if (file->external_dir_num == 0 &&
-				(file->dbOid != 0 ||
-				 path_is_prefix_of_path("global", file->rel_path)) &&
-				S_ISREG(file->mode))
-		{
-			bool is_datafile = file->is_datafile;
-			set_forkname(file);
-			if (is_datafile != file->is_datafile)
-			{
-				if (is_datafile)
-					elog(WARNING, "File '%s' was stored as datafile, but looks like it is not",
-						 file->rel_path);
-				else
-					elog(WARNING, "File '%s' was stored as non-datafile, but looks like it is",
-						 file->rel_path);
-				/* Lets fail in tests */
-				Assert(file->is_datafile == file->is_datafile);
-				file->is_datafile = is_datafile;
-			}
-		}
+	join_path_components(journal_path, backup->root_dir, DATABASE_FILE_LIST_JOURNAL);
 
-		parray_append(files, file);
+	fp = fio_open_stream(journal_path, FIO_BACKUP_HOST);
+	if (fp == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open \"%s\": %s", journal_path, strerror(errno));
+		return;
 	}
 
-	FIN_FILE_CRC32(true, content_crc);
+	sorted = parray_new();
+	parray_concat(sorted, files);
+	parray_qsort(sorted, pgFileCompareRelPathWithExternal);
 
-	if (ferror(fp))
-		elog(ERROR, "Failed to read from file: \"%s\"", backup_filelist_path);
+	while (fgets(buf, lengthof(buf), fp))
+	{
+		pgFile	   *file;
+		pgFile	  **listed;
 
-	fio_close_stream(fp);
+		/* the last record may be written partly */
+		if (buf[strlen(buf) - 1] != '\n')
+			break;
 
-	if (backup->content_crc != 0 &&
-		backup->content_crc != content_crc)
-	{
-		elog(WARNING, "Invalid CRC of backup control file '%s': %u. Expected: %u",
-					 backup_filelist_path, content_crc, backup->content_crc);
-		parray_free(files);
-		files = NULL;
+		file = parse_file_list_line(buf);
+		finish_file_list_entry(file);
 
+		listed = (pgFile **) parray_bsearch(sorted, file, pgFileCompareRelPathWithExternal);
+		if (listed)
+		{
+			/* keep the pointer in the list, but take the content of the record */
+			pgFile		tmp = **listed;
+
+			**listed = *file;
+			*file = tmp;
+		}
+		pgFileFree(file);
 	}
 
-	/* redundant sanity? */
-	if (!files)
-		elog(strict ? ERROR : WARNING, "Failed to get file list for backup %s", backup_id_of(backup));
+	if (ferror(fp))
+		elog(WARNING, "Failed to read from file: \"%s\"", journal_path);
 
-	return files;
+	fio_close_stream(fp);
+	parray_free(sorted);
 }
 
 /*
@@ -1646,8 +1763,30 @@ catalog_get_timelines(InstanceState *instanceState, InstanceConfig *instance)
 					parray_append(tlinfo->xlog_filelist, wal_file);
 					continue;
 				}
-				/* we only expect compressed wal files with .gz suffix */
-				else if (strcmp(suffix, "gz") != 0)
+				/* block summary of WAL segment */
+				else if (IsBlockSummaryFileName(file->name))
+				{
+					elog(VERBOSE, "block summary file \"%s\"", file->name);
+
+					if (!tlinfo || tlinfo->tli != tli)
+					{
+						tlinfo = timelineInfoNew(tli);
+						parray_append(timelineinfos, tlinfo);
+					}
+
+					/* append file to xlog file list */
+					wal_file = palloc(sizeof(xlogFile));
+					wal_file->file = *file;
+					wal_file->segno = segno;
+					wal_file->type = BLOCK_SUMMARY_FILE;
+					wal_file->keep = false;
+					parray_append(tlinfo->xlog_filelist, wal_file);
+					continue;
+				}
+				/* we only expect compressed wal files with .gz, .zst or .lz4 suffix */
+				else if (strcmp(suffix, "gz") != 0 &&
+						 strcmp(suffix, "zst") != 0 &&
+						 strcmp(suffix, "lz4") != 0)
 				{
 					elog(WARNING, "unexpected WAL file name \"%s\"", file->name);
 					continue;
@@ -2510,45 +2649,71 @@ write_backup(pgBackup *backup, bool strict)
 }
 
 /*
- * Output the list of files to backup catalog DATABASE_FILE_LIST
+ * Print the record of the file for DATABASE_FILE_LIST into the line
+ * of BLCKSZ bytes.
+ */
+static void
+print_file_list_line(char *line, pgFile *file)
+{
+	int			len = 0;
+
+	len = sprintf(line, "{\"path\":\"%s\", \"size\":\"" INT64_FORMAT "\", "
+				 "\"mode\":\"%u\", \"is_datafile\":\"%u\", "
+				 "\"is_cfs\":\"%u\", \"crc\":\"%u\", "
+				 "\"compress_alg\":\"%s\", \"external_dir_num\":\"%d\", "
+				 "\"dbOid\":\"%u\"",
+				file->rel_path, file->write_size, file->mode,
+				file->is_datafile ? 1 : 0,
+				file->is_cfs ? 1 : 0,
+				file->crc,
+				deparse_compress_alg(file->compress_alg),
+				file->external_dir_num,
+				file->dbOid);
+
+	if (file->uncompressed_size != 0 &&
+			file->uncompressed_size != file->write_size)
+		len += sprintf(line+len, ",\"full_size\":\"" INT64_FORMAT "\"",
+					   file->uncompressed_size);
+
+	if (file->is_datafile)
+		len += sprintf(line+len, ",\"segno\":\"%d\"", file->segno);
+
+	if (file->linked)
+		len += sprintf(line+len, ",\"linked\":\"%s\"", file->linked);
+
+	if (file->n_blocks > 0)
+		len += sprintf(line+len, ",\"n_blocks\":\"%i\"", file->n_blocks);
+
+	if (file->n_headers > 0)
+	{
+		len += sprintf(line+len, ",\"n_headers\":\"%i\"", file->n_headers);
+		len += sprintf(line+len, ",\"hdr_crc\":\"%u\"", file->hdr_crc);
+		len += sprintf(line+len, ",\"hdr_off\":\"%llu\"", file->hdr_off);
+		len += sprintf(line+len, ",\"hdr_size\":\"%i\"", file->hdr_size);
+	}
+
+	sprintf(line+len, "}\n");
+}
+
+/*
+ * Output the list of files to backup catalog DATABASE_FILE_INDEX
  */
 void
 write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 					  parray *external_list, bool sync)
 {
-	FILE	   *out;
 	char		control_path[MAXPGPATH];
-	char		control_path_temp[MAXPGPATH];
+	char		text_control_path[MAXPGPATH];
 	size_t		i = 0;
-	#define BUFFERSZ (1024*1024)
-	char		*buf;
+	pg_crc32	content_crc;
 	int64 		backup_size_on_disk = 0;
 	int64 		uncompressed_size_on_disk = 0;
 	int64 		wal_size_on_disk = 0;
 
-	join_path_components(control_path, backup->root_dir, DATABASE_FILE_LIST);
-	snprintf(control_path_temp, sizeof(control_path_temp), "%s.tmp", control_path);
-
-	out = fopen(control_path_temp, PG_BINARY_W);
-	if (out == NULL)
-		elog(ERROR, "Cannot open file list \"%s\": %s", control_path_temp,
-			 strerror(errno));
+	join_path_components(control_path, backup->root_dir, DATABASE_FILE_INDEX);
 
-	if (chmod(control_path_temp, FILE_PERMISSION) == -1)
-		elog(ERROR, "Cannot change mode of \"%s\": %s", control_path_temp,
-			 strerror(errno));
-
-	buf = pgut_malloc(BUFFERSZ);
-	setvbuf(out, buf, _IOFBF, BUFFERSZ);
-
-	if (sync)
-		INIT_FILE_CRC32(true, backup->content_crc);
-
-	/* print each file in the list */
 	for (i = 0; i < parray_num(files); i++)
 	{
-		int       len = 0;
-		char      line[BLCKSZ];
 		pgFile   *file = (pgFile *) parray_get(files, i);
 
 		/* Ignore disappeared file */
@@ -2576,77 +2741,205 @@ write_backup_filelist(pgBackup *backup, parray *files, const char *root,
 				uncompressed_size_on_disk += file->uncompressed_size;
 			}
 		}
+	}
 
-		len = sprintf(line, "{\"path\":\"%s\", \"size\":\"" INT64_FORMAT "\", "
-					 "\"mode\":\"%u\", \"is_datafile\":\"%u\", "
-					 "\"is_cfs\":\"%u\", \"crc\":\"%u\", "
-					 "\"compress_alg\":\"%s\", \"external_dir_num\":\"%d\", "
-					 "\"dbOid\":\"%u\"",
-					file->rel_path, file->write_size, file->mode,
-					file->is_datafile ? 1 : 0,
-					file->is_cfs ? 1 : 0,
-					file->crc,
-					deparse_compress_alg(file->compress_alg),
-					file->external_dir_num,
-					file->dbOid);
-
-		if (file->uncompressed_size != 0 &&
-				file->uncompressed_size != file->write_size)
-			len += sprintf(line+len, ",\"full_size\":\"" INT64_FORMAT "\"",
-						   file->uncompressed_size);
-
-		if (file->is_datafile)
-			len += sprintf(line+len, ",\"segno\":\"%d\"", file->segno);
-
-		if (file->linked)
-			len += sprintf(line+len, ",\"linked\":\"%s\"", file->linked);
-
-		if (file->n_blocks > 0)
-			len += sprintf(line+len, ",\"n_blocks\":\"%i\"", file->n_blocks);
-
-		if (file->n_headers > 0)
-		{
-			len += sprintf(line+len, ",\"n_headers\":\"%i\"", file->n_headers);
-			len += sprintf(line+len, ",\"hdr_crc\":\"%u\"", file->hdr_crc);
-			len += sprintf(line+len, ",\"hdr_off\":\"%llu\"", file->hdr_off);
-			len += sprintf(line+len, ",\"hdr_size\":\"%i\"", file->hdr_size);
-		}
+	write_file_list_index(control_path, files, &content_crc, sync);
 
-		sprintf(line+len, "}\n");
+	if (sync)
+		backup->content_crc = content_crc;
+
+	/* merge of the backup taken by older version replaces its text list */
+	join_path_components(text_control_path, backup->root_dir, DATABASE_FILE_LIST);
+	if (fio_unlink(text_control_path, FIO_BACKUP_HOST) != 0 && errno != ENOENT)
+		elog(ERROR, "Cannot remove file \"%s\": %s", text_control_path,
+			 strerror(errno));
 
-		if (sync)
-			COMP_FILE_CRC32(true, backup->content_crc, line, strlen(line));
+	/* use extra variable to avoid reset of previous data_bytes value in case of error */
+	backup->data_bytes = backup_size_on_disk;
+	backup->uncompressed_bytes = uncompressed_size_on_disk;
 
-		fprintf(out, "%s", line);
+	if (backup->stream)
+		backup->wal_bytes = wal_size_on_disk;
+}
+
+/*
+ * Open DATABASE_FILE_INDEX of the backup to look up single files.
+ * Returns NULL if the backup was taken by older version
+ * or the file list is corrupted.
+ */
+FileListIndex *
+open_backup_filelist_index(pgBackup *backup)
+{
+	char		path[MAXPGPATH];
+	FileListIndex *index;
+
+	join_path_components(path, backup->root_dir, DATABASE_FILE_INDEX);
+
+	index = file_list_index_open(path, WARNING);
+	if (index == NULL)
+		return NULL;
+
+	if (backup->content_crc != 0 &&
+		backup->content_crc != file_list_index_crc(index))
+	{
+		elog(WARNING, "Invalid CRC of backup control file '%s'", path);
+		file_list_index_close(index);
+		return NULL;
 	}
 
-	if (sync)
-		FIN_FILE_CRC32(true, backup->content_crc);
+	return index;
+}
 
-	if (fflush(out) != 0)
-		elog(ERROR, "Cannot flush file list \"%s\": %s",
-			 control_path_temp, strerror(errno));
+/*
+ * Print the file list of the backup in the text format of DATABASE_FILE_LIST.
+ */
+void
+print_backup_filelist(pgBackup *backup, FILE *out)
+{
+	parray	   *files = get_backup_filelist(backup, true);
+	size_t		i;
 
-	if (sync && fsync(fileno(out)) < 0)
-		elog(ERROR, "Cannot sync file list \"%s\": %s",
-			 control_path_temp, strerror(errno));
+	for (i = 0; i < parray_num(files); i++)
+	{
+		char		line[BLCKSZ];
 
-	if (fclose(out) != 0)
-		elog(ERROR, "Cannot close file list \"%s\": %s",
-			 control_path_temp, strerror(errno));
+		print_file_list_line(line, (pgFile *) parray_get(files, i));
+		fputs(line, out);
+	}
 
-	if (rename(control_path_temp, control_path) < 0)
-		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
-			 control_path_temp, control_path, strerror(errno));
+	parray_walk(files, pgFileFree);
+	parray_free(files);
+}
 
-	/* use extra variable to avoid reset of previous data_bytes value in case of error */
-	backup->data_bytes = backup_size_on_disk;
-	backup->uncompressed_bytes = uncompressed_size_on_disk;
+/*
+ * Journal of the files, copied by the running backup.
+ *
+ * The file list is written once before copying and once at the end.
+ * Meanwhile the records of copied files are appended to the journal,
+ * so that the list of an interrupted backup shows what was copied.
+ * get_backup_filelist() applies the journal, if it is left behind.
+ *
+ * Every record is written through fio as soon as the file is copied, so
+ * nothing is lost in a buffer of the process if the backup fails.
+ * filelist_journal_flush() syncs the journal before backup.control is
+ * updated, so that the sizes saved there never cover files missing from
+ * the journal on disk.
+ */
+static int	filelist_journal = -1;
+static char filelist_journal_path[MAXPGPATH];
+static pthread_mutex_t filelist_journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* sizes of the backup, including the files in the journal */
+static int64 journal_data_bytes = 0;
+static int64 journal_uncompressed_bytes = 0;
+static int64 journal_wal_bytes = 0;
 
+/*
+ * Start the journal of the backup, after its file list is written.
+ */
+void
+filelist_journal_open(pgBackup *backup)
+{
+	join_path_components(filelist_journal_path, backup->root_dir,
+						 DATABASE_FILE_LIST_JOURNAL);
+
+	filelist_journal = fio_open(filelist_journal_path,
+								O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+								FIO_BACKUP_HOST);
+	if (filelist_journal < 0)
+		elog(ERROR, "Cannot open file list journal \"%s\": %s",
+			 filelist_journal_path, strerror(errno));
+
+	if (fio_chmod(filelist_journal_path, FILE_PERMISSION, FIO_BACKUP_HOST) == -1)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", filelist_journal_path,
+			 strerror(errno));
+
+	journal_data_bytes = backup->data_bytes;
+	journal_uncompressed_bytes = backup->uncompressed_bytes;
+	journal_wal_bytes = backup->wal_bytes;
+}
+
+/*
+ * Append the record of the copied file to the journal.
+ * Can be called by several threads at once.
+ */
+void
+filelist_journal_append(pgFile *file)
+{
+	char		line[BLCKSZ];
+	size_t		len;
+	bool		written;
+
+	/* Ignore disappeared file */
+	if (file->write_size == FILE_NOT_FOUND)
+		return;
+
+	print_file_list_line(line, file);
+	len = strlen(line);
+
+	pthread_lock(&filelist_journal_mutex);
+
+	/* a record is written at once, so records of threads do not mix */
+	written = (fio_write(filelist_journal, line, len) == len);
+
+	if (S_ISREG(file->mode) && file->write_size > 0)
+	{
+		if (IsXLogFileName(file->name) && file->external_dir_num == 0)
+			journal_wal_bytes += file->write_size;
+		else
+		{
+			journal_data_bytes += file->write_size;
+			journal_uncompressed_bytes += file->uncompressed_size;
+		}
+	}
+
+	pthread_mutex_unlock(&filelist_journal_mutex);
+
+	if (!written)
+		elog(ERROR, "Cannot write file list journal \"%s\": %s",
+			 filelist_journal_path, strerror(errno));
+}
+
+/*
+ * Sync the journal and update the sizes of the backup,
+ * to be saved by write_backup() right after.
+ */
+void
+filelist_journal_flush(pgBackup *backup)
+{
+	bool		flushed;
+
+	pthread_lock(&filelist_journal_mutex);
+
+	flushed = (fio_sync(filelist_journal_path, FIO_BACKUP_HOST) == 0);
+
+	backup->data_bytes = journal_data_bytes;
+	backup->uncompressed_bytes = journal_uncompressed_bytes;
 	if (backup->stream)
-		backup->wal_bytes = wal_size_on_disk;
+		backup->wal_bytes = journal_wal_bytes;
+
+	pthread_mutex_unlock(&filelist_journal_mutex);
+
+	if (!flushed)
+		elog(ERROR, "Cannot sync file list journal \"%s\": %s",
+			 filelist_journal_path, strerror(errno));
+}
+
+/*
+ * Remove the journal, once the final file list is written.
+ */
+void
+filelist_journal_close(pgBackup *backup)
+{
+	if (filelist_journal < 0)
+		return;
 
-	free(buf);
+	/* the records are in the file list already */
+	fio_close(filelist_journal);
+	filelist_journal = -1;
+
+	if (fio_unlink(filelist_journal_path, FIO_BACKUP_HOST) != 0 && errno != ENOENT)
+		elog(ERROR, "Cannot remove file list journal \"%s\": %s",
+			 filelist_journal_path, strerror(errno));
 }
 
 /*
@@ -2880,6 +3173,10 @@ parse_compress_alg(const char *arg)
 
 	if (pg_strncasecmp("zlib", arg, len) == 0)
 		return ZLIB_COMPRESS;
+	else if (pg_strncasecmp("zstd", arg, len) == 0)
+		return ZSTD_COMPRESS;
+	else if (pg_strncasecmp("lz4", arg, len) == 0)
+		return LZ4_COMPRESS;
 	else if (pg_strncasecmp("pglz", arg, len) == 0)
 		return PGLZ_COMPRESS;
 	else if (pg_strncasecmp("none", arg, len) == 0)
@@ -2902,11 +3199,52 @@ deparse_compress_alg(int alg)
 			return "zlib";
 		case PGLZ_COMPRESS:
 			return "pglz";
+		case ZSTD_COMPRESS:
+			return "zstd";
+		case LZ4_COMPRESS:
+			return "lz4";
 	}
 
 	return NULL;
 }
 
+/*
+ * Suffix of WAL segment compressed by archive-push with given algorithm,
+ * or NULL if WAL is not compressed with it.
+ */
+const char*
+compress_alg_wal_suffix(CompressAlg alg)
+{
+	switch (alg)
+	{
+		case ZLIB_COMPRESS:
+			return ".gz";
+		case ZSTD_COMPRESS:
+			return ".zst";
+		case LZ4_COMPRESS:
+			return ".lz4";
+		default:
+			return NULL;
+	}
+}
+
+/*
+ * Detect algorithm of compressed WAL segment by its file name.
+ * Only zstd and lz4 are recognized, gzip files are handled separately.
+ */
+CompressAlg
+wal_suffix_compress_alg(const char *path)
+{
+	size_t		len = strlen(path);
+
+	if (len > 4 && strcmp(path + len - 4, ".zst") == 0)
+		return ZSTD_COMPRESS;
+	if (len > 4 && strcmp(path + len - 4, ".lz4") == 0)
+		return LZ4_COMPRESS;
+
+	return NOT_DEFINED_COMPRESS;
+}
+
 /*
  * Fill PGNodeInfo struct with default values.
  */
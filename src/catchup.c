@@ -365,6 +365,7 @@ typedef struct
 	parray	   *dest_filelist;
 	XLogRecPtr	sync_lsn;
 	BackupMode	backup_mode;
+	ForkJoin   *fork_join;
 	int	thread_num;
 	size_t	transfered_bytes;
 	bool	completed;
@@ -374,7 +375,7 @@ typedef struct
 static void *
 catchup_thread_runner(void *arg)
 {
-	int			i;
+	size_t		i;
 	char		from_fullpath[MAXPGPATH];
 	char		to_fullpath[MAXPGPATH];
 
@@ -382,7 +383,7 @@ catchup_thread_runner(void *arg)
 	int 		n_files = parray_num(arguments->source_filelist);
 
 	/* catchup a file */
-	for (i = 0; i < n_files; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &i))
 	{
 		pgFile	*file = (pgFile *) parray_get(arguments->source_filelist, i);
 		pgFile	*dest_file = NULL;
@@ -394,14 +395,11 @@ catchup_thread_runner(void *arg)
 		if (file->excluded)
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during catchup");
 
-		elog(progress ? INFO : LOG, "Progress: (%d/%d). Process file \"%s\"",
+		elog(progress ? INFO : LOG, "Progress: (%zu/%d). Process file \"%s\"",
 			 i + 1, n_files, file->rel_path);
 
 		/* construct destination filepath */
@@ -482,15 +480,16 @@ catchup_multithreaded_copy(int num_threads,
 	XLogRecPtr	sync_lsn,
 	BackupMode	backup_mode)
 {
-	/* arrays with meta info for multi threaded catchup */
+	/* meta info for multi threaded catchup */
 	catchup_thread_runner_arg *threads_args;
-	pthread_t	*threads;
+	ForkJoin   *fork_join;
 
 	bool all_threads_successful = true;
 	ssize_t transfered_bytes_result = 0;
 	int	i;
 
 	/* init thread args */
+	fork_join = fork_join_create(num_threads, parray_num(source_filelist));
 	threads_args = (catchup_thread_runner_arg *) palloc(sizeof(catchup_thread_runner_arg) * num_threads);
 	for (i = 0; i < num_threads; i++)
 		threads_args[i] = (catchup_thread_runner_arg){
@@ -501,6 +500,7 @@ catchup_multithreaded_copy(int num_threads,
 			.dest_filelist = dest_filelist,
 			.sync_lsn = sync_lsn,
 			.backup_mode = backup_mode,
+			.fork_join = fork_join,
 			.thread_num = i + 1,
 			.transfered_bytes = 0,
 			.completed = false,
@@ -508,26 +508,17 @@ catchup_multithreaded_copy(int num_threads,
 
 	/* Run threads */
 	thread_interrupted = false;
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
 	if (!dry_run)
-	{
-		for (i = 0; i < num_threads; i++)
-		{
-			elog(VERBOSE, "Start thread num: %i", i);
-			pthread_create(&threads[i], NULL, &catchup_thread_runner, &(threads_args[i]));
-		}
-	}
+		fork_join_run(fork_join, catchup_thread_runner, threads_args,
+						sizeof(catchup_thread_runner_arg));
 
-	/* Wait threads */
 	for (i = 0; i < num_threads; i++)
 	{
-		if (!dry_run)
-			pthread_join(threads[i], NULL);
 		all_threads_successful &= threads_args[i].completed;
 		transfered_bytes_result += threads_args[i].transfered_bytes;
 	}
 
-	free(threads);
+	fork_join_free(fork_join);
 	free(threads_args);
 	return all_threads_successful ? transfered_bytes_result : -1;
 }
@@ -965,9 +956,6 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 		}
 	}
 
-	/* clear file locks */
-	pfilearray_clear_locks(source_filelist);
-
 	/* Sort by size for load balancing */
 	parray_qsort(source_filelist, pgFileCompareSizeDesc);
 
@@ -1000,10 +988,12 @@ do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads,
 	/* run copy threads */
 	elog(INFO, "Start transferring data files");
 	time(&start_time);
+	throttle_start(source_conn);
 	transfered_datafiles_bytes = catchup_multithreaded_copy(num_threads, &source_node_info,
 		source_pgdata, dest_pgdata,
 		source_filelist, dest_filelist,
 		dest_redo.lsn, current.backup_mode);
+	throttle_stop();
 	catchup_isok = transfered_datafiles_bytes != -1;
 
 	/* at last copy control file */
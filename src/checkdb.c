@@ -37,6 +37,8 @@ typedef struct
 	 * and want to read it via buffer cache to ensure
 	 */
 	ConnectionArgs conn_arg;
+	/* tasks of threads, sharing files_list */
+	ForkJoin   *fork_join;
 	/* number of thread for debugging */
 	int			thread_num;
 	/* pgdata path */
@@ -66,6 +68,8 @@ typedef struct
 	 * to use in threads to connect to databases
 	 */
 	ConnectionArgs conn_arg;
+	/* tasks of threads, sharing index_list */
+	ForkJoin   *fork_join;
 	/* number of thread for debugging */
 	int			thread_num;
 	/*
@@ -86,8 +90,6 @@ typedef struct pg_indexEntry
 	bool checkunique_is_supported;
 	/* schema where amcheck extension is located */
 	char *amcheck_nspname;
-	/* lock for synchronization of parallel threads  */
-	volatile pg_atomic_flag lock;
 } pg_indexEntry;
 
 static void
@@ -130,7 +132,7 @@ static void do_amcheck(ConnectionOptions conn_opt, PGconn *conn);
 static void *
 check_files(void *arg)
 {
-	int			i;
+	size_t		i;
 	check_files_arg *arguments = (check_files_arg *) arg;
 	int			n_files_list = 0;
 	char		from_fullpath[MAXPGPATH];
@@ -139,7 +141,7 @@ check_files(void *arg)
 		n_files_list = parray_num(arguments->files_list);
 
 	/* check a file */
-	for (i = 0; i < n_files_list; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &i))
 	{
 		pgFile	   *file = (pgFile *) parray_get(arguments->files_list, i);
 
@@ -151,15 +153,12 @@ check_files(void *arg)
 		if (S_ISDIR(file->mode))
 			continue;
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		join_path_components(from_fullpath, arguments->from_root, file->rel_path);
 
 		elog(VERBOSE, "Checking file:  \"%s\" ", from_fullpath);
 
 		if (progress)
-			elog(INFO, "Progress: (%d/%d). Process file \"%s\"",
+			elog(INFO, "Progress: (%zu/%d). Process file \"%s\"",
 				 i + 1, n_files_list, from_fullpath);
 
 		if (S_ISREG(file->mode))
@@ -198,8 +197,8 @@ static void
 do_block_validation(char *pgdata, uint32 checksum_version)
 {
 	int			i;
-	/* arrays with meta info for multi threaded check */
-	pthread_t	*threads;
+	/* meta info for multi threaded check */
+	ForkJoin   *fork_join;
 	check_files_arg *threads_args;
 	bool		check_isok = true;
 	parray *files_list = NULL;
@@ -222,18 +221,11 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 	/* Extract information about files in pgdata parsing their names:*/
 	parse_filelist_filenames(files_list, pgdata);
 
-	/* setup threads */
-	for (i = 0; i < parray_num(files_list); i++)
-	{
-		pgFile	   *file = (pgFile *) parray_get(files_list, i);
-		pg_atomic_init_flag(&file->lock);
-	}
-
 	/* Sort by size for load balancing */
 	parray_qsort(files_list, pgFileCompareSize);
 
 	/* init thread args with own file lists */
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	fork_join = fork_join_create(num_threads, parray_num(files_list));
 	threads_args = (check_files_arg *) palloc(sizeof(check_files_arg)*num_threads);
 
 	for (i = 0; i < num_threads; i++)
@@ -247,6 +239,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 		arg->conn_arg.conn = NULL;
 		arg->conn_arg.cancel_conn = NULL;
 
+		arg->fork_join = fork_join;
 		arg->thread_num = i + 1;
 		/* By default there is some error */
 		arg->ret = 1;
@@ -254,23 +247,14 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 
 	elog(INFO, "Start checking data files");
 
-	/* Run threads */
-	for (i = 0; i < num_threads; i++)
-	{
-		check_files_arg *arg = &(threads_args[i]);
-
-		elog(VERBOSE, "Start thread num: %i", i);
+	fork_join_run(fork_join, check_files, threads_args, sizeof(check_files_arg));
 
-		pthread_create(&threads[i], NULL, check_files, arg);
-	}
-
-	/* Wait threads */
 	for (i = 0; i < num_threads; i++)
 	{
-		pthread_join(threads[i], NULL);
 		if (threads_args[i].ret > 0)
 			check_isok = false;
 	}
+	fork_join_free(fork_join);
 
 	/* cleanup */
 	if (files_list)
@@ -290,7 +274,7 @@ do_block_validation(char *pgdata, uint32 checksum_version)
 static void *
 check_indexes(void *arg)
 {
-	int			i;
+	size_t		i;
 	check_indexes_arg *arguments = (check_indexes_arg *) arg;
 	int			n_indexes = 0;
 	my_thread_num = arguments->thread_num;
@@ -298,20 +282,17 @@ check_indexes(void *arg)
 	if (arguments->index_list)
 		n_indexes = parray_num(arguments->index_list);
 
-	for (i = 0; i < n_indexes; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &i))
 	{
 		pg_indexEntry *ind = (pg_indexEntry *) parray_get(arguments->index_list, i);
 
-		if (!pg_atomic_test_set_flag(&ind->lock))
-			continue;
-
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Thread [%d]: interrupted during checkdb --amcheck",
 				arguments->thread_num);
 
 		if (progress)
-			elog(INFO, "Thread [%d]. Progress: (%d/%d). Amchecking index '%s.%s'",
+			elog(INFO, "Thread [%d]. Progress: (%zu/%d). Amchecking index '%s.%s'",
 				 arguments->thread_num, i + 1, n_indexes,
 				 ind->namespace, ind->name);
 
@@ -509,7 +490,6 @@ get_index_list(const char *dbname, bool first_db_with_amcheck,
 		ind->checkunique_is_supported = checkunique_is_supported;
 		ind->amcheck_nspname = pgut_malloc(strlen(amcheck_nspname) + 1);
 		strcpy(ind->amcheck_nspname, amcheck_nspname);
-		pg_atomic_clear_flag(&ind->lock);
 
 		if (index_list == NULL)
 			index_list = parray_new();
@@ -609,8 +589,8 @@ static void
 do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 {
 	int			i;
-	/* arrays with meta info for multi threaded amcheck */
-	pthread_t	*threads;
+	/* meta info for multi threaded amcheck */
+	ForkJoin   *fork_join;
 	check_indexes_arg *threads_args;
 	bool		check_isok = true;
 	PGresult   *res_db;
@@ -660,7 +640,7 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 		first_db_with_amcheck = false;
 
 		/* init thread args with own index lists */
-		threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+		fork_join = fork_join_create(num_threads, parray_num(index_list));
 		threads_args = (check_indexes_arg *) palloc(sizeof(check_indexes_arg)*num_threads);
 
 		for (j = 0; j < num_threads; j++)
@@ -676,26 +656,21 @@ do_amcheck(ConnectionOptions conn_opt, PGconn *conn)
 			arg->conn_opt.pgdatabase = dbname;
 			arg->conn_opt.pguser = conn_opt.pguser;
 
+			arg->fork_join = fork_join;
 			arg->thread_num = j + 1;
 			/* By default there are some error */
 			arg->ret = 1;
 		}
 
-		/* Run threads */
-		for (j = 0; j < num_threads; j++)
-		{
-			check_indexes_arg *arg = &(threads_args[j]);
-			elog(VERBOSE, "Start thread num: %i", j);
-			pthread_create(&threads[j], NULL, check_indexes, arg);
-		}
+		fork_join_run(fork_join, check_indexes, threads_args, sizeof(check_indexes_arg));
 
-		/* Wait threads */
 		for (j = 0; j < num_threads; j++)
 		{
-			pthread_join(threads[j], NULL);
 			if (threads_args[j].ret > 0)
 				check_isok = false;
 		}
+		fork_join_free(fork_join);
+		pfree(threads_args);
 
 		if (check_isok)
 			elog(INFO, "Amcheck succeeded for database '%s'", dbname);
@@ -763,12 +738,21 @@ do_checkdb(bool need_amcheck,
 		 * we don't need this connection anymore.
 		 * block validation can last long time,
 		 * so we don't hold the connection open,
-		 * rather open new connection for amcheck
+		 * rather open new connection for amcheck.
+		 * Adaptive rate limiting polls the database through it, though.
 		 */
-		if (cur_conn)
+		if (cur_conn && !adaptive_rate)
+		{
 			pgut_disconnect(cur_conn);
+			cur_conn = NULL;
+		}
 
+		throttle_start(cur_conn);
 		do_block_validation(pgdata, nodeInfo.checksum_version);
+		throttle_stop();
+
+		if (cur_conn)
+			pgut_disconnect(cur_conn);
 	}
 
 	if (need_amcheck)
@@ -17,11 +17,32 @@
 
 #include <unistd.h>
 #include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <sys/uio.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#endif
 
 #ifdef HAVE_LIBZ
 #include <zlib.h>
 #endif
 
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef USE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#include <lz4frame.h>
+#endif
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
 #include "utils/thread.h"
 
 /* Union to ease operations on relation pages */
@@ -31,8 +52,173 @@ typedef struct DataPage
 	char            data[BLCKSZ];
 } DataPage;
 
+/*
+ * Room required to store one page in the output buffer,
+ * compressed page may require more space than uncompressed.
+ */
+#define MAX_PAGE_ENTRY_SIZE (sizeof(BackupPageHeader) + BLCKSZ * 2)
+
+#ifdef HAVE_LIBURING
+/* number of consecutive blocks requested by one asynchronous read */
+#define ASYNC_READ_BLOCKS (CHUNK_SIZE / BLCKSZ)
+
+/* Asynchronous read of several consecutive blocks */
+typedef struct AsyncRead
+{
+	char	   *buf;
+	BlockNumber blknum;		/* first requested block */
+	BlockNumber nblocks;	/* number of requested blocks */
+	int			result;		/* number of bytes read or -errno */
+	bool		in_flight;
+} AsyncRead;
+
+/*
+ * io_uring ring of the thread with io_queue_depth read buffers.
+ * It is created on the first use and reused for every file read
+ * by the thread, until async_read_ring_free() is called.
+ * The ring is also registered under ring_key, so that it is released
+ * by the key destructor if the thread exits on elog(ERROR) or
+ * interruption, without reaching async_read_ring_free().
+ */
+static __thread struct io_uring *thread_ring = NULL;
+static __thread AsyncRead *thread_reads = NULL;
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static bool ring_key_created = false;
+
+/* set once io_uring turned out to be unsupported by the kernel */
+static __thread bool uring_unavailable = false;
+#endif
+
+/* alignment of buffers for reads with O_DIRECT */
+#define DIRECT_IO_ALIGN 4096
+
+/*
+ * Source of extents of consecutive blocks for send_pages().
+ * Extents are read either synchronously by pread(), or, if
+ * --io-queue-depth is set, ahead of time through io_uring,
+ * keeping up to io_queue_depth reads in flight.
+ * If the pagemap is used, each range of changed blocks is read
+ * synchronously by extent_reader_range().
+ * With --direct-io extents are read past the page cache, if the
+ * filesystem allows it, otherwise they are dropped from the cache
+ * once read.
+ */
+typedef struct ExtentReader
+{
+	FILE	   *in;
+	const char *from_fullpath;
+	BlockNumber n_blocks;		/* read blocks up to this one */
+	int			fd;				/* descriptor extents are read from */
+	bool		direct;			/* fd is opened with O_DIRECT */
+	bool		drop_cache;		/* drop extents from page cache after reading */
+	char	   *buf;			/* extent buffer for synchronous reads */
+#ifdef HAVE_LIBURING
+	bool		use_uring;
+	struct io_uring *ring;		/* ring of the thread */
+	AsyncRead  *reads;			/* circular queue of io_queue_depth reads */
+	int			head;			/* read to be consumed next */
+	int			n_queued;		/* number of reads starting from head */
+	bool		head_consumed;	/* head buffer is handed out to the caller */
+	BlockNumber next_blknum;	/* first block not requested yet */
+#endif
+} ExtentReader;
+
+/*
+ * Copy of the file in a member of the backup chain, restored by
+ * restore_data_file_resolved().
+ */
+typedef struct ChainSource
+{
+	pgBackup   *backup;
+	pgFile	   *file;
+	BackupPageHeader2 *headers;
+	uint32		backup_version;
+	FILE	   *in;				/* opened on the first block read */
+	char	   *in_buf;
+	off_t		cur_pos;
+	char		fullpath[MAXPGPATH];
+} ChainSource;
+
+/* Member of the chain holding the newest copy of the block */
+typedef struct BlockOwner
+{
+	int32		source;			/* index in the chain, or one of below */
+	int32		n_hdr;			/* header of the block in that source */
+} BlockOwner;
+
+#define BLOCK_NOT_RESOLVED	(-1)
+#define BLOCK_SKIPPED		(-2)	/* the block need not be restored */
+
+/* number of pages of consecutive blocks written by one pwritev() */
+#define PAGE_WRITER_PAGES	32
+
+/*
+ * Writer of restored pages into the destination data file.
+ * Pages are read from the backup right into the slots of the writer,
+ * decompressed in place, and pages of consecutive blocks are written
+ * by a single pwritev(). Zeroed pages of a new file are not written,
+ * but left as holes, while runs of other blocks are preallocated before
+ * they are written.
+ * Pages of remote file are sent to the agent in batches, as they are
+ * stored in the backup, and the agent decompresses and writes them.
+ * Local files on Windows are written page by page through stdio.
+ */
+typedef struct PageWriter
+{
+	FILE	   *out;
+	const char *to_fullpath;
+	int			fd;				/* local descriptor, -1 to write through fio */
+	char	   *batch;			/* pages to be sent to the agent */
+	size_t		batch_len;
+	bool		preallocate;
+	DataPage   *pages;
+	DataPage   *slots[PAGE_WRITER_PAGES];
+	int			n_pending;		/* pages not written yet */
+	BlockNumber	run_start;		/* block of the first pending slot */
+	BlockNumber	alloc_start;	/* run of blocks noted for preallocation */
+	BlockNumber	alloc_end;
+	BlockNumber	written_end;	/* blocks are written up to this one */
+	BlockNumber	hole_end;		/* holes are left up to this block */
+	off_t		cur_pos_out;	/* write position of fio */
+} PageWriter;
+
+static void page_writer_init(PageWriter *writer, FILE *out,
+							 const char *to_fullpath, bool sparse);
+static DataPage *page_writer_page(PageWriter *writer);
+static void page_writer_write(PageWriter *writer, BlockNumber blknum,
+							  int32 compressed_size, CompressAlg alg,
+							  uint32 backup_version);
+static void page_writer_hole(PageWriter *writer, BlockNumber blknum);
+static void page_writer_reserve(PageWriter *writer, BlockNumber blknum);
+static void page_writer_truncate(PageWriter *writer, BlockNumber blknum);
+static void page_writer_flush(PageWriter *writer);
+static void page_writer_finish(PageWriter *writer);
+
+static size_t restore_data_file_internal(FILE *in, PageWriter *writer, pgFile *file,
+										 uint32 backup_version, const char *from_fullpath,
+										 int nblocks, datapagemap_t *map,
+										 PageState *checksum_map, int checksum_version,
+										 datapagemap_t *lsn_map, BackupPageHeader2 *headers,
+										 bool sparse);
+static size_t restore_data_file_resolved(ChainSource *sources, int n_sources,
+										 pgFile *dest_file, PageWriter *writer,
+										 PageState *checksum_map, XLogRecPtr shift_lsn,
+										 datapagemap_t *lsn_map, bool sparse);
+static pgFile *chain_member_file(pgBackup *backup, int backup_seq,
+								 pgFile *dest_file);
+static bool restored_page_is_compressed(DataPage *page, int32 compressed_size,
+										CompressAlg alg, uint32 backup_version);
+static void write_restored_page(FILE *out, const char *to_fullpath,
+								BlockNumber blknum, DataPage *page,
+								int32 compressed_size, CompressAlg alg,
+								uint32 backup_version, off_t *cur_pos_out);
 static bool get_page_header(FILE *in, const char *fullpath, BackupPageHeader *bph,
 							pg_crc32 *crc, bool use_crc32c);
+static int32 check_page_lsn(pgFile *file, XLogRecPtr prev_backup_start_lsn,
+							BlockNumber blknum, BackupMode backup_mode,
+							const char *from_fullpath, PageState *page_st);
 
 #ifdef HAVE_LIBZ
 /* Implementation of zlib compression method */
@@ -58,6 +244,82 @@ zlib_decompress(void *dst, size_t dst_size, void const *src, size_t src_size)
 }
 #endif
 
+#ifdef USE_ZSTD
+/* Implementation of zstd compression method */
+static int32
+zstd_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			  int level, const char **errormsg)
+{
+	size_t	rc = ZSTD_compress(dst, dst_size, src, src_size, level);
+
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+
+/* Implementation of zstd decompression method */
+static int32
+zstd_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
+				const char **errormsg)
+{
+	size_t	rc = ZSTD_decompress(dst, dst_size, src, src_size);
+
+	if (ZSTD_isError(rc))
+	{
+		if (errormsg)
+			*errormsg = ZSTD_getErrorName(rc);
+		return -1;
+	}
+	return rc;
+}
+#endif
+
+#ifdef USE_LZ4
+/*
+ * Implementation of lz4 compression method.
+ * Low levels use the fast compressor, higher levels switch to lz4hc.
+ */
+static int32
+lz4_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			 int level, const char **errormsg)
+{
+	int		rc;
+
+	if (level < LZ4HC_CLEVEL_MIN)
+		rc = LZ4_compress_default(src, dst, src_size, dst_size);
+	else
+		rc = LZ4_compress_HC(src, dst, src_size, dst_size, level);
+
+	if (rc <= 0)
+	{
+		if (errormsg)
+			*errormsg = "LZ4 compression failed";
+		return -1;
+	}
+	return rc;
+}
+
+/* Implementation of lz4 decompression method */
+static int32
+lz4_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
+			   const char **errormsg)
+{
+	int		rc = LZ4_decompress_safe(src, dst, src_size, dst_size);
+
+	if (rc < 0)
+	{
+		if (errormsg)
+			*errormsg = "LZ4 decompression failed, data is corrupted";
+		return -1;
+	}
+	return rc;
+}
+#endif
+
 /*
  * Compresses source into dest using algorithm. Returns the number of bytes
  * written in the destination buffer, or -1 if compression fails.
@@ -83,6 +345,18 @@ do_compress(void *dst, size_t dst_size, void const *src, size_t src_size,
 #endif
 		case PGLZ_COMPRESS:
 			return pglz_compress(src, src_size, dst, PGLZ_strategy_always);
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+			return zstd_compress(dst, dst_size, src, src_size, level, errormsg);
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+			return lz4_compress(dst, dst_size, src, src_size, level, errormsg);
+#endif
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support requested compression algorithm";
+			break;
 	}
 
 	return -1;
@@ -120,149 +394,651 @@ do_decompress(void *dst, size_t dst_size, void const *src, size_t src_size,
 #else
 			return pglz_decompress(src, src_size, dst, dst_size);
 #endif
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+			return zstd_decompress(dst, dst_size, src, src_size, errormsg);
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+			return lz4_decompress(dst, dst_size, src, src_size, errormsg);
+#endif
+		default:
+			if (errormsg)
+				*errormsg = "This build does not support requested compression algorithm";
+			break;
 	}
 
 	return -1;
 }
 
-#define ZLIB_MAGIC 0x78
-
 /*
- * Before version 2.0.23 there was a bug in pro_backup that pages which compressed
- * size is exactly the same as original size are not treated as compressed.
- * This check tries to detect and decompress such pages.
- * There is no 100% criteria to determine whether page is compressed or not.
- * But at least we will do this check only for pages which will no pass validation step.
+ * Check if this build can decompress data compressed with the algorithm.
+ * Backups are checked before their files are read, so that restore and
+ * merge do not fail halfway on algorithm, which is not built in.
  */
-static bool
-page_may_be_compressed(Page page, CompressAlg alg, uint32 backup_version)
+bool
+compress_alg_supported(CompressAlg alg)
 {
-	PageHeader	phdr;
-
-	phdr = (PageHeader) page;
-
-	/* First check if page header is valid (it seems to be fast enough check) */
-	if (!(PageGetPageSize(page) == BLCKSZ &&
-	//	  PageGetPageLayoutVersion(phdr) == PG_PAGE_LAYOUT_VERSION &&
-		  (phdr->pd_flags & ~PD_VALID_FLAG_BITS) == 0 &&
-		  phdr->pd_lower >= SizeOfPageHeaderData &&
-		  phdr->pd_lower <= phdr->pd_upper &&
-		  phdr->pd_upper <= phdr->pd_special &&
-		  phdr->pd_special <= BLCKSZ &&
-		  phdr->pd_special == MAXALIGN(phdr->pd_special)))
+	switch (alg)
 	{
-		/* ... end only if it is invalid, then do more checks */
-		if (backup_version >= 20023)
-		{
-			/* Versions 2.0.23 and higher don't have such bug */
-			return false;
-		}
+		case NONE_COMPRESS:
+		case NOT_DEFINED_COMPRESS:
+		case PGLZ_COMPRESS:
+			return true;
 #ifdef HAVE_LIBZ
-		/* For zlib we can check page magic:
-		 * https://stackoverflow.com/questions/9050260/what-does-a-zlib-header-look-like
-		 */
-		if (alg == ZLIB_COMPRESS && *(char *)page != ZLIB_MAGIC)
-		{
-			return false;
-		}
+		case ZLIB_COMPRESS:
+			return true;
 #endif
-		/* otherwise let's try to decompress the page */
-		return true;
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+			return true;
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+			return true;
+#endif
+		default:
+			return false;
 	}
-	return false;
 }
 
-/* Verify page's header */
-bool
-parse_page(Page page, XLogRecPtr *lsn)
+#ifdef USE_LZ4
+static void
+lz4_frame_prefs(LZ4F_preferences_t *prefs, size_t src_size, int level)
 {
-	PageHeader	phdr = (PageHeader) page;
-
-	/* Get lsn from page header */
-	*lsn = PageXLogRecPtrGet(phdr->pd_lsn);
+	memset(prefs, 0, sizeof(LZ4F_preferences_t));
+	prefs->frameInfo.contentSize = src_size;
+	prefs->compressionLevel = level;
+}
+#endif
 
-	if (PageGetPageSize(page) == BLCKSZ &&
-	//	PageGetPageLayoutVersion(phdr) == PG_PAGE_LAYOUT_VERSION &&
-		(phdr->pd_flags & ~PD_VALID_FLAG_BITS) == 0 &&
-		phdr->pd_lower >= SizeOfPageHeaderData &&
-		phdr->pd_lower <= phdr->pd_upper &&
-		phdr->pd_upper <= phdr->pd_special &&
-		phdr->pd_special <= BLCKSZ &&
-		phdr->pd_special == MAXALIGN(phdr->pd_special))
-		return true;
+/*
+ * Maximum size of a frame of zstd or lz4 format for the source of given
+ * size, or 0 if algorithm is not supported by this build.
+ */
+size_t
+compress_frame_bound(size_t src_size, CompressAlg alg)
+{
+	switch (alg)
+	{
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+			return ZSTD_compressBound(src_size);
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+		{
+			LZ4F_preferences_t prefs;
 
-	return false;
+			lz4_frame_prefs(&prefs, src_size, 0);
+			return LZ4F_compressFrameBound(src_size, &prefs);
+		}
+#endif
+		default:
+			return 0;
+	}
 }
 
-/* We know that header is invalid, store specific
- * details in errormsg.
+/*
+ * Streaming compressor of a single frame of the standard zstd or lz4
+ * format, so that the result can be handled by command line utilities
+ * as well. Used for WAL segments, which are compressed chunk by chunk,
+ * without loading the whole segment into memory.
  */
-void
-get_header_errormsg(Page page, char **errormsg)
+struct FrameCompressor
 {
-	PageHeader  phdr = (PageHeader) page;
-	*errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+	CompressAlg	alg;
+	char	   *buf;			/* compressed data of the last chunk */
+	size_t		buf_size;
+	size_t		pending;		/* bytes of lz4 frame header not returned yet */
+#ifdef USE_ZSTD
+	ZSTD_CCtx  *zstd_ctx;
+#endif
+#ifdef USE_LZ4
+	LZ4F_cctx  *lz4_ctx;
+	LZ4F_preferences_t lz4_prefs;
+#endif
+};
 
-	if (PageGetPageSize(page) != BLCKSZ)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"page size %lu is not equal to block size %u",
-				PageGetPageSize(page), BLCKSZ);
+/*
+ * Start a frame with the content of given size, which is then fed
+ * in chunks of at most chunk_size bytes.
+ * Returns NULL if compression cannot be started.
+ */
+FrameCompressor *
+frame_compressor_create(CompressAlg alg, int level, size_t content_size,
+						size_t chunk_size, const char **errormsg)
+{
+	FrameCompressor *fc = pgut_new0(FrameCompressor);
 
-	else if (phdr->pd_lower < SizeOfPageHeaderData)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_lower %i is less than page header size %lu",
-				phdr->pd_lower, SizeOfPageHeaderData);
+	fc->alg = alg;
 
-	else if (phdr->pd_lower > phdr->pd_upper)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_lower %u is greater than pd_upper %u",
-				phdr->pd_lower, phdr->pd_upper);
+	switch (alg)
+	{
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+		{
+			size_t	rc;
 
-	else if (phdr->pd_upper > phdr->pd_special)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_upper %u is greater than pd_special %u",
-				phdr->pd_upper, phdr->pd_special);
+			fc->zstd_ctx = ZSTD_createCCtx();
+			if (fc->zstd_ctx == NULL)
+			{
+				*errormsg = "Cannot create zstd compression context";
+				break;
+			}
 
-	else if (phdr->pd_special > BLCKSZ)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_special %u is greater than block size %u",
-				phdr->pd_special, BLCKSZ);
+			rc = ZSTD_CCtx_setParameter(fc->zstd_ctx, ZSTD_c_compressionLevel, level);
+			if (!ZSTD_isError(rc))
+				rc = ZSTD_CCtx_setPledgedSrcSize(fc->zstd_ctx, content_size);
+			if (ZSTD_isError(rc))
+			{
+				*errormsg = ZSTD_getErrorName(rc);
+				break;
+			}
 
-	else if (phdr->pd_special != MAXALIGN(phdr->pd_special))
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_special %i is misaligned, expected %lu",
-				phdr->pd_special, MAXALIGN(phdr->pd_special));
+			fc->buf_size = ZSTD_compressBound(chunk_size) + ZSTD_CStreamOutSize();
+			fc->buf = pgut_malloc(fc->buf_size);
+			return fc;
+		}
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+		{
+			size_t	rc;
 
-	else if (phdr->pd_flags & ~PD_VALID_FLAG_BITS)
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
-				"pd_flags mask contain illegal bits");
+			rc = LZ4F_createCompressionContext(&fc->lz4_ctx, LZ4F_VERSION);
+			if (LZ4F_isError(rc))
+			{
+				*errormsg = LZ4F_getErrorName(rc);
+				fc->lz4_ctx = NULL;
+				break;
+			}
 
-	else
-		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid");
+			lz4_frame_prefs(&fc->lz4_prefs, content_size, level);
+
+			/* room for the frame header, one chunk and the frame footer */
+			fc->buf_size = LZ4F_HEADER_SIZE_MAX +
+				LZ4F_compressBound(chunk_size, &fc->lz4_prefs);
+			fc->buf = pgut_malloc(fc->buf_size);
+
+			rc = LZ4F_compressBegin(fc->lz4_ctx, fc->buf, fc->buf_size,
+									&fc->lz4_prefs);
+			if (LZ4F_isError(rc))
+			{
+				*errormsg = LZ4F_getErrorName(rc);
+				break;
+			}
+			fc->pending = rc;
+			return fc;
+		}
+#endif
+		default:
+			*errormsg = "This build does not support requested compression algorithm";
+			break;
+	}
+
+	frame_compressor_free(fc);
+	return NULL;
 }
 
-/* We know that checksumms are mismatched, store specific
- * details in errormsg.
+/*
+ * Compress the next chunk of content, the last chunk completes the frame.
+ * The compressed data is returned in *dst, valid until the next call.
+ * Returns the size of compressed data, which may be zero if the data is
+ * still buffered by the compressor, or -1 if compression fails.
  */
-void
-get_checksum_errormsg(Page page, char **errormsg, BlockNumber absolute_blkno)
+int64
+frame_compressor_next(FrameCompressor *fc, void const *src, size_t src_size,
+					  bool last, char **dst, const char **errormsg)
 {
-	PageHeader	phdr = (PageHeader) page;
-	*errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+	*dst = fc->buf;
 
-	snprintf(*errormsg, ERRMSG_MAX_LEN,
-			 "page verification failed, "
-			 "calculated checksum %u but expected %u",
-			 phdr->pd_checksum,
-			 pg_checksum_page(page, absolute_blkno));
-}
+	switch (fc->alg)
+	{
+#ifdef USE_ZSTD
+		case ZSTD_COMPRESS:
+		{
+			ZSTD_inBuffer in = {src, src_size, 0};
+			ZSTD_outBuffer out = {fc->buf, fc->buf_size, 0};
+			ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+			size_t	remaining;
 
-/*
- * Retrieves a page taking the backup mode into account
- * and writes it into argument "page". Argument "page"
- * should be a pointer to allocated BLCKSZ of bytes.
- *
- * Prints appropriate warnings/errors/etc into log.
+			for (;;)
+			{
+				remaining = ZSTD_compressStream2(fc->zstd_ctx, &out, &in, mode);
+				if (ZSTD_isError(remaining))
+				{
+					*errormsg = ZSTD_getErrorName(remaining);
+					return -1;
+				}
+
+				if (last ? remaining == 0 : in.pos == in.size)
+					break;
+
+				/* output buffer is full, grow it */
+				if (out.pos == out.size)
+				{
+					fc->buf_size *= 2;
+					fc->buf = pgut_realloc(fc->buf, fc->buf_size);
+					out.dst = fc->buf;
+					out.size = fc->buf_size;
+				}
+			}
+
+			*dst = fc->buf;
+			return out.pos;
+		}
+#endif
+#ifdef USE_LZ4
+		case LZ4_COMPRESS:
+		{
+			size_t	len = fc->pending;
+			size_t	rc;
+
+			rc = LZ4F_compressUpdate(fc->lz4_ctx, fc->buf + len,
+									 fc->buf_size - len, src, src_size, NULL);
+			if (LZ4F_isError(rc))
+			{
+				*errormsg = LZ4F_getErrorName(rc);
+				return -1;
+			}
+			len += rc;
+
+			if (last)
+			{
+				rc = LZ4F_compressEnd(fc->lz4_ctx, fc->buf + len,
+									  fc->buf_size - len, NULL);
+				if (LZ4F_isError(rc))
+				{
+					*errormsg = LZ4F_getErrorName(rc);
+					return -1;
+				}
+				len += rc;
+			}
+
+			fc->pending = 0;
+			return len;
+		}
+#endif
+		default:
+			*errormsg = "This build does not support requested compression algorithm";
+			return -1;
+	}
+}
+
+void
+frame_compressor_free(FrameCompressor *fc)
+{
+	if (fc == NULL)
+		return;
+
+#ifdef USE_ZSTD
+	if (fc->zstd_ctx)
+		ZSTD_freeCCtx(fc->zstd_ctx);
+#endif
+#ifdef USE_LZ4
+	if (fc->lz4_ctx)
+		LZ4F_freeCompressionContext(fc->lz4_ctx);
+#endif
+	pg_free(fc->buf);
+	pg_free(fc);
+}
+
+#if defined(USE_ZSTD) || defined(USE_LZ4)
+/*
+ * Decompress zstd or lz4 frames into a buffer, which is grown if the size
+ * of content is not known in advance. Returns the size of decompressed
+ * content, or -1 in case of error.
+ */
+static int64
+decompress_frames(char **dst, size_t dst_size, char const *src, size_t src_size,
+				  CompressAlg alg, const char **errormsg)
+{
+	size_t		src_pos = 0;
+	size_t		dst_pos = 0;
+	size_t		rc = 0;
+#ifdef USE_ZSTD
+	ZSTD_DCtx  *zstd_ctx = NULL;
+#endif
+#ifdef USE_LZ4
+	LZ4F_dctx  *lz4_ctx = NULL;
+#endif
+
+#ifdef USE_ZSTD
+	if (alg == ZSTD_COMPRESS)
+	{
+		unsigned long long content_size = ZSTD_getFrameContentSize(src, src_size);
+
+		if (content_size != ZSTD_CONTENTSIZE_UNKNOWN &&
+			content_size != ZSTD_CONTENTSIZE_ERROR)
+			dst_size = content_size;
+
+		zstd_ctx = ZSTD_createDCtx();
+		if (zstd_ctx == NULL)
+		{
+			*errormsg = "Cannot create zstd decompression context";
+			return -1;
+		}
+	}
+#endif
+#ifdef USE_LZ4
+	if (alg == LZ4_COMPRESS)
+	{
+		LZ4F_frameInfo_t frame_info;
+
+		if (LZ4F_isError(LZ4F_createDecompressionContext(&lz4_ctx, LZ4F_VERSION)))
+		{
+			*errormsg = "Cannot create lz4 decompression context";
+			return -1;
+		}
+
+		/* consumes frame header, decompression continues right after it */
+		src_pos = src_size;
+		rc = LZ4F_getFrameInfo(lz4_ctx, &frame_info, src, &src_pos);
+		if (LZ4F_isError(rc))
+		{
+			*errormsg = LZ4F_getErrorName(rc);
+			LZ4F_freeDecompressionContext(lz4_ctx);
+			return -1;
+		}
+
+		if (frame_info.contentSize > 0)
+			dst_size = frame_info.contentSize;
+	}
+#endif
+
+	/* leave room to tell completely filled buffer from the end of content */
+	dst_size = Max(dst_size, BLCKSZ) + 1;
+	*dst = pgut_malloc(dst_size);
+
+	for (;;)
+	{
+		if (dst_pos == dst_size)
+		{
+			dst_size *= 2;
+			*dst = pgut_realloc(*dst, dst_size);
+		}
+
+#ifdef USE_ZSTD
+		if (alg == ZSTD_COMPRESS)
+		{
+			ZSTD_inBuffer in = {src, src_size, src_pos};
+			ZSTD_outBuffer out = {*dst, dst_size, dst_pos};
+
+			rc = ZSTD_decompressStream(zstd_ctx, &out, &in);
+			if (ZSTD_isError(rc))
+			{
+				*errormsg = ZSTD_getErrorName(rc);
+				break;
+			}
+			src_pos = in.pos;
+			dst_pos = out.pos;
+		}
+#endif
+#ifdef USE_LZ4
+		if (alg == LZ4_COMPRESS)
+		{
+			size_t		src_len = src_size - src_pos;
+			size_t		dst_len = dst_size - dst_pos;
+
+			rc = LZ4F_decompress(lz4_ctx, *dst + dst_pos, &dst_len,
+								 src + src_pos, &src_len, NULL);
+			if (LZ4F_isError(rc))
+			{
+				*errormsg = LZ4F_getErrorName(rc);
+				break;
+			}
+			src_pos += src_len;
+			dst_pos += dst_len;
+		}
+#endif
+
+		/* all frames are complete */
+		if (rc == 0 && src_pos == src_size)
+			break;
+
+		/* decompressor waits for more input, which is not going to come */
+		if (src_pos == src_size && dst_pos < dst_size)
+		{
+			*errormsg = "Compressed data is truncated";
+			break;
+		}
+	}
+
+#ifdef USE_ZSTD
+	if (zstd_ctx)
+		ZSTD_freeDCtx(zstd_ctx);
+#endif
+#ifdef USE_LZ4
+	if (lz4_ctx)
+		LZ4F_freeDecompressionContext(lz4_ctx);
+#endif
+
+	if (*errormsg)
+	{
+		pg_free(*dst);
+		*dst = NULL;
+		return -1;
+	}
+
+	return dst_pos;
+}
+#endif
+
+/*
+ * Read the whole file compressed by frame_compressor_next() and decompress it
+ * in memory. File may be located on remote host.
+ * Return codes:
+ *   SEND_OK       (0)
+ *   FILE_MISSING (-1)
+ *   OPEN_FAILED  (-2)
+ *   READ_FAILED  (-3)
+ *   ZLIB_ERROR   (-5) - decompression failed, errormsg is set
+ * On success, content is allocated by pgut_malloc() and must be freed by caller.
+ */
+int
+read_compressed_frame(const char *path, CompressAlg alg, fio_location location,
+					  char **content, size_t *size, const char **errormsg)
+{
+	int			fd;
+	struct stat st;
+	char	   *buf = NULL;
+	size_t		read_len = 0;
+	int			exit_code = SEND_OK;
+
+	*content = NULL;
+	*size = 0;
+	*errormsg = NULL;
+
+	fd = fio_open(path, O_RDONLY | PG_BINARY, location);
+	if (fd < 0)
+		return errno == ENOENT ? FILE_MISSING : OPEN_FAILED;
+
+	if (fio_fstat(fd, &st) < 0)
+	{
+		exit_code = OPEN_FAILED;
+		goto cleanup;
+	}
+
+	buf = pgut_malloc(st.st_size + 1);
+
+	while (read_len < st.st_size)
+	{
+		ssize_t		rc = fio_read(fd, buf + read_len,
+								  Min(st.st_size - read_len, OUT_BUF_SIZE));
+
+		if (rc <= 0)
+		{
+			exit_code = READ_FAILED;
+			goto cleanup;
+		}
+		read_len += rc;
+	}
+
+#if defined(USE_ZSTD) || defined(USE_LZ4)
+	/* algorithm is supported by this build */
+	if (compress_frame_bound(read_len, alg) > 0)
+	{
+		int64		rc = decompress_frames(content, read_len * 4, buf, read_len,
+										   alg, errormsg);
+
+		if (rc < 0)
+			exit_code = ZLIB_ERROR;
+		else
+			*size = rc;
+	}
+	else
+#endif
+	{
+		*errormsg = "This build does not support requested compression algorithm";
+		exit_code = ZLIB_ERROR;
+	}
+
+cleanup:
+	pg_free(buf);
+	fio_close(fd);
+
+	return exit_code;
+}
+
+#define ZLIB_MAGIC 0x78
+
+/*
+ * Before version 2.0.23 there was a bug in pro_backup that pages which compressed
+ * size is exactly the same as original size are not treated as compressed.
+ * This check tries to detect and decompress such pages.
+ * There is no 100% criteria to determine whether page is compressed or not.
+ * But at least we will do this check only for pages which will no pass validation step.
+ */
+static bool
+page_may_be_compressed(Page page, CompressAlg alg, uint32 backup_version)
+{
+	PageHeader	phdr;
+
+	phdr = (PageHeader) page;
+
+	/* First check if page header is valid (it seems to be fast enough check) */
+	if (!(PageGetPageSize(page) == BLCKSZ &&
+	//	  PageGetPageLayoutVersion(phdr) == PG_PAGE_LAYOUT_VERSION &&
+		  (phdr->pd_flags & ~PD_VALID_FLAG_BITS) == 0 &&
+		  phdr->pd_lower >= SizeOfPageHeaderData &&
+		  phdr->pd_lower <= phdr->pd_upper &&
+		  phdr->pd_upper <= phdr->pd_special &&
+		  phdr->pd_special <= BLCKSZ &&
+		  phdr->pd_special == MAXALIGN(phdr->pd_special)))
+	{
+		/* ... end only if it is invalid, then do more checks */
+		if (backup_version >= 20023)
+		{
+			/* Versions 2.0.23 and higher don't have such bug */
+			return false;
+		}
+#ifdef HAVE_LIBZ
+		/* For zlib we can check page magic:
+		 * https://stackoverflow.com/questions/9050260/what-does-a-zlib-header-look-like
+		 */
+		if (alg == ZLIB_COMPRESS && *(char *)page != ZLIB_MAGIC)
+		{
+			return false;
+		}
+#endif
+		/* otherwise let's try to decompress the page */
+		return true;
+	}
+	return false;
+}
+
+/* Verify page's header */
+bool
+parse_page(Page page, XLogRecPtr *lsn)
+{
+	PageHeader	phdr = (PageHeader) page;
+
+	/* Get lsn from page header */
+	*lsn = PageXLogRecPtrGet(phdr->pd_lsn);
+
+	if (PageGetPageSize(page) == BLCKSZ &&
+	//	PageGetPageLayoutVersion(phdr) == PG_PAGE_LAYOUT_VERSION &&
+		(phdr->pd_flags & ~PD_VALID_FLAG_BITS) == 0 &&
+		phdr->pd_lower >= SizeOfPageHeaderData &&
+		phdr->pd_lower <= phdr->pd_upper &&
+		phdr->pd_upper <= phdr->pd_special &&
+		phdr->pd_special <= BLCKSZ &&
+		phdr->pd_special == MAXALIGN(phdr->pd_special))
+		return true;
+
+	return false;
+}
+
+/* We know that header is invalid, store specific
+ * details in errormsg.
+ */
+void
+get_header_errormsg(Page page, char **errormsg)
+{
+	PageHeader  phdr = (PageHeader) page;
+	*errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+
+	if (PageGetPageSize(page) != BLCKSZ)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"page size %lu is not equal to block size %u",
+				PageGetPageSize(page), BLCKSZ);
+
+	else if (phdr->pd_lower < SizeOfPageHeaderData)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_lower %i is less than page header size %lu",
+				phdr->pd_lower, SizeOfPageHeaderData);
+
+	else if (phdr->pd_lower > phdr->pd_upper)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_lower %u is greater than pd_upper %u",
+				phdr->pd_lower, phdr->pd_upper);
+
+	else if (phdr->pd_upper > phdr->pd_special)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_upper %u is greater than pd_special %u",
+				phdr->pd_upper, phdr->pd_special);
+
+	else if (phdr->pd_special > BLCKSZ)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_special %u is greater than block size %u",
+				phdr->pd_special, BLCKSZ);
+
+	else if (phdr->pd_special != MAXALIGN(phdr->pd_special))
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_special %i is misaligned, expected %lu",
+				phdr->pd_special, MAXALIGN(phdr->pd_special));
+
+	else if (phdr->pd_flags & ~PD_VALID_FLAG_BITS)
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid, "
+				"pd_flags mask contain illegal bits");
+
+	else
+		snprintf(*errormsg, ERRMSG_MAX_LEN, "page header invalid");
+}
+
+/* We know that checksumms are mismatched, store specific
+ * details in errormsg.
+ */
+void
+get_checksum_errormsg(Page page, char **errormsg, BlockNumber absolute_blkno)
+{
+	PageHeader	phdr = (PageHeader) page;
+	*errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+
+	snprintf(*errormsg, ERRMSG_MAX_LEN,
+			 "page verification failed, "
+			 "calculated checksum %u but expected %u",
+			 phdr->pd_checksum,
+			 pg_checksum_page(page, absolute_blkno));
+}
+
+/*
+ * Retrieves a page taking the backup mode into account
+ * and writes it into argument "page". Argument "page"
+ * should be a pointer to allocated BLCKSZ of bytes.
+ *
+ * Prints appropriate warnings/errors/etc into log.
  * Returns:
  *                 PageIsOk(0) if page was successfully retrieved
  *         PageIsTruncated(-1) if the page was truncated
@@ -302,6 +1078,9 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 		/* read the block */
 		int read_len = fio_pread(in, page, blknum * BLCKSZ);
 
+		if (read_len > 0)
+			throttle_consume(read_len);
+
 		/* The block could have been truncated. It is fine. */
 		if (read_len == 0)
 		{
@@ -375,58 +1154,558 @@ prepare_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
 		if (!strict)
 			elevel = WARNING;
 
-		if (errormsg)
-			elog(elevel, "Corruption detected in file \"%s\", block %u: %s",
-							from_fullpath, blknum, errormsg);
-		else
-			elog(elevel, "Corruption detected in file \"%s\", block %u",
-							from_fullpath, blknum);
+		if (errormsg)
+			elog(elevel, "Corruption detected in file \"%s\", block %u: %s",
+							from_fullpath, blknum, errormsg);
+		else
+			elog(elevel, "Corruption detected in file \"%s\", block %u",
+							from_fullpath, blknum);
+
+		pg_free(errormsg);
+		return PageIsCorrupted;
+	}
+
+	/* Checkdb not going futher */
+	if (!strict)
+		return PageIsOk;
+
+	return check_page_lsn(file, prev_backup_start_lsn, blknum,
+						  backup_mode, from_fullpath, page_st);
+}
+
+/*
+ * Skip page if page lsn is less than START_LSN of parent backup.
+ * Nullified pages must be copied by DELTA backup, just to be safe.
+ */
+static int32
+check_page_lsn(pgFile *file, XLogRecPtr prev_backup_start_lsn,
+			   BlockNumber blknum, BackupMode backup_mode,
+			   const char *from_fullpath, PageState *page_st)
+{
+	if ((backup_mode == BACKUP_MODE_DIFF_DELTA || backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
+		file->exists_in_prev &&
+		page_st->lsn > 0 &&
+		page_st->lsn < prev_backup_start_lsn)
+	{
+		elog(VERBOSE, "Skipping blknum %u in file: \"%s\", file->exists_in_prev: %s, page_st->lsn: %X/%X, prev_backup_start_lsn: %X/%X",
+			blknum, from_fullpath,
+			file->exists_in_prev ? "true" : "false",
+			(uint32) (page_st->lsn >> 32), (uint32) page_st->lsn,
+			(uint32) (prev_backup_start_lsn >> 32), (uint32) prev_backup_start_lsn);
+		return SkipCurrentPage;
+	}
+
+	return PageIsOk;
+}
+
+/*
+ * Same as prepare_page(), but for a page, which was already read
+ * as a part of an extent by read_extent().
+ * Most of the time the page is valid, so only validate it in place.
+ * Torn or corrupted pages are re-read one by one by prepare_page(),
+ * which does all the retries.
+ */
+static int32
+prepare_extent_page(pgFile *file, XLogRecPtr prev_backup_start_lsn,
+					BlockNumber blknum, FILE *in,
+					BackupMode backup_mode, Page page,
+					uint32 checksum_version,
+					const char *from_fullpath,
+					PageState *page_st)
+{
+	BlockNumber absolute_blknum = file->segno * RELSEG_SIZE + blknum;
+
+	/* check for interrupt */
+	if (interrupted || thread_interrupted)
+		elog(ERROR, "Interrupted during page reading");
+
+	switch (validate_one_page(page, absolute_blknum,
+							  InvalidXLogRecPtr, page_st,
+							  checksum_version))
+	{
+		case PAGE_IS_ZEROED:
+			elog(VERBOSE, "File: \"%s\" blknum %u, empty page", from_fullpath, blknum);
+			return PageIsOk;
+
+		case PAGE_IS_VALID:
+			return check_page_lsn(file, prev_backup_start_lsn, blknum,
+								  backup_mode, from_fullpath, page_st);
+
+		default:
+			elog(VERBOSE, "File: \"%s\" blknum %u is not valid, read it again",
+					from_fullpath, blknum);
+			return prepare_page(file, prev_backup_start_lsn,
+								blknum, in, backup_mode, page,
+								true, checksum_version,
+								from_fullpath, page_st);
+	}
+}
+
+/*
+ * Read up to nblocks consecutive blocks, starting from blknum, into the
+ * extent buffer with as few pread() calls as possible.
+ * Returns the number of whole blocks read, which may be less than
+ * requested if the file was truncated or the last block is torn.
+ */
+static BlockNumber
+read_extent(ExtentReader *reader, char *extent, BlockNumber blknum,
+			BlockNumber nblocks)
+{
+	size_t	len = (size_t) nblocks * BLCKSZ;
+	size_t	read_len = 0;
+
+	while (read_len < len)
+	{
+		ssize_t rc = pread(reader->fd, extent + read_len, len - read_len,
+						   (off_t) blknum * BLCKSZ + read_len);
+
+		if (rc < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			elog(ERROR, "Cannot read blocks %u-%u of \"%s\": %s",
+				 blknum, blknum + nblocks - 1, reader->from_fullpath, strerror(errno));
+		}
+
+		/* end of file */
+		if (rc == 0)
+			break;
+
+		read_len += rc;
+
+		/*
+		 * Direct reads must stay aligned, torn last block
+		 * is left to prepare_page().
+		 */
+		if (reader->direct && read_len % BLCKSZ != 0)
+			break;
+	}
+
+	if (reader->drop_cache && read_len > 0)
+		fio_drop_cache(reader->fd, (off_t) blknum * BLCKSZ, read_len);
+
+	return read_len / BLCKSZ;
+}
+
+#ifdef HAVE_LIBURING
+/* Queue the read of the next portion of blocks */
+static void
+async_read_submit(ExtentReader *reader, AsyncRead *ar)
+{
+	struct io_uring_sqe *sqe = io_uring_get_sqe(reader->ring);
+
+	/* there are never more than io_queue_depth reads in the ring */
+	Assert(sqe != NULL);
+
+	ar->blknum = reader->next_blknum;
+	ar->nblocks = Min(ASYNC_READ_BLOCKS, reader->n_blocks - ar->blknum);
+	ar->result = 0;
+	ar->in_flight = true;
+
+	io_uring_prep_read(sqe, reader->fd, ar->buf,
+					   ar->nblocks * BLCKSZ, (off_t) ar->blknum * BLCKSZ);
+	io_uring_sqe_set_data(sqe, ar);
+
+	reader->next_blknum += ar->nblocks;
+	reader->n_queued++;
+}
+
+/* Keep the queue full, until all the blocks of the file are requested */
+static void
+async_read_fill(ExtentReader *reader)
+{
+	int		n_submitted = 0;
+	int		rc;
+
+	while (reader->n_queued < io_queue_depth &&
+		   reader->next_blknum < reader->n_blocks)
+	{
+		int		i = (reader->head + reader->n_queued) % io_queue_depth;
+
+		async_read_submit(reader, &reader->reads[i]);
+		n_submitted++;
+	}
+
+	if (n_submitted == 0)
+		return;
+
+	rc = io_uring_submit(reader->ring);
+	if (rc < 0)
+		elog(ERROR, "Cannot submit reads of \"%s\": %s",
+			 reader->from_fullpath, strerror(-rc));
+}
+
+/*
+ * Wait for the given read to complete. Completions may arrive in any
+ * order, so reap them all as they come.
+ */
+static void
+async_read_wait(ExtentReader *reader, AsyncRead *ar)
+{
+	while (ar->in_flight)
+	{
+		struct io_uring_cqe *cqe;
+		AsyncRead  *done;
+		int			rc = io_uring_wait_cqe(reader->ring, &cqe);
+
+		if (rc == -EINTR)
+			continue;
+		if (rc < 0)
+			elog(ERROR, "Cannot wait for reads of \"%s\": %s",
+				 reader->from_fullpath, strerror(-rc));
+
+		done = (AsyncRead *) io_uring_cqe_get_data(cqe);
+		done->result = cqe->res;
+		done->in_flight = false;
+		io_uring_cqe_seen(reader->ring, cqe);
+	}
+}
+
+/* Wait for all queued reads and forget about them */
+static void
+async_read_drain(ExtentReader *reader)
+{
+	int		i;
+
+	for (i = 0; i < reader->n_queued; i++)
+		async_read_wait(reader, &reader->reads[(reader->head + i) % io_queue_depth]);
+
+	reader->n_queued = 0;
+	reader->head_consumed = false;
+}
+#endif
+
+/* Allocate buffer suitable for reads with O_DIRECT, free it with pg_free() */
+static void *
+malloc_io_aligned(size_t size)
+{
+#ifndef WIN32
+	void	   *ptr;
+	int			rc = posix_memalign(&ptr, DIRECT_IO_ALIGN, size);
+
+	if (rc != 0)
+		elog(ERROR, "could not allocate memory (%lu bytes): %s",
+			 (unsigned long) size, strerror(rc));
+	return ptr;
+#else
+	return pgut_malloc(size);
+#endif
+}
+
+#ifdef HAVE_LIBURING
+/* Destructor of ring_key, called on exit of the thread owning a ring */
+static void
+async_read_ring_release(void *ring)
+{
+	async_read_ring_free();
+}
+
+static void
+ring_key_create(void)
+{
+	ring_key_created = (pthread_key_create(&ring_key, async_read_ring_release) == 0);
+}
+
+/*
+ * Create io_uring ring of the calling thread, if it is not created yet.
+ * Returns false if io_uring is not supported.
+ */
+static bool
+async_read_ring_init(void)
+{
+	int		rc;
+	int		i;
+
+	if (thread_ring)
+		return true;
+
+	if (uring_unavailable)
+		return false;
+
+	/* without the key the ring would leak, if the thread exits on error */
+	pthread_once(&ring_key_once, ring_key_create);
+	if (!ring_key_created)
+	{
+		uring_unavailable = true;
+		elog(WARNING, "Cannot create thread key for io_uring, falling back to synchronous reads");
+		return false;
+	}
+
+	thread_ring = (struct io_uring *) pgut_malloc0(sizeof(struct io_uring));
+	rc = io_uring_queue_init(io_queue_depth, thread_ring, 0);
+	if (rc != 0)
+	{
+		pg_free(thread_ring);
+		thread_ring = NULL;
+
+		/* Not worth retrying for every file */
+		uring_unavailable = true;
+		elog(WARNING, "Cannot initialize io_uring, falling back to synchronous reads: %s",
+			 strerror(-rc));
+		return false;
+	}
+
+	thread_reads = (AsyncRead *) pgut_malloc0(io_queue_depth * sizeof(AsyncRead));
+	for (i = 0; i < io_queue_depth; i++)
+		thread_reads[i].buf = malloc_io_aligned(ASYNC_READ_BLOCKS * BLCKSZ);
+
+	pthread_setspecific(ring_key, thread_ring);
+
+	return true;
+}
+#endif
+
+/* Release io_uring ring of the calling thread */
+void
+async_read_ring_free(void)
+{
+#ifdef HAVE_LIBURING
+	int		i;
+
+	if (!thread_ring)
+		return;
+
+	io_uring_queue_exit(thread_ring);
+	for (i = 0; i < io_queue_depth; i++)
+		pg_free(thread_reads[i].buf);
+	pg_free(thread_reads);
+	pg_free(thread_ring);
+	thread_reads = NULL;
+	thread_ring = NULL;
+
+	/* the destructor has nothing to release anymore */
+	pthread_setspecific(ring_key, NULL);
+#endif
+}
+
+/*
+ * Prepare to read the file up to n_blocks. Reading ahead makes sense
+ * only when the whole file is read sequentially.
+ */
+static void
+extent_reader_init(ExtentReader *reader, FILE *in, BlockNumber n_blocks,
+				   const char *from_fullpath, bool read_ahead)
+{
+	memset(reader, 0, sizeof(ExtentReader));
+	reader->in = in;
+	reader->n_blocks = n_blocks;
+	reader->from_fullpath = from_fullpath;
+	reader->fd = fileno(in);
+
+	if (direct_io)
+	{
+		int		fd = fio_open_direct(from_fullpath);
+
+		if (fd >= 0)
+		{
+			reader->fd = fd;
+			reader->direct = true;
+		}
+		else
+		{
+			elog(VERBOSE, "Cannot open file \"%s\" for direct reads, "
+				 "it is dropped from page cache instead: %s",
+				 from_fullpath, strerror(errno));
+			reader->drop_cache = true;
+		}
+	}
+
+#ifdef HAVE_LIBURING
+	/* files, that fit into one extent, gain nothing from reading ahead */
+	if (read_ahead && io_queue_depth > 0 &&
+		n_blocks > BACKUP_EXTENT_BLOCKS && async_read_ring_init())
+	{
+		reader->use_uring = true;
+		reader->ring = thread_ring;
+		reader->reads = thread_reads;
+		return;
+	}
+#endif
+
+	reader->buf = malloc_io_aligned(BACKUP_EXTENT_SIZE);
+}
+
+/*
+ * Get the extent of consecutive blocks, starting from blknum.
+ * Returns the number of whole blocks available in *extent, which may
+ * be zero if the file was truncated. The extent stays valid until the
+ * next call.
+ */
+static BlockNumber
+extent_reader_next(ExtentReader *reader, BlockNumber blknum, char **extent)
+{
+	BlockNumber	n_read;
+
+#ifdef HAVE_LIBURING
+	if (reader->use_uring)
+	{
+		AsyncRead  *ar;
+
+		/* previous extent is consumed by now, its slot can be reused */
+		if (reader->head_consumed)
+		{
+			reader->head = (reader->head + 1) % io_queue_depth;
+			reader->n_queued--;
+			reader->head_consumed = false;
+		}
+
+		/*
+		 * Caller got off the sequential path because of a short read,
+		 * start reading ahead from the requested block again.
+		 */
+		if (reader->n_queued == 0 || reader->reads[reader->head].blknum != blknum)
+		{
+			async_read_drain(reader);
+			reader->next_blknum = blknum;
+		}
+
+		async_read_fill(reader);
+
+		ar = &reader->reads[reader->head];
+		async_read_wait(reader, ar);
+		reader->head_consumed = true;
+
+		if (ar->result < 0)
+			elog(ERROR, "Cannot read blocks %u-%u of \"%s\": %s",
+				 ar->blknum, ar->blknum + ar->nblocks - 1,
+				 reader->from_fullpath, strerror(-ar->result));
+
+		if (reader->drop_cache && ar->result > 0)
+			fio_drop_cache(reader->fd, (off_t) ar->blknum * BLCKSZ, ar->result);
+
+		throttle_consume(ar->result);
+
+		*extent = ar->buf;
+		return ar->result / BLCKSZ;
+	}
+#endif
+
+	*extent = reader->buf;
+	n_read = read_extent(reader, reader->buf, blknum,
+						 Min(BACKUP_EXTENT_BLOCKS, reader->n_blocks - blknum));
+	throttle_consume((size_t) n_read * BLCKSZ);
+
+	return n_read;
+}
+
+/*
+ * Read the range of changed blocks, given by pagemap_next_range(), with
+ * a single read. The reader must be initialized without reading ahead.
+ */
+static BlockNumber
+extent_reader_range(ExtentReader *reader, BlockNumber blknum,
+					BlockNumber nblocks, char **extent)
+{
+	BlockNumber	n_read;
+
+	Assert(nblocks <= BACKUP_EXTENT_BLOCKS);
+
+	*extent = reader->buf;
+	n_read = read_extent(reader, reader->buf, blknum, nblocks);
+	throttle_consume((size_t) n_read * BLCKSZ);
+
+	return n_read;
+}
+
+/*
+ * Get the next range of changed blocks of pagemap within
+ * [start_blknum, end_blknum). The range begins with a changed block,
+ * but unchanged blocks in the middle of it are read as well.
+ */
+static bool
+pagemap_next_range(datapagemap_t *pagemap, datapagemap_iterator_t *iter,
+				   BlockNumber start_blknum, BlockNumber end_blknum,
+				   BlockNumber *range_start, BlockNumber *range_nblocks)
+{
+	for (;;)
+	{
+		if (!datapagemap_next_range(iter, PAGEMAP_GAP_BLOCKS,
+									BACKUP_EXTENT_BLOCKS,
+									range_start, range_nblocks))
+			return false;
+
+		if (*range_start >= end_blknum)
+			return false;
 
-		pg_free(errormsg);
-		return PageIsCorrupted;
+		if (*range_start + *range_nblocks > start_blknum)
+			break;
 	}
 
-	/* Checkdb not going futher */
-	if (!strict)
-		return PageIsOk;
-
-	/*
-	 * Skip page if page lsn is less than START_LSN of parent backup.
-	 * Nullified pages must be copied by DELTA backup, just to be safe.
-	 */
-	if ((backup_mode == BACKUP_MODE_DIFF_DELTA || backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
-		file->exists_in_prev &&
-		page_st->lsn > 0 &&
-		page_st->lsn < prev_backup_start_lsn)
+	/* the range ends with a changed block, so there is one past start_blknum */
+	while (*range_start < start_blknum ||
+		   !datapagemap_is_set(pagemap, *range_start))
 	{
-		elog(VERBOSE, "Skipping blknum %u in file: \"%s\", file->exists_in_prev: %s, page_st->lsn: %X/%X, prev_backup_start_lsn: %X/%X",
-			blknum, from_fullpath,
-			file->exists_in_prev ? "true" : "false",
-			(uint32) (page_st->lsn >> 32), (uint32) page_st->lsn,
-			(uint32) (prev_backup_start_lsn >> 32), (uint32) prev_backup_start_lsn);
-		return SkipCurrentPage;
+		(*range_start)++;
+		(*range_nblocks)--;
 	}
 
-	return PageIsOk;
+	*range_nblocks = Min(*range_nblocks, end_blknum - *range_start);
+
+	return true;
+}
+
+static void
+extent_reader_free(ExtentReader *reader)
+{
+#ifdef HAVE_LIBURING
+	/* kernel may still be writing into the buffers, the ring is kept */
+	if (reader->use_uring)
+		async_read_drain(reader);
+#endif
+	pg_free(reader->buf);
+
+	if (reader->direct)
+		close(reader->fd);
+}
+
+/*
+ * Check if every byte of the page is zero.
+ * The page may be unaligned, so it is compared bytewise: if the first
+ * byte is zero and every byte equals the next one, all of them are zero.
+ * For a valid page memcmp() stops in the page header.
+ */
+static bool
+page_is_zeroed(const char *page)
+{
+	return page[0] == 0 && memcmp(page, page + 1, BLCKSZ - 1) == 0;
 }
 
-/* split this function in two: compress() and backup() */
+/*
+ * Compress the page and put it, prefixed with BackupPageHeader, into dst,
+ * which must have room for at least MAX_PAGE_ENTRY_SIZE bytes.
+ * Zeroed page is stored as a header with PageIsZeroed in it.
+ * Returns the size of page data stored after the header.
+ */
 static int
 compress_and_backup_page(pgFile *file, BlockNumber blknum,
-						FILE *in, FILE *out, pg_crc32 *crc,
-						int page_state, Page page,
+						char *dst, pg_crc32 *crc, Page page,
 						CompressAlg calg, int clevel,
-						const char *from_fullpath, const char *to_fullpath)
+						const char *from_fullpath)
 {
 	int         compressed_size = 0;
 	size_t		write_buffer_size = 0;
-	char		write_buffer[BLCKSZ*2]; /* compressed page may require more space than uncompressed */
-	BackupPageHeader* bph = (BackupPageHeader*)write_buffer;
+	BackupPageHeader bph;
 	const char *errormsg = NULL;
 
+	file->compress_alg = calg; /* TODO: wtf? why here? */
+
+	if (page_is_zeroed(page))
+	{
+		bph.block = blknum;
+		bph.compressed_size = PageIsZeroed;
+		memcpy(dst, &bph, sizeof(BackupPageHeader));
+
+		COMP_FILE_CRC32(true, *crc, dst, sizeof(BackupPageHeader));
+
+		file->write_size += sizeof(BackupPageHeader);
+		file->uncompressed_size += BLCKSZ;
+
+		return 0;
+	}
+
 	/* Compress the page */
-	compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
-								  sizeof(write_buffer) - sizeof(BackupPageHeader),
+	compressed_size = do_compress(dst + sizeof(BackupPageHeader),
+								  MAX_PAGE_ENTRY_SIZE - sizeof(BackupPageHeader),
 								  page, BLCKSZ, calg, clevel,
 								  &errormsg);
 	/* Something went wrong and errormsg was assigned, throw a warning */
@@ -434,26 +1713,21 @@ compress_and_backup_page(pgFile *file, BlockNumber blknum,
 		elog(WARNING, "An error occured during compressing block %u of file \"%s\": %s",
 			 blknum, from_fullpath, errormsg);
 
-	file->compress_alg = calg; /* TODO: wtf? why here? */
-
 	/* compression didn`t worked */
 	if (compressed_size <= 0 || compressed_size >= BLCKSZ)
 	{
 		/* Do not compress page */
-		memcpy(write_buffer + sizeof(BackupPageHeader), page, BLCKSZ);
+		memcpy(dst + sizeof(BackupPageHeader), page, BLCKSZ);
 		compressed_size = BLCKSZ;
 	}
-	bph->block = blknum;
-	bph->compressed_size = compressed_size;
+	/* dst is not necessarily aligned, so copy the header in */
+	bph.block = blknum;
+	bph.compressed_size = compressed_size;
+	memcpy(dst, &bph, sizeof(BackupPageHeader));
 	write_buffer_size = compressed_size + sizeof(BackupPageHeader);
 
 	/* Update CRC */
-	COMP_FILE_CRC32(true, *crc, write_buffer, write_buffer_size);
-
-	/* write data page */
-	if (fio_fwrite(out, write_buffer, write_buffer_size) != write_buffer_size)
-		elog(ERROR, "File: \"%s\", cannot write at block %u: %s",
-			 to_fullpath, blknum, strerror(errno));
+	COMP_FILE_CRC32(true, *crc, dst, write_buffer_size);
 
 	file->write_size += write_buffer_size;
 	file->uncompressed_size += BLCKSZ;
@@ -493,7 +1767,7 @@ backup_data_file(pgFile *file, const char *from_fullpath, const char *to_fullpat
 	bool        use_pagemap;
 	char	   *errmsg = NULL;
 	BlockNumber err_blknum = 0;
-	/* page headers */
+	/* page headers, kept in the per-thread arena */
 	BackupPageHeader2 *headers = NULL;
 
 	/* sanity */
@@ -569,7 +1843,7 @@ backup_data_file(pgFile *file, const char *from_fullpath, const char *to_fullpat
 						(backup_mode == BACKUP_MODE_DIFF_DELTA || backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
 						file->exists_in_prev ? prev_backup_start_lsn : InvalidXLogRecPtr,
 						calg, clevel, checksum_version, use_pagemap,
-						&headers, backup_mode);
+						&headers, backup_mode, 0, file->n_blocks);
 	}
 
 	/* check for errors */
@@ -635,7 +1909,369 @@ cleanup:
 
 	pg_free(errmsg);
 	pg_free(file->pagemap.bitmap);
-	pg_free(headers);
+}
+
+#define GF2_DIM 32		/* dimension of GF(2) vectors (length of CRC) */
+
+static uint32
+gf2_matrix_times(const uint32 *mat, uint32 vec)
+{
+	uint32		sum = 0;
+
+	while (vec)
+	{
+		if (vec & 1)
+			sum ^= *mat;
+		vec >>= 1;
+		mat++;
+	}
+	return sum;
+}
+
+static void
+gf2_matrix_square(uint32 *square, const uint32 *mat)
+{
+	int			n;
+
+	for (n = 0; n < GF2_DIM; n++)
+		square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/*
+ * Compute CRC-32C of concatenation of two chunks of data, given CRC-32C
+ * of each chunk and length of the second one.
+ * The same algorithm as crc32_combine() in zlib, but for CRC-32C polynomial.
+ */
+static pg_crc32
+crc32c_combine(pg_crc32 crc1, pg_crc32 crc2, size_t len2)
+{
+	int			n;
+	uint32		row;
+	uint32		even[GF2_DIM];	/* even-power-of-two zeros operator */
+	uint32		odd[GF2_DIM];	/* odd-power-of-two zeros operator */
+
+	if (len2 == 0)
+		return crc1;
+
+	/* put operator for one zero bit in odd */
+	odd[0] = 0x82F63B78;		/* reversed CRC-32C polynomial */
+	row = 1;
+	for (n = 1; n < GF2_DIM; n++)
+	{
+		odd[n] = row;
+		row <<= 1;
+	}
+
+	/* put operator for two zero bits in even */
+	gf2_matrix_square(even, odd);
+
+	/* put operator for four zero bits in odd */
+	gf2_matrix_square(odd, even);
+
+	/* apply len2 zeros to crc1 (first square will put the operator for one
+	 * zero byte, eight zero bits, in even) */
+	do
+	{
+		/* apply zeros operator for this bit of len2 */
+		gf2_matrix_square(even, odd);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(even, crc1);
+		len2 >>= 1;
+
+		if (len2 == 0)
+			break;
+
+		/* another iteration of the loop with odd and even swapped */
+		gf2_matrix_square(odd, even);
+		if (len2 & 1)
+			crc1 = gf2_matrix_times(odd, crc1);
+		len2 >>= 1;
+	} while (len2 != 0);
+
+	return crc1 ^ crc2;
+}
+
+/* Get path of the part file, where the range of the data file is backed up */
+static void
+get_range_part_path(char *part_fullpath, const char *to_fullpath, int range_num)
+{
+	/* the first range is written directly into the backup file */
+	if (range_num == 0)
+		strncpy(part_fullpath, to_fullpath, MAXPGPATH);
+	else
+		snprintf(part_fullpath, MAXPGPATH, "%s.part%d", to_fullpath, range_num);
+}
+
+/*
+ * Remove the part file of the range, left behind by a backup,
+ * which failed before the ranges of the file were assembled.
+ * Used on cleanup, so failures are only reported.
+ */
+void
+remove_range_part(pgFileRange *range, const char *to_root)
+{
+	char		to_fullpath[MAXPGPATH];
+	char		part_fullpath[MAXPGPATH];
+
+	/* the first range is the backup file itself */
+	if (range->range_num == 0)
+		return;
+
+	join_path_components(to_fullpath, to_root, range->file->rel_path);
+	get_range_part_path(part_fullpath, to_fullpath, range->range_num);
+
+	if (remove(part_fullpath) != 0 && errno != ENOENT)
+		elog(WARNING, "Cannot remove file \"%s\": %s",
+			 part_fullpath, strerror(errno));
+}
+
+/* Append the part file to the backup file and remove it */
+static void
+append_range_part(FILE *out, const char *to_fullpath,
+				  const char *part_fullpath, char *buf)
+{
+	FILE	   *in;
+	size_t		read_len;
+
+	in = fopen(part_fullpath, PG_BINARY_R);
+	if (in == NULL)
+		elog(ERROR, "Cannot open file \"%s\": %s",
+			 part_fullpath, strerror(errno));
+
+	while ((read_len = fread(buf, 1, BACKUP_EXTENT_SIZE, in)) > 0)
+	{
+		if (fwrite(buf, 1, read_len, out) != read_len)
+			elog(ERROR, "Cannot write to file \"%s\": %s",
+				 to_fullpath, strerror(errno));
+	}
+
+	if (ferror(in))
+		elog(ERROR, "Cannot read file \"%s\": %s",
+			 part_fullpath, strerror(errno));
+
+	fclose(in);
+
+	if (remove(part_fullpath) != 0)
+		elog(ERROR, "Cannot remove file \"%s\": %s",
+			 part_fullpath, strerror(errno));
+}
+
+/*
+ * Assemble the backup file from the ranges of the data file: append part
+ * files to the backup file, written by the first range, compute sizes
+ * and CRC of the whole file and write headers of all ranges into the header
+ * map as one array.
+ */
+static void
+stitch_data_file_ranges(pgFile *file, const char *from_fullpath,
+						const char *to_fullpath, BackupMode backup_mode,
+						HeaderMap *hdr_map)
+{
+	char		part_fullpath[MAXPGPATH];
+	BackupPageHeader2 *headers = NULL;
+	FILE	   *out = NULL;
+	char	   *buf = NULL;
+	int			n_headers = 0;
+	int			i;
+
+	/* reset size summary */
+	file->read_size = 0;
+	file->write_size = 0;
+	file->uncompressed_size = 0;
+	file->n_headers = 0;
+	/* start with CRC of empty file */
+	INIT_FILE_CRC32(true, file->crc);
+	FIN_FILE_CRC32(true, file->crc);
+
+	for (i = 0; i < file->n_ranges; i++)
+	{
+		if (file->ranges[i].n_blocks_read == FILE_MISSING)
+			break;
+		n_headers += file->ranges[i].part.n_headers;
+	}
+
+	/*
+	 * File was removed by concurrent postgres transaction,
+	 * throw away whatever other ranges managed to copy.
+	 */
+	if (i < file->n_ranges)
+	{
+		elog(LOG, "File not found: \"%s\"", from_fullpath);
+		file->write_size = FILE_NOT_FOUND;
+
+		for (i = 0; i < file->n_ranges; i++)
+		{
+			get_range_part_path(part_fullpath, to_fullpath, i);
+			if (remove(part_fullpath) != 0 && errno != ENOENT)
+				elog(ERROR, "Cannot remove file \"%s\": %s",
+					 part_fullpath, strerror(errno));
+		}
+		goto cleanup;
+	}
+
+	if (n_headers > 0)
+		headers = header_arena_reserve(n_headers + 1);
+
+	/* refresh n_blocks for FULL and DELTA */
+	if (backup_mode == BACKUP_MODE_FULL ||
+		backup_mode == BACKUP_MODE_DIFF_DELTA)
+		file->n_blocks = 0;
+
+	for (i = 0; i < file->n_ranges; i++)
+	{
+		pgFileRange *range = &file->ranges[i];
+		int			j;
+
+		file->read_size += range->n_blocks_read * BLCKSZ;
+
+		if ((backup_mode == BACKUP_MODE_FULL ||
+			 backup_mode == BACKUP_MODE_DIFF_DELTA) &&
+			range->n_blocks_read > 0)
+			file->n_blocks = range->start_blknum + range->n_blocks_read;
+
+		if (range->part.write_size == 0)
+			continue;
+
+		/* the first range is already in place */
+		if (i > 0)
+		{
+			if (!out)
+			{
+				out = fopen(to_fullpath, PG_BINARY_A);
+				if (out == NULL)
+					elog(ERROR, "Cannot open backup file \"%s\": %s",
+						 to_fullpath, strerror(errno));
+
+				/* update file permission */
+				if (chmod(to_fullpath, FILE_PERMISSION) == -1)
+					elog(ERROR, "Cannot change mode of \"%s\": %s", to_fullpath,
+						 strerror(errno));
+
+				buf = pgut_malloc(BACKUP_EXTENT_SIZE);
+			}
+
+			get_range_part_path(part_fullpath, to_fullpath, i);
+			append_range_part(out, to_fullpath, part_fullpath, buf);
+		}
+
+		/* positions of pages are shifted by the size of preceding ranges */
+		for (j = 0; j < range->part.n_headers; j++)
+		{
+			headers[file->n_headers + j] = range->headers[j];
+			headers[file->n_headers + j].pos += file->write_size;
+		}
+
+		file->crc = crc32c_combine(file->crc, range->part.crc,
+								   range->part.write_size);
+		file->compress_alg = range->part.compress_alg;
+		file->n_headers += range->part.n_headers;
+		file->write_size += range->part.write_size;
+		file->uncompressed_size += range->part.uncompressed_size;
+	}
+
+	if (out && fclose(out))
+		elog(ERROR, "Cannot close the backup file \"%s\": %s",
+			 to_fullpath, strerror(errno));
+
+	/* dummy header, marking the end of the last page */
+	if (file->n_headers > 0)
+	{
+		MemSet(&headers[file->n_headers], 0, sizeof(BackupPageHeader2));
+		headers[file->n_headers].pos = file->write_size;
+	}
+
+	/* Determine that file didn`t changed in case of incremental backup */
+	if (backup_mode != BACKUP_MODE_FULL &&
+		file->exists_in_prev &&
+		file->write_size == 0 &&
+		file->n_blocks > 0)
+	{
+		file->write_size = BYTES_INVALID;
+	}
+
+	/* dump page headers */
+	write_page_headers(headers, file, hdr_map, false);
+
+cleanup:
+	for (i = 0; i < file->n_ranges; i++)
+	{
+		pg_free(file->ranges[i].headers);
+		file->ranges[i].headers = NULL;
+	}
+
+	pg_free(buf);
+	pg_free(file->pagemap.bitmap);
+}
+
+/*
+ * Backup the range of blocks of a large data file.
+ * Ranges of the same file are backed up by several threads at once,
+ * see pgFileRange. Returns true, if the calling thread has completed
+ * the last range of the file and assembled the backup file.
+ */
+bool
+backup_data_file_range(pgFileRange *range, const char *from_fullpath,
+					   const char *to_fullpath, XLogRecPtr prev_backup_start_lsn,
+					   BackupMode backup_mode, CompressAlg calg, int clevel,
+					   uint32 checksum_version, HeaderMap *hdr_map)
+{
+	pgFile	   *file = range->file;
+	pgFile	   *part = &range->part;
+	char		part_fullpath[MAXPGPATH];
+	bool		use_pagemap;
+
+	get_range_part_path(part_fullpath, to_fullpath, range->range_num);
+
+	/*
+	 * Part file is not created, if the range has no pages to back up,
+	 * so make sure there is no stale one to be left over.
+	 */
+	if (range->range_num > 0 &&
+		remove(part_fullpath) != 0 && errno != ENOENT)
+		elog(ERROR, "Cannot remove file \"%s\": %s",
+			 part_fullpath, strerror(errno));
+
+	/* reset size summary */
+	part->read_size = 0;
+	part->write_size = 0;
+	part->uncompressed_size = 0;
+	part->n_headers = 0;
+	INIT_FILE_CRC32(true, part->crc);
+
+	if (file->pagemap.bitmapsize == PageBitmapIsEmpty ||
+		 file->pagemap_isabsent || !file->exists_in_prev ||
+		 !file->pagemap.bitmap)
+		use_pagemap = false;
+	else
+		use_pagemap = true;
+
+	range->n_blocks_read = send_pages(part_fullpath, from_fullpath, part,
+						/* send prev backup START_LSN */
+						(backup_mode == BACKUP_MODE_DIFF_DELTA || backup_mode == BACKUP_MODE_DIFF_PTRACK) &&
+						file->exists_in_prev ? prev_backup_start_lsn : InvalidXLogRecPtr,
+						calg, clevel, checksum_version, use_pagemap,
+						&range->headers, backup_mode,
+						range->start_blknum, range->end_blknum);
+
+	/* finish CRC calculation */
+	FIN_FILE_CRC32(true, part->crc);
+
+	/* headers are in the per-thread arena, keep them until stitching */
+	if (part->n_headers > 0)
+	{
+		size_t		len = (part->n_headers + 1) * sizeof(BackupPageHeader2);
+		BackupPageHeader2 *headers = range->headers;
+
+		range->headers = pgut_malloc(len);
+		memcpy(range->headers, headers, len);
+	}
+
+	/* the thread, completing the last range, is responsible for the file */
+	if (pg_atomic_add_fetch_u32(&file->n_ranges_done, 1) < (uint32) file->n_ranges)
+		return false;
+
+	stitch_data_file_ranges(file, from_fullpath, to_fullpath, backup_mode, hdr_map);
+	return true;
 }
 
 /*
@@ -825,19 +2461,53 @@ backup_non_data_file(pgFile *file, pgFile *prev_file,
 								  to_fullpath, file, missing_ok);
 }
 
+/*
+ * Find the copy of the destination file in the member 'backup_seq' of
+ * the parent chain. Restore does not load file lists of parent backups,
+ * their copies of the file are attached to it instead, see restore_chain().
+ */
+static pgFile *
+chain_member_file(pgBackup *backup, int backup_seq, pgFile *dest_file)
+{
+	pgFile	  **res_file;
+	pgFileCopy *copy;
+
+	if (backup->files)
+	{
+		res_file = parray_bsearch(backup->files, dest_file, pgFileCompareRelPathWithExternal);
+		return res_file ? *res_file : NULL;
+	}
+
+	for (copy = dest_file->chain_copies; copy; copy = copy->next)
+	{
+		if (copy->backup_seq == backup_seq)
+			return copy->file;
+	}
+
+	return NULL;
+}
+
 /*
  * Iterate over parent backup chain and lookup given destination file in
  * filelist of every chain member starting with FULL backup.
  * Apply changed blocks to destination file from every backup in parent chain.
+ * "is_new" means that destination file was empty before restore.
  */
 size_t
 restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 				  const char *to_fullpath, bool use_bitmap, PageState *checksum_map,
-				  XLogRecPtr shift_lsn, datapagemap_t *lsn_map, bool use_headers)
+				  XLogRecPtr shift_lsn, datapagemap_t *lsn_map, bool use_headers,
+				  bool is_new)
 {
 	size_t total_write_len = 0;
 	char  *in_buf = pgut_malloc(STDIO_BUFSIZE);
 	int    backup_seq = 0;
+	/*
+	 * Zeroed pages may be left as holes only if every block is written
+	 * at most once, otherwise they must overwrite older data.
+	 */
+	bool   sparse = is_new && (use_bitmap || parray_num(parent_chain) == 1);
+	PageWriter writer;
 
 	/*
 	 * FULL -> INCR -> DEST
@@ -852,6 +2522,70 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 		/* start with full backup */
 		backup_seq = parray_num(parent_chain) - 1;
 
+	page_writer_init(&writer, out, to_fullpath, sparse);
+
+	/*
+	 * If every copy of the file in the chain has its headers in header map,
+	 * find the newest copy of every block first and restore each block once.
+	 */
+	if (use_bitmap && use_headers && parray_num(parent_chain) > 1)
+	{
+		char		from_root[MAXPGPATH];
+		int			n_sources = parray_num(parent_chain);
+		ChainSource *sources = pgut_malloc0(n_sources * sizeof(ChainSource));
+		bool		resolvable = true;
+		int			i;
+
+		for (i = 0; i < n_sources && resolvable; i++)
+		{
+			pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+			pgFile	   *file;
+			ChainSource *src = &sources[i];
+
+			file = chain_member_file(backup, i, dest_file);
+
+			/* file does not exist yet, is unchanged or truncated */
+			if (file == NULL ||
+				file->write_size == BYTES_INVALID ||
+				file->write_size == 0)
+				continue;
+
+			/* headers are stored in the file, as in backups older than 2.4.0 */
+			if (file->n_headers <= 0)
+			{
+				resolvable = false;
+				break;
+			}
+
+			src->backup = backup;
+			src->file = file;
+			src->backup_version = parse_program_version(backup->program_version);
+			join_path_components(from_root, backup->root_dir, DATABASE_DIR);
+			join_path_components(src->fullpath, from_root, src->file->rel_path);
+
+			src->headers = get_data_file_headers(&(backup->hdr_map), src->file,
+												 src->backup_version, true);
+			if (!src->headers)
+				elog(ERROR, "Failed to get page headers for file \"%s\"", src->fullpath);
+		}
+
+		if (resolvable)
+			total_write_len = restore_data_file_resolved(sources, n_sources, dest_file,
+														 &writer, checksum_map,
+														 shift_lsn, lsn_map, is_new);
+
+		for (i = 0; i < n_sources; i++)
+			pg_free(sources[i].headers);
+		pg_free(sources);
+
+		if (resolvable)
+		{
+			page_writer_finish(&writer);
+			pg_free(in_buf);
+			return total_write_len;
+		}
+	}
+
 //	for (i = parray_num(parent_chain) - 1; i >= 0; i--)
 //	for (i = 0; i < parray_num(parent_chain); i++)
 	while (backup_seq >= 0 && backup_seq < parray_num(parent_chain))
@@ -860,7 +2594,6 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 		char     from_fullpath[MAXPGPATH];
 		FILE    *in = NULL;
 
-		pgFile **res_file = NULL;
 		pgFile  *tmp_file = NULL;
 
 		/* page headers */
@@ -868,15 +2601,14 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 
 		pgBackup *backup = (pgBackup *) parray_get(parent_chain, backup_seq);
 
+		/* lookup file in intermediate backup */
+		tmp_file = chain_member_file(backup, backup_seq, dest_file);
+
 		if (use_bitmap)
 			backup_seq++;
 		else
 			backup_seq--;
 
-		/* lookup file in intermediate backup */
-		res_file = parray_bsearch(backup->files, dest_file, pgFileCompareRelPathWithExternal);
-		tmp_file = (res_file) ? *res_file : NULL;
-
 		/* Destination file is not exists yet at this moment */
 		if (tmp_file == NULL)
 			continue;
@@ -925,29 +2657,628 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 		 * have BackupPageHeader with meta information, so we cannot just
 		 * copy the file from backup.
 		 */
-		total_write_len += restore_data_file_internal(in, out, tmp_file,
+		total_write_len += restore_data_file_internal(in, &writer, tmp_file,
 													  parse_program_version(backup->program_version),
-													  from_fullpath, to_fullpath, dest_file->n_blocks,
+													  from_fullpath, dest_file->n_blocks,
 													  use_bitmap ? &(dest_file)->pagemap : NULL,
 													  checksum_map, backup->checksum_version,
 													  /* shiftmap can be used only if backup state precedes the shift */
 													  backup->stop_lsn <= shift_lsn ? lsn_map : NULL,
-													  headers);
+													  headers, sparse);
+
+		if (fclose(in) != 0)
+			elog(ERROR, "Cannot close file \"%s\": %s", from_fullpath,
+				strerror(errno));
+
+		pg_free(headers);
+
+//		datapagemap_print_debug(&(dest_file)->pagemap);
+	}
+	page_writer_finish(&writer);
+	pg_free(in_buf);
+
+	return total_write_len;
+}
+
+/*
+ * Restore data file from the members of the chain, listed in 'sources'
+ * from the newest to the oldest, without reading a block twice.
+ *
+ * The newest copy of every block is found from the page headers alone.
+ * Then the blocks are written in block order, each read and decompressed
+ * once, while every source file is read only forward.
+ */
+static size_t
+restore_data_file_resolved(ChainSource *sources, int n_sources,
+						   pgFile *dest_file, PageWriter *writer,
+						   PageState *checksum_map, XLogRecPtr shift_lsn,
+						   datapagemap_t *lsn_map, bool sparse)
+{
+	datapagemap_t *map = &(dest_file->pagemap);
+	int			nblocks = dest_file->n_blocks;
+	BlockNumber	n_owners = 0;
+	BlockOwner *owners;
+	BlockNumber	blknum;
+	size_t		write_len = 0;
+	int			i;
+
+	/* the file is not longer than its last block in any copy */
+	for (i = 0; i < n_sources; i++)
+	{
+		ChainSource *src = &sources[i];
+		int			n_hdr;
+
+		for (n_hdr = 0; src->headers && n_hdr < src->file->n_headers; n_hdr++)
+		{
+			blknum = src->headers[n_hdr].block;
+
+			/* no point in writing redundant data */
+			if (nblocks > 0 && blknum >= nblocks)
+				continue;
+
+			if (blknum >= n_owners)
+				n_owners = blknum + 1;
+		}
+	}
+
+	owners = pgut_malloc(Max(n_owners, 1) * sizeof(BlockOwner));
+	for (blknum = 0; blknum < n_owners; blknum++)
+		owners[blknum].source = BLOCK_NOT_RESOLVED;
+
+	/* the newest copy of the block wins */
+	for (i = 0; i < n_sources; i++)
+	{
+		ChainSource *src = &sources[i];
+		/* shiftmap can be used only if backup state precedes the shift */
+		bool		use_lsn_map = lsn_map && src->backup &&
+			src->backup->stop_lsn <= shift_lsn;
+		int			n_hdr;
+
+		for (n_hdr = 0; src->headers && n_hdr < src->file->n_headers; n_hdr++)
+		{
+			BackupPageHeader2 *hdr = &src->headers[n_hdr];
+
+			blknum = hdr->block;
+			if (blknum >= n_owners ||
+				owners[blknum].source != BLOCK_NOT_RESOLVED)
+				continue;
+
+			/* Incremental restore in LSN mode */
+			if (use_lsn_map && datapagemap_is_set(lsn_map, blknum))
+				datapagemap_add(map, blknum);
+
+			/* Incremental restore in CHECKSUM mode, see restore_data_file_internal() */
+			if (checksum_map && checksum_map[blknum].checksum != 0 &&
+				hdr->checksum == checksum_map[blknum].checksum &&
+				hdr->lsn == checksum_map[blknum].lsn)
+				datapagemap_add(map, blknum);
+
+			if (datapagemap_is_set(map, blknum))
+				owners[blknum].source = BLOCK_SKIPPED;
+			else
+			{
+				owners[blknum].source = i;
+				owners[blknum].n_hdr = n_hdr;
+			}
+		}
+	}
+
+	/* blocks with payload are preallocated, zeroed pages are left as holes */
+	if (sparse)
+	{
+		for (blknum = 0; blknum < n_owners; blknum++)
+		{
+			BackupPageHeader2 *hdr;
+
+			if (owners[blknum].source < 0)
+				continue;
+
+			hdr = &sources[owners[blknum].source].headers[owners[blknum].n_hdr];
+			if (hdr[1].pos - hdr[0].pos > sizeof(BackupPageHeader))
+				page_writer_reserve(writer, blknum);
+		}
+		page_writer_reserve(writer, InvalidBlockNumber);
+	}
+
+	for (blknum = 0; blknum < n_owners; blknum++)
+	{
+		ChainSource *src;
+		BackupPageHeader2 *hdr;
+		DataPage   *page;
+		int32		compressed_size;
+		size_t		read_len;
+
+		/* check for interrupt */
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during data file restore");
+
+		if (owners[blknum].source < 0)
+			continue;
+
+		src = &sources[owners[blknum].source];
+		hdr = &src->headers[owners[blknum].n_hdr];
+
+		/* page header is not included */
+		compressed_size = hdr[1].pos - hdr[0].pos - sizeof(BackupPageHeader);
+
+		Assert(compressed_size >= 0);
+		Assert(compressed_size <= BLCKSZ);
+
+		datapagemap_add(map, blknum);
+
+		/* zeroed page has no payload, there is nothing to read */
+		if (compressed_size == 0)
+		{
+			write_len += BLCKSZ;
+
+			/*
+			 * Every block is written once, so the page is left as a hole
+			 * in the new file.
+			 */
+			if (sparse)
+				page_writer_hole(writer, blknum);
+			else
+			{
+				page_writer_page(writer);
+				page_writer_write(writer, blknum, PageIsZeroed,
+								  src->file->compress_alg, src->backup_version);
+			}
+			continue;
+		}
+
+		if (src->in == NULL)
+		{
+			src->in = fopen(src->fullpath, PG_BINARY_R);
+			if (src->in == NULL)
+				elog(ERROR, "Cannot open backup file \"%s\": %s", src->fullpath,
+					 strerror(errno));
+
+			/* set stdio buffering for input data file */
+			src->in_buf = pgut_malloc(STDIO_BUFSIZE);
+			setvbuf(src->in, src->in_buf, _IOFBF, STDIO_BUFSIZE);
+			src->cur_pos = 0;
+		}
+
+		/* blocks of a newer copy are skipped by seeking forward */
+		if (src->cur_pos != hdr->pos)
+		{
+			if (fseek(src->in, hdr->pos, SEEK_SET) != 0)
+				elog(ERROR, "Cannot seek to offset %u of \"%s\": %s",
+					 hdr->pos, src->fullpath, strerror(errno));
+
+			src->cur_pos = hdr->pos;
+		}
+
+		read_len = compressed_size + sizeof(BackupPageHeader);
+		page = page_writer_page(writer);
+		if (fread(page, 1, read_len, src->in) != read_len)
+			elog(ERROR, "Cannot read block %u file \"%s\": %s",
+				 blknum, src->fullpath, strerror(errno));
+
+		src->cur_pos += read_len;
+
+		page_writer_write(writer, blknum, compressed_size,
+						  src->file->compress_alg, src->backup_version);
+		write_len += BLCKSZ;
+	}
+
+	for (i = 0; i < n_sources; i++)
+	{
+		if (sources[i].in && fclose(sources[i].in) != 0)
+			elog(ERROR, "Cannot close file \"%s\": %s", sources[i].fullpath,
+				 strerror(errno));
+		sources[i].in = NULL;
+		pg_free(sources[i].in_buf);
+		sources[i].in_buf = NULL;
+	}
+	pg_free(owners);
+
+	elog(LOG, "Restored file \"%s\" from %d backups: %lu bytes",
+		 writer->to_fullpath, n_sources, write_len);
+	return write_len;
+}
+
+/*
+ * Check whether the page, read from the backup file, is compressed.
+ * Page smaller than BLCKSZ is compressed.
+ * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
+ * we have to check, whether it is compressed or not using
+ * page_may_be_compressed() function.
+ */
+static bool
+restored_page_is_compressed(DataPage *page, int32 compressed_size,
+							CompressAlg alg, uint32 backup_version)
+{
+	return compressed_size != BLCKSZ ||
+		page_may_be_compressed(page->data, alg, backup_version);
+}
+
+/*
+ * Write the page, read from the backup file, into block 'blknum'
+ * of the restored file through stdio, as local files on Windows are.
+ * 'cur_pos_out' tracks the write position, so that sequential writes
+ * need no fseek.
+ */
+static void
+write_restored_page(FILE *out, const char *to_fullpath, BlockNumber blknum,
+					DataPage *page, int32 compressed_size, CompressAlg alg,
+					uint32 backup_version, off_t *cur_pos_out)
+{
+	off_t		write_pos = (off_t) blknum * BLCKSZ;
+	bool		is_compressed = false;
+
+	if (compressed_size == PageIsZeroed)
+		memset(page->data, 0, BLCKSZ);
+	else
+		is_compressed = restored_page_is_compressed(page, compressed_size, alg,
+													backup_version);
+
+	/*
+	 * Seek and write the restored page.
+	 * When restoring file from FULL backup, pages are written sequentially,
+	 * so there is no need to issue fseek for every page.
+	 */
+	if (*cur_pos_out != write_pos)
+	{
+		if (fio_fseek(out, write_pos) < 0)
+			elog(ERROR, "Cannot seek block %u of \"%s\": %s",
+				blknum, to_fullpath, strerror(errno));
+
+		*cur_pos_out = write_pos;
+	}
+
+	/*
+	 * If page is compressed and restore is in remote mode,
+	 * send compressed page to the remote side.
+	 */
+	if (is_compressed)
+	{
+		ssize_t rc;
+		rc = fio_fwrite_async_compressed(out, page->data, compressed_size, alg);
+
+		if (!fio_is_remote_file(out) && rc != BLCKSZ)
+			elog(ERROR, "Cannot write block %u of \"%s\": %s, size: %u",
+				 blknum, to_fullpath, strerror(errno), compressed_size);
+	}
+	else
+	{
+		if (fio_fwrite_async(out, page->data, BLCKSZ) != BLCKSZ)
+			elog(ERROR, "Cannot write block %u of \"%s\": %s",
+				 blknum, to_fullpath, strerror(errno));
+	}
+
+	*cur_pos_out += BLCKSZ; /* update current write position */
+}
+
+/*
+ * Set up writer of restored pages into data file 'out'.
+ * If 'sparse' is true, the file is new and every block of it
+ * is written at most once.
+ */
+static void
+page_writer_init(PageWriter *writer, FILE *out, const char *to_fullpath,
+				 bool sparse)
+{
+	int			n_slots = 1;
+	int			i;
+
+	memset(writer, 0, sizeof(PageWriter));
+	writer->out = out;
+	writer->to_fullpath = to_fullpath;
+	writer->fd = -1;
+	writer->cur_pos_out = -1;
+
+#ifndef WIN32
+	if (!fio_is_remote_file(out))
+	{
+		/* pages are written past stdio buffer of the file */
+		if (fflush(out) != 0)
+			elog(ERROR, "Cannot flush file \"%s\": %s", to_fullpath,
+				 strerror(errno));
+
+		writer->fd = fileno(out);
+		n_slots = PAGE_WRITER_PAGES;
+	}
+#endif
+
+	if (fio_is_remote_file(out))
+		writer->batch = pgut_malloc(PAGE_WRITER_PAGES *
+									(sizeof(fio_page_entry) + BLCKSZ));
+
+#ifdef __linux__
+	writer->preallocate = sparse && writer->fd >= 0;
+#endif
+
+	writer->pages = pgut_malloc(n_slots * sizeof(DataPage));
+	for (i = 0; i < n_slots; i++)
+		writer->slots[i] = &writer->pages[i];
+}
+
+/*
+ * Get the slot to read the next page into.
+ */
+static DataPage *
+page_writer_page(PageWriter *writer)
+{
+	if (writer->fd < 0)
+		return writer->slots[0];
+
+	if (writer->n_pending == PAGE_WRITER_PAGES)
+		page_writer_flush(writer);
+
+	return writer->slots[writer->n_pending];
+}
+
+/*
+ * Write the page, read into the slot returned by page_writer_page(),
+ * into block 'blknum'.
+ */
+static void
+page_writer_write(PageWriter *writer, BlockNumber blknum,
+				  int32 compressed_size, CompressAlg alg, uint32 backup_version)
+{
+	DataPage   *page;
+
+	if (writer->batch)
+	{
+		fio_page_entry entry;
+
+		if (writer->n_pending == PAGE_WRITER_PAGES)
+			page_writer_flush(writer);
+
+		page = writer->slots[0];
+		entry.blknum = blknum;
+		entry.size = 0;
+		entry.compress_alg = NONE_COMPRESS;
+
+		if (compressed_size != PageIsZeroed)
+		{
+			entry.size = compressed_size;
+			if (restored_page_is_compressed(page, compressed_size, alg, backup_version))
+				entry.compress_alg = alg;
+		}
+
+		memcpy(writer->batch + writer->batch_len, &entry, sizeof(entry));
+		writer->batch_len += sizeof(entry);
+		memcpy(writer->batch + writer->batch_len, page->data, entry.size);
+		writer->batch_len += entry.size;
+		writer->n_pending++;
+
+		if (blknum + 1 > writer->written_end)
+			writer->written_end = blknum + 1;
+		return;
+	}
+
+	if (writer->fd < 0)
+	{
+		write_restored_page(writer->out, writer->to_fullpath, blknum,
+							writer->slots[0], compressed_size, alg,
+							backup_version, &writer->cur_pos_out);
+
+		if (blknum + 1 > writer->written_end)
+			writer->written_end = blknum + 1;
+		return;
+	}
+
+	page = writer->slots[writer->n_pending];
+
+	/* the page does not continue pending run, write the run out first */
+	if (writer->n_pending > 0 &&
+		blknum != writer->run_start + writer->n_pending)
+	{
+		int			slot = writer->n_pending;
+
+		page_writer_flush(writer);
+
+		writer->slots[slot] = writer->slots[0];
+		writer->slots[0] = page;
+	}
+
+	if (writer->n_pending == 0)
+		writer->run_start = blknum;
+
+	if (compressed_size == PageIsZeroed)
+		memset(page->data, 0, BLCKSZ);
+	else if (restored_page_is_compressed(page, compressed_size, alg, backup_version))
+	{
+		char		buf[BLCKSZ];
+		int32		uncompressed_size;
+		const char *errormsg = NULL;
+
+		uncompressed_size = do_decompress(buf, BLCKSZ, page->data,
+										  compressed_size, alg, &errormsg);
+		if (uncompressed_size < 0 && errormsg != NULL)
+			elog(ERROR, "An error occured during decompressing block %u of file \"%s\": %s",
+				 blknum, writer->to_fullpath, errormsg);
+
+		if (uncompressed_size != BLCKSZ)
+			elog(ERROR, "Page %u of file \"%s\" uncompressed to %d bytes. != BLCKSZ",
+				 blknum, writer->to_fullpath, uncompressed_size);
+
+		memcpy(page->data, buf, BLCKSZ);
+	}
+
+	writer->n_pending++;
+}
+
+/*
+ * Note that zeroed page of block 'blknum' is left as a hole.
+ */
+static void
+page_writer_hole(PageWriter *writer, BlockNumber blknum)
+{
+	if (blknum + 1 > writer->hole_end)
+		writer->hole_end = blknum + 1;
+}
+
+/*
+ * Note that block 'blknum' of the new file is going to be written.
+ * Runs of such blocks are preallocated, so that the file is not
+ * fragmented by holes left in between. Pass InvalidBlockNumber once
+ * all the blocks are noted.
+ */
+static void
+page_writer_reserve(PageWriter *writer, BlockNumber blknum)
+{
+	if (!writer->preallocate)
+		return;
+
+	if (blknum != InvalidBlockNumber &&
+		writer->alloc_end > writer->alloc_start &&
+		blknum == writer->alloc_end)
+	{
+		writer->alloc_end++;
+		return;
+	}
+
+#ifdef __linux__
+	/* size of the file is given by the writes, as without preallocation */
+	if (writer->alloc_end > writer->alloc_start &&
+		fallocate(writer->fd, FALLOC_FL_KEEP_SIZE,
+				  (off_t) writer->alloc_start * BLCKSZ,
+				  (off_t) (writer->alloc_end - writer->alloc_start) * BLCKSZ) != 0)
+	{
+		/* not supported by filesystem, restore goes on without it */
+		elog(VERBOSE, "Cannot preallocate file \"%s\": %s",
+			 writer->to_fullpath, strerror(errno));
+		writer->preallocate = false;
+	}
+#endif
+
+	if (blknum == InvalidBlockNumber)
+		writer->alloc_start = writer->alloc_end = 0;
+	else
+	{
+		writer->alloc_start = blknum;
+		writer->alloc_end = blknum + 1;
+	}
+}
+
+/*
+ * Truncate the file to 'blknum' blocks.
+ */
+static void
+page_writer_truncate(PageWriter *writer, BlockNumber blknum)
+{
+	page_writer_flush(writer);
+
+	/* To correctly truncate file, we must first flush STDIO buffers */
+	if (fio_fflush(writer->out) != 0)
+		elog(ERROR, "Cannot flush file \"%s\": %s", writer->to_fullpath, strerror(errno));
+
+	/* Set position to the start of file */
+	if (fio_fseek(writer->out, 0) < 0)
+		elog(ERROR, "Cannot seek to the start of file \"%s\": %s", writer->to_fullpath, strerror(errno));
+	writer->cur_pos_out = 0;
+
+	if (fio_ftruncate(writer->out, (off_t) blknum * BLCKSZ) != 0)
+		elog(ERROR, "Cannot truncate file \"%s\": %s", writer->to_fullpath, strerror(errno));
+
+	writer->written_end = Min(writer->written_end, blknum);
+	writer->hole_end = Min(writer->hole_end, blknum);
+}
+
+/*
+ * Write pending run of pages by pwritev(), or send pending batch
+ * of pages to the agent.
+ */
+static void
+page_writer_flush(PageWriter *writer)
+{
+#ifndef WIN32
+	struct iovec iov[PAGE_WRITER_PAGES];
+	int			first = 0;
+	off_t		write_pos = (off_t) writer->run_start * BLCKSZ;
+	int			i;
+#endif
+
+	if (writer->batch)
+	{
+		if (writer->n_pending > 0)
+			fio_fwrite_pages_async(writer->out, writer->batch, writer->batch_len);
+
+		writer->batch_len = 0;
+		writer->n_pending = 0;
+		return;
+	}
+
+#ifndef WIN32
+	if (writer->n_pending == 0)
+		return;
+
+	for (i = 0; i < writer->n_pending; i++)
+	{
+		iov[i].iov_base = writer->slots[i]->data;
+		iov[i].iov_len = BLCKSZ;
+	}
+
+	while (first < writer->n_pending)
+	{
+		ssize_t		rc = pwritev(writer->fd, iov + first,
+								 writer->n_pending - first, write_pos);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+
+		if (rc <= 0)
+		{
+			/* pwritev() reports no error if it has written nothing */
+			if (rc == 0)
+				errno = ENOSPC;
+			elog(ERROR, "Cannot write blocks %u-%u of \"%s\": %s",
+				 writer->run_start, writer->run_start + writer->n_pending - 1,
+				 writer->to_fullpath, strerror(errno));
+		}
+
+		write_pos += rc;
+
+		/* skip what is written, including part of the page */
+		while (rc > 0)
+		{
+			if ((size_t) rc >= iov[first].iov_len)
+			{
+				rc -= iov[first].iov_len;
+				first++;
+			}
+			else
+			{
+				iov[first].iov_base = (char *) iov[first].iov_base + rc;
+				iov[first].iov_len -= rc;
+				rc = 0;
+			}
+		}
+	}
 
-		if (fclose(in) != 0)
-			elog(ERROR, "Cannot close file \"%s\": %s", from_fullpath,
-				strerror(errno));
+	if (writer->run_start + writer->n_pending > writer->written_end)
+		writer->written_end = writer->run_start + writer->n_pending;
+	writer->n_pending = 0;
+#endif
+}
 
-		pg_free(headers);
+/*
+ * Write out pending pages and release the writer.
+ */
+static void
+page_writer_finish(PageWriter *writer)
+{
+	page_writer_flush(writer);
 
-//		datapagemap_print_debug(&(dest_file)->pagemap);
+	/* make sure the file is not shorter than the last zeroed page */
+	if (writer->hole_end > writer->written_end)
+	{
+		page_writer_page(writer);
+		page_writer_write(writer, writer->hole_end - 1, PageIsZeroed,
+						  NOT_DEFINED_COMPRESS, 0);
+		page_writer_flush(writer);
 	}
-	pg_free(in_buf);
 
-	return total_write_len;
+	pg_free(writer->pages);
+	pg_free(writer->batch);
+	writer->pages = NULL;
+	writer->batch = NULL;
 }
 
-/* Restore block from "in" file to "out" file.
+/* Restore block from "in" file into the file of "writer".
  * If "nblocks" is greater than zero, then skip restoring blocks,
  * whose position if greater than "nblocks".
  * If map is NULL, then page bitmap cannot be used for restore optimization
@@ -955,44 +3286,51 @@ restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
  * backup. We restoring from newest to oldest and page, once restored, marked in map.
  * When the same page, but in older backup, encountered, we check the map, if it is
  * marked as already restored, then page is skipped.
+ * If "sparse" is true, no other data is going to be written into blocks
+ * restored from this file, so zeroed pages are left as holes in the file.
  */
-size_t
-restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_version,
-						   const char *from_fullpath, const char *to_fullpath, int nblocks,
+static size_t
+restore_data_file_internal(FILE *in, PageWriter *writer, pgFile *file, uint32 backup_version,
+						   const char *from_fullpath, int nblocks,
 						   datapagemap_t *map, PageState *checksum_map, int checksum_version,
-						   datapagemap_t *lsn_map, BackupPageHeader2 *headers)
+						   datapagemap_t *lsn_map, BackupPageHeader2 *headers, bool sparse)
 {
 	BlockNumber	blknum = 0;
 	int n_hdr = -1;
 	size_t write_len = 0;
-	off_t cur_pos_out = 0;
 	off_t cur_pos_in = 0;
 
 	/* should not be possible */
 	Assert(!(backup_version >= 20400 && file->n_headers <= 0));
 
-	/*
-	 * We rely on stdio buffering of input and output.
-	 * For buffering to be efficient, we try to minimize the
-	 * number of lseek syscalls, because it forces buffer flush.
-	 * For that, we track current write position in
-	 * output file and issue fseek only when offset of block to be
-	 * written not equal to current write position, which happens
-	 * a lot when blocks from incremental backup are restored,
-	 * but should never happen in case of blocks from FULL backup.
-	 */
-	if (fio_fseek(out, cur_pos_out) < 0)
-		elog(ERROR, "Cannot seek block %u of \"%s\": %s",
-				blknum, to_fullpath, strerror(errno));
+	/* blocks with payload are preallocated, zeroed pages are left as holes */
+	if (headers && sparse)
+	{
+		for (n_hdr = 0; n_hdr < file->n_headers; n_hdr++)
+		{
+			blknum = headers[n_hdr].block;
+
+			if (nblocks > 0 && blknum >= nblocks)
+				break;
+
+			if (map && datapagemap_is_set(map, blknum))
+				continue;
+
+			if (headers[n_hdr + 1].pos - headers[n_hdr].pos > sizeof(BackupPageHeader))
+				page_writer_reserve(writer, blknum);
+		}
+		page_writer_reserve(writer, InvalidBlockNumber);
+
+		blknum = 0;
+		n_hdr = -1;
+	}
 
 	for (;;)
 	{
-		off_t		write_pos;
 		size_t		len;
 		size_t		read_len;
-		DataPage	page;
+		DataPage   *page = page_writer_page(writer);
 		int32		compressed_size = 0;
-		bool		is_compressed = false;
 
 		/* incremental restore vars */
 		uint16 page_crc = 0;
@@ -1016,10 +3354,14 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 			 * page header is not included */
 			compressed_size = headers[n_hdr+1].pos - headers[n_hdr].pos - sizeof(BackupPageHeader);
 
-			Assert(compressed_size > 0);
+			Assert(compressed_size >= 0);
 			Assert(compressed_size <= BLCKSZ);
 
 			read_len = compressed_size + sizeof(BackupPageHeader);
+
+			/* zeroed page has no payload */
+			if (compressed_size == 0)
+				compressed_size = PageIsZeroed;
 		}
 		else
 		{
@@ -1027,19 +3369,21 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 			 * or when merging something. Align read_len only when restoring
 			 * or merging old backups.
 			 */
-			if (get_page_header(in, from_fullpath, &(page).bph, NULL, false))
+			if (get_page_header(in, from_fullpath, &(page)->bph, NULL, false))
 			{
 				cur_pos_in += sizeof(BackupPageHeader);
 
 				/* backward compatibility kludge TODO: remove in 3.0 */
-				blknum = page.bph.block;
-				compressed_size = page.bph.compressed_size;
+				blknum = page->bph.block;
+				compressed_size = page->bph.compressed_size;
 
 				/* this has a potential to backfire when retrying merge of old backups,
 				 * so we just forbid the retrying of failed merges between versions >= 2.4.0 and
 				 * version < 2.4.0
 				 */
-				if (backup_version >= 20400)
+				if (compressed_size == PageIsZeroed)
+					read_len = 0;
+				else if (backup_version >= 20400)
 					read_len = compressed_size;
 				else
 					/* For some unknown and possibly dump reason I/O operations
@@ -1071,23 +3415,13 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 			 * We need to truncate file to this length.
 			 */
 
-			elog(VERBOSE, "Truncate file \"%s\" to block %u", to_fullpath, blknum);
-
-			/* To correctly truncate file, we must first flush STDIO buffers */
-			if (fio_fflush(out) != 0)
-				elog(ERROR, "Cannot flush file \"%s\": %s", to_fullpath, strerror(errno));
-
-			/* Set position to the start of file */
-			if (fio_fseek(out, 0) < 0)
-				elog(ERROR, "Cannot seek to the start of file \"%s\": %s", to_fullpath, strerror(errno));
-
-			if (fio_ftruncate(out, blknum * BLCKSZ) != 0)
-				elog(ERROR, "Cannot truncate file \"%s\": %s", to_fullpath, strerror(errno));
+			elog(VERBOSE, "Truncate file \"%s\" to block %u", writer->to_fullpath, blknum);
 
+			page_writer_truncate(writer, blknum);
 			break;
 		}
 
-		Assert(compressed_size > 0);
+		Assert(compressed_size > 0 || compressed_size == PageIsZeroed);
 		Assert(compressed_size <= BLCKSZ);
 
 		/* no point in writing redundant data */
@@ -1140,9 +3474,9 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 
 		/* read a page from file */
 		if (headers)
-			len = fread(&page, 1, read_len, in);
+			len = fread(page, 1, read_len, in);
 		else
-			len = fread(page.data, 1, read_len, in);
+			len = fread(page->data, 1, read_len, in);
 
 		if (len != read_len)
 			elog(ERROR, "Cannot read block %u file \"%s\": %s",
@@ -1151,55 +3485,24 @@ restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_vers
 		cur_pos_in += read_len;
 
 		/*
-		 * if page size is smaller than BLCKSZ, decompress the page.
-		 * BUGFIX for versions < 2.0.23: if page size is equal to BLCKSZ.
-		 * we have to check, whether it is compressed or not using
-		 * page_may_be_compressed() function.
+		 * Zeroed page. If nothing has been written into the block,
+		 * skip it, leaving a hole in the file.
 		 */
-		if (compressed_size != BLCKSZ
-			|| page_may_be_compressed(page.data, file->compress_alg, backup_version))
+		if (compressed_size == PageIsZeroed && sparse)
 		{
-			is_compressed = true;
-		}
-
-		/*
-		 * Seek and write the restored page.
-		 * When restoring file from FULL backup, pages are written sequentially,
-		 * so there is no need to issue fseek for every page.
-		 */
-		write_pos = blknum * BLCKSZ;
+			page_writer_hole(writer, blknum);
 
-		if (cur_pos_out != write_pos)
-		{
-			if (fio_fseek(out, write_pos) < 0)
-				elog(ERROR, "Cannot seek block %u of \"%s\": %s",
-					blknum, to_fullpath, strerror(errno));
+			write_len += BLCKSZ;
 
-			cur_pos_out = write_pos;
+			if (map)
+				datapagemap_add(map, blknum);
+			continue;
 		}
 
-		/*
-		 * If page is compressed and restore is in remote mode,
-		 * send compressed page to the remote side.
-		 */
-		if (is_compressed)
-		{
-			ssize_t rc;
-			rc = fio_fwrite_async_compressed(out, page.data, compressed_size, file->compress_alg);
-
-			if (!fio_is_remote_file(out) && rc != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s, size: %u",
-					 blknum, to_fullpath, strerror(errno), compressed_size);
-		}
-		else
-		{
-			if (fio_fwrite_async(out, page.data, BLCKSZ) != BLCKSZ)
-				elog(ERROR, "Cannot write block %u of \"%s\": %s",
-					 blknum, to_fullpath, strerror(errno));
-		}
+		page_writer_write(writer, blknum, compressed_size,
+						  file->compress_alg, backup_version);
 
 		write_len += BLCKSZ;
-		cur_pos_out += BLCKSZ; /* update current write position */
 
 		/* Mark page as restored to avoid reading this page when restoring parent backups */
 		if (map)
@@ -1280,23 +3583,26 @@ restore_non_data_file(parray *parent_chain, pgBackup *dest_backup,
 		 * Full copy is latest possible destination file with size equal or
 		 * greater than zero.
 		 */
+		int			backup_seq = 1;
+
 		tmp_backup = dest_backup->parent_backup_link;
 		while (tmp_backup)
 		{
-			pgFile	**res_file = NULL;
-
 			/* lookup file in intermediate backup */
-			res_file =  parray_bsearch(tmp_backup->files, dest_file, pgFileCompareRelPathWithExternal);
-			tmp_file = (res_file) ? *res_file : NULL;
+			tmp_file = chain_member_file(tmp_backup, backup_seq++, dest_file);
 
 			/*
 			 * It should not be possible not to find destination file in intermediate
-			 * backup, without encountering full copy first.
+			 * backup, without encountering full copy first. Restore keeps only
+			 * changed copies, so the file may be missing from them.
 			 */
 			if (!tmp_file)
 			{
-				elog(ERROR, "Failed to locate non-data file \"%s\" in backup %s",
-					dest_file->rel_path, backup_id_of(tmp_backup));
+				if (tmp_backup->files)
+					elog(ERROR, "Failed to locate non-data file \"%s\" in backup %s",
+						dest_file->rel_path, backup_id_of(tmp_backup));
+
+				tmp_backup = tmp_backup->parent_backup_link;
 				continue;
 			}
 
@@ -1684,11 +3990,15 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 			 */
 			compressed_size = headers[n_hdr+1].pos - headers[n_hdr].pos - sizeof(BackupPageHeader);
 
-			Assert(compressed_size > 0);
+			Assert(compressed_size >= 0);
 			Assert(compressed_size <= BLCKSZ);
 
 			read_len = sizeof(BackupPageHeader) + compressed_size;
 
+			/* zeroed page has no payload */
+			if (compressed_size == 0)
+				compressed_size = PageIsZeroed;
+
 			if (cur_pos_in != headers[n_hdr].pos)
 			{
 				if (fio_fseek(in, headers[n_hdr].pos) < 0)
@@ -1710,7 +4020,7 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 				 */
 				blknum = compressed_page.bph.block;
 				compressed_size = compressed_page.bph.compressed_size;
-				read_len = MAXALIGN(compressed_size);
+				read_len = compressed_size == PageIsZeroed ? 0 : MAXALIGN(compressed_size);
 			}
 			else
 				break;
@@ -1725,7 +4035,7 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 		}
 
 		Assert(compressed_size <= BLCKSZ);
-		Assert(compressed_size > 0);
+		Assert(compressed_size > 0 || compressed_size == PageIsZeroed);
 
 		if (headers)
 			len = fread(&compressed_page, 1, read_len, in);
@@ -1747,6 +4057,20 @@ validate_file_pages(pgFile *file, const char *fullpath, XLogRecPtr stop_lsn,
 		else
 			COMP_FILE_CRC32(use_crc32c, crc, compressed_page.data, read_len);
 
+		/* header of zeroed page must agree with the map */
+		if (compressed_size == PageIsZeroed)
+		{
+			if (compressed_page.bph.compressed_size != PageIsZeroed)
+			{
+				elog(WARNING, "File: %s blknum %u, unexpected size %d of zeroed page",
+					 file->rel_path, blknum, compressed_page.bph.compressed_size);
+				is_valid = false;
+			}
+			else
+				elog(VERBOSE, "File: %s blknum %u, empty zeroed page", file->rel_path, blknum);
+			continue;
+		}
+
 		if (compressed_size != BLCKSZ
 			|| page_may_be_compressed(compressed_page.data, file->compress_alg,
 									  backup_version))
@@ -2006,6 +4330,49 @@ get_page_header(FILE *in, const char *fullpath, BackupPageHeader* bph,
 	return true;
 }
 
+/*
+ * Per-thread arena for page headers of the file being backed up.
+ * It grows geometrically and is reused for every file processed
+ * by the thread, so collecting headers takes no allocations, once
+ * the arena has grown to the size of the largest file.
+ * Entries keep headers of the previous file, and headers are written
+ * to the header map with their padding, so every entry is zeroed
+ * before it is filled.
+ */
+static __thread BackupPageHeader2 *header_arena = NULL;
+static __thread size_t header_arena_size = 0;	/* number of entries */
+
+/*
+ * Make room for n_headers page headers in the arena, preserving its content.
+ * The arena is valid until the next call in the same thread.
+ */
+BackupPageHeader2 *
+header_arena_reserve(size_t n_headers)
+{
+	if (n_headers > header_arena_size)
+	{
+		size_t		new_size = Max(header_arena_size * 2, BACKUP_EXTENT_BLOCKS);
+
+		while (new_size < n_headers)
+			new_size *= 2;
+
+		header_arena = (BackupPageHeader2 *) pgut_realloc(header_arena,
+											new_size * sizeof(BackupPageHeader2));
+		header_arena_size = new_size;
+	}
+
+	return header_arena;
+}
+
+/* Release the arena of the calling thread */
+void
+header_arena_free(void)
+{
+	pg_free(header_arena);
+	header_arena = NULL;
+	header_arena_size = 0;
+}
+
 /* Open local backup file for writing, set permissions and buffering */
 FILE*
 open_local_file_rw(const char *to_fullpath, char **out_buf, uint32 buf_size)
@@ -2034,21 +4401,33 @@ int
 send_pages(const char *to_fullpath, const char *from_fullpath,
 		   pgFile *file, XLogRecPtr prev_backup_start_lsn, CompressAlg calg, int clevel,
 		   uint32 checksum_version, bool use_pagemap, BackupPageHeader2 **headers,
-		   BackupMode backup_mode)
+		   BackupMode backup_mode, BlockNumber start_blknum, BlockNumber end_blknum)
 {
 	FILE *in = NULL;
 	FILE *out = NULL;
 	off_t  cur_pos_out = 0;
 	char  curr_page[BLCKSZ];
 	int   n_blocks_read = 0;
-	BlockNumber blknum = 0;
+	BlockNumber blknum = start_blknum;
 	datapagemap_iterator_t *iter = NULL;
 	int   compressed_size = 0;
-	BackupPageHeader2 *header = NULL;
-	parray *harray = NULL;
+	/* page headers are collected in the per-thread arena */
+	BackupPageHeader2 *harena = NULL;
+	int   hdr_num = 0;
+
+	/* extent of consecutive blocks read from the source file */
+	ExtentReader reader;
+	char *extent = NULL;
+	BlockNumber extent_start = 0;
+	BlockNumber extent_nblocks = 0;
+	/* range of changed blocks in the extent, if the pagemap is used */
+	BlockNumber range_nblocks = 0;
+
+	/* compressed pages not yet written to the backup file */
+	char *out_extent = NULL;
+	size_t out_extent_len = 0;
 
 	/* stdio buffers */
-	char *in_buf = NULL;
 	char *out_buf = NULL;
 
 	/* open source file for read */
@@ -2066,31 +4445,56 @@ send_pages(const char *to_fullpath, const char *from_fullpath,
 	}
 
 	/*
-	 * Enable stdio buffering for local input file,
-	 * unless the pagemap is involved, which
-	 * imply a lot of random access.
+	 * Disable stdio buffering for local input file: the file is read
+	 * by whole extents or, if the pagemap is involved, by ranges of
+	 * changed blocks, bypassing stdio altogether.
+	 * Stdio is used only to re-read single pages, that failed validation.
 	 */
+	setvbuf(in, NULL, _IONBF, BUFSIZ);
+
+	extent_reader_init(&reader, in, end_blknum, from_fullpath, !use_pagemap);
 
 	if (use_pagemap)
 	{
 		iter = datapagemap_iterate(&file->pagemap);
-		datapagemap_next(iter, &blknum); /* set first block */
 
-		setvbuf(in, NULL, _IONBF, BUFSIZ);
-	}
-	else
-	{
-		in_buf = pgut_malloc(STDIO_BUFSIZE);
-		setvbuf(in, in_buf, _IOFBF, STDIO_BUFSIZE);
+		/* read the first range, skipping the blocks before start_blknum */
+		if (pagemap_next_range(&file->pagemap, iter, start_blknum, end_blknum,
+							   &extent_start, &range_nblocks))
+		{
+			blknum = extent_start;
+			extent_nblocks = extent_reader_range(&reader, extent_start,
+												 range_nblocks, &extent);
+		}
+		else
+			blknum = end_blknum;
 	}
 
-	harray = parray_new();
-
-	while (blknum < file->n_blocks)
+	while (blknum < end_blknum)
 	{
 		PageState page_st;
-		int rc = prepare_page(file, prev_backup_start_lsn,
-							  blknum, in, backup_mode, curr_page,
+		Page	page = curr_page;
+		int		rc;
+
+		/* current extent is exhausted, read the next one */
+		if (!use_pagemap && blknum >= extent_start + extent_nblocks)
+		{
+			extent_start = blknum;
+			extent_nblocks = extent_reader_next(&reader, blknum, &extent);
+		}
+
+		if (blknum < extent_start + extent_nblocks)
+		{
+			page = extent + (blknum - extent_start) * BLCKSZ;
+			rc = prepare_extent_page(file, prev_backup_start_lsn,
+									 blknum, in, backup_mode, page,
+									 checksum_version, from_fullpath,
+									 &page_st);
+		}
+		else
+			/* extent was cut short, let prepare_page() deal with truncation */
+			rc = prepare_page(file, prev_backup_start_lsn,
+							  blknum, in, backup_mode, page,
 							  true, checksum_version,
 							  from_fullpath, &page_st);
 
@@ -2101,21 +4505,34 @@ send_pages(const char *to_fullpath, const char *from_fullpath,
 		{
 			/* lazily open backup file (useful for s3) */
 			if (!out)
+			{
 				out = open_local_file_rw(to_fullpath, &out_buf, STDIO_BUFSIZE);
+				out_extent = pgut_malloc(BACKUP_EXTENT_SIZE);
+			}
 
-			header = pgut_new0(BackupPageHeader2);
-			*header = (BackupPageHeader2){
-					.block = blknum,
-					.pos = cur_pos_out,
-					.lsn = page_st.lsn,
-					.checksum = page_st.checksum,
-			};
-
-			parray_append(harray, header);
+			/* flush accumulated pages, if there is no room for another one */
+			if (out_extent_len + MAX_PAGE_ENTRY_SIZE > BACKUP_EXTENT_SIZE)
+			{
+				if (fio_fwrite(out, out_extent, out_extent_len) != out_extent_len)
+					elog(ERROR, "File: \"%s\", cannot write at block %u: %s",
+						 to_fullpath, blknum, strerror(errno));
+				out_extent_len = 0;
+			}
 
-			compressed_size = compress_and_backup_page(file, blknum, in, out, &(file->crc),
-														rc, curr_page, calg, clevel,
-														from_fullpath, to_fullpath);
+			/* reserve room for the dummy header as well */
+			harena = header_arena_reserve(hdr_num + 2);
+			MemSet(&harena[hdr_num], 0, sizeof(BackupPageHeader2));
+			harena[hdr_num].block = blknum;
+			harena[hdr_num].pos = cur_pos_out;
+			harena[hdr_num].lsn = page_st.lsn;
+			harena[hdr_num].checksum = page_st.checksum;
+			hdr_num++;
+
+			compressed_size = compress_and_backup_page(file, blknum,
+													   out_extent + out_extent_len,
+													   &(file->crc), page, calg, clevel,
+													   from_fullpath);
+			out_extent_len += compressed_size + sizeof(BackupPageHeader);
 			cur_pos_out += compressed_size + sizeof(BackupPageHeader);
 		}
 
@@ -2124,36 +4541,49 @@ send_pages(const char *to_fullpath, const char *from_fullpath,
 		/* next block */
 		if (use_pagemap)
 		{
-			/* exit if pagemap is exhausted */
-			if (!datapagemap_next(iter, &blknum))
-				break;
+			/* skip unchanged blocks in the middle of the range */
+			do
+				blknum++;
+			while (blknum < extent_start + range_nblocks &&
+				   !datapagemap_is_set(&file->pagemap, blknum));
+
+			if (blknum >= extent_start + range_nblocks)
+			{
+				/* exit if pagemap is exhausted */
+				if (!pagemap_next_range(&file->pagemap, iter, blknum, end_blknum,
+										&extent_start, &range_nblocks))
+					break;
+
+				blknum = extent_start;
+				extent_nblocks = extent_reader_range(&reader, extent_start,
+													 range_nblocks, &extent);
+			}
 		}
 		else
 			blknum++;
 	}
 
+	/* write the rest of accumulated pages */
+	if (out_extent_len > 0 &&
+		fio_fwrite(out, out_extent, out_extent_len) != out_extent_len)
+		elog(ERROR, "File: \"%s\", cannot write at block %u: %s",
+			 to_fullpath, blknum, strerror(errno));
+
 	/*
 	 * Add dummy header, so we can later extract the length of last header
 	 * as difference between their offsets.
 	 */
-	if (parray_num(harray) > 0)
+	if (hdr_num > 0)
 	{
-		size_t hdr_num = parray_num(harray);
-		size_t i;
-
-		file->n_headers = (int) hdr_num; /* is it valid? */
-		*headers = (BackupPageHeader2 *) pgut_malloc0((hdr_num + 1) * sizeof(BackupPageHeader2));
-		for (i = 0; i < hdr_num; i++)
-		{
-			header = (BackupPageHeader2 *)parray_get(harray, i);
-			(*headers)[i] = *header;
-			pg_free(header);
-		}
-		(*headers)[hdr_num] = (BackupPageHeader2){.pos=cur_pos_out};
+		file->n_headers = hdr_num;
+		MemSet(&harena[hdr_num], 0, sizeof(BackupPageHeader2));
+		harena[hdr_num].pos = cur_pos_out;
+		*headers = harena;
 	}
-	parray_free(harray);
 
 	/* cleanup */
+	extent_reader_free(&reader);
+
 	if (in && fclose(in))
 		elog(ERROR, "Cannot close the source file \"%s\": %s",
 			 to_fullpath, strerror(errno));
@@ -2164,7 +4594,7 @@ send_pages(const char *to_fullpath, const char *from_fullpath,
 			 to_fullpath, strerror(errno));
 
 	pg_free(iter);
-	pg_free(in_buf);
+	pg_free(out_extent);
 	pg_free(out_buf);
 
 	return n_blocks_read;
@@ -2312,22 +4742,154 @@ copy_pages(const char *to_fullpath, const char *from_fullpath,
 }
 
 /*
- * Attempt to open header file, read content and return as
+ * Page headers of the file are compressed in the header map with zstd or lz4
+ * if the file itself is compressed with them, and with zlib otherwise.
+ */
+static CompressAlg
+header_map_compress_alg(pgFile *file)
+{
+	if (file->compress_alg == ZSTD_COMPRESS || file->compress_alg == LZ4_COMPRESS)
+		return file->compress_alg;
+
+	return ZLIB_COMPRESS;
+}
+
+/*
+ * Make the whole page header map of a backup available to reading threads.
+ *
+ * The map is immutable once the backup is done, so it is mapped into memory
+ * once and shared by all threads instead of opening the file for every
+ * data file. Where mmap() is not available, the map is read into memory.
+ */
+static bool
+open_header_map_image(HeaderMap *hdr_map, int elevel)
+{
+	bool        success = false;
+	int         fd;
+	struct stat st;
+
+	if (pg_atomic_read_u32(&hdr_map->is_mapped))
+	{
+		pg_read_barrier();
+		return hdr_map->map != NULL || hdr_map->map_size == 0;
+	}
+
+	pthread_lock(&(hdr_map->mutex));
+
+	if (pg_atomic_read_u32(&hdr_map->is_mapped))
+	{
+		pthread_mutex_unlock(&(hdr_map->mutex));
+		return hdr_map->map != NULL || hdr_map->map_size == 0;
+	}
+
+	fd = open(hdr_map->path, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+	{
+		pthread_mutex_unlock(&(hdr_map->mutex));
+		elog(elevel, "Cannot open header file \"%s\": %s", hdr_map->path, strerror(errno));
+		return false;
+	}
+
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		pthread_mutex_unlock(&(hdr_map->mutex));
+		elog(elevel, "Cannot stat header file \"%s\": %s", hdr_map->path, strerror(errno));
+		return false;
+	}
+
+	hdr_map->map_size = st.st_size;
+
+	if (hdr_map->map_size == 0)
+		success = true;
+	else
+	{
+#ifndef WIN32
+		void   *addr = mmap(NULL, hdr_map->map_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (addr == MAP_FAILED)
+			elog(WARNING, "Cannot map header file \"%s\": %s", hdr_map->path, strerror(errno));
+		else
+		{
+			hdr_map->map = addr;
+			success = true;
+		}
+#else
+		char   *buf = pgut_malloc(hdr_map->map_size);
+		size_t  done = 0;
+
+		while (done < hdr_map->map_size)
+		{
+			int rc = read(fd, buf + done, hdr_map->map_size - done);
+
+			if (rc <= 0)
+				break;
+			done += rc;
+		}
+
+		if (done != hdr_map->map_size)
+		{
+			elog(WARNING, "Cannot read header file \"%s\": %s", hdr_map->path, strerror(errno));
+			pg_free(buf);
+		}
+		else
+		{
+			hdr_map->map = buf;
+			success = true;
+		}
+#endif
+	}
+
+	close(fd);
+
+	if (success)
+	{
+		pg_write_barrier();
+		pg_atomic_write_u32(&hdr_map->is_mapped, 1);
+	}
+	else
+		hdr_map->map_size = 0;
+
+	pthread_mutex_unlock(&(hdr_map->mutex));
+
+	if (!success)
+		elog(elevel, "Cannot load header file \"%s\"", hdr_map->path);
+
+	return success;
+}
+
+/* Release the image of the page header map */
+static void
+close_header_map_image(HeaderMap *hdr_map)
+{
+	if (hdr_map->map)
+	{
+#ifndef WIN32
+		if (munmap(hdr_map->map, hdr_map->map_size) != 0)
+			elog(WARNING, "Cannot unmap header file \"%s\": %s",
+				 hdr_map->path, strerror(errno));
+#else
+		pg_free(hdr_map->map);
+#endif
+	}
+	hdr_map->map = NULL;
+	hdr_map->map_size = 0;
+	pg_atomic_write_u32(&hdr_map->is_mapped, 0);
+}
+
+/*
+ * Find headers of the file in header map, decompress them and return as
  * array of headers.
- * TODO: some access optimizations would be great here:
- * less fseeks, buffering, descriptor sharing, etc.
  */
 BackupPageHeader2*
 get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, bool strict)
 {
 	bool     success = false;
-	FILE    *in = NULL;
 	size_t   read_len = 0;
 	pg_crc32 hdr_crc;
 	BackupPageHeader2 *headers = NULL;
 	/* header decompression */
 	int     z_len = 0;
-	char   *zheaders = NULL;
 	const char *errormsg = NULL;
 
 	if (backup_version < 20400)
@@ -2336,22 +4898,17 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 	if (file->n_headers <= 0)
 		return NULL;
 
-	/* TODO: consider to make this descriptor thread-specific */
-	in = fopen(hdr_map->path, PG_BINARY_R);
-
-	if (!in)
-	{
-		elog(strict ? ERROR : WARNING, "Cannot open header file \"%s\": %s", hdr_map->path, strerror(errno));
+	if (!open_header_map_image(hdr_map, strict ? ERROR : WARNING))
 		return NULL;
-	}
-	/* disable buffering for header file */
-	setvbuf(in, NULL, _IONBF, 0);
 
-	if (fseeko(in, file->hdr_off, SEEK_SET))
+	if (file->hdr_size <= 0 ||
+		file->hdr_off > hdr_map->map_size ||
+		(size_t) file->hdr_size > hdr_map->map_size - file->hdr_off)
 	{
-		elog(strict ? ERROR : WARNING, "Cannot seek to position %llu in page header map \"%s\": %s",
-			file->hdr_off, hdr_map->path, strerror(errno));
-		goto cleanup;
+		elog(strict ? ERROR : WARNING, "Cannot read header file at offset: %llu len: %i \"%s\": "
+			 "file size is %lu", file->hdr_off, file->hdr_size, hdr_map->path,
+			 (unsigned long) hdr_map->map_size);
+		return NULL;
 	}
 
 	/*
@@ -2360,23 +4917,12 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 	 */
 	read_len = (file->n_headers+1) * sizeof(BackupPageHeader2);
 
-	/* allocate memory for compressed headers */
-	zheaders = pgut_malloc(file->hdr_size);
-	memset(zheaders, 0, file->hdr_size);
-
-	if (fread(zheaders, 1, file->hdr_size, in) != file->hdr_size)
-	{
-		elog(strict ? ERROR : WARNING, "Cannot read header file at offset: %llu len: %i \"%s\": %s",
-			file->hdr_off, file->hdr_size, hdr_map->path, strerror(errno));
-		goto cleanup;
-	}
-
 	/* allocate memory for uncompressed headers */
 	headers = pgut_malloc(read_len);
 	memset(headers, 0, read_len);
 
-	z_len = do_decompress(headers, read_len, zheaders, file->hdr_size,
-						  ZLIB_COMPRESS, &errormsg);
+	z_len = do_decompress(headers, read_len, hdr_map->map + file->hdr_off, file->hdr_size,
+						  header_map_compress_alg(file), &errormsg);
 	if (z_len <= 0)
 	{
 		if (errormsg)
@@ -2406,10 +4952,6 @@ get_data_file_headers(HeaderMap *hdr_map, pgFile *file, uint32 backup_version, b
 
 cleanup:
 
-	pg_free(zheaders);
-	if (in && fclose(in))
-		elog(ERROR, "Cannot close file \"%s\"", hdr_map->path);
-
 	if (!success)
 	{
 		pg_free(headers);
@@ -2448,33 +4990,7 @@ write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map,
 
 	/* compress headers */
 	z_len = do_compress(zheaders, read_len * 2, headers,
-						read_len, ZLIB_COMPRESS, 1, &errormsg);
-
-	/* writing to header map must be serialized */
-	pthread_lock(&(hdr_map->mutex)); /* what if we crash while trying to obtain mutex? */
-
-	if (!hdr_map->fp)
-	{
-		elog(LOG, "Creating page header map \"%s\"", map_path);
-
-		hdr_map->fp = fopen(map_path, PG_BINARY_A);
-		if (hdr_map->fp == NULL)
-			elog(ERROR, "Cannot open header file \"%s\": %s",
-				 map_path, strerror(errno));
-
-		/* enable buffering for header file */
-		hdr_map->buf = pgut_malloc(LARGE_CHUNK_SIZE);
-		setvbuf(hdr_map->fp, hdr_map->buf, _IOFBF, LARGE_CHUNK_SIZE);
-
-		/* update file permission */
-		if (chmod(map_path, FILE_PERMISSION) == -1)
-			elog(ERROR, "Cannot change mode of \"%s\": %s", map_path,
-				 strerror(errno));
-
-		file->hdr_off = 0;
-	}
-	else
-		file->hdr_off = hdr_map->offset;
+						read_len, header_map_compress_alg(file), 1, &errormsg);
 
 	if (z_len <= 0)
 	{
@@ -2486,20 +5002,55 @@ write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map,
 				 file->rel_path, z_len);
 	}
 
+	/* the map is created by the first writer */
+	if (!pg_atomic_read_u32(&hdr_map->is_open))
+	{
+		pthread_lock(&(hdr_map->mutex));
+
+		if (!pg_atomic_read_u32(&hdr_map->is_open))
+		{
+			elog(LOG, "Creating page header map \"%s\"", map_path);
+
+			hdr_map->fd = open(map_path, O_CREAT | O_WRONLY | O_TRUNC | PG_BINARY,
+							   FILE_PERMISSION);
+			if (hdr_map->fd < 0)
+			{
+				pthread_mutex_unlock(&(hdr_map->mutex));
+				elog(ERROR, "Cannot open header file \"%s\": %s",
+					 map_path, strerror(errno));
+			}
+
+			/* update file permission */
+			if (chmod(map_path, FILE_PERMISSION) == -1)
+			{
+				pthread_mutex_unlock(&(hdr_map->mutex));
+				elog(ERROR, "Cannot change mode of \"%s\": %s", map_path,
+					 strerror(errno));
+			}
+
+			/* publish fd only after it is set */
+			pg_write_barrier();
+			pg_atomic_write_u32(&hdr_map->is_open, 1);
+		}
+
+		pthread_mutex_unlock(&(hdr_map->mutex));
+	}
+	else
+		pg_read_barrier();
+
+	/*
+	 * Reserve space in the map and write headers there. Writers don't wait
+	 * for each other, so the map is filled in the order of reservations.
+	 */
+	file->hdr_off = pg_atomic_fetch_add_u64(&hdr_map->offset, z_len);
+
 	elog(VERBOSE, "Writing headers for file \"%s\" offset: %llu, len: %i, crc: %u",
 			file->rel_path, file->hdr_off, z_len, file->hdr_crc);
 
-	if (fwrite(zheaders, 1, z_len, hdr_map->fp) != z_len)
-	{
-		pthread_mutex_unlock(&(hdr_map->mutex));
+	if (pwrite(hdr_map->fd, zheaders, z_len, file->hdr_off) != z_len)
 		elog(ERROR, "Cannot write to file \"%s\": %s", map_path, strerror(errno));
-	}
 
 	file->hdr_size = z_len;	  /* save the length of compressed headers */
-	hdr_map->offset += z_len; /* update current offset in map */
-
-	/* End critical section */
-	pthread_mutex_unlock(&(hdr_map->mutex));
 
 	pg_free(zheaders);
 }
@@ -2507,8 +5058,12 @@ write_page_headers(BackupPageHeader2 *headers, pgFile *file, HeaderMap *hdr_map,
 void
 init_header_map(pgBackup *backup)
 {
-	backup->hdr_map.fp = NULL;
-	backup->hdr_map.buf = NULL;
+	backup->hdr_map.fd = -1;
+	pg_atomic_init_u32(&backup->hdr_map.is_open, 0);
+	pg_atomic_init_u64(&backup->hdr_map.offset, 0);
+	backup->hdr_map.map = NULL;
+	backup->hdr_map.map_size = 0;
+	pg_atomic_init_u32(&backup->hdr_map.is_mapped, 0);
 	join_path_components(backup->hdr_map.path, backup->root_dir, HEADER_MAP);
 	join_path_components(backup->hdr_map.path_tmp, backup->root_dir, HEADER_MAP_TMP);
 	backup->hdr_map.mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
@@ -2518,10 +5073,11 @@ void
 cleanup_header_map(HeaderMap *hdr_map)
 {
 	/* cleanup descriptor */
-	if (hdr_map->fp && fclose(hdr_map->fp))
+	if (pg_atomic_read_u32(&hdr_map->is_open) && close(hdr_map->fd))
 		elog(ERROR, "Cannot close file \"%s\"", hdr_map->path);
-	hdr_map->fp = NULL;
-	hdr_map->offset = 0;
-	pg_free(hdr_map->buf);
-	hdr_map->buf = NULL;
+	hdr_map->fd = -1;
+	pg_atomic_write_u32(&hdr_map->is_open, 0);
+	pg_atomic_write_u64(&hdr_map->offset, 0);
+
+	close_header_map_image(hdr_map);
 }
@@ -65,6 +65,32 @@ datapagemap_add(datapagemap_t *map, BlockNumber blkno)
 	map->bitmap[offset] |= (1 << bitno);
 }
 
+/*
+ * Add all blocks of the src bitmap to the dst bitmap.
+ * The src bitmap is consumed.
+ */
+void
+datapagemap_merge(datapagemap_t *dst, datapagemap_t *src)
+{
+	int			i;
+
+	/* take over the bigger bitmap, so that there is nothing to enlarge */
+	if (dst->bitmapsize < src->bitmapsize)
+	{
+		datapagemap_t tmp = *dst;
+
+		*dst = *src;
+		*src = tmp;
+	}
+
+	for (i = 0; i < src->bitmapsize; i++)
+		dst->bitmap[i] |= src->bitmap[i];
+
+	pg_free(src->bitmap);
+	src->bitmap = NULL;
+	src->bitmapsize = 0;
+}
+
 /*
  * Start iterating through all entries in the page map.
  *
@@ -111,3 +137,39 @@ datapagemap_next(datapagemap_iterator_t *iter, BlockNumber *blkno)
 	return false;
 }
 
+/*
+ * Get the next range of blocks, which starts and ends with a set bit.
+ *
+ * Set bits, separated by no more than max_gap unset ones, are coalesced
+ * into one range, so that a caller can fetch them by a single read.
+ * The range is limited to max_blocks blocks.
+ */
+bool
+datapagemap_next_range(datapagemap_iterator_t *iter, BlockNumber max_gap,
+					   BlockNumber max_blocks, BlockNumber *start,
+					   BlockNumber *nblocks)
+{
+	datapagemap_t *map = iter->map;
+	BlockNumber last;
+	BlockNumber blk;
+
+	if (!datapagemap_next(iter, start))
+		return false;
+
+	last = *start;
+	for (blk = last + 1; blk - *start < max_blocks && blk - last <= max_gap + 1; blk++)
+	{
+		int			offset = blk / 8;
+
+		if (offset >= map->bitmapsize)
+			break;
+
+		if (map->bitmap[offset] & (1 << (blk % 8)))
+			last = blk;
+	}
+
+	iter->nextblkno = last + 1;
+	*nblocks = last - *start + 1;
+
+	return true;
+}
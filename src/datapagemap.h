@@ -28,7 +28,11 @@ typedef struct datapagemap datapagemap_t;
 typedef struct datapagemap_iterator datapagemap_iterator_t;
 
 extern void datapagemap_add(datapagemap_t *map, BlockNumber blkno);
+extern void datapagemap_merge(datapagemap_t *dst, datapagemap_t *src);
 extern datapagemap_iterator_t *datapagemap_iterate(datapagemap_t *map);
 extern bool datapagemap_next(datapagemap_iterator_t *iter, BlockNumber *blkno);
+extern bool datapagemap_next_range(datapagemap_iterator_t *iter,
+								   BlockNumber max_gap, BlockNumber max_blocks,
+								   BlockNumber *start, BlockNumber *nblocks);
 
 #endif							/* DATAPAGEMAP_H */
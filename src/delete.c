@@ -970,6 +970,8 @@ delete_walfiles_in_tli(InstanceState *instanceState, XLogRecPtr keep_lsn, timeli
 					elog(VERBOSE, "Removed partial WAL segment \"%s\"", wal_fullpath);
 				else if (wal_file->type == BACKUP_HISTORY_FILE)
 					elog(VERBOSE, "Removed backup history file \"%s\"", wal_fullpath);
+				else if (wal_file->type == BLOCK_SUMMARY_FILE)
+					elog(VERBOSE, "Removed block summary file \"%s\"", wal_fullpath);
 			}
 
 			wal_deleted = true;
@@ -19,6 +19,7 @@
 #include "catalog/pg_tablespace.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 
@@ -126,7 +127,11 @@ static char dir_check_file(pgFile *file, bool backup_logs);
 
 static void dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 								   bool exclude, bool follow_symlink, bool backup_logs,
-								   bool skip_hidden, int external_dir_num, fio_location location);
+								   bool skip_hidden, int external_dir_num, fio_location location,
+								   int depth, parray *tasks);
+static void dir_list_file_parallel(parray *files, pgFile *root_file, const char *root,
+								   bool exclude, bool follow_symlink, bool backup_logs,
+								   bool skip_hidden, int external_dir_num);
 static void opt_path_map(ConfigOption *opt, const char *arg,
 						 TablespaceList *list, const char *type);
 static void cleanup_tablespace(const char *path);
@@ -134,6 +139,41 @@ static void cleanup_tablespace(const char *path);
 static void control_string_bad_format(const char* str);
 
 
+/*
+ * Subdirectories of this depth are listed in parallel by dir_list_file().
+ * In PGDATA these are database directories in "base" and tablespaces
+ * in "pg_tblspc", which hold almost all the files of the cluster.
+ */
+#define DIR_LIST_SPLIT_DEPTH 2
+
+/* Subdirectory, listed by one of the threads */
+typedef struct
+{
+	pgFile	   *dir;
+	char	   *path;			/* full path of the directory */
+	size_t		pos;			/* position of its contents in the list */
+	parray	   *files;			/* contents of the directory */
+} dir_list_task;
+
+typedef struct
+{
+	parray	   *tasks;
+	bool		exclude;
+	bool		follow_symlink;
+	bool		backup_logs;
+	bool		skip_hidden;
+	int			external_dir_num;
+
+	ForkJoin   *fork_join;
+	int			thread_num;
+
+	/*
+	 * Return value from the thread.
+	 * 0 means there is no error, 1 - there is an error.
+	 */
+	int			ret;
+} dir_list_arg;
+
 /* Tablespace mapping */
 static TablespaceList tablespace_dirs = {NULL, NULL};
 /* Extra directories mapping */
@@ -195,6 +235,43 @@ pgFileNew(const char *path, const char *rel_path, bool follow_symlink,
 	return file;
 }
 
+/*
+ * Same as pgFileNew(), but for the entry "name" of the open directory.
+ * Local entries are stat'ed relative to the directory descriptor, so the
+ * kernel does not walk the whole path for every file.
+ */
+static pgFile *
+pgFileNewAt(DIR *dir, const char *name, const char *path, const char *rel_path,
+			bool follow_symlink, int external_dir_num, fio_location location)
+{
+#ifndef WIN32
+	struct stat		st;
+	pgFile		   *file;
+
+	if (fio_is_remote(location))
+		return pgFileNew(path, rel_path, follow_symlink, external_dir_num, location);
+
+	if (fstatat(dirfd(dir), name, &st, follow_symlink ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+	{
+		/* file not found is not an error case */
+		if (errno == ENOENT)
+			return NULL;
+		elog(ERROR, "Cannot stat file \"%s\": %s", path,
+			strerror(errno));
+	}
+
+	file = pgFileInit(rel_path);
+	file->size = st.st_size;
+	file->mode = st.st_mode;
+	file->mtime = st.st_mtime;
+	file->external_dir_num = external_dir_num;
+
+	return file;
+#else
+	return pgFileNew(path, rel_path, follow_symlink, external_dir_num, location);
+#endif
+}
+
 pgFile *
 pgFileInit(const char *rel_path)
 {
@@ -224,8 +301,6 @@ pgFileInit(const char *rel_path)
 	/* Number of blocks backed up during backup */
 	file->n_headers = 0;
 
-	// May be add?
-	// pg_atomic_clear_flag(file->lock);
 	file->excluded = false;
 	return file;
 }
@@ -272,22 +347,22 @@ pgFileFree(void *file)
 
 	file_ptr = (pgFile *) file;
 
+	while (file_ptr->chain_copies)
+	{
+		pgFileCopy *copy = file_ptr->chain_copies;
+
+		file_ptr->chain_copies = copy->next;
+		pgFileFree(copy->file);
+		pfree(copy);
+	}
+
 	pfree(file_ptr->linked);
 	pfree(file_ptr->rel_path);
+	pfree(file_ptr->ranges);
 
 	pfree(file);
 }
 
-/* Compare two pgFile with their path in ascending order of ASCII code. */
-int
-pgFileMapComparePath(const void *f1, const void *f2)
-{
-	page_map_entry *f1p = *(page_map_entry **)f1;
-	page_map_entry *f2p = *(page_map_entry **)f2;
-
-	return strcmp(f1p->path, f2p->path);
-}
-
 /* Compare two pgFile with their name in ascending order of ASCII code. */
 int
 pgFileCompareName(const void *f1, const void *f2)
@@ -435,6 +510,9 @@ db_map_entry_free(void *entry)
  * When follow_symlink is true, symbolic link is ignored and only file or
  * directory linked to will be listed.
  *
+ * Local directories are listed by num_threads threads, the order of
+ * the files is the same as in single-threaded listing.
+ *
  * TODO: make it strictly local
  */
 void
@@ -466,8 +544,13 @@ dir_list_file(parray *files, const char *root, bool exclude, bool follow_symlink
 	if (add_root)
 		parray_append(files, file);
 
-	dir_list_file_internal(files, file, root, exclude, follow_symlink,
-						   backup_logs, skip_hidden, external_dir_num, location);
+	if (num_threads > 1 && !fio_is_remote(location))
+		dir_list_file_parallel(files, file, root, exclude, follow_symlink,
+							   backup_logs, skip_hidden, external_dir_num);
+	else
+		dir_list_file_internal(files, file, root, exclude, follow_symlink,
+							   backup_logs, skip_hidden, external_dir_num, location,
+							   0, NULL);
 
 	if (!add_root)
 		pgFileFree(file);
@@ -642,12 +725,17 @@ dir_check_file(pgFile *file, bool backup_logs)
  * "files" files from pgdata_exclude_files and directories from
  * pgdata_exclude_dir.
  *
+ * If "tasks" is not NULL, subdirectories of DIR_LIST_SPLIT_DEPTH are not
+ * listed, but added to "tasks" to be listed by other threads. "depth" is
+ * the depth of parent_dir, starting with 0 for the root directory.
+ *
  * TODO: should we check for interrupt here ?
  */
 static void
 dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 					   bool exclude, bool follow_symlink, bool backup_logs,
-					   bool skip_hidden, int external_dir_num, fio_location location)
+					   bool skip_hidden, int external_dir_num, fio_location location,
+					   int depth, parray *tasks)
 {
 	DIR			  *dir;
 	struct dirent *dent;
@@ -679,8 +767,8 @@ dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 		join_path_components(child, parent_dir, dent->d_name);
 		join_path_components(rel_child, parent->rel_path, dent->d_name);
 
-		file = pgFileNew(child, rel_child, follow_symlink, external_dir_num,
-						 location);
+		file = pgFileNewAt(dir, dent->d_name, child, rel_child, follow_symlink,
+						   external_dir_num, location);
 		if (file == NULL)
 			continue;
 
@@ -735,8 +823,22 @@ dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 		 * recursively.
 		 */
 		if (S_ISDIR(file->mode))
-			dir_list_file_internal(files, file, child, exclude, follow_symlink,
-								   backup_logs, skip_hidden, external_dir_num, location);
+		{
+			if (tasks && depth + 1 >= DIR_LIST_SPLIT_DEPTH)
+			{
+				dir_list_task *task = pgut_new(dir_list_task);
+
+				task->dir = file;
+				task->path = pgut_strdup(child);
+				task->pos = parray_num(files);
+				task->files = parray_new();
+				parray_append(tasks, task);
+			}
+			else
+				dir_list_file_internal(files, file, child, exclude, follow_symlink,
+									   backup_logs, skip_hidden, external_dir_num,
+									   location, depth + 1, tasks);
+		}
 	}
 
 	if (errno && errno != ENOENT)
@@ -749,6 +851,111 @@ dir_list_file_internal(parray *files, pgFile *parent, const char *parent_dir,
 	fio_closedir(dir);
 }
 
+/* List the subdirectories, dealt to the threads */
+static void *
+dir_list_worker(void *arg)
+{
+	dir_list_arg *arguments = (dir_list_arg *) arg;
+	size_t		task_num;
+
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &task_num))
+	{
+		dir_list_task *task = (dir_list_task *) parray_get(arguments->tasks, task_num);
+
+		if (interrupted || thread_interrupted)
+			elog(ERROR, "Interrupted during directory listing");
+
+		dir_list_file_internal(task->files, task->dir, task->path,
+							   arguments->exclude, arguments->follow_symlink,
+							   arguments->backup_logs, arguments->skip_hidden,
+							   arguments->external_dir_num, FIO_LOCAL_HOST,
+							   DIR_LIST_SPLIT_DEPTH, NULL);
+	}
+
+	/* Listing is successful */
+	arguments->ret = 0;
+
+	return NULL;
+}
+
+/*
+ * List local directory "root" on num_threads threads. The top of the tree
+ * is listed by the calling thread, and the subdirectories of
+ * DIR_LIST_SPLIT_DEPTH are dealt to the threads. Their contents are
+ * then spliced into "files" right after the subdirectories themselves.
+ */
+static void
+dir_list_file_parallel(parray *files, pgFile *root_file, const char *root,
+					   bool exclude, bool follow_symlink, bool backup_logs,
+					   bool skip_hidden, int external_dir_num)
+{
+	parray	   *top_files = parray_new();
+	parray	   *tasks = parray_new();
+	ForkJoin   *fork_join;
+	dir_list_arg *threads_args;
+	size_t		top_pos = 0;
+	int			i;
+
+	dir_list_file_internal(top_files, root_file, root, exclude, follow_symlink,
+						   backup_logs, skip_hidden, external_dir_num,
+						   FIO_LOCAL_HOST, 0, tasks);
+
+	if (parray_num(tasks) > 0)
+	{
+		fork_join = fork_join_create(num_threads, parray_num(tasks));
+		threads_args = (dir_list_arg *) palloc(sizeof(dir_list_arg) * num_threads);
+
+		for (i = 0; i < num_threads; i++)
+		{
+			dir_list_arg *arg = &(threads_args[i]);
+
+			arg->tasks = tasks;
+			arg->exclude = exclude;
+			arg->follow_symlink = follow_symlink;
+			arg->backup_logs = backup_logs;
+			arg->skip_hidden = skip_hidden;
+			arg->external_dir_num = external_dir_num;
+			arg->fork_join = fork_join;
+			arg->thread_num = i + 1;
+			/* By default there are some error */
+			arg->ret = 1;
+		}
+
+		thread_interrupted = false;
+		fork_join_run(fork_join, dir_list_worker, threads_args, sizeof(dir_list_arg));
+
+		for (i = 0; i < num_threads; i++)
+		{
+			if (threads_args[i].ret == 1)
+				elog(ERROR, "Cannot list directory \"%s\"", root);
+		}
+
+		fork_join_free(fork_join);
+		pfree(threads_args);
+	}
+
+	/* splice the contents of subdirectories into the list */
+	for (i = 0; i < parray_num(tasks); i++)
+	{
+		dir_list_task *task = (dir_list_task *) parray_get(tasks, i);
+
+		for (; top_pos < task->pos; top_pos++)
+			parray_append(files, parray_get(top_files, top_pos));
+
+		parray_concat(files, task->files);
+
+		parray_free(task->files);
+		pfree(task->path);
+		pfree(task);
+	}
+
+	for (; top_pos < parray_num(top_files); top_pos++)
+		parray_append(files, parray_get(top_files, top_pos));
+
+	parray_free(top_files);
+	parray_free(tasks);
+}
+
 /*
  * Retrieve tablespace path, either relocated or original depending on whether
  * -T was passed or not.
@@ -1760,20 +1967,6 @@ cleanup_tablespace(const char *path)
 	parray_free(files);
 }
 
-/*
- * Clear the synchronisation locks in a parray of (pgFile *)'s
- */
-void
-pfilearray_clear_locks(parray *file_list)
-{
-	int i;
-	for (i = 0; i < parray_num(file_list); i++)
-	{
-		pgFile *file = (pgFile *) parray_get(file_list, i);
-		pg_atomic_clear_flag(&file->lock);
-	}
-}
-
 static inline bool
 is_forkname(char *name, size_t *pos, const char *forkname)
 {
@@ -0,0 +1,570 @@
+/*-------------------------------------------------------------------------
+ *
+ * filelist.c: binary file list of the backup
+ *
+ * Portions Copyright (c) 2009-2011, NIPPON TELEGRAPH AND TELEPHONE CORPORATION
+ * Portions Copyright (c) 2015-2025, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include "utils/file.h"
+
+/*
+ * DATABASE_FILE_INDEX consists of the header, the array of fixed-width
+ * records sorted by path and external directory number, and the table of
+ * zero-terminated strings, which the records point to.
+ *
+ * The file is used as is: the whole list is loaded without any parsing,
+ * and a single file is found by binary search over the records, so that
+ * the list need not be loaded at all. All fields are stored in little-endian
+ * byte order, so that a backup can be read on a machine of the other
+ * endianness. On little-endian machines the records are used as is.
+ *
+ * The text format of DATABASE_FILE_LIST is still read for backups taken
+ * by older versions and is printed by "show --files".
+ */
+#define FILE_LIST_MAGIC		0x4C464250	/* "PBFL" */
+#define FILE_LIST_VERSION	1
+
+typedef struct FileListHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint32		record_size;	/* sizeof(FileListRecord) */
+	uint32		n_records;
+	uint64		strings_off;	/* position of the string table */
+	uint64		strings_size;
+} FileListHeader;
+
+typedef struct FileListRecord
+{
+	int64		write_size;
+	int64		uncompressed_size;
+	uint64		hdr_off;
+	uint64		path;			/* offsets in the string table */
+	uint64		linked;			/* 0 if the file is not a link */
+	uint32		mode;
+	uint32		crc;
+	uint32		dbOid;
+	int32		external_dir_num;
+	int32		segno;
+	int32		n_blocks;
+	int32		n_headers;
+	uint32		hdr_crc;
+	int32		hdr_size;
+	uint8		is_datafile;
+	uint8		is_cfs;
+	uint8		compress_alg;
+	uint8		padding;
+} FileListRecord;
+
+/* buffered writer of the file through fio */
+typedef struct FileListWriter
+{
+	int			fd;
+	const char *path;
+	char	   *buf;
+	size_t		len;
+	pg_crc32	crc;
+} FileListWriter;
+
+struct FileListIndex
+{
+	char	   *path;
+	char	   *image;			/* content of the file */
+	size_t		image_size;
+	bool		mapped;			/* image is mmap()'ed */
+	const FileListRecord *records;
+	uint32		n_records;
+	const char *strings;
+	uint64		strings_size;
+};
+
+static void write_image(FileListWriter *writer, const void *data, size_t len);
+static void flush_image(FileListWriter *writer);
+static const char *index_string(FileListIndex *index, uint64 off);
+static void record_to_file(FileListIndex *index, const FileListRecord *rec,
+						   pgFile *file);
+
+/*
+ * Write the files of the list into DATABASE_FILE_INDEX at 'path'.
+ * Disappeared files are skipped. CRC of the written content
+ * is returned in 'crc'.
+ */
+void
+write_file_list_index(const char *path, parray *files, pg_crc32 *crc,
+					  bool sync)
+{
+	FileListWriter writer;
+	char		path_temp[MAXPGPATH];
+	parray	   *sorted;
+	FileListHeader header;
+	uint64		strings_size = 1;	/* leading empty string */
+	uint64		string_off = 1;
+	size_t		i;
+
+	StaticAssertStmt(sizeof(FileListHeader) == 32 && sizeof(FileListRecord) == 80,
+					 "layout of the file list must not depend on the platform");
+
+	/* records are sorted by path, keep the order of the caller's list */
+	sorted = parray_new();
+	for (i = 0; i < parray_num(files); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+
+		/* Ignore disappeared file */
+		if (file->write_size == FILE_NOT_FOUND)
+			continue;
+
+		strings_size += strlen(file->rel_path) + 1;
+		if (file->linked)
+			strings_size += strlen(file->linked) + 1;
+
+		parray_append(sorted, file);
+	}
+	parray_qsort(sorted, pgFileCompareRelPathWithExternal);
+
+	if (parray_num(sorted) > PG_UINT32_MAX)
+		elog(ERROR, "Too many files in the backup: %zu", parray_num(sorted));
+
+	snprintf(path_temp, sizeof(path_temp), "%s.tmp", path);
+
+	writer.fd = fio_open(path_temp, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+						 FIO_BACKUP_HOST);
+	if (writer.fd < 0)
+		elog(ERROR, "Cannot open file list \"%s\": %s", path_temp,
+			 strerror(errno));
+
+	if (fio_chmod(path_temp, FILE_PERMISSION, FIO_BACKUP_HOST) == -1)
+		elog(ERROR, "Cannot change mode of \"%s\": %s", path_temp,
+			 strerror(errno));
+
+	writer.path = path_temp;
+	writer.buf = pgut_malloc(STDIO_BUFSIZE);
+	writer.len = 0;
+	INIT_FILE_CRC32(true, writer.crc);
+
+	MemSet(&header, 0, sizeof(header));
+	header.magic = LE32(FILE_LIST_MAGIC);
+	header.version = LE32(FILE_LIST_VERSION);
+	header.record_size = LE32(sizeof(FileListRecord));
+	header.n_records = LE32(parray_num(sorted));
+	header.strings_off = LE64(sizeof(FileListHeader) +
+		(uint64) parray_num(sorted) * sizeof(FileListRecord));
+	header.strings_size = LE64(strings_size);
+
+	write_image(&writer, &header, sizeof(header));
+
+	for (i = 0; i < parray_num(sorted); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(sorted, i);
+		FileListRecord rec;
+
+		/* keep the values the text format would give back */
+		MemSet(&rec, 0, sizeof(rec));
+		rec.write_size = LE64(file->write_size);
+		rec.uncompressed_size = LE64(file->uncompressed_size != 0 ?
+			file->uncompressed_size : file->write_size);
+		rec.mode = LE32(file->mode);
+		rec.crc = LE32(file->crc);
+		rec.dbOid = LE32(file->dbOid);
+		rec.external_dir_num = LE32(file->external_dir_num);
+		rec.segno = LE32(file->is_datafile ? file->segno : 0);
+		rec.n_blocks = LE32(file->n_blocks > 0 ? file->n_blocks : BLOCKNUM_INVALID);
+		if (file->n_headers > 0)
+		{
+			rec.n_headers = LE32(file->n_headers);
+			rec.hdr_crc = LE32(file->hdr_crc);
+			rec.hdr_off = LE64(file->hdr_off);
+			rec.hdr_size = LE32(file->hdr_size);
+		}
+		rec.is_datafile = file->is_datafile ? 1 : 0;
+		rec.is_cfs = file->is_cfs ? 1 : 0;
+		rec.compress_alg = (uint8) file->compress_alg;
+
+		rec.path = LE64(string_off);
+		string_off += strlen(file->rel_path) + 1;
+		if (file->linked)
+		{
+			rec.linked = LE64(string_off);
+			string_off += strlen(file->linked) + 1;
+		}
+
+		write_image(&writer, &rec, sizeof(rec));
+	}
+
+	/* the string table, in the same order */
+	write_image(&writer, "", 1);
+	for (i = 0; i < parray_num(sorted); i++)
+	{
+		pgFile	   *file = (pgFile *) parray_get(sorted, i);
+
+		write_image(&writer, file->rel_path, strlen(file->rel_path) + 1);
+		if (file->linked)
+			write_image(&writer, file->linked, strlen(file->linked) + 1);
+	}
+
+	flush_image(&writer);
+	FIN_FILE_CRC32(true, writer.crc);
+	*crc = writer.crc;
+
+	if (fio_close(writer.fd) != 0)
+		elog(ERROR, "Cannot close file list \"%s\": %s",
+			 path_temp, strerror(errno));
+
+	if (sync && fio_sync(path_temp, FIO_BACKUP_HOST) != 0)
+		elog(ERROR, "Cannot sync file list \"%s\": %s",
+			 path_temp, strerror(errno));
+
+	if (fio_rename(path_temp, path, FIO_BACKUP_HOST) < 0)
+		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+			 path_temp, path, strerror(errno));
+
+	pg_free(writer.buf);
+	parray_free(sorted);
+}
+
+/*
+ * Records are small, collect them into a large buffer, so that the remote
+ * agent gets a message per STDIO_BUFSIZE bytes rather than per record.
+ */
+static void
+write_image(FileListWriter *writer, const void *data, size_t len)
+{
+	COMP_FILE_CRC32(true, writer->crc, data, len);
+
+	while (len > 0)
+	{
+		size_t		chunk = Min(len, STDIO_BUFSIZE - writer->len);
+
+		memcpy(writer->buf + writer->len, data, chunk);
+		writer->len += chunk;
+		data = (const char *) data + chunk;
+		len -= chunk;
+
+		if (writer->len == STDIO_BUFSIZE)
+			flush_image(writer);
+	}
+}
+
+static void
+flush_image(FileListWriter *writer)
+{
+	if (writer->len == 0)
+		return;
+
+	if (fio_write(writer->fd, writer->buf, writer->len) != writer->len)
+		elog(ERROR, "Cannot write file list \"%s\": %s",
+			 writer->path, strerror(errno));
+
+	writer->len = 0;
+}
+
+/*
+ * Open DATABASE_FILE_INDEX at 'path'. The local file is mapped into memory,
+ * the remote one is read.
+ *
+ * Returns NULL with errno ENOENT if the file does not exist, i.e. the backup
+ * was taken by an older version. Other failures are reported with 'elevel'.
+ */
+FileListIndex *
+file_list_index_open(const char *path, int elevel)
+{
+	FileListIndex *index;
+	const FileListHeader *header;
+
+	index = pgut_new0(FileListIndex);
+	index->path = pgut_strdup(path);
+
+	if (fio_is_remote(FIO_BACKUP_HOST))
+	{
+		if (fio_access(path, F_OK, FIO_BACKUP_HOST) != 0)
+			goto missing;
+
+		index->image = slurpFile(path, "", &index->image_size, true, FIO_BACKUP_HOST);
+		if (index->image == NULL)
+		{
+			elog(elevel, "Cannot read file list \"%s\": %s", path, strerror(errno));
+			goto fail;
+		}
+	}
+	else
+	{
+		int			fd;
+		struct stat st;
+
+		fd = open(path, O_RDONLY | PG_BINARY, 0);
+		if (fd < 0)
+		{
+			if (errno == ENOENT)
+				goto missing;
+			elog(elevel, "Cannot open file list \"%s\": %s", path, strerror(errno));
+			goto fail;
+		}
+
+		if (fstat(fd, &st) != 0)
+		{
+			elog(elevel, "Cannot stat file list \"%s\": %s", path, strerror(errno));
+			close(fd);
+			goto fail;
+		}
+		index->image_size = st.st_size;
+
+		if (index->image_size >= sizeof(FileListHeader))
+		{
+#ifndef WIN32
+			void	   *addr = mmap(NULL, index->image_size, PROT_READ, MAP_SHARED, fd, 0);
+
+			if (addr == MAP_FAILED)
+			{
+				elog(elevel, "Cannot map file list \"%s\": %s", path, strerror(errno));
+				close(fd);
+				goto fail;
+			}
+			index->image = addr;
+			index->mapped = true;
+#else
+			size_t		done = 0;
+
+			index->image = pgut_malloc(index->image_size);
+			while (done < index->image_size)
+			{
+				int			rc = read(fd, index->image + done, index->image_size - done);
+
+				if (rc <= 0)
+					break;
+				done += rc;
+			}
+
+			if (done != index->image_size)
+			{
+				elog(elevel, "Cannot read file list \"%s\": %s", path, strerror(errno));
+				close(fd);
+				goto fail;
+			}
+#endif
+		}
+		close(fd);
+	}
+
+	header = (const FileListHeader *) index->image;
+	if (index->image_size < sizeof(FileListHeader) ||
+		LE32(header->magic) != FILE_LIST_MAGIC)
+	{
+		elog(elevel, "File list \"%s\" has invalid format", path);
+		goto fail;
+	}
+
+	if (LE32(header->version) != FILE_LIST_VERSION ||
+		LE32(header->record_size) != sizeof(FileListRecord))
+	{
+		elog(elevel, "File list \"%s\" has unsupported version %u",
+			 path, LE32(header->version));
+		goto fail;
+	}
+
+	/* the string table follows the records and ends with zero */
+	if (LE64(header->strings_off) != sizeof(FileListHeader) +
+			(uint64) LE32(header->n_records) * sizeof(FileListRecord) ||
+		LE64(header->strings_size) == 0 ||
+		LE64(header->strings_off) + LE64(header->strings_size) != index->image_size ||
+		index->image[index->image_size - 1] != '\0')
+	{
+		elog(elevel, "File list \"%s\" is truncated", path);
+		goto fail;
+	}
+
+	index->records = (const FileListRecord *) (index->image + sizeof(FileListHeader));
+	index->n_records = LE32(header->n_records);
+	index->strings = index->image + LE64(header->strings_off);
+	index->strings_size = LE64(header->strings_size);
+
+	return index;
+
+missing:
+	file_list_index_close(index);
+	errno = ENOENT;
+	return NULL;
+
+fail:
+	file_list_index_close(index);
+	errno = EINVAL;
+	return NULL;
+}
+
+void
+file_list_index_close(FileListIndex *index)
+{
+	if (index->image)
+	{
+#ifndef WIN32
+		if (index->mapped)
+		{
+			if (munmap(index->image, index->image_size) != 0)
+				elog(WARNING, "Cannot unmap file list \"%s\": %s",
+					 index->path, strerror(errno));
+		}
+		else
+#endif
+			pg_free(index->image);
+	}
+
+	pg_free(index->path);
+	pg_free(index);
+}
+
+/*
+ * CRC of the whole file, to be compared with content-crc of the backup.
+ */
+pg_crc32
+file_list_index_crc(FileListIndex *index)
+{
+	pg_crc32	crc;
+
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, index->image, index->image_size);
+	FIN_FILE_CRC32(true, crc);
+
+	return crc;
+}
+
+/* Number of files in the index */
+uint32
+file_list_index_size(FileListIndex *index)
+{
+	return index->n_records;
+}
+
+/*
+ * Fill 'file' with the record at position 'pos' in the order of path.
+ * rel_path and name of the file point into the index and are valid until
+ * the index is closed, the link target is not filled.
+ */
+void
+file_list_index_get(FileListIndex *index, uint32 pos, pgFile *file)
+{
+	const FileListRecord *rec = &index->records[pos];
+	char	   *name;
+
+	Assert(pos < index->n_records);
+
+	MemSet(file, 0, sizeof(pgFile));
+	file->rel_path = (char *) index_string(index, LE64(rec->path));
+	name = last_dir_separator(file->rel_path);
+	file->name = name ? name + 1 : file->rel_path;
+	record_to_file(index, rec, file);
+}
+
+/*
+ * Create pgFile for the record at position 'pos'.
+ */
+pgFile *
+file_list_index_get_file(FileListIndex *index, uint32 pos)
+{
+	const FileListRecord *rec = &index->records[pos];
+	pgFile	   *file;
+
+	Assert(pos < index->n_records);
+
+	file = pgFileInit(index_string(index, LE64(rec->path)));
+	record_to_file(index, rec, file);
+	if (rec->linked)
+	{
+		file->linked = pgut_strdup(index_string(index, LE64(rec->linked)));
+		canonicalize_path(file->linked);
+	}
+
+	return file;
+}
+
+/*
+ * Create pgFile for every record of the index,
+ * in the order of path and external directory number.
+ */
+parray *
+file_list_index_get_files(FileListIndex *index)
+{
+	parray	   *files = parray_new();
+	uint32		i;
+
+	for (i = 0; i < index->n_records; i++)
+		parray_append(files, file_list_index_get_file(index, i));
+
+	return files;
+}
+
+/*
+ * Find the file by binary search and fill 'file' with its record,
+ * as file_list_index_get() does.
+ */
+bool
+file_list_index_find(FileListIndex *index, const char *rel_path,
+					 int external_dir_num, pgFile *file)
+{
+	uint32		lo = 0;
+	uint32		hi = index->n_records;
+
+	while (lo < hi)
+	{
+		uint32		mid = lo + (hi - lo) / 2;
+		const FileListRecord *rec = &index->records[mid];
+		int32		rec_dir_num = (int32) LE32(rec->external_dir_num);
+		int			cmp;
+
+		cmp = strcmp(index_string(index, LE64(rec->path)), rel_path);
+		if (cmp == 0)
+			cmp = (rec_dir_num > external_dir_num) -
+				  (rec_dir_num < external_dir_num);
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else if (cmp > 0)
+			hi = mid;
+		else
+		{
+			file_list_index_get(index, mid, file);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static const char *
+index_string(FileListIndex *index, uint64 off)
+{
+	if (off >= index->strings_size)
+		elog(ERROR, "File list \"%s\" is corrupted: invalid string offset " UINT64_FORMAT,
+			 index->path, off);
+
+	return index->strings + off;
+}
+
+static void
+record_to_file(FileListIndex *index, const FileListRecord *rec, pgFile *file)
+{
+	file->write_size = (int64) LE64(rec->write_size);
+	file->uncompressed_size = (int64) LE64(rec->uncompressed_size);
+	file->mode = (mode_t) LE32(rec->mode);
+	file->crc = LE32(rec->crc);
+	file->dbOid = LE32(rec->dbOid);
+	file->external_dir_num = (int32) LE32(rec->external_dir_num);
+	file->segno = (int32) LE32(rec->segno);
+	file->n_blocks = (int32) LE32(rec->n_blocks);
+	file->n_headers = (int32) LE32(rec->n_headers);
+	file->hdr_crc = LE32(rec->hdr_crc);
+	file->hdr_off = LE64(rec->hdr_off);
+	file->hdr_size = (int32) LE32(rec->hdr_size);
+	file->is_datafile = rec->is_datafile != 0;
+	file->is_cfs = rec->is_cfs != 0;
+	file->compress_alg = (CompressAlg) rec->compress_alg;
+}
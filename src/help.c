@@ -130,7 +130,8 @@ help_pg_probackup(void)
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [--external-dirs=external-directories-paths]\n"));
-	printf(_("                 [--no-sync]\n"));
+	printf(_("                 [--no-sync] [--io-queue-depth=depth]\n"));
+	printf(_("                 [--direct-io] [--max-rate=rate [--adaptive-rate]]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-format-console=log-format-console]\n"));
@@ -197,11 +198,12 @@ help_pg_probackup(void)
 	printf(_("                 [-D pgdata-path] [--progress] [-j num-threads]\n"));
 	printf(_("                 [--amcheck] [--skip-block-validation]\n"));
 	printf(_("                 [--heapallindexed] [--checkunique]\n"));
+	printf(_("                 [--max-rate=rate [--adaptive-rate]]\n"));
 	printf(_("                 [--help]\n"));
 
 	printf(_("\n  %s show -B backup-dir\n"), PROGRAM_NAME);
 	printf(_("                 [--instance=instance-name [-i backup-id]]\n"));
-	printf(_("                 [--format=format] [--archive]\n"));
+	printf(_("                 [--format=format] [--archive] [--files]\n"));
 	printf(_("                 [--no-color] [--help]\n"));
 
 	printf(_("\n  %s delete -B backup-dir --instance=instance-name\n"), PROGRAM_NAME);
@@ -236,7 +238,7 @@ help_pg_probackup(void)
 	printf(_("                 [--wal-file-path=wal-file-path]\n"));
 	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--archive-timeout=timeout]\n"));
-	printf(_("                 [--no-ready-rename] [--no-sync]\n"));
+	printf(_("                 [--no-ready-rename] [--no-sync] [--block-summary]\n"));
 	printf(_("                 [--overwrite] [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -267,7 +269,7 @@ help_pg_probackup(void)
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n"));
-	printf(_("                 [--dry-run]\n"));
+	printf(_("                 [--dry-run] [--max-rate=rate [--adaptive-rate]]\n"));
 	printf(_("                 [--help]\n"));
 
 	if ((PROGRAM_URL || PROGRAM_EMAIL))
@@ -308,7 +310,8 @@ help_backup(void)
 	printf(_("                 [--backup-pg-log] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--no-validate] [--skip-block-validation]\n"));
 	printf(_("                 [-E external-directories-paths]\n"));
-	printf(_("                 [--no-sync]\n"));
+	printf(_("                 [--no-sync] [--io-queue-depth=depth]\n"));
+	printf(_("                 [--direct-io] [--max-rate=rate [--adaptive-rate]]\n"));
 	printf(_("                 [--log-level-console=log-level-console]\n"));
 	printf(_("                 [--log-level-file=log-level-file]\n"));
 	printf(_("                 [--log-format-console=log-format-console]\n"));
@@ -350,6 +353,13 @@ help_backup(void)
 	printf(_("                                   backup some directories not from pgdata \n"));
 	printf(_("                                   (example: --external-dirs=/tmp/dir1:/tmp/dir2)\n"));
 	printf(_("      --no-sync                    do not sync backed up files to disk\n"));
+	printf(_("      --io-queue-depth=NUM         number of asynchronous io_uring reads in flight\n"));
+	printf(_("                                   per thread; 0 disables; (default: 0)\n"));
+	printf(_("      --direct-io                  read files past the page cache, or drop them\n"));
+	printf(_("                                   from it after reading\n"));
+	printf(_("      --max-rate=RATE              limit the rate of reading files, in kB per second\n"));
+	printf(_("                                   (example: --max-rate=100MB); 0 disables; (default: 0)\n"));
+	printf(_("      --adaptive-rate              lower the rate, when I/O latency of the database grows\n"));
 	printf(_("      --note=text                  add note to backup\n"));
 	printf(_("                                   (example: --note='backup before app update to v13.1')\n"));
 
@@ -405,7 +415,7 @@ help_backup(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib', 'pglz', 'none' (default: none)\n"));
+	printf(_("                                   available options: 'zlib', 'zstd', 'lz4', 'pglz', 'none' (default: none)\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -637,7 +647,8 @@ help_checkdb(void)
 	printf(_("\n%s checkdb [-B backup-dir] [--instance=instance-name]\n"), PROGRAM_NAME);
 	printf(_("                 [-D pgdata-path] [-j num-threads] [--progress]\n"));
 	printf(_("                 [--amcheck] [--skip-block-validation]\n"));
-	printf(_("                 [--heapallindexed] [--checkunique]\n\n"));
+	printf(_("                 [--heapallindexed] [--checkunique]\n"));
+	printf(_("                 [--max-rate=rate [--adaptive-rate]]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-dir     location of the backup storage area\n"));
 	printf(_("      --instance=instance-name     name of the instance\n"));
@@ -654,6 +665,9 @@ help_checkdb(void)
 	printf(_("                                   can be used only with '--amcheck' option\n"));
 	printf(_("      --checkunique                also check unique constraints\n"));
 	printf(_("                                   can be used only with '--amcheck' option\n"));
+	printf(_("      --max-rate=RATE              limit the rate of reading files, in kB per second\n"));
+	printf(_("                                   (example: --max-rate=100MB); 0 disables; (default: 0)\n"));
+	printf(_("      --adaptive-rate              lower the rate, when I/O latency of the database grows\n"));
 
 	printf(_("\n  Logging options:\n"));
 	printf(_("      --log-level-console=log-level-console\n"));
@@ -697,12 +711,13 @@ help_show(void)
 {
 	printf(_("\n%s show -B backup-dir\n"), PROGRAM_NAME);
 	printf(_("                 [--instance=instance-name [-i backup-id]]\n"));
-	printf(_("                 [--format=format] [--archive]\n\n"));
+	printf(_("                 [--format=format] [--archive] [--files]\n\n"));
 
 	printf(_("  -B, --backup-path=backup-dir     location of the backup storage area\n"));
 	printf(_("      --instance=instance-name     show info about specific instance\n"));
 	printf(_("  -i, --backup-id=backup-id        show info about specific backups\n"));
 	printf(_("      --archive                    show WAL archive information\n"));
+	printf(_("      --files                      show file list of the backup\n"));
 	printf(_("      --format=format              show format=PLAIN|JSON\n"));
 	printf(_("      --no-color                   disable the coloring for plain format\n\n"));
 }
@@ -909,7 +924,7 @@ help_set_config(void)
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','zstd','lz4','pglz','none' (default: 'none')\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -1028,7 +1043,7 @@ help_archive_push(void)
 	printf(_("                 [--wal-file-path=wal-file-path]\n"));
 	printf(_("                 [-j num-threads] [--batch-size=batch_size]\n"));
 	printf(_("                 [--archive-timeout=timeout]\n"));
-	printf(_("                 [--no-ready-rename] [--no-sync]\n"));
+	printf(_("                 [--no-ready-rename] [--no-sync] [--block-summary]\n"));
 	printf(_("                 [--overwrite] [--compress]\n"));
 	printf(_("                 [--compress-algorithm=compress-algorithm]\n"));
 	printf(_("                 [--compress-level=compress-level]\n"));
@@ -1048,11 +1063,13 @@ help_archive_push(void)
 	printf(_("      --no-ready-rename            do not rename '.ready' files in 'archive_status' directory\n"));
 	printf(_("      --no-sync                    do not sync WAL file to disk\n"));
 	printf(_("      --overwrite                  overwrite archived WAL file\n"));
+	printf(_("      --block-summary              write summary of blocks changed in WAL file\n"));
+	printf(_("                                   for PAGE backups\n"));
 
 	printf(_("\n  Compression options:\n"));
 	printf(_("      --compress                   alias for --compress-algorithm='zlib' and --compress-level=1\n"));
 	printf(_("      --compress-algorithm=compress-algorithm\n"));
-	printf(_("                                   available options: 'zlib','pglz','none' (default: 'none')\n"));
+	printf(_("                                   available options: 'zlib','zstd','lz4','pglz','none' (default: 'none')\n"));
 	printf(_("      --compress-level=compress-level\n"));
 	printf(_("                                   level of compression [0-9] (default: 1)\n"));
 
@@ -1180,7 +1197,7 @@ help_catchup(void)
 	printf(_("                 [--remote-proto] [--remote-host]\n"));
 	printf(_("                 [--remote-port] [--remote-path] [--remote-user]\n"));
 	printf(_("                 [--ssh-options]\n"));
-	printf(_("                 [--dry-run]\n"));
+	printf(_("                 [--dry-run] [--max-rate=rate [--adaptive-rate]]\n"));
 	printf(_("                 [--help]\n\n"));
 
 	printf(_("  -b, --backup-mode=catchup-mode   catchup mode=FULL|DELTA|PTRACK\n"));
@@ -1196,6 +1213,9 @@ help_catchup(void)
 	printf(_("  -x, --exclude-path=path_prefix   files with path_prefix (relative to pgdata) will be\n"));
 	printf(_("                                   excluded from catchup (can be used multiple times)\n"));
 	printf(_("                                   Dangerous option! Use at your own risk!\n"));
+	printf(_("      --max-rate=RATE              limit the rate of reading files, in kB per second\n"));
+	printf(_("                                   (example: --max-rate=100MB); 0 disables; (default: 0)\n"));
+	printf(_("      --adaptive-rate              lower the rate, when I/O latency of the database grows\n"));
 
 	printf(_("\n  Connection options:\n"));
 	printf(_("  -U, --pguser=USERNAME            user name to connect as (default: current local user)\n"));
@@ -32,6 +32,9 @@ typedef struct
 	bool        is_retry;
 	bool        no_sync;
 
+	ForkJoin   *fork_join;
+	int			thread_num;
+
 	/*
 	 * Return value from the thread.
 	 * 0 means there is no error, 1 - there is an error.
@@ -446,7 +449,7 @@ merge_chain(InstanceState *instanceState,
 	bool        is_retry = false;
 //	size_t 		total_in_place_merge_bytes = 0;
 
-	pthread_t	*threads = NULL;
+	ForkJoin   *fork_join = NULL;
 	merge_files_arg *threads_args = NULL;
 	time_t		merge_time;
 	bool		merge_isok = true;
@@ -510,6 +513,11 @@ merge_chain(InstanceState *instanceState,
 				backup->program_version,
 				PROGRAM_VERSION);
 		}
+
+		if (!compress_alg_supported(backup->compress_alg))
+			elog(ERROR, "Backup %s is compressed with %s, but current pg_probackup binary "
+						"is built without its support",
+				 backup_id_of(backup), deparse_compress_alg(backup->compress_alg));
 	}
 
 	/* If destination backup compression algorithm differs from
@@ -620,7 +628,7 @@ merge_chain(InstanceState *instanceState,
 	if (parse_program_version(dest_backup->program_version) < 20300)
 		use_bitmap = false;
 
-	/* Setup threads */
+	/* Create external directories */
 	for (i = 0; i < parray_num(dest_backup->files); i++)
 	{
 		pgFile	   *file = (pgFile *) parray_get(dest_backup->files, i);
@@ -636,11 +644,9 @@ merge_chain(InstanceState *instanceState,
 			join_path_components(dirpath, new_container, file->rel_path);
 			dir_create_dir(dirpath, DIR_PERMISSION, false);
 		}
-
-		pg_atomic_init_flag(&file->lock);
 	}
 
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	fork_join = fork_join_create(num_threads, parray_num(dest_backup->files));
 	threads_args = (merge_files_arg *) palloc(sizeof(merge_files_arg) * num_threads);
 
 	thread_interrupted = false;
@@ -661,19 +667,17 @@ merge_chain(InstanceState *instanceState,
 		arg->use_bitmap = use_bitmap;
 		arg->is_retry = is_retry;
 		arg->no_sync = no_sync;
+		arg->fork_join = fork_join;
+		arg->thread_num = i + 1;
 		/* By default there are some error */
 		arg->ret = 1;
-
-		elog(VERBOSE, "Start thread: %d", i);
-
-		pthread_create(&threads[i], NULL, merge_files, arg);
 	}
 
-	/* Wait threads */
+	fork_join_run(fork_join, merge_files, threads_args, sizeof(merge_files_arg));
+
 	result_filelist = parray_new();
 	for (i = 0; i < num_threads; i++)
 	{
-		pthread_join(threads[i], NULL);
 		if (threads_args[i].ret == 1)
 			merge_isok = false;
 
@@ -697,7 +701,7 @@ merge_chain(InstanceState *instanceState,
 				pretty_time);
 
 	/* If temp header map is open, then close it and make rename */
-	if (full_backup->hdr_map.fp)
+	if (pg_atomic_read_u32(&full_backup->hdr_map.is_open))
 	{
 		cleanup_header_map(&(full_backup->hdr_map));
 
@@ -881,10 +885,10 @@ merge_rename:
 	/* Critical section end */
 
 	/* Cleanup */
-	if (threads)
+	if (fork_join)
 	{
 		pfree(threads_args);
-		pfree(threads);
+		fork_join_free(fork_join);
 	}
 
 	if (result_filelist)
@@ -918,12 +922,13 @@ static void *
 merge_files(void *arg)
 {
 	int		i;
+	size_t	task;
 	merge_files_arg *arguments = (merge_files_arg *) arg;
 	size_t n_files = parray_num(arguments->dest_backup->files);
 
-	for (i = 0; i < n_files; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &task))
 	{
-		pgFile	   *dest_file = (pgFile *) parray_get(arguments->dest_backup->files, i);
+		pgFile	   *dest_file = (pgFile *) parray_get(arguments->dest_backup->files, task);
 		pgFile	   *tmp_file;
 		bool		in_place = false; /* keep file as it is */
 
@@ -931,9 +936,6 @@ merge_files(void *arg)
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during merge");
 
-		if (!pg_atomic_test_set_flag(&dest_file->lock))
-			continue;
-
 		tmp_file = pgFileInit(dest_file->rel_path);
 		tmp_file->mode = dest_file->mode;
 		tmp_file->is_datafile = dest_file->is_datafile;
@@ -945,8 +947,8 @@ merge_files(void *arg)
 		if (S_ISDIR(dest_file->mode))
 			goto done;
 
-		elog(progress ? INFO : LOG, "Progress: (%d/%lu). Merging file \"%s\"",
-			i + 1, n_files, dest_file->rel_path);
+		elog(progress ? INFO : LOG, "Progress: (%zu/%lu). Merging file \"%s\"",
+			task + 1, n_files, dest_file->rel_path);
 
 		if (dest_file->is_datafile && !dest_file->is_cfs)
 			tmp_file->segno = dest_file->segno;
@@ -1109,6 +1111,8 @@ done:
 		parray_append(arguments->merge_filelist, tmp_file);
 	}
 
+	header_arena_free();
+
 	/* Data files merging is successful */
 	arguments->ret = 0;
 
@@ -1226,7 +1230,7 @@ merge_data_file(parray *parent_chain, pgBackup *full_backup,
 	tmp_file->size = restore_data_file(parent_chain, dest_file, out, to_fullpath_tmp1,
 									   use_bitmap, NULL, InvalidXLogRecPtr, NULL,
 									   /* when retrying merge header map cannot be trusted */
-									   is_retry ? false : true);
+									   is_retry ? false : true, true);
 	if (fclose(out) != 0)
 		elog(ERROR, "Cannot close file \"%s\": %s",
 			 to_fullpath_tmp1, strerror(errno));
@@ -97,6 +97,80 @@ typedef struct XLogRecTarget
 	XLogRecPtr	rec_lsn;
 } XLogRecTarget;
 
+/*
+ * Blocks of a relation segment changed in WAL.
+ * Key of the entry is (rnode, forknum, segno).
+ */
+typedef struct BlockChangeEntry
+{
+	RelFileNode	rnode;
+	ForkNumber	forknum;
+	BlockNumber	segno;
+	datapagemap_t pagemap;		/* block numbers within the segment */
+	struct BlockChangeEntry *next;	/* next entry in the hash bucket */
+} BlockChangeEntry;
+
+/*
+ * Hash table of block changes, collected by a single WAL reader thread,
+ * so it needs no locking. Tables of all threads are merged into pagemaps
+ * of backup_files_list after the threads are done.
+ */
+typedef struct BlockChangeMap
+{
+	BlockChangeEntry **buckets;
+	uint32		n_buckets;		/* power of 2 */
+	uint32		n_entries;
+	BlockChangeEntry *last;		/* entry found by the previous lookup */
+} BlockChangeMap;
+
+#define BLOCK_CHANGE_MAP_INIT_BUCKETS	1024
+
+/*
+ * Block summary is written by archive-push next to the WAL segment in
+ * the archive, as a file with the ".bsum" suffix. It lists blocks changed
+ * by WAL records which begin in the segment, so PAGE backup can build its
+ * pagemap without reading the segment.
+ *
+ * The file consists of the header followed by n_ranges block ranges.
+ * All fields are stored in little-endian byte order, the CRC is computed
+ * over the stored bytes.
+ */
+#define BLOCK_SUMMARY_MAGIC		0x4D535342	/* "BSSM" */
+#define BLOCK_SUMMARY_VERSION	1
+
+typedef struct BlockSummaryHeader
+{
+	uint32		magic;
+	uint32		version;
+	uint64		system_identifier;
+	uint64		segno;
+	TimeLineID	tli;
+	uint32		wal_seg_size;
+	uint32		n_ranges;
+	pg_crc32	crc;			/* of the header up to crc and the ranges */
+} BlockSummaryHeader;
+
+typedef struct BlockSummaryRange
+{
+	uint32		spc_oid;		/* RelFileNode of the relation */
+	uint32		db_oid;
+	uint32		rel_number;
+	uint32		forknum;
+	BlockNumber	start;			/* block number within the relation */
+	uint32		count;
+} BlockSummaryRange;
+
+/* fields of RelFileNode were renamed in RelFileLocator */
+#if PG_VERSION_NUM >= 160000
+#define RNODE_SPC(rnode)	((rnode).spcOid)
+#define RNODE_DB(rnode)		((rnode).dbOid)
+#define RNODE_REL(rnode)	((rnode).relNumber)
+#else
+#define RNODE_SPC(rnode)	((rnode).spcNode)
+#define RNODE_DB(rnode)		((rnode).dbNode)
+#define RNODE_REL(rnode)	((rnode).relNode)
+#endif
+
 typedef struct XLogReaderData
 {
 	int			thread_num;
@@ -118,6 +192,21 @@ typedef struct XLogReaderData
 	gzFile		 gz_xlogfile;
 	char		 gz_xlogpath[MAXPGPATH];
 #endif
+
+	/* WAL segment compressed with zstd or lz4 is decompressed in memory */
+	char		*frame_xlogdata;
+	size_t		 frame_xlogsize;
+	char		 frame_xlogpath[MAXPGPATH];
+
+	/* blocks changed in WAL, read by this thread */
+	BlockChangeMap block_changes;
+
+	/*
+	 * Block changes are collected for a block summary, which is discarded
+	 * if a record cannot be tracked.
+	 */
+	bool		summarize;
+	bool		summary_failed;
 } XLogReaderData;
 
 /* Function to process a WAL record */
@@ -190,6 +279,21 @@ static void validateXLogRecord(XLogReaderState *record,
 							   XLogReaderData *reader_data, bool *stop_reading);
 static bool getRecordTimestamp(XLogReaderState *record, TimestampTz *recordXtime);
 
+static void block_change_add(BlockChangeMap *map, RelFileNode *rnode,
+							 ForkNumber forknum, BlockNumber blkno);
+static void block_change_map_flush(BlockChangeMap *map);
+static void block_change_map_free(BlockChangeMap *map);
+
+static bool extractPageMapInterval(const char *archivedir, TimeLineID tli,
+								   uint32 segment_size, XLogRecPtr startpoint,
+								   XLogRecPtr endpoint, bool inclusive_endpoint);
+static bool summarize_wal_segment(const char *pg_xlog_dir, TimeLineID tli,
+								  XLogSegNo segno, uint32 segment_size,
+								  BlockChangeMap *map);
+static bool read_block_summary(const char *archivedir, TimeLineID tli,
+							   XLogSegNo segno, uint32 segment_size,
+							   BlockChangeMap *map);
+
 static XLogSegNo segno_start = 0;
 /* Segment number where target record is located */
 static XLogSegNo segno_target = 0;
@@ -242,7 +346,8 @@ static XLogRecPtr		wal_target_lsn = InvalidXLogRecPtr;
  * given timeline. Collect data blocks touched by the WAL records into a page map.
  *
  * Pagemap extracting is processed using threads. Each thread reads single WAL
- * file.
+ * file. Segments which have a block summary in the archive are not read,
+ * blocks are taken from their summaries.
  */
 bool
 extractPageMap(const char *archivedir, uint32 wal_seg_size,
@@ -254,10 +359,8 @@ extractPageMap(const char *archivedir, uint32 wal_seg_size,
 
 	if (start_tli == end_tli)
 		/* easy case */
-		extract_isok = RunXLogThreads(archivedir, 0, InvalidTransactionId,
-									  InvalidXLogRecPtr, end_tli, wal_seg_size,
-									  startpoint, endpoint, false, extractPageInfo,
-									  NULL, true);
+		extract_isok = extractPageMapInterval(archivedir, end_tli, wal_seg_size,
+											  startpoint, endpoint, true);
 	else
 	{
 		/* We have to process WAL located on several different xlog intervals,
@@ -348,10 +451,11 @@ extractPageMap(const char *archivedir, uint32 wal_seg_size,
 			if (tmp_interval->tli == end_tli)
 				inclusive_endpoint = true;
 
-			extract_isok = RunXLogThreads(archivedir, 0, InvalidTransactionId,
-									  InvalidXLogRecPtr, tmp_interval->tli, wal_seg_size,
-									  tmp_interval->begin_lsn, tmp_interval->end_lsn,
-									  false, extractPageInfo, NULL, inclusive_endpoint);
+			extract_isok = extractPageMapInterval(archivedir, tmp_interval->tli,
+												  wal_seg_size,
+												  tmp_interval->begin_lsn,
+												  tmp_interval->end_lsn,
+												  inclusive_endpoint);
 			if (!extract_isok)
 				break;
 
@@ -363,6 +467,97 @@ extractPageMap(const char *archivedir, uint32 wal_seg_size,
 	return extract_isok;
 }
 
+/*
+ * Collect data blocks touched by WAL from 'startpoint' to 'endpoint' on the
+ * single timeline. Blocks of segments with a valid block summary are taken
+ * from the summary, continuous runs of other segments are read by
+ * RunXLogThreads().
+ *
+ * A summary lists blocks of all records which begin in its segment, so for
+ * the first and the last segment it can mark more blocks than needed.
+ * That only makes the backup copy a few unchanged pages.
+ */
+static bool
+extractPageMapInterval(const char *archivedir, TimeLineID tli,
+					   uint32 segment_size, XLogRecPtr startpoint,
+					   XLogRecPtr endpoint, bool inclusive_endpoint)
+{
+	BlockChangeMap summary_changes;
+	XLogSegNo	start_segno;
+	XLogSegNo	end_segno;
+	XLogSegNo	segno;
+	XLogSegNo	run_segno = 0;	/* first segment of a run to read */
+	bool		in_run = false;
+	uint32		n_summaries = 0;
+	bool		result = true;
+
+	if (XLogRecPtrIsInvalid(endpoint) ||
+		(!XRecOffIsValid(endpoint) && !XRecOffIsNull(endpoint)))
+		return RunXLogThreads(archivedir, 0, InvalidTransactionId,
+							  InvalidXLogRecPtr, tli, segment_size,
+							  startpoint, endpoint, false, extractPageInfo,
+							  NULL, inclusive_endpoint);
+
+	GetXLogSegNo(startpoint, start_segno, segment_size);
+	GetXLogSegNo(endpoint, end_segno, segment_size);
+	if (XRecOffIsNull(endpoint))
+		end_segno--;
+
+	MemSet(&summary_changes, 0, sizeof(BlockChangeMap));
+
+	for (segno = start_segno; segno <= end_segno + 1; segno++)
+	{
+		XLogRecPtr	run_start;
+		XLogRecPtr	run_end;
+
+		if (segno <= end_segno &&
+			!read_block_summary(archivedir, tli, segno, segment_size,
+								&summary_changes))
+		{
+			/* this segment must be read */
+			if (!in_run)
+			{
+				run_segno = segno;
+				in_run = true;
+			}
+			continue;
+		}
+
+		if (segno <= end_segno)
+			n_summaries++;
+
+		if (!in_run)
+			continue;
+		in_run = false;
+
+		/* Read the run of segments without summaries */
+		if (run_segno == start_segno)
+			run_start = startpoint;
+		else
+			GetXLogRecPtr(run_segno, 0, segment_size, run_start);
+
+		if (segno > end_segno)
+			run_end = endpoint;
+		else
+			GetXLogRecPtr(segno, 0, segment_size, run_end);
+
+		result = RunXLogThreads(archivedir, 0, InvalidTransactionId,
+								InvalidXLogRecPtr, tli, segment_size,
+								run_start, run_end, false, extractPageInfo, NULL,
+								segno > end_segno ? inclusive_endpoint : false);
+		if (!result)
+			break;
+	}
+
+	if (n_summaries > 0)
+		elog(LOG, "Blocks of %u WAL segments on tli %i are taken from block summaries",
+			 n_summaries, tli);
+
+	block_change_map_flush(&summary_changes);
+
+	return result;
+}
+
 /*
  * Ensure that the backup has all wal files needed for recovery to consistent
  * state.
@@ -1069,6 +1264,44 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 			}
 		}
 #endif
+		/* Try to read WAL segment compressed with zstd or lz4 */
+		if (!reader_data->xlogexists)
+		{
+			CompressAlg	algs[] = {ZSTD_COMPRESS, LZ4_COMPRESS};
+			int			i;
+
+			for (i = 0; i < lengthof(algs); i++)
+			{
+				const char *errormsg = NULL;
+				int			rc;
+
+				snprintf(reader_data->frame_xlogpath, MAXPGPATH, "%s%s",
+						 reader_data->xlogpath, compress_alg_wal_suffix(algs[i]));
+
+				rc = read_compressed_frame(reader_data->frame_xlogpath, algs[i],
+										   FIO_LOCAL_HOST,
+										   &reader_data->frame_xlogdata,
+										   &reader_data->frame_xlogsize,
+										   &errormsg);
+				if (rc == FILE_MISSING)
+					continue;
+
+				if (rc != SEND_OK)
+				{
+					elog(WARNING, "Thread [%d]: Could not read compressed WAL segment \"%s\": %s",
+						 reader_data->thread_num, reader_data->frame_xlogpath,
+						 errormsg ? errormsg : strerror(errno));
+					return -1;
+				}
+
+				elog(LOG, "Thread [%d]: Opening compressed WAL segment \"%s\"",
+					 reader_data->thread_num, reader_data->frame_xlogpath);
+
+				reader_data->xlogexists = true;
+				break;
+			}
+		}
+
 		/* Exit without error if WAL segment doesn't exist */
 		if (!reader_data->xlogexists)
 			return -1;
@@ -1109,6 +1342,18 @@ SimpleXLogPageRead(XLogReaderState *xlogreader, XLogRecPtr targetPagePtr,
 			return -1;
 		}
 	}
+	else if (reader_data->frame_xlogdata != NULL)
+	{
+		if (targetPageOff + XLOG_BLCKSZ > reader_data->frame_xlogsize)
+		{
+			elog(WARNING, "Thread [%d]: Could not read from compressed WAL segment \"%s\": "
+				 "unexpected end of file",
+				 reader_data->thread_num, reader_data->frame_xlogpath);
+			return -1;
+		}
+
+		memcpy(readBuf, reader_data->frame_xlogdata + targetPageOff, XLOG_BLCKSZ);
+	}
 #ifdef HAVE_LIBZ
 	else
 	{
@@ -1291,6 +1536,10 @@ RunXLogThreads(const char *archivedir, time_t target_time,
 	}
 	thread_interrupted = false;
 
+	/* Pagemaps are filled only after all the threads are done */
+	for (i = 0; i < threads_need; i++)
+		block_change_map_flush(&thread_args[i].reader_data.block_changes);
+
 //  TODO: we must detect difference between actual error (failed to read WAL) and interrupt signal
 //	if (interrupted)
 //		elog(ERROR, "Interrupted during WAL parsing");
@@ -1731,6 +1980,12 @@ CleanupXLogPageRead(XLogReaderState *xlogreader)
 		fio_close(reader_data->xlogfile);
 		reader_data->xlogfile = -1;
 	}
+	else if (reader_data->frame_xlogdata != NULL)
+	{
+		pg_free(reader_data->frame_xlogdata);
+		reader_data->frame_xlogdata = NULL;
+		reader_data->frame_xlogsize = 0;
+	}
 #ifdef HAVE_LIBZ
 	else if (reader_data->gz_xlogfile != NULL)
 	{
@@ -1758,6 +2013,10 @@ PrintXLogCorruptionMsg(XLogReaderData *reader_data, int elevel)
 			elog(elevel, "Thread [%d]: Possible WAL corruption. "
 						 "Error has occured during reading WAL segment \"%s\"",
 				 reader_data->thread_num, reader_data->xlogpath);
+		else if (reader_data->frame_xlogdata != NULL)
+			elog(elevel, "Thread [%d]: Possible WAL corruption. "
+						 "Error has occured during reading WAL segment \"%s\"",
+				 reader_data->thread_num, reader_data->frame_xlogpath);
 #ifdef HAVE_LIBZ
 		else if (reader_data->gz_xlogfile != NULL)
 			elog(elevel, "Thread [%d]: Possible WAL corruption. "
@@ -1839,7 +2098,16 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		 * This record type modifies a relation file in some special way, but
 		 * we don't recognize the type. That's bad - we don't know how to
 		 * track that change.
+		 *
+		 * Block summary is just not written then. PAGE backup reads
+		 * the segment and reports the error.
 		 */
+		if (reader_data->summarize)
+		{
+			reader_data->summary_failed = true;
+			return;
+		}
+
 		elog(ERROR, "WAL record modifies a relation, but record type is not recognized\n"
 			 "lsn: %X/%X, rmgr: %s, info: %02X",
 		  (uint32) (record->ReadRecPtr >> 32), (uint32) (record->ReadRecPtr),
@@ -1867,8 +2135,600 @@ extractPageInfo(XLogReaderState *record, XLogReaderData *reader_data,
 		if (forknum != MAIN_FORKNUM)
 			continue;
 
-		process_block_change(forknum, rnode, blkno);
+		block_change_add(&reader_data->block_changes, &rnode, forknum, blkno);
+	}
+}
+
+static uint32
+block_change_hash(RelFileNode *rnode, ForkNumber forknum, BlockNumber segno)
+{
+	const uint32 *words = (const uint32 *) rnode;
+	uint32		h = (uint32) forknum * 0x9E3779B1 ^ segno;
+	int			i;
+
+	StaticAssertStmt(sizeof(RelFileNode) % sizeof(uint32) == 0,
+					 "RelFileNode must consist of 32-bit words");
+
+	for (i = 0; i < sizeof(RelFileNode) / sizeof(uint32); i++)
+		h = (h ^ words[i]) * 0x01000193;
+
+	/* murmur3 finalizer, to use the low bits as the bucket number */
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/* Double the number of buckets of the block change map */
+static void
+block_change_map_grow(BlockChangeMap *map)
+{
+	uint32		n_buckets = map->n_buckets * 2;
+	BlockChangeEntry **buckets;
+	uint32		i;
+
+	buckets = (BlockChangeEntry **) pgut_malloc0(n_buckets * sizeof(BlockChangeEntry *));
+
+	for (i = 0; i < map->n_buckets; i++)
+	{
+		BlockChangeEntry *entry = map->buckets[i];
+
+		while (entry)
+		{
+			BlockChangeEntry *next = entry->next;
+			uint32		bucket = block_change_hash(&entry->rnode, entry->forknum,
+												   entry->segno) & (n_buckets - 1);
+
+			entry->next = buckets[bucket];
+			buckets[bucket] = entry;
+			entry = next;
+		}
+	}
+
+	pg_free(map->buckets);
+	map->buckets = buckets;
+	map->n_buckets = n_buckets;
+}
+
+/*
+ * Remember the block, changed by a WAL record, in the map of the thread.
+ * Consecutive records usually change the same relation,
+ * so the previously found entry is checked first.
+ */
+static void
+block_change_add(BlockChangeMap *map, RelFileNode *rnode,
+				 ForkNumber forknum, BlockNumber blkno)
+{
+	BlockNumber	segno = blkno / RELSEG_SIZE;
+	BlockChangeEntry *entry = map->last;
+	uint32		bucket;
+
+	if (entry == NULL || entry->segno != segno || entry->forknum != forknum ||
+		memcmp(&entry->rnode, rnode, sizeof(RelFileNode)) != 0)
+	{
+		if (map->buckets == NULL)
+		{
+			map->n_buckets = BLOCK_CHANGE_MAP_INIT_BUCKETS;
+			map->buckets = (BlockChangeEntry **)
+				pgut_malloc0(map->n_buckets * sizeof(BlockChangeEntry *));
+		}
+
+		bucket = block_change_hash(rnode, forknum, segno) & (map->n_buckets - 1);
+
+		for (entry = map->buckets[bucket]; entry; entry = entry->next)
+		{
+			if (entry->segno == segno && entry->forknum == forknum &&
+				memcmp(&entry->rnode, rnode, sizeof(RelFileNode)) == 0)
+				break;
+		}
+
+		if (entry == NULL)
+		{
+			entry = (BlockChangeEntry *) pgut_malloc0(sizeof(BlockChangeEntry));
+			entry->rnode = *rnode;
+			entry->forknum = forknum;
+			entry->segno = segno;
+			entry->next = map->buckets[bucket];
+			map->buckets[bucket] = entry;
+
+			if (++map->n_entries > map->n_buckets * 2)
+				block_change_map_grow(map);
+		}
+
+		map->last = entry;
+	}
+
+	datapagemap_add(&entry->pagemap, blkno % RELSEG_SIZE);
+}
+
+/*
+ * Move blocks, collected by a WAL reader thread, to pagemaps of
+ * backup_files_list and free the map.
+ */
+static void
+block_change_map_flush(BlockChangeMap *map)
+{
+	uint32		i;
+
+	for (i = 0; i < map->n_buckets; i++)
+	{
+		BlockChangeEntry *entry = map->buckets[i];
+
+		while (entry)
+		{
+			BlockChangeEntry *next = entry->next;
+
+			process_block_change(entry->forknum, entry->rnode, entry->segno,
+								 &entry->pagemap);
+			entry = next;
+		}
 	}
+
+	block_change_map_free(map);
+}
+
+/* Free entries of the block change map */
+static void
+block_change_map_free(BlockChangeMap *map)
+{
+	uint32		i;
+
+	for (i = 0; i < map->n_buckets; i++)
+	{
+		BlockChangeEntry *entry = map->buckets[i];
+
+		while (entry)
+		{
+			BlockChangeEntry *next = entry->next;
+
+			pg_free(entry->pagemap.bitmap);
+			pg_free(entry);
+			entry = next;
+		}
+	}
+
+	pg_free(map->buckets);
+	MemSet(map, 0, sizeof(BlockChangeMap));
+}
+
+/*
+ * Collect blocks changed by WAL records which begin in the segment 'segno',
+ * located in 'pg_xlog_dir'. The last record may continue in the next segment,
+ * it is read from 'pg_xlog_dir' too.
+ *
+ * Returns false if some record cannot be read or its changes cannot be
+ * tracked, the map must be discarded then.
+ */
+static bool
+summarize_wal_segment(const char *pg_xlog_dir, TimeLineID tli, XLogSegNo segno,
+					  uint32 segment_size, BlockChangeMap *map)
+{
+	XLogReaderState *xlogreader;
+	XLogReaderData reader_data;
+	XLogRecPtr	startpoint;
+	XLogRecPtr	endpoint;
+	XLogRecPtr	found;
+	bool		result = false;
+
+	xlogreader = InitXLogPageRead(&reader_data, pg_xlog_dir, tli, segment_size,
+								  false, false, true);
+	reader_data.summarize = true;
+
+	GetXLogRecPtr(segno, 0, segment_size, startpoint);
+	GetXLogRecPtr(segno + 1, 0, segment_size, endpoint);
+
+#if PG_VERSION_NUM >= 130000
+	if (XLogRecPtrIsInvalid(startpoint))
+		startpoint = SizeOfXLogShortPHD;
+	XLogBeginRead(xlogreader, startpoint);
+#endif
+
+	found = XLogFindNextRecord(xlogreader, startpoint);
+
+	if (XLogRecPtrIsInvalid(found))
+	{
+		elog(LOG, "Could not find WAL record in segment %X/%X",
+			 (uint32) (startpoint >> 32), (uint32) (startpoint));
+		goto cleanup;
+	}
+	startpoint = found;
+
+	for (;;)
+	{
+		XLogRecord *record;
+		char	   *errormsg;
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during WAL reading");
+
+		record = WalReadRecord(xlogreader, startpoint, &errormsg);
+
+		if (record == NULL)
+		{
+			XLogRecPtr	errptr;
+
+			errptr = XLogRecPtrIsInvalid(startpoint) ? xlogreader->EndRecPtr :
+				startpoint;
+
+			elog(LOG, "Could not read WAL record at %X/%X: %s",
+				 (uint32) (errptr >> 32), (uint32) (errptr),
+				 errormsg ? errormsg : "no record");
+			break;
+		}
+
+		/* The record begins in the next segment, it is not ours */
+		if (xlogreader->ReadRecPtr >= endpoint)
+		{
+			result = true;
+			break;
+		}
+
+		extractPageInfo(xlogreader, &reader_data, NULL);
+
+		if (reader_data.summary_failed)
+		{
+			elog(LOG, "WAL record at %X/%X cannot be summarized",
+				 (uint32) (xlogreader->ReadRecPtr >> 32),
+				 (uint32) (xlogreader->ReadRecPtr));
+			break;
+		}
+
+		/* The record ends the segment, e.g. XLOG_SWITCH */
+		if (xlogreader->EndRecPtr >= endpoint)
+		{
+			result = true;
+			break;
+		}
+
+		/* continue reading at next record */
+		startpoint = InvalidXLogRecPtr;
+	}
+
+cleanup:
+	CleanupXLogPageRead(xlogreader);
+	XLogReaderFree(xlogreader);
+
+	/* Collected blocks are moved to the caller's map */
+	*map = reader_data.block_changes;
+
+	return result;
+}
+
+/*
+ * Write block summary of the WAL segment 'wal_file_name', located in
+ * 'pg_xlog_dir', into the archive. Called by archive-push after the segment
+ * is pushed.
+ *
+ * Failure to summarize the segment is not an error: PAGE backup reads
+ * segments which have no summary.
+ */
+void
+write_block_summary(const char *pg_xlog_dir, const char *archive_dir,
+					const char *wal_file_name, uint32 segment_size,
+					bool overwrite, bool no_sync)
+{
+	BlockChangeMap map;
+	BlockSummaryHeader header;
+	BlockSummaryRange *ranges = NULL;
+	uint32		max_ranges = 0;
+	uint32		n_ranges;
+	TimeLineID	tli;
+	XLogSegNo	segno;
+	char		to_fullpath[MAXPGPATH];
+	char		to_fullpath_part[MAXPGPATH];
+	int			out;
+	uint32		i;
+
+	StaticAssertStmt(sizeof(BlockSummaryHeader) == 40 && sizeof(BlockSummaryRange) == 24,
+					 "layout of the block summary must not depend on the platform");
+
+	join_path_components(to_fullpath, archive_dir, wal_file_name);
+	canonicalize_path(to_fullpath);
+	strlcat(to_fullpath, ".bsum", sizeof(to_fullpath));
+	snprintf(to_fullpath_part, sizeof(to_fullpath_part), "%s.part", to_fullpath);
+
+	if (!overwrite && fileExists(to_fullpath, FIO_BACKUP_HOST))
+	{
+		elog(LOG, "Block summary already exists, skip writing: \"%s\"",
+			 to_fullpath);
+		return;
+	}
+
+	GetXLogFromFileName(wal_file_name, &tli, &segno, segment_size);
+
+	MemSet(&map, 0, sizeof(BlockChangeMap));
+	if (!summarize_wal_segment(pg_xlog_dir, tli, segno, segment_size, &map))
+	{
+		elog(LOG, "Cannot summarize WAL segment \"%s\", skip writing block summary",
+			 wal_file_name);
+		block_change_map_free(&map);
+		return;
+	}
+
+	MemSet(&header, 0, sizeof(BlockSummaryHeader));
+	header.magic = BLOCK_SUMMARY_MAGIC;
+	header.version = BLOCK_SUMMARY_VERSION;
+	header.system_identifier = instance_config.system_identifier;
+	header.segno = segno;
+	header.tli = tli;
+	header.wal_seg_size = segment_size;
+
+	/* Turn pagemaps of relation segments into ranges of blocks */
+	for (i = 0; i < map.n_buckets; i++)
+	{
+		BlockChangeEntry *entry;
+
+		for (entry = map.buckets[i]; entry; entry = entry->next)
+		{
+			datapagemap_iterator_t *iter = datapagemap_iterate(&entry->pagemap);
+			uint32		first_range = header.n_ranges;
+			BlockNumber	blkno;
+
+			while (datapagemap_next(iter, &blkno))
+			{
+				BlockSummaryRange *range;
+
+				blkno += entry->segno * RELSEG_SIZE;
+
+				/* pagemap is iterated in ascending order */
+				if (header.n_ranges > first_range)
+				{
+					range = &ranges[header.n_ranges - 1];
+					if (range->start + range->count == blkno)
+					{
+						range->count++;
+						continue;
+					}
+				}
+
+				if (header.n_ranges == max_ranges)
+				{
+					max_ranges = max_ranges ? max_ranges * 2 : 256;
+					ranges = (BlockSummaryRange *)
+						pgut_realloc(ranges, max_ranges * sizeof(BlockSummaryRange));
+				}
+
+				range = &ranges[header.n_ranges++];
+				MemSet(range, 0, sizeof(BlockSummaryRange));
+				range->spc_oid = RNODE_SPC(entry->rnode);
+				range->db_oid = RNODE_DB(entry->rnode);
+				range->rel_number = RNODE_REL(entry->rnode);
+				range->forknum = entry->forknum;
+				range->start = blkno;
+				range->count = 1;
+			}
+			pg_free(iter);
+		}
+	}
+	block_change_map_free(&map);
+	n_ranges = header.n_ranges;
+
+	/* the summary is stored in little-endian byte order */
+	header.magic = LE32(header.magic);
+	header.version = LE32(header.version);
+	header.system_identifier = LE64(header.system_identifier);
+	header.segno = LE64(header.segno);
+	header.tli = LE32(header.tli);
+	header.wal_seg_size = LE32(header.wal_seg_size);
+	header.n_ranges = LE32(header.n_ranges);
+	for (i = 0; i < n_ranges; i++)
+	{
+		BlockSummaryRange *range = &ranges[i];
+
+		range->spc_oid = LE32(range->spc_oid);
+		range->db_oid = LE32(range->db_oid);
+		range->rel_number = LE32(range->rel_number);
+		range->forknum = LE32(range->forknum);
+		range->start = LE32(range->start);
+		range->count = LE32(range->count);
+	}
+
+	INIT_FILE_CRC32(true, header.crc);
+	COMP_FILE_CRC32(true, header.crc, &header, offsetof(BlockSummaryHeader, crc));
+	if (n_ranges > 0)
+		COMP_FILE_CRC32(true, header.crc, ranges,
+						n_ranges * sizeof(BlockSummaryRange));
+	FIN_FILE_CRC32(true, header.crc);
+	header.crc = LE32(header.crc);
+
+	out = fio_open(to_fullpath_part, O_RDWR | O_CREAT | O_EXCL | PG_BINARY, FIO_BACKUP_HOST);
+	if (out < 0 && errno == EEXIST)
+	{
+		struct stat	st;
+
+		/*
+		 * The temp file is left by an archive-push, which has crashed, or
+		 * is being written by a concurrent archive-push of the same segment.
+		 * The summary is written at once, so the file is stale if it has not
+		 * been modified for archive_timeout. Like push_file(), reuse the
+		 * stale file, or any file with --overwrite.
+		 */
+		if (overwrite ||
+			(fio_stat(to_fullpath_part, &st, false, FIO_BACKUP_HOST) == 0 &&
+			 time(NULL) - st.st_mtime >= (time_t) instance_config.archive_timeout))
+		{
+			elog(LOG, "Reusing stale temp block summary \"%s\"", to_fullpath_part);
+			fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+			out = fio_open(to_fullpath_part, O_RDWR | O_CREAT | O_EXCL | PG_BINARY,
+						   FIO_BACKUP_HOST);
+		}
+		else
+			errno = EEXIST;
+	}
+
+	if (out < 0)
+	{
+		elog(LOG, "Cannot create temp block summary \"%s\": %s",
+			 to_fullpath_part, strerror(errno));
+		pg_free(ranges);
+		return;
+	}
+
+	if (fio_write(out, &header, sizeof(BlockSummaryHeader)) != sizeof(BlockSummaryHeader) ||
+		(n_ranges > 0 &&
+		 fio_write(out, ranges, n_ranges * sizeof(BlockSummaryRange)) !=
+		 n_ranges * sizeof(BlockSummaryRange)))
+	{
+		fio_close(out);
+		fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot write block summary \"%s\": %s",
+			 to_fullpath_part, strerror(errno));
+	}
+	pg_free(ranges);
+
+	if (fio_close(out) != 0)
+	{
+		fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot close block summary \"%s\": %s",
+			 to_fullpath_part, strerror(errno));
+	}
+
+	if (!no_sync && fio_sync(to_fullpath_part, FIO_BACKUP_HOST) != 0)
+		elog(ERROR, "Failed to sync file \"%s\": %s",
+			 to_fullpath_part, strerror(errno));
+
+	if (fio_rename(to_fullpath_part, to_fullpath, FIO_BACKUP_HOST) < 0)
+	{
+		fio_unlink(to_fullpath_part, FIO_BACKUP_HOST);
+		elog(ERROR, "Cannot rename file \"%s\" to \"%s\": %s",
+			 to_fullpath_part, to_fullpath, strerror(errno));
+	}
+
+	elog(LOG, "Block summary of WAL segment \"%s\" is written, ranges: %u",
+		 wal_file_name, n_ranges);
+}
+
+/*
+ * Add blocks from the block summary of the segment 'segno' in 'archivedir'
+ * to the map. Returns false if the summary is absent or invalid.
+ */
+static bool
+read_block_summary(const char *archivedir, TimeLineID tli, XLogSegNo segno,
+				   uint32 segment_size, BlockChangeMap *map)
+{
+	char		xlogfname[MAXFNAMELEN];
+	char		path[MAXPGPATH];
+	FILE	   *in;
+	struct stat	st;
+	BlockSummaryHeader header;
+	BlockSummaryRange *ranges = NULL;
+	pg_crc32	crc;
+	uint32		n_ranges;
+	uint32		i;
+	bool		result = false;
+
+	GetXLogFileName(xlogfname, tli, segno, segment_size);
+	join_path_components(path, archivedir, xlogfname);
+	strlcat(path, ".bsum", sizeof(path));
+
+	in = fopen(path, PG_BINARY_R);
+	if (in == NULL)
+	{
+		if (errno != ENOENT)
+			elog(WARNING, "Cannot open block summary \"%s\": %s",
+				 path, strerror(errno));
+		return false;
+	}
+
+	if (fstat(fileno(in), &st) < 0 ||
+		fread(&header, 1, sizeof(BlockSummaryHeader), in) != sizeof(BlockSummaryHeader))
+	{
+		elog(WARNING, "Cannot read block summary \"%s\"", path);
+		goto cleanup;
+	}
+
+	if (LE32(header.magic) != BLOCK_SUMMARY_MAGIC)
+	{
+		elog(WARNING, "Block summary \"%s\" has invalid format, "
+			 "the segment will be read", path);
+		goto cleanup;
+	}
+
+	if (LE32(header.version) != BLOCK_SUMMARY_VERSION)
+	{
+		elog(WARNING, "Block summary \"%s\" has unsupported version %u, "
+			 "the segment will be read", path, LE32(header.version));
+		goto cleanup;
+	}
+
+	n_ranges = LE32(header.n_ranges);
+	if ((uint64) st.st_size != sizeof(BlockSummaryHeader) +
+					  (uint64) n_ranges * sizeof(BlockSummaryRange))
+	{
+		elog(WARNING, "Block summary \"%s\" is truncated, the segment will be read",
+			 path);
+		goto cleanup;
+	}
+
+	if (n_ranges > 0)
+	{
+		ranges = (BlockSummaryRange *)
+			pgut_malloc(n_ranges * sizeof(BlockSummaryRange));
+
+		if (fread(ranges, sizeof(BlockSummaryRange), n_ranges, in) != n_ranges)
+		{
+			elog(WARNING, "Cannot read block summary \"%s\"", path);
+			goto cleanup;
+		}
+	}
+
+	/* CRC covers the stored bytes, check it before anything is trusted */
+	INIT_FILE_CRC32(true, crc);
+	COMP_FILE_CRC32(true, crc, &header, offsetof(BlockSummaryHeader, crc));
+	if (n_ranges > 0)
+		COMP_FILE_CRC32(true, crc, ranges,
+						n_ranges * sizeof(BlockSummaryRange));
+	FIN_FILE_CRC32(true, crc);
+
+	if (!EQ_CRC32C(crc, LE32(header.crc)))
+	{
+		elog(WARNING, "Block summary \"%s\" is corrupted, the segment will be read",
+			 path);
+		goto cleanup;
+	}
+
+	if (LE64(header.system_identifier) != instance_config.system_identifier ||
+		LE64(header.segno) != segno || LE32(header.tli) != tli ||
+		LE32(header.wal_seg_size) != segment_size)
+	{
+		elog(WARNING, "Block summary \"%s\" does not match WAL segment, "
+			 "the segment will be read", path);
+		goto cleanup;
+	}
+
+	for (i = 0; i < n_ranges; i++)
+	{
+		BlockSummaryRange *range = &ranges[i];
+		RelFileNode	rnode;
+		BlockNumber	start = LE32(range->start);
+		uint32		count = LE32(range->count);
+		BlockNumber	blkno;
+
+		/* Only the main fork is tracked, see extractPageInfo() */
+		if (LE32(range->forknum) != MAIN_FORKNUM)
+			continue;
+
+		MemSet(&rnode, 0, sizeof(rnode));
+		RNODE_SPC(rnode) = LE32(range->spc_oid);
+		RNODE_DB(rnode) = LE32(range->db_oid);
+		RNODE_REL(rnode) = LE32(range->rel_number);
+
+		for (blkno = start; blkno - start < count; blkno++)
+			block_change_add(map, &rnode, MAIN_FORKNUM, blkno);
+	}
+
+	elog(VERBOSE, "Blocks of WAL segment \"%s\" are taken from block summary",
+		 xlogfname);
+	result = true;
+
+cleanup:
+	pg_free(ranges);
+	fclose(in);
+
+	return result;
 }
 
 /*
@@ -88,6 +88,10 @@ bool perm_slot = false;
 /* backup options */
 bool         backup_logs = false;
 bool         smooth_checkpoint;
+int          io_queue_depth = 0;
+bool         direct_io = false;
+uint64       max_rate = 0;
+bool         adaptive_rate = false;
 bool         remote_agent = false;
 static char *backup_note = NULL;
 /* catchup options */
@@ -155,6 +159,7 @@ static char *wal_file_path;
 static char *wal_file_name;
 static bool file_overwrite = false;
 static bool no_ready_rename = false;
+static bool block_summary = false;
 static char archive_push_xlog_dir[MAXPGPATH] = "";
 
 /* archive get options */
@@ -164,6 +169,7 @@ bool no_validate_wal = false;
 /* show options */
 ShowFormat show_format = SHOW_PLAIN;
 bool show_archive = false;
+static bool show_files = false;
 static bool show_base_units = false;
 
 /* set-backup options */
@@ -219,6 +225,10 @@ static ConfigOption cmd_options[] =
 	{ 'b', 185, "dry-run",			&dry_run,			SOURCE_CMD_STRICT },
 	{ 's', 238, "note",				&backup_note,		SOURCE_CMD_STRICT },
 	{ 'U', 241, "start-time",		&start_time,		SOURCE_CMD_STRICT },
+	{ 'i', 168, "io-queue-depth",	&io_queue_depth,	SOURCE_CMD_STRICT },
+	{ 'b', 173, "direct-io",		&direct_io,			SOURCE_CMD_STRICT },
+	{ 'U', 174, "max-rate",			&max_rate,			SOURCE_CMD_STRICT, SOURCE_DEFAULT, 0, OPTION_UNIT_KB, option_get_value },
+	{ 'b', 175, "adaptive-rate",	&adaptive_rate,		SOURCE_CMD_STRICT },
 	/* catchup options */
 	{ 's', 239, "source-pgdata",		&catchup_source_pgdata,	SOURCE_CMD_STRICT },
 	{ 's', 240, "destination-pgdata",	&catchup_destination_pgdata,	SOURCE_CMD_STRICT },
@@ -270,12 +280,14 @@ static ConfigOption cmd_options[] =
 	{ 'b', 152, "overwrite",		&file_overwrite,	SOURCE_CMD_STRICT },
 	{ 'b', 153, "no-ready-rename",	&no_ready_rename,	SOURCE_CMD_STRICT },
 	{ 'i', 162, "batch-size",		&batch_size,		SOURCE_CMD_STRICT },
+	{ 'b', 176, "block-summary",	&block_summary,		SOURCE_CMD_STRICT },
 	/* archive-get options */
 	{ 's', 163, "prefetch-dir",		&prefetch_dir,		SOURCE_CMD_STRICT },
 	{ 'b', 164, "no-validate-wal",	&no_validate_wal,	SOURCE_CMD_STRICT },
 	/* show options */
 	{ 'f', 165, "format",			opt_show_format,	SOURCE_CMD_STRICT },
 	{ 'b', 166, "archive",			&show_archive,		SOURCE_CMD_STRICT },
+	{ 'b', 177, "files",			&show_files,		SOURCE_CMD_STRICT },
 	/* show-config options */
 	{ 'b', 167, "no-scale-units",	&show_base_units,SOURCE_CMD_STRICT },
 	/* set-backup options */
@@ -963,6 +975,28 @@ main(int argc, char *argv[])
 	if (num_threads < 1)
 		num_threads = 1;
 
+	if (io_queue_depth < 0)
+		elog(ERROR, "--io-queue-depth must be a non-negative number");
+
+	if (io_queue_depth > MAX_IO_QUEUE_DEPTH)
+	{
+		elog(WARNING, "--io-queue-depth is too large, it is set to %d",
+			 MAX_IO_QUEUE_DEPTH);
+		io_queue_depth = MAX_IO_QUEUE_DEPTH;
+	}
+
+#ifndef HAVE_LIBURING
+	if (io_queue_depth > 0)
+	{
+		elog(WARNING, "This pg_probackup was built without io_uring support, "
+			 "--io-queue-depth is ignored");
+		io_queue_depth = 0;
+	}
+#endif
+
+	if (adaptive_rate && max_rate == 0)
+		elog(ERROR, "Option '--adaptive-rate' must be used with '--max-rate' option");
+
 	if (batch_size < 1)
 		batch_size = 1;
 
@@ -973,7 +1007,8 @@ main(int argc, char *argv[])
 	{
 		case ARCHIVE_PUSH_CMD:
 			do_archive_push(instanceState, &instance_config, archive_push_xlog_dir, wal_file_name,
-							batch_size, file_overwrite, no_sync, no_ready_rename);
+							batch_size, file_overwrite, no_sync, no_ready_rename,
+							block_summary);
 			break;
 		case ARCHIVE_GET_CMD:
 			do_archive_get(instanceState, &instance_config, prefetch_dir,
@@ -1026,7 +1061,8 @@ main(int argc, char *argv[])
 						  restore_params,
 						  no_sync);
 		case SHOW_CMD:
-			return do_show(catalogState, instanceState, current.backup_id, show_archive);
+			return do_show(catalogState, instanceState, current.backup_id,
+						   show_archive, show_files);
 		case DELETE_CMD:
 
 			if (delete_expired && backup_id_string)
@@ -1166,6 +1202,16 @@ compress_init(ProbackupSubcmd const subcmd)
 		if (instance_config.compress_alg == ZLIB_COMPRESS)
 			elog(ERROR, "This build does not support zlib compression");
 		else
+#endif
+#ifndef USE_ZSTD
+		if (instance_config.compress_alg == ZSTD_COMPRESS)
+			elog(ERROR, "This build does not support zstd compression");
+		else
+#endif
+#ifndef USE_LZ4
+		if (instance_config.compress_alg == LZ4_COMPRESS)
+			elog(ERROR, "This build does not support lz4 compression");
+		else
 #endif
 		if (instance_config.compress_alg == PGLZ_COMPRESS && num_threads > 1)
 			elog(ERROR, "Multithread backup does not support pglz compression");
@@ -84,6 +84,8 @@ extern const char  *PROGRAM_EMAIL;
 #define BACKUP_LOCK_FILE		"backup.pid"
 #define BACKUP_RO_LOCK_FILE		"backup_ro.pid"
 #define DATABASE_FILE_LIST		"backup_content.control"
+#define DATABASE_FILE_INDEX		"backup_content.index"
+#define DATABASE_FILE_LIST_JOURNAL	"backup_content.journal"
 #define PG_BACKUP_LABEL_FILE	"backup_label"
 #define PG_TABLESPACE_MAP_FILE	"tablespace_map"
 #define RELMAPPER_FILENAME		"pg_filenode.map"
@@ -128,12 +130,51 @@ extern const char  *PROGRAM_EMAIL;
 #define LARGE_CHUNK_SIZE (4 * 1024 * 1024)
 #define OUT_BUF_SIZE (512 * 1024)
 
+/* size of the extent of consecutive blocks read at once by send_pages() */
+#define BACKUP_EXTENT_SIZE (1024 * 1024)
+#define BACKUP_EXTENT_BLOCKS (BACKUP_EXTENT_SIZE / BLCKSZ)
+
+/*
+ * Changed blocks of pagemap, separated by no more than this number of
+ * unchanged ones, are read at once: reading a few extra blocks is cheaper
+ * than another seek.
+ */
+#define PAGEMAP_GAP_BLOCKS 4
+
+/*
+ * size of the block range of a large data file, processed by one thread,
+ * see pgFileRange
+ */
+#define BACKUP_RANGE_SIZE (128 * 1024 * 1024)
+#define BACKUP_RANGE_BLOCKS (BACKUP_RANGE_SIZE / BLCKSZ)
+
 /* retry attempts */
 #define PAGE_READ_ATTEMPTS 300
 
+/* max number of asynchronous reads in flight per thread, see --io-queue-depth */
+#define MAX_IO_QUEUE_DEPTH 256
+
 /* max size of note, that can be added to backup */
 #define MAX_NOTE_SIZE 1024
 
+/*
+ * Convert fields of binary files in little-endian byte order to the order
+ * of the machine and back, see file list index and block summary
+ */
+#ifdef WORDS_BIGENDIAN
+#define LE32(x) ((uint32) ( \
+		(((uint32) (x) & 0x000000ff) << 24) | \
+		(((uint32) (x) & 0x0000ff00) << 8) | \
+		(((uint32) (x) & 0x00ff0000) >> 8) | \
+		(((uint32) (x) & 0xff000000) >> 24)))
+#define LE64(x) ((uint64) ( \
+		((uint64) LE32((uint64) (x) & 0xffffffff) << 32) | \
+		(uint64) LE32((uint64) (x) >> 32)))
+#else
+#define LE32(x) ((uint32) (x))
+#define LE64(x) ((uint64) (x))
+#endif
+
 /* Check if an XLogRecPtr value is pointed to 0 offset */
 #define XRecOffIsNull(xlrp) \
 		((xlrp) % XLOG_BLCKSZ == 0)
@@ -217,6 +258,8 @@ typedef enum CompressAlg
 	NONE_COMPRESS,
 	PGLZ_COMPRESS,
 	ZLIB_COMPRESS,
+	ZSTD_COMPRESS,
+	LZ4_COMPRESS,
 } CompressAlg;
 
 typedef enum ForkName
@@ -285,14 +328,18 @@ typedef struct pgFile
 	int		n_blocks;		/* number of blocks in the data file in data directory */
 	bool	is_cfs;			/* Flag to distinguish files compressed by CFS*/
 	struct pgFile  *cfs_chain;	/* linked list of CFS segment's cfm, bck, cfm_bck related files */
+	struct pgFileCopy *chain_copies;	/* copies in parent backups, used by restore */
 	int		external_dir_num;	/* Number of external directory. 0 if not external */
 	bool	exists_in_prev;		/* Mark files, both data and regular, that exists in previous backup */
 	CompressAlg		compress_alg;		/* compression algorithm applied to the file */
-	volatile 		pg_atomic_flag lock;/* lock for synchronization of parallel threads  */
 	datapagemap_t	pagemap;			/* bitmap of pages updated since previous backup
 										   may take up to 16kB per file */
 	bool			pagemap_isabsent;	/* Used to mark files with unknown state of pagemap,
 										 * i.e. datafiles without _ptrack */
+	/* Block ranges of a large data file, backed up by several threads */
+	struct pgFileRange *ranges;
+	int				n_ranges;
+	volatile		pg_atomic_uint32 n_ranges_done;
 	/* Coordinates in header map */
 	int      n_headers;		/* number of blocks in the data file in backup */
 	pg_crc32 hdr_crc;		/* CRC value of header file: name_hdr */
@@ -303,12 +350,16 @@ typedef struct pgFile
 	bool	remove_from_list;	/* tmp flag to clean up files list from temp and unlogged tables */
 } pgFile;
 
-typedef struct page_map_entry
+/*
+ * Copy of the restored file in a parent backup, unless the file was
+ * unchanged there. Listed in the order of the parent chain.
+ */
+typedef struct pgFileCopy
 {
-	const char	*path;		/* file or directory name */
-	char		*pagemap;
-	size_t		 pagemapsize;
-} page_map_entry;
+	int			backup_seq;		/* position of the backup in the parent chain */
+	pgFile	   *file;
+	struct pgFileCopy *next;
+} pgFileCopy;
 
 /* Special values of datapagemap_t bitmapsize */
 #define PageBitmapIsEmpty 0		/* Used to mark unchanged datafiles */
@@ -356,14 +407,14 @@ typedef enum ShowFormat
 #define BYTES_INVALID		(-1) /* file didn`t changed since previous backup, DELTA backup do not rely on it */
 #define FILE_NOT_FOUND		(-2) /* file disappeared during backup */
 #define BLOCKNUM_INVALID	(-1)
-#define PROGRAM_VERSION	"2.5.16"
+#define PROGRAM_VERSION	"2.6.0"
 
 /* update when remote agent API or behaviour changes */
-#define AGENT_PROTOCOL_VERSION 20509
-#define AGENT_PROTOCOL_VERSION_STR "2.5.9"
+#define AGENT_PROTOCOL_VERSION 20600
+#define AGENT_PROTOCOL_VERSION_STR "2.6.0"
 
 /* update only when changing storage format */
-#define STORAGE_FORMAT_VERSION "2.4.4"
+#define STORAGE_FORMAT_VERSION "2.6.0"
 
 typedef struct ConnectionOptions
 {
@@ -451,15 +502,24 @@ typedef struct PGNodeInfo
 
 } PGNodeInfo;
 
+/* binary file list of the backup, see filelist.c */
+typedef struct FileListIndex FileListIndex;
+
+/* streaming compressor of zstd or lz4 frame, see data.c */
+typedef struct FrameCompressor FrameCompressor;
+
 /* structure used for access to block header map */
 typedef struct HeaderMap
 {
 	char     path[MAXPGPATH];
 	char     path_tmp[MAXPGPATH]; /* used only in merge */
-	FILE    *fp;                  /* used only for writing */
-	char    *buf;                 /* buffer */
-	pg_off_t offset;              /* current position in fp */
-	pthread_mutex_t mutex;
+	int      fd;                  /* used only for writing */
+	volatile pg_atomic_uint32 is_open;	/* fd is opened by the first writer */
+	volatile pg_atomic_uint64 offset;	/* end of space reserved by writers */
+	char    *map;                 /* read-only image of the map, used for reading */
+	size_t   map_size;
+	volatile pg_atomic_uint32 is_mapped;	/* map is set up by the first reader */
+	pthread_mutex_t mutex;        /* serializes opening of fd and map */
 
 } HeaderMap;
 
@@ -619,12 +679,14 @@ typedef struct
 	const char *external_prefix;
 
 	parray	   *files_list;
+	parray	   *ranges_list;	/* block ranges of large data files */
 	parray	   *prev_filelist;
 	parray	   *external_dirs;
 	XLogRecPtr	prev_start_lsn;
 
 	int			thread_num;
 	HeaderMap   *hdr_map;
+	ForkJoin   *fork_join;
 
 	/*
 	 * Return value from the thread.
@@ -679,7 +741,8 @@ typedef enum xlogFileType
 	SEGMENT,
 	TEMP_SEGMENT,
 	PARTIAL_SEGMENT,
-	BACKUP_HISTORY_FILE
+	BACKUP_HISTORY_FILE,
+	BLOCK_SUMMARY_FILE
 } xlogFileType;
 
 typedef struct xlogFile
@@ -711,6 +774,27 @@ typedef struct BackupPageHeader2
 	uint16      checksum;
 } BackupPageHeader2;
 
+/*
+ * Range of blocks of a large data file, backed up by one thread.
+ * The first range is written directly into the backup file, the others
+ * into temporary part files. The thread, which completes the last range
+ * of the file, appends part files to the backup file and writes headers
+ * of all ranges into the header map as one array.
+ */
+typedef struct pgFileRange
+{
+	pgFile	   *file;			/* file the range belongs to */
+	int			file_num;		/* position of the file in the file list */
+	pgFile		part;			/* copy of the file, accumulating sizes and
+								 * CRC of the range */
+	int			range_num;		/* number of the range in the file */
+	BlockNumber	start_blknum;	/* first block of the range */
+	BlockNumber	end_blknum;		/* first block after the range */
+	int			n_blocks_read;	/* result of send_pages() */
+	BackupPageHeader2 *headers;	/* headers of the range, positions are
+								 * relative to the start of the part file */
+} pgFileRange;
+
 typedef struct StopBackupCallbackParams
 {
 	PGconn	*conn;
@@ -722,6 +806,7 @@ typedef struct StopBackupCallbackParams
 #define SkipCurrentPage -1
 #define PageIsTruncated -2
 #define PageIsCorrupted -3 /* used by checkdb */
+#define PageIsZeroed	-4 /* zeroed page, only header is stored */
 
 /*
  * Return timeline, xlog ID and record offset from an LSN of the type
@@ -730,10 +815,21 @@ typedef struct StopBackupCallbackParams
 #define XLogDataFromLSN(data, xlogid, xrecoff)		\
 	sscanf(data, "%X/%X", xlogid, xrecoff)
 
-#define IsCompressedXLogFileName(fname) \
-	(strlen(fname) == XLOG_FNAME_LEN + strlen(".gz") &&			\
+#define IsXLogFileNameWithSuffix(fname, suffix) \
+	(strlen(fname) == XLOG_FNAME_LEN + strlen(suffix) &&		\
 	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&		\
-	 strcmp((fname) + XLOG_FNAME_LEN, ".gz") == 0)
+	 strcmp((fname) + XLOG_FNAME_LEN, suffix) == 0)
+
+/* WAL segment compressed with zlib, zstd or lz4 */
+#define IsCompressedXLogFileName(fname) \
+	(IsXLogFileNameWithSuffix(fname, ".gz") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".zst") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".lz4"))
+
+/* summary of blocks changed in WAL segment, or its temp file */
+#define IsBlockSummaryFileName(fname) \
+	(IsXLogFileNameWithSuffix(fname, ".bsum") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".bsum.part"))
 
 #if PG_VERSION_NUM >= 110000
 
@@ -781,9 +877,9 @@ typedef struct StopBackupCallbackParams
 #endif
 
 #define IsPartialCompressXLogFileName(fname)	\
-	(strlen(fname) == XLOG_FNAME_LEN + strlen(".gz.partial") && \
-	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&		\
-	 strcmp((fname) + XLOG_FNAME_LEN, ".gz.partial") == 0)
+	(IsXLogFileNameWithSuffix(fname, ".gz.partial") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".zst.partial") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".lz4.partial"))
 
 #define IsTempXLogFileName(fname)	\
 	(strlen(fname) == XLOG_FNAME_LEN + strlen(".part") &&	\
@@ -796,9 +892,9 @@ typedef struct StopBackupCallbackParams
 	 strcmp((fname) + XLOG_FNAME_LEN, ".partial.part") == 0)
 
 #define IsTempCompressXLogFileName(fname)	\
-	(strlen(fname) == XLOG_FNAME_LEN + strlen(".gz.part") && \
-	 strspn(fname, "0123456789ABCDEF") == XLOG_FNAME_LEN &&		\
-	 strcmp((fname) + XLOG_FNAME_LEN, ".gz.part") == 0)
+	(IsXLogFileNameWithSuffix(fname, ".gz.part") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".zst.part") ||	\
+	 IsXLogFileNameWithSuffix(fname, ".lz4.part"))
 
 #define IsSshProtocol() (instance_config.remote.host && strcmp(instance_config.remote.proto, "ssh") == 0)
 
@@ -823,6 +919,10 @@ extern bool perm_slot;
 /* backup options */
 extern bool		backup_logs;
 extern bool		smooth_checkpoint;
+extern int		io_queue_depth;
+extern bool		direct_io;
+extern uint64	max_rate;
+extern bool		adaptive_rate;
 
 /* remote probackup options */
 extern bool remote_agent;
@@ -898,7 +998,7 @@ extern void do_checkdb(bool need_amcheck, ConnectionOptions conn_opt,
 extern BackupMode parse_backup_mode(const char *value);
 extern const char *deparse_backup_mode(BackupMode mode);
 extern void process_block_change(ForkNumber forknum, RelFileNode rnode,
-								 BlockNumber blkno);
+								 BlockNumber segno, datapagemap_t *pagemap);
 
 /* in catchup.c */
 extern int do_catchup(const char *source_pgdata, const char *dest_pgdata, int num_threads, bool sync_dest_files,
@@ -954,7 +1054,7 @@ extern int do_add_instance(InstanceState *instanceState, InstanceConfig *instanc
 /* in archive.c */
 extern void do_archive_push(InstanceState *instanceState, InstanceConfig *instance, char *pg_xlog_dir,
 						   char *wal_file_name, int batch_size, bool overwrite,
-						   bool no_sync, bool no_ready_rename);
+						   bool no_sync, bool no_ready_rename, bool block_summary);
 extern void do_archive_get(InstanceState *instanceState, InstanceConfig *instance, const char *prefetch_dir_arg, char *wal_file_path,
 						   char *wal_file_name, int batch_size, bool validate_wal);
 
@@ -966,7 +1066,8 @@ extern InstanceConfig *readInstanceConfigFile(InstanceState *instanceState);
 
 /* in show.c */
 extern int do_show(CatalogState *catalogState, InstanceState *instanceState,
-				   time_t requested_backup_id, bool show_archive);
+				   time_t requested_backup_id, bool show_archive,
+				   bool show_files);
 extern void memorize_environment_locale(void);
 extern void free_environment_locale(void);
 
@@ -1043,6 +1144,13 @@ extern void add_note(pgBackup *target_backup, char *note);
 extern void pgBackupWriteControl(FILE *out, pgBackup *backup, bool utc);
 extern void write_backup_filelist(pgBackup *backup, parray *files,
 								  const char *root, parray *external_list, bool sync);
+extern void filelist_journal_open(pgBackup *backup);
+extern void filelist_journal_append(pgFile *file);
+extern void filelist_journal_flush(pgBackup *backup);
+extern void filelist_journal_close(pgBackup *backup);
+extern FileListIndex *open_backup_filelist_index(pgBackup *backup);
+extern void finish_file_list_entry(pgFile *file);
+extern void print_backup_filelist(pgBackup *backup, FILE *out);
 
 
 extern void pgBackupInitDir(pgBackup *backup, const char *backup_instance_path);
@@ -1072,6 +1180,8 @@ extern void wait_ssh(void);
 
 extern CompressAlg parse_compress_alg(const char *arg);
 extern const char* deparse_compress_alg(int alg);
+extern const char* compress_alg_wal_suffix(CompressAlg alg);
+extern CompressAlg wal_suffix_compress_alg(const char *path);
 
 /* in dir.c */
 extern bool get_control_value_int64(const char *str, const char *name, int64 *value_int64, bool is_mandatory);
@@ -1129,8 +1239,8 @@ extern void pgFileFree(void *file);
 extern pg_crc32 pgFileGetCRC(const char *file_path, bool use_crc32c, bool missing_ok);
 extern pg_crc32 pgFileGetCRCTruncated(const char *file_path, bool use_crc32c, bool missing_ok);
 extern pg_crc32 pgFileGetCRCgz(const char *file_path, bool use_crc32c, bool missing_ok);
+extern pg_crc32 pgFileGetCRCCompressed(const char *file_path, bool use_crc32c, bool missing_ok);
 
-extern int pgFileMapComparePath(const void *f1, const void *f2);
 extern int pgFileCompareName(const void *f1, const void *f2);
 extern int pgFileCompareNameWithString(const void *f1, const void *f2);
 extern int pgFileCompareRelPathWithString(const void *f1, const void *f2);
@@ -1142,7 +1252,6 @@ extern int pgFileCompareSizeDesc(const void *f1, const void *f2);
 extern int pgCompareString(const void *str1, const void *str2);
 extern int pgPrefixCompareString(const void *str1, const void *str2);
 extern int pgCompareOid(const void *f1, const void *f2);
-extern void pfilearray_clear_locks(parray *file_list);
 extern bool set_forkname(pgFile *file);
 
 /* in data.c */
@@ -1157,6 +1266,11 @@ extern void backup_data_file(pgFile *file, const char *from_fullpath, const char
 							 XLogRecPtr prev_backup_start_lsn, BackupMode backup_mode,
 							 CompressAlg calg, int clevel, uint32 checksum_version,
 							 HeaderMap *hdr_map, bool missing_ok);
+extern void remove_range_part(pgFileRange *range, const char *to_root);
+extern bool backup_data_file_range(pgFileRange *range, const char *from_fullpath,
+								   const char *to_fullpath, XLogRecPtr prev_backup_start_lsn,
+								   BackupMode backup_mode, CompressAlg calg, int clevel,
+								   uint32 checksum_version, HeaderMap *hdr_map);
 extern void backup_non_data_file(pgFile *file, pgFile *prev_file,
 								 const char *from_fullpath, const char *to_fullpath,
 								 BackupMode backup_mode, time_t parent_backup_time,
@@ -1168,11 +1282,8 @@ extern void backup_non_data_file_internal(const char *from_fullpath,
 
 extern size_t restore_data_file(parray *parent_chain, pgFile *dest_file, FILE *out,
 								const char *to_fullpath, bool use_bitmap, PageState *checksum_map,
-								XLogRecPtr shift_lsn, datapagemap_t *lsn_map, bool use_headers);
-extern size_t restore_data_file_internal(FILE *in, FILE *out, pgFile *file, uint32 backup_version,
-										 const char *from_fullpath, const char *to_fullpath, int nblocks,
-										 datapagemap_t *map, PageState *checksum_map, int checksum_version,
-										 datapagemap_t *lsn_map, BackupPageHeader2 *headers);
+								XLogRecPtr shift_lsn, datapagemap_t *lsn_map, bool use_headers,
+								bool is_new);
 extern size_t restore_non_data_file(parray *parent_chain, pgBackup *dest_backup,
 									pgFile *dest_file, FILE *out, const char *to_fullpath,
 									bool already_exists);
@@ -1217,6 +1328,9 @@ extern XLogRecPtr get_first_record_lsn(const char *archivedir, XLogRecPtr start_
 									   TimeLineID tli, uint32 wal_seg_size, int timeout);
 extern XLogRecPtr get_next_record_lsn(const char *archivedir, XLogSegNo	segno, TimeLineID tli,
 									  uint32 wal_seg_size, int timeout, XLogRecPtr target);
+extern void write_block_summary(const char *pg_xlog_dir, const char *archive_dir,
+								const char *wal_file_name, uint32 wal_seg_size,
+								bool overwrite, bool no_sync);
 
 /* in util.c */
 extern TimeLineID get_current_timeline(PGconn *conn);
@@ -1250,6 +1364,15 @@ extern int32  do_compress(void* dst, size_t dst_size, void const* src, size_t sr
 						  CompressAlg alg, int level, const char **errormsg);
 extern int32  do_decompress(void* dst, size_t dst_size, void const* src, size_t src_size,
 							CompressAlg alg, const char **errormsg);
+extern bool   compress_alg_supported(CompressAlg alg);
+extern size_t compress_frame_bound(size_t src_size, CompressAlg alg);
+extern FrameCompressor *frame_compressor_create(CompressAlg alg, int level, size_t content_size,
+												size_t chunk_size, const char **errormsg);
+extern int64  frame_compressor_next(FrameCompressor *fc, void const* src, size_t src_size,
+									bool last, char **dst, const char **errormsg);
+extern void   frame_compressor_free(FrameCompressor *fc);
+extern int    read_compressed_frame(const char *path, CompressAlg alg, fio_location location,
+									char **content, size_t *size, const char **errormsg);
 
 extern void pretty_size(int64 size, char *buf, size_t len);
 extern void pretty_time_interval(double time, char *buf, size_t len);
@@ -1267,16 +1390,36 @@ extern void get_ptrack_version(PGconn *backup_conn, PGNodeInfo *nodeInfo);
 extern bool pg_is_ptrack_enabled(PGconn *backup_conn, int ptrack_version_num);
 
 extern XLogRecPtr get_last_ptrack_lsn(PGconn *backup_conn, PGNodeInfo *nodeInfo);
-extern parray * pg_ptrack_get_pagemapset(PGconn *backup_conn, const char *ptrack_schema,
-										 int ptrack_version_num, XLogRecPtr lsn);
+
+/* in filelist.c */
+extern void write_file_list_index(const char *path, parray *files,
+								  pg_crc32 *crc, bool sync);
+extern FileListIndex *file_list_index_open(const char *path, int elevel);
+extern void file_list_index_close(FileListIndex *index);
+extern pg_crc32 file_list_index_crc(FileListIndex *index);
+extern uint32 file_list_index_size(FileListIndex *index);
+extern void file_list_index_get(FileListIndex *index, uint32 pos, pgFile *file);
+extern pgFile *file_list_index_get_file(FileListIndex *index, uint32 pos);
+extern parray *file_list_index_get_files(FileListIndex *index);
+extern bool file_list_index_find(FileListIndex *index, const char *rel_path,
+								 int external_dir_num, pgFile *file);
+
+/* in walsummary.c */
+extern bool make_pagemap_from_wal_summaries(PGconn *backup_conn,
+											XLogRecPtr start_lsn, TimeLineID start_tli,
+											XLogRecPtr end_lsn, TimeLineID end_tli);
 
 /* open local file to writing */
 extern FILE* open_local_file_rw(const char *to_fullpath, char **out_buf, uint32 buf_size);
 
+extern BackupPageHeader2 *header_arena_reserve(size_t n_headers);
+extern void header_arena_free(void);
+extern void async_read_ring_free(void);
+
 extern int send_pages(const char *to_fullpath, const char *from_fullpath,
 					  pgFile *file, XLogRecPtr prev_backup_start_lsn, CompressAlg calg, int clevel,
 					  uint32 checksum_version, bool use_pagemap, BackupPageHeader2 **headers,
-					  BackupMode backup_mode);
+					  BackupMode backup_mode, BlockNumber start_blknum, BlockNumber end_blknum);
 extern int copy_pages(const char *to_fullpath, const char *from_fullpath,
 					  pgFile *file, XLogRecPtr prev_backup_start_lsn,
 					  uint32 checksum_version, bool use_pagemap,
@@ -1350,6 +1493,11 @@ extern void start_WAL_streaming(PGconn *backup_conn, char *stream_dst_path,
 extern int wait_WAL_streaming_end(parray *backup_files_list);
 extern parray* parse_tli_history_buffer(char *history, TimeLineID tli);
 
+/* in throttle.c */
+extern void throttle_start(PGconn *conn);
+extern void throttle_stop(void);
+extern void throttle_consume(size_t bytes);
+
 /* external variables and functions, implemented in backup.c */
 typedef struct PGStopBackupResult
 {
@@ -184,69 +184,113 @@ get_last_ptrack_lsn(PGconn *backup_conn, PGNodeInfo *nodeInfo)
  */
 
 /*
- * Fetch a list of changed files with their ptrack maps.
+ * Index of data files by their relative path, for matching ptrack pagemaps
+ * against the file list as the rows of pagemapset arrive.
+ * Open addressing, the number of slots is a power of 2.
  */
-parray *
-pg_ptrack_get_pagemapset(PGconn *backup_conn, const char *ptrack_schema,
-						 int ptrack_version_num, XLogRecPtr lsn)
+typedef struct PtrackFileIndex
 {
-	PGresult   *res;
-	char		lsn_buf[17 + 1];
-	char	   *params[1];
-	parray	   *pagemapset = NULL;
-	int			i;
-	char		query[512];
+	pgFile	  **slots;
+	uint32		n_slots;
+} PtrackFileIndex;
 
-	snprintf(lsn_buf, sizeof lsn_buf, "%X/%X", (uint32) (lsn >> 32), (uint32) lsn);
-	params[0] = pstrdup(lsn_buf);
+static uint32
+ptrack_path_hash(const char *path)
+{
+	uint32		h = 2166136261u;	/* FNV-1a */
 
-	if (!ptrack_schema)
-		elog(ERROR, "Schema name of ptrack extension is missing");
+	for (; *path; path++)
+		h = (h ^ (unsigned char) *path) * 16777619u;
 
-	if (ptrack_version_num == 200)
-		sprintf(query, "SELECT path, pagemap FROM %s.pg_ptrack_get_pagemapset($1) ORDER BY 1",
-				ptrack_schema);
-	else
-		sprintf(query, "SELECT path, pagemap FROM %s.ptrack_get_pagemapset($1) ORDER BY 1",
-				ptrack_schema);
-
-	res = pgut_execute(backup_conn, query, 1, (const char **) params);
-	pfree(params[0]);
+	return h;
+}
 
-	if (PQnfields(res) != 2)
-		elog(ERROR, "Cannot get ptrack pagemapset");
+static void
+ptrack_file_index_build(PtrackFileIndex *index, parray *files)
+{
+	size_t		i;
 
-	/* sanity ? */
+	index->n_slots = 1024;
+	while (index->n_slots < parray_num(files) * 2)
+		index->n_slots *= 2;
+	index->slots = (pgFile **) pgut_malloc0(index->n_slots * sizeof(pgFile *));
 
-	/* Construct database map */
-	for (i = 0; i < PQntuples(res); i++)
+	for (i = 0; i < parray_num(files); i++)
 	{
-		page_map_entry *pm_entry = (page_map_entry *) pgut_malloc(sizeof(page_map_entry));
+		pgFile	   *file = (pgFile *) parray_get(files, i);
+		uint32		slot;
+
+		/*
+		 * For now nondata files are not entitled to have pagemap
+		 * TODO It's possible to use ptrack for incremental backup of
+		 * relation forks. Not implemented yet.
+		 */
+		if (!file->is_datafile || file->is_cfs)
+			continue;
 
-		/* get path */
-		pm_entry->path = pgut_strdup(PQgetvalue(res, i, 0));
+		/* Consider only files from PGDATA (this check is probably redundant) */
+		if (file->external_dir_num != 0)
+			continue;
 
-		/* get bytea */
-		pm_entry->pagemap = (char *) PQunescapeBytea((unsigned char *) PQgetvalue(res, i, 1),
-													&pm_entry->pagemapsize);
+		slot = ptrack_path_hash(file->rel_path) & (index->n_slots - 1);
+		while (index->slots[slot] != NULL)
+			slot = (slot + 1) & (index->n_slots - 1);
+		index->slots[slot] = file;
+	}
+}
 
-		if (pagemapset == NULL)
-			pagemapset = parray_new();
+static pgFile *
+ptrack_file_index_lookup(PtrackFileIndex *index, const char *path)
+{
+	uint32		slot = ptrack_path_hash(path) & (index->n_slots - 1);
 
-		parray_append(pagemapset, pm_entry);
+	for (; index->slots[slot] != NULL; slot = (slot + 1) & (index->n_slots - 1))
+	{
+		if (strcmp(index->slots[slot]->rel_path, path) == 0)
+			return index->slots[slot];
 	}
 
-	PQclear(res);
+	return NULL;
+}
 
-	return pagemapset;
+/*
+ * Attach a row of pagemapset, i.e. path and pagemap of a changed file,
+ * to the file in the list. Rows are received in binary format,
+ * so the bytea needs no unescaping.
+ */
+static void
+ptrack_pagemap_row(PGresult *res, void *arg)
+{
+	PtrackFileIndex *index = (PtrackFileIndex *) arg;
+	pgFile	   *file;
+	int			pagemapsize;
+
+	if (PQnfields(res) != 2)
+		elog(ERROR, "Cannot get ptrack pagemapset");
+
+	file = ptrack_file_index_lookup(index, PQgetvalue(res, 0, 0));
+
+	/* File without bitmap is treated as unchanged */
+	if (file == NULL)
+		return;
+
+	pagemapsize = PQgetlength(res, 0, 1);
+	if (pagemapsize == 0)
+		return;
+
+	elog(VERBOSE, "Using ptrack pagemap for file \"%s\"", file->rel_path);
+	file->pagemap.bitmap = (char *) pgut_malloc(pagemapsize);
+	memcpy(file->pagemap.bitmap, PQgetvalue(res, 0, 1), pagemapsize);
+	file->pagemap.bitmapsize = pagemapsize;
 }
 
 /*
  * Given a list of files in the instance to backup, build a pagemap for each
  * data file that has ptrack. Result is saved in the pagemap field of pgFile.
  *
- * We fetch a list of changed files with their ptrack maps.  After that files
- * are merged with their bitmaps.  File without bitmap is treated as unchanged.
+ * Changed files with their ptrack maps are fetched row by row and attached
+ * to the files through a hash index by path, so neither the whole pagemapset
+ * is kept in memory, nor the file list is searched.
  */
 void
 make_pagemap_from_ptrack_2(parray *files,
@@ -255,55 +299,28 @@ make_pagemap_from_ptrack_2(parray *files,
 						   int ptrack_version_num,
 						   XLogRecPtr lsn)
 {
-	parray *filemaps;
-	int		file_i = 0;
-	page_map_entry *dummy_map = NULL;
-
-	/* Receive all available ptrack bitmaps at once */
-	filemaps = pg_ptrack_get_pagemapset(backup_conn, ptrack_schema,
-										ptrack_version_num, lsn);
-
-	if (filemaps != NULL)
-		parray_qsort(filemaps, pgFileMapComparePath);
-	else
-		return;
-
-	dummy_map = (page_map_entry *) pgut_malloc(sizeof(page_map_entry));
+	PtrackFileIndex index;
+	char		lsn_buf[17 + 1];
+	const char *params[1];
+	char		query[512];
 
-	/* Iterate over files and look for corresponding pagemap if any */
-	for (file_i = 0; file_i < parray_num(files); file_i++)
-	{
-		pgFile *file = (pgFile *) parray_get(files, file_i);
-		page_map_entry **res_map = NULL;
-		page_map_entry *map = NULL;
+	if (!ptrack_schema)
+		elog(ERROR, "Schema name of ptrack extension is missing");
 
-		/*
-		 * For now nondata files are not entitled to have pagemap
-		 * TODO It's possible to use ptrack for incremental backup of
-		 * relation forks. Not implemented yet.
-		 */
-		if (!file->is_datafile || file->is_cfs)
-			continue;
+	snprintf(lsn_buf, sizeof lsn_buf, "%X/%X", (uint32) (lsn >> 32), (uint32) lsn);
+	params[0] = lsn_buf;
 
-		/* Consider only files from PGDATA (this check is probably redundant) */
-		if (file->external_dir_num != 0)
-			continue;
+	if (ptrack_version_num == 200)
+		sprintf(query, "SELECT path, pagemap FROM %s.pg_ptrack_get_pagemapset($1)",
+				ptrack_schema);
+	else
+		sprintf(query, "SELECT path, pagemap FROM %s.ptrack_get_pagemapset($1)",
+				ptrack_schema);
 
-		if (filemaps)
-		{
-			dummy_map->path = file->rel_path;
-			res_map = parray_bsearch(filemaps, dummy_map, pgFileMapComparePath);
-			map = (res_map) ? *res_map : NULL;
-		}
+	ptrack_file_index_build(&index, files);
 
-		/* Found map */
-		if (map)
-		{
-			elog(VERBOSE, "Using ptrack pagemap for file \"%s\"", file->rel_path);
-			file->pagemap.bitmapsize = map->pagemapsize;
-			file->pagemap.bitmap = map->pagemap;
-		}
-	}
+	pgut_execute_foreach_row(backup_conn, query, 1, params, false,
+							 ptrack_pagemap_row, &index);
 
-	free(dummy_map);
+	pg_free(index.slots);
 }
@@ -32,6 +32,9 @@ typedef struct
 	IncrRestoreMode        incremental_mode;
 	XLogRecPtr  shift_lsn;    /* used only in LSN incremental_mode */
 
+	ForkJoin   *fork_join;
+	int			thread_num;
+
 	/*
 	 * Return value from the thread.
 	 * 0 means there is no error, 1 - there is an error.
@@ -69,6 +72,8 @@ static void restore_chain(pgBackup *dest_backup, parray *parent_chain,
 						  parray *dbOid_exclude_list, pgRestoreParams *params,
 						  const char *pgdata_path, bool no_sync, bool cleanup_pgdata,
 						  bool backup_has_tblspc);
+static void collect_chain_copies(parray *dest_files, pgBackup *backup,
+								 int backup_seq);
 
 /*
  * Iterate over backup list to find all ancestors of the broken parent_backup
@@ -732,8 +737,8 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 	char	dest_pg_control_fullpath[MAXPGPATH];
 	char	dest_pg_control_bak_fullpath[MAXPGPATH];
 
-	/* arrays with meta info for multi threaded backup */
-	pthread_t  *threads;
+	/* meta info for multi threaded restore */
+	ForkJoin   *fork_join;
 	restore_files_arg *threads_args;
 	bool		restore_isok = true;
 	bool        use_bitmap = true;
@@ -757,6 +762,11 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 		if (!lock_backup(backup, true, false))
 			elog(ERROR, "Cannot lock backup %s", backup_id_of(backup));
 
+		if (!compress_alg_supported(backup->compress_alg))
+			elog(ERROR, "Backup %s is compressed with %s, but current pg_probackup binary "
+						"is built without its support",
+				 backup_id_of(backup), deparse_compress_alg(backup->compress_alg));
+
 		if (backup->status != BACKUP_STATUS_OK &&
 			backup->status != BACKUP_STATUS_DONE)
 		{
@@ -779,18 +789,29 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 				"XLOG_BLCKSZ(%d) is not compatible(%d expected)",
 				backup->wal_block_size, XLOG_BLCKSZ);
 
-		/* populate backup filelist */
-		if (backup->start_time != dest_backup->start_time)
-			backup->files = get_backup_filelist(backup, true);
-		else
-			backup->files = dest_files;
-
 		/*
-		 * this sorting is important, because we rely on it to find
-		 * destination file in intermediate backups file lists
-		 * using bsearch.
+		 * File lists of parent backups are not loaded,
+		 * see collect_chain_copies() below.
 		 */
-		parray_qsort(backup->files, pgFileCompareRelPathWithExternal);
+		if (backup->start_time == dest_backup->start_time)
+			backup->files = dest_files;
+		else
+			backup->files = NULL;
+	}
+
+	/*
+	 * this sorting is important, because we rely on it to find
+	 * destination file in intermediate backups file lists.
+	 */
+	parray_qsort(dest_files, pgFileCompareRelPathWithExternal);
+
+	/* from the oldest backup, so that copies are listed in chain order */
+	for (i = parray_num(parent_chain) - 1; i >= 0; i--)
+	{
+		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
+
+		if (backup->start_time != dest_backup->start_time)
+			collect_chain_copies(dest_files, backup, i);
 	}
 
 	/* If dest backup version is older than 2.4.0, then bitmap optimization
@@ -869,9 +890,6 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 		}
 	}
 
-	/* setup threads */
-	pfilearray_clear_locks(dest_files);
-
 	/* Get list of files in destination directory and remove redundant files */
 	if (params->incremental_mode != INCR_NONE || cleanup_pgdata)
 	{
@@ -980,7 +998,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 	 */
 	fio_disconnect();
 
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	fork_join = fork_join_create(num_threads, parray_num(dest_files));
 	threads_args = (restore_files_arg *) palloc(sizeof(restore_files_arg) *
 												num_threads);
 	if (dest_backup->stream)
@@ -991,7 +1009,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 	pretty_size(dest_bytes, pretty_dest_bytes, lengthof(pretty_dest_bytes));
 		/*
 	 * [Issue #313]
-	 * find pg_control file (in already sorted earlier dest_files, see parray_qsort(backup->files...))
+	 * find pg_control file (in already sorted earlier dest_files, see parray_qsort(dest_files...))
 	 * and exclude it from list for future special processing
 	 */
 	{
@@ -1045,20 +1063,17 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 		arg->use_bitmap = use_bitmap;
 		arg->incremental_mode = params->incremental_mode;
 		arg->shift_lsn = params->shift_lsn;
+		arg->fork_join = fork_join;
+		arg->thread_num = i + 1;
 		threads_args[i].restored_bytes = 0;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
-
-		/* Useless message TODO: rewrite */
-		elog(LOG, "Start thread %i", i + 1);
-
-		pthread_create(&threads[i], NULL, restore_files, arg);
 	}
 
-	/* Wait theads */
+	fork_join_run(fork_join, restore_files, threads_args, sizeof(restore_files_arg));
+
 	for (i = 0; i < num_threads; i++)
 	{
-		pthread_join(threads[i], NULL);
 		if (threads_args[i].ret == 1)
 			restore_isok = false;
 
@@ -1163,7 +1178,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 	}
 
 	/* cleanup */
-	pfree(threads);
+	fork_join_free(fork_join);
 	pfree(threads_args);
 
 	if (external_dirs != NULL)
@@ -1177,12 +1192,93 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 
 	if(dest_pg_control_file) pgFileFree(dest_pg_control_file);
 
+	/* copies of parent backups are freed along with dest files */
+	parray_walk(dest_files, pgFileFree);
+	parray_free(dest_files);
+
 	for (i = parray_num(parent_chain) - 1; i >= 0; i--)
 	{
 		pgBackup   *backup = (pgBackup *) parray_get(parent_chain, i);
 
-		parray_walk(backup->files, pgFileFree);
-		parray_free(backup->files);
+		backup->files = NULL;
+	}
+}
+
+/*
+ * Attach the copies of files, changed in the parent backup, to the files
+ * of the destination backup. Both lists are sorted, so the list of the
+ * parent is walked once along with 'dest_files', streamed from its index.
+ * Only the copies are kept in memory, unchanged files are not.
+ */
+static void
+collect_chain_copies(parray *dest_files, pgBackup *backup, int backup_seq)
+{
+	FileListIndex *index = open_backup_filelist_index(backup);
+	parray	   *files = NULL;
+	size_t		n_files;
+	size_t		pos = 0;
+	size_t		i;
+
+	if (index)
+		n_files = file_list_index_size(index);
+	else
+	{
+		/* backup taken by older version has no index */
+		files = get_backup_filelist(backup, true);
+		parray_qsort(files, pgFileCompareRelPathWithExternal);
+		n_files = parray_num(files);
+	}
+
+	for (i = 0; i < parray_num(dest_files) && pos < n_files; i++)
+	{
+		pgFile	   *dest_file = (pgFile *) parray_get(dest_files, i);
+		pgFile		rec;
+		pgFile	   *file = NULL;
+		pgFileCopy *copy;
+		int			cmp = -1;
+
+		for (; pos < n_files; pos++)
+		{
+			if (index)
+			{
+				file_list_index_get(index, pos, &rec);
+				file = &rec;
+			}
+			else
+				file = (pgFile *) parray_get(files, pos);
+
+			cmp = pgFileCompareRelPathWithExternal(&file, &dest_file);
+			if (cmp >= 0)
+				break;
+		}
+
+		/* not in the backup, or not changed since its parent */
+		if (cmp != 0 || file->write_size == BYTES_INVALID)
+			continue;
+
+		copy = pgut_new(pgFileCopy);
+		copy->backup_seq = backup_seq;
+		if (index)
+		{
+			copy->file = file_list_index_get_file(index, pos);
+			finish_file_list_entry(copy->file);
+		}
+		else
+		{
+			copy->file = file;
+			parray_set(files, pos, NULL);
+		}
+		copy->next = dest_file->chain_copies;
+		dest_file->chain_copies = copy;
+		pos++;
+	}
+
+	if (index)
+		file_list_index_close(index);
+	else
+	{
+		parray_walk(files, pgFileFree);
+		parray_free(files);
 	}
 }
 
@@ -1192,7 +1288,7 @@ restore_chain(pgBackup *dest_backup, parray *parent_chain,
 static void *
 restore_files(void *arg)
 {
-	int         i;
+	size_t      i;
 	uint64      n_files;
 	char        to_fullpath[MAXPGPATH];
 	FILE       *out = NULL;
@@ -1202,7 +1298,7 @@ restore_files(void *arg)
 
 	n_files = (unsigned long) parray_num(arguments->dest_files);
 
-	for (i = 0; i < parray_num(arguments->dest_files); i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &i))
 	{
 		bool     already_exists = false;
 		PageState      *checksum_map = NULL; /* it should take ~1.5MB at most */
@@ -1214,14 +1310,11 @@ restore_files(void *arg)
 		if (S_ISDIR(dest_file->mode))
 			continue;
 
-		if (!pg_atomic_test_set_flag(&dest_file->lock))
-			continue;
-
 		/* check for interrupt */
 		if (interrupted || thread_interrupted)
 			elog(ERROR, "Interrupted during restore");
 
-		elog(progress ? INFO : LOG, "Progress: (%d/%lu). Restore file \"%s\"",
+		elog(progress ? INFO : LOG, "Progress: (%zu/%lu). Restore file \"%s\"",
 			 i + 1, n_files, dest_file->rel_path);
 
 		/* Only files from pgdata can be skipped by partial restore */
@@ -1346,7 +1439,8 @@ restore_files(void *arg)
 			arguments->restored_bytes += restore_data_file(arguments->parent_chain,
 														   dest_file, out, to_fullpath,
 														   arguments->use_bitmap, checksum_map,
-														   arguments->shift_lsn, lsn_map, true);
+														   arguments->shift_lsn, lsn_map, true,
+														   !already_exists);
 		}
 		else
 		{
@@ -2134,7 +2228,7 @@ get_dbOid_exclude_list(pgBackup *backup, parray *datname_list,
 
 	files = get_backup_filelist(backup, true);
 
-	/* look for 'database_map' file in backup_content.control */
+	/* look for 'database_map' file in the file list */
 	for (i = 0; i < parray_num(files); i++)
 	{
 		pgFile	   *file = (pgFile *) parray_get(files, i);
@@ -58,6 +58,7 @@ static void show_instance_end(void);
 static void show_instance(InstanceState *instanceState, time_t requested_backup_id, bool show_name);
 static void print_backup_json_object(PQExpBuffer buf, pgBackup *backup);
 static int show_backup(InstanceState *instanceState, time_t requested_backup_id);
+static int show_backup_files(InstanceState *instanceState, time_t requested_backup_id);
 
 static void show_instance_plain(const char *instance_name, parray *backup_list, bool show_name);
 static void show_instance_json(const char *instance_name, parray *backup_list);
@@ -115,7 +116,7 @@ static void set_output_numeric_locale(output_numeric_locale loc) {
  */
 int
 do_show(CatalogState *catalogState, InstanceState *instanceState, 
-		time_t requested_backup_id, bool show_archive)
+		time_t requested_backup_id, bool show_archive, bool show_files)
 {
 	int i;
 
@@ -127,6 +128,14 @@ do_show(CatalogState *catalogState, InstanceState *instanceState,
 		requested_backup_id != INVALID_BACKUP_ID)
 		elog(ERROR, "You cannot specify --archive and (-i, --backup-id) options together");
 
+	if (show_files)
+	{
+		if (requested_backup_id == INVALID_BACKUP_ID)
+			elog(ERROR, "You must specify (-i, --backup-id) to use --files option");
+
+		return show_backup_files(instanceState, requested_backup_id);
+	}
+
 	/*
 	 * if instance is not specified,
 	 * show information about all instances in this backup catalog
@@ -579,6 +588,29 @@ show_backup(InstanceState *instanceState, time_t requested_backup_id)
 	return 0;
 }
 
+/*
+ * Print the file list of the backup, one JSON object per file,
+ * as DATABASE_FILE_LIST was written by older versions.
+ */
+static int
+show_backup_files(InstanceState *instanceState, time_t requested_backup_id)
+{
+	parray	   *backups;
+
+	backups = catalog_get_backup_list(instanceState, requested_backup_id);
+
+	if (parray_num(backups) == 0)
+		elog(INFO, "Requested backup \"%s\" is not found.",
+			 base36enc(requested_backup_id));
+	else
+		print_backup_filelist((pgBackup *) parray_get(backups, 0), stdout);
+
+	parray_walk(backups, pgBackupFree);
+	parray_free(backups);
+
+	return 0;
+}
+
 /*
  * Show instance backups in plain format.
  */
@@ -0,0 +1,281 @@
+/*-------------------------------------------------------------------------
+ *
+ * throttle.c: limit the rate of reading data files
+ *
+ * Portions Copyright (c) 2015-2025, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+#include "utils/thread.h"
+#include "instr_time.h"
+
+/*
+ * Rate limiter is a token bucket shared by all worker threads.
+ * Every thread takes from the bucket as many bytes as it has read,
+ * and the bucket is refilled at the current rate. When the bucket runs dry,
+ * the thread sleeps until its debt is paid off, so that threads reading
+ * at the same time queue up one after another.
+ *
+ * In adaptive mode the rate follows the I/O latency of the database itself,
+ * i.e. the average time of a block read, as accounted in pg_stat_database
+ * with track_io_timing enabled. When the latency grows well above the lowest
+ * one seen so far, the rate is halved, otherwise it is raised back to
+ * the limit step by step.
+ */
+
+/* bucket holds no more than this number of seconds of reading */
+#define THROTTLE_BURST_SEC			0.1
+/* sleep in slices of this length to notice interrupts */
+#define THROTTLE_SLEEP_SLICE_USEC	100000L
+/* how often the database is polled in adaptive mode */
+#define THROTTLE_POLL_INTERVAL_SEC	2.0
+/* minimum number of block reads to judge the latency by */
+#define THROTTLE_MIN_BLOCKS_READ	64
+/* latency is degraded, if it is several times above the baseline... */
+#define THROTTLE_LATENCY_FACTOR		2.0
+/* ...and is longer by at least this number of milliseconds */
+#define THROTTLE_LATENCY_SLACK_MS	1.0
+/* rate is never lowered below max_rate / THROTTLE_MIN_RATE_DIVISOR */
+#define THROTTLE_MIN_RATE_DIVISOR	16
+/* rate is raised back by max_rate / THROTTLE_RAISE_DIVISOR per poll */
+#define THROTTLE_RAISE_DIVISOR		8
+
+typedef struct Throttle
+{
+	pthread_mutex_t	mutex;
+	double		max_rate;		/* bytes per second, 0 means no limit */
+	double		rate;			/* current rate */
+	double		tokens;			/* bytes allowed to read, negative is a debt */
+	instr_time	last_refill;
+
+	/* adaptive mode */
+	PGconn	   *conn;			/* own connection of the throttle, NULL if
+								 * the rate is fixed */
+	bool		polling;		/* some thread is polling the database */
+	instr_time	last_poll;
+	int64		blks_read;		/* statistics of the previous poll */
+	double		blk_read_time;
+	double		baseline;		/* lowest latency seen, ms per block */
+} Throttle;
+
+static Throttle throttle = {PTHREAD_MUTEX_INITIALIZER};
+
+static bool throttle_read_stats(PGconn *conn, int64 *blks_read,
+								double *blk_read_time);
+static void throttle_poll(void);
+
+/*
+ * Start limiting the rate of reading to max_rate.
+ * In adaptive mode statistics of the database are polled by worker threads,
+ * so the throttle opens its own connection with the parameters of conn,
+ * which stays with the main thread.
+ */
+void
+throttle_start(PGconn *conn)
+{
+	char		pretty_rate[20];
+	PGresult   *res;
+	bool		io_timing;
+	PGconn	   *poll_conn;
+
+	throttle.max_rate = (double) max_rate * 1024;
+	throttle.rate = throttle.max_rate;
+	throttle.tokens = 0;
+	throttle.conn = NULL;
+	throttle.polling = false;
+	throttle.baseline = -1;
+	INSTR_TIME_SET_CURRENT(throttle.last_refill);
+	throttle.last_poll = throttle.last_refill;
+
+	if (max_rate == 0)
+		return;
+
+	pretty_size((int64) throttle.max_rate, pretty_rate, lengthof(pretty_rate));
+	elog(INFO, "Reading rate is limited to %s/s", pretty_rate);
+
+	if (!adaptive_rate || conn == NULL)
+		return;
+
+	res = pgut_execute(conn, "SHOW track_io_timing", 0, NULL);
+	io_timing = (strcmp(PQgetvalue(res, 0, 0), "on") == 0);
+	PQclear(res);
+
+	if (!io_timing)
+	{
+		elog(WARNING, "Parameter \"track_io_timing\" is disabled, "
+			 "I/O latency of the database is unknown. Reading rate is fixed");
+		return;
+	}
+
+	poll_conn = pgut_connect(PQhost(conn), PQport(conn), PQdb(conn), PQuser(conn));
+
+	if (!throttle_read_stats(poll_conn, &throttle.blks_read, &throttle.blk_read_time))
+	{
+		pgut_disconnect(poll_conn);
+		return;
+	}
+
+	throttle.conn = poll_conn;
+}
+
+/*
+ * Stop limiting the rate of reading.
+ * Called after worker threads are finished, so nobody is polling.
+ */
+void
+throttle_stop(void)
+{
+	throttle.max_rate = 0;
+
+	if (throttle.conn)
+	{
+		pgut_disconnect(throttle.conn);
+		throttle.conn = NULL;
+	}
+}
+
+/*
+ * Account the given number of bytes read and sleep, if the reading
+ * goes faster than allowed.
+ */
+void
+throttle_consume(size_t bytes)
+{
+	instr_time	now;
+	instr_time	elapsed;
+	double		wait_sec = 0;
+	bool		need_poll = false;
+
+	if (throttle.max_rate == 0)
+		return;
+
+	pthread_lock(&throttle.mutex);
+
+	INSTR_TIME_SET_CURRENT(now);
+	elapsed = now;
+	INSTR_TIME_SUBTRACT(elapsed, throttle.last_refill);
+	throttle.last_refill = now;
+
+	throttle.tokens = Min(throttle.tokens + INSTR_TIME_GET_DOUBLE(elapsed) * throttle.rate,
+						  throttle.rate * THROTTLE_BURST_SEC);
+	throttle.tokens -= bytes;
+
+	if (throttle.tokens < 0)
+		wait_sec = -throttle.tokens / throttle.rate;
+
+	if (throttle.conn != NULL && !throttle.polling)
+	{
+		elapsed = now;
+		INSTR_TIME_SUBTRACT(elapsed, throttle.last_poll);
+
+		if (INSTR_TIME_GET_DOUBLE(elapsed) >= THROTTLE_POLL_INTERVAL_SEC)
+		{
+			throttle.polling = true;
+			throttle.last_poll = now;
+			need_poll = true;
+		}
+	}
+
+	pthread_mutex_unlock(&throttle.mutex);
+
+	if (need_poll)
+		throttle_poll();
+
+	while (wait_sec > 0 && !interrupted && !thread_interrupted)
+	{
+		long		usec = Min((long) (wait_sec * 1000000), THROTTLE_SLEEP_SLICE_USEC);
+
+		pg_usleep(Max(usec, 1));
+		wait_sec -= (double) usec / 1000000;
+	}
+}
+
+/*
+ * Get cumulative number of blocks read by the database and time spent
+ * on reading them, in milliseconds.
+ * Called from worker threads, so must not throw errors.
+ */
+static bool
+throttle_read_stats(PGconn *conn, int64 *blks_read, double *blk_read_time)
+{
+	PGresult   *res;
+	bool		ok = false;
+
+	res = PQexec(conn, "SELECT sum(blks_read)::bigint, sum(blk_read_time)::float8 "
+					   "FROM pg_catalog.pg_stat_database");
+
+	if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1)
+	{
+		*blks_read = atoll(PQgetvalue(res, 0, 0));
+		*blk_read_time = atof(PQgetvalue(res, 0, 1));
+		ok = true;
+	}
+	else
+		elog(WARNING, "Cannot get I/O statistics of the database, "
+			 "reading rate is fixed: %s", PQerrorMessage(conn));
+
+	PQclear(res);
+	return ok;
+}
+
+/* Adjust the rate to the I/O latency of the database */
+static void
+throttle_poll(void)
+{
+	int64		blks_read;
+	double		blk_read_time;
+	bool		ok;
+
+	/*
+	 * The connection belongs to the throttle and is used by one thread at
+	 * a time, see throttle.polling. It is closed by throttle_stop().
+	 */
+	ok = throttle_read_stats(throttle.conn, &blks_read, &blk_read_time);
+
+	pthread_lock(&throttle.mutex);
+
+	if (ok && throttle.max_rate > 0)
+	{
+		int64		delta_blks = blks_read - throttle.blks_read;
+		double		min_rate = throttle.max_rate / THROTTLE_MIN_RATE_DIVISOR;
+		double		rate = throttle.rate + throttle.max_rate / THROTTLE_RAISE_DIVISOR;
+		double		latency = 0;
+
+		/* the database barely reads anything, there is nobody to disturb */
+		if (delta_blks >= THROTTLE_MIN_BLOCKS_READ)
+		{
+			latency = (blk_read_time - throttle.blk_read_time) / delta_blks;
+
+			if (throttle.baseline < 0 || latency < throttle.baseline)
+				throttle.baseline = latency;
+
+			if (latency > throttle.baseline * THROTTLE_LATENCY_FACTOR &&
+				latency > throttle.baseline + THROTTLE_LATENCY_SLACK_MS)
+				rate = throttle.rate / 2;
+		}
+
+		rate = Max(Min(rate, throttle.max_rate), min_rate);
+
+		if (rate != throttle.rate)
+		{
+			char		pretty_rate[20];
+
+			pretty_size((int64) rate, pretty_rate, lengthof(pretty_rate));
+			elog(LOG, "I/O latency of the database is %.3f ms, "
+				 "reading rate is limited to %s/s", latency, pretty_rate);
+			throttle.rate = rate;
+		}
+
+		throttle.blks_read = blks_read;
+		throttle.blk_read_time = blk_read_time;
+	}
+
+	/* after a failure nobody polls again, the rate stays as it is */
+	if (ok)
+		throttle.polling = false;
+
+	pthread_mutex_unlock(&throttle.mutex);
+}
@@ -10,6 +10,8 @@
 
 #define PRINTF_BUF_SIZE  1024
 #define FILE_PERMISSIONS 0600
+/* number of restored pages of consecutive blocks written by agent at once */
+#define FIO_WRITE_RUN_PAGES 32
 
 static __thread unsigned long fio_fdset = 0;
 static __thread void* fio_stdin_buffer;
@@ -34,6 +36,7 @@ typedef struct
 	int         clevel;
 	int         bitmapsize;
 	int         path_len;
+	bool        direct_io;	/* drop read pages from page cache */
 } fio_send_request;
 
 typedef struct
@@ -46,6 +49,7 @@ typedef struct
 	bool exclusive_backup;
 	bool skip_hidden;
 	int  external_dir_num;
+	int  num_threads;
 } fio_list_dir_request;
 
 typedef struct
@@ -998,6 +1002,124 @@ fio_write_compressed_impl(int fd, void const* buf, size_t size, int compress_alg
 	}
 }
 
+/*
+ * Send batch of pages to be written into remote file at their blocks.
+ * 'buf' holds fio_page_entry of every page, followed by its data.
+ * Compressed pages are decompressed by the agent.
+ */
+void
+fio_fwrite_pages_async(FILE* f, void const* buf, size_t size)
+{
+	fio_header hdr;
+
+	Assert(fio_is_remote_file(f));
+
+	hdr.cop = FIO_WRITE_PAGES_ASYNC;
+	hdr.handle = fio_fileno(f) & ~FIO_PIPE_MARKER;
+	hdr.size = size;
+	hdr.arg = 0;
+
+	IO_CHECK(fio_write_all(fio_stdout, &hdr, sizeof(hdr)), sizeof(hdr));
+	IO_CHECK(fio_write_all(fio_stdout, buf, size), size);
+}
+
+/* Write run of pages of consecutive blocks */
+static bool
+fio_write_pages_run(int fd, char const* buf, BlockNumber blknum, int n_pages)
+{
+	size_t		len = (size_t) n_pages * BLCKSZ;
+
+	if (lseek(fd, (off_t) blknum * BLCKSZ, SEEK_SET) < 0 ||
+		durable_write(fd, buf, len) <= 0)
+	{
+		async_errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+		snprintf(async_errormsg, ERRMSG_MAX_LEN, "%s", strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Write pages of FIO_WRITE_PAGES_ASYNC message. Pages are decompressed
+ * into a buffer, and pages of consecutive blocks are written at once.
+ */
+static void
+fio_write_pages_impl(int fd, char const* buf, size_t size)
+{
+	static char *run_buf = NULL;
+	BlockNumber	run_start = 0;
+	int			n_run = 0;
+	size_t		pos = 0;
+
+	/* If the previous command already have failed,
+	 * then there is no point in bashing a head against the wall
+	 */
+	if (async_errormsg)
+		return;
+
+	if (run_buf == NULL)
+		run_buf = pgut_malloc(FIO_WRITE_RUN_PAGES * BLCKSZ);
+
+	while (pos < size)
+	{
+		fio_page_entry page;
+		char	   *dst;
+
+		if (pos + sizeof(page) > size)
+		{
+			async_errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+			snprintf(async_errormsg, ERRMSG_MAX_LEN,
+					 "Truncated page entry in batch of pages");
+			return;
+		}
+
+		memcpy(&page, buf + pos, sizeof(page));
+		pos += sizeof(page);
+
+		/* do not trust the sizes, sent by the other side */
+		if (page.size > BLCKSZ ||
+			(page.size != 0 && page.compress_alg == NONE_COMPRESS &&
+			 page.size != BLCKSZ) ||
+			pos + page.size > size)
+		{
+			async_errormsg = pgut_malloc(ERRMSG_MAX_LEN);
+			snprintf(async_errormsg, ERRMSG_MAX_LEN,
+					 "Invalid size %u of block %u in batch of pages",
+					 page.size, page.blknum);
+			return;
+		}
+
+		/* write out the run, if the page does not continue it */
+		if (n_run > 0 &&
+			(page.blknum != run_start + n_run || n_run == FIO_WRITE_RUN_PAGES))
+		{
+			if (!fio_write_pages_run(fd, run_buf, run_start, n_run))
+				return;
+			n_run = 0;
+		}
+
+		if (n_run == 0)
+			run_start = page.blknum;
+
+		dst = run_buf + (size_t) n_run * BLCKSZ;
+
+		if (page.size == 0)
+			memset(dst, 0, BLCKSZ);
+		else if (page.compress_alg == NONE_COMPRESS)
+			memcpy(dst, buf + pos, BLCKSZ);
+		else if (fio_decompress(dst, buf + pos, page.size, page.compress_alg,
+								&async_errormsg) < 0)
+			return;
+
+		pos += page.size;
+		n_run++;
+	}
+
+	if (n_run > 0)
+		fio_write_pages_run(fd, run_buf, run_start, n_run);
+}
+
 /* check if remote agent encountered any error during execution of async operations */
 int
 fio_check_error_file(FILE* f, char **errmsg)
@@ -1332,6 +1454,54 @@ fio_rename(char const* old_path, char const* new_path, fio_location location)
 	}
 }
 
+/*
+ * Open local file for reading past the page cache.
+ * Returns -1 if O_DIRECT is not supported by the platform or the filesystem.
+ */
+int
+fio_open_direct(char const* path)
+{
+#ifdef O_DIRECT
+	return open(path, O_RDONLY | O_DIRECT | PG_BINARY, 0);
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}
+
+/* Ask the kernel to evict the pages of local file, which we have read */
+void
+fio_drop_cache(int fd, off_t offset, off_t len)
+{
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_DONTNEED)
+	(void) posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/*
+ * Accumulate consecutive read ranges, so that cache is dropped
+ * by large portions instead of a system call for every page.
+ */
+void
+fio_drop_cache_add(fio_cache_range *range, off_t offset, off_t len)
+{
+	if (range->len > 0 &&
+		(offset != range->offset + range->len || range->len >= LARGE_CHUNK_SIZE))
+		fio_drop_cache_flush(range);
+
+	if (range->len == 0)
+		range->offset = offset;
+	range->len += len;
+}
+
+void
+fio_drop_cache_flush(fio_cache_range *range)
+{
+	if (range->len > 0)
+		fio_drop_cache(range->fd, range->offset, range->len);
+	range->len = 0;
+}
+
 /* Sync file to disk */
 int
 fio_sync(char const* path, fio_location location)
@@ -1415,7 +1585,7 @@ fio_get_crc32_ex(const char *file_path, fio_location location,
 	else
 	{
 		if (decompress)
-			return pgFileGetCRCgz(file_path, true, missing_ok);
+			return pgFileGetCRCCompressed(file_path, true, missing_ok);
 		else if (truncated)
 			return pgFileGetCRCTruncated(file_path, true, missing_ok);
 		else
@@ -1886,6 +2056,7 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 		fio_send_request arg;
 	} req;
 	BlockNumber	n_blocks_read = 0;
+	BlockNumber	n_blocks_throttled = 0;
 	BlockNumber blknum = 0;
 
 	/* send message with header
@@ -1921,6 +2092,7 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 	req.arg.calg = calg;
 	req.arg.clevel = clevel;
 	req.arg.path_len = strlen(from_fullpath) + 1;
+	req.arg.direct_io = direct_io;
 
 	file->compress_alg = calg; /* TODO: wtf? why here? */
 
@@ -1981,10 +2153,14 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			/* n_blocks_read reported by EOF */
 			n_blocks_read = hdr.arg;
 
+			/* agent has also read the pages, which were not sent */
+			if (n_blocks_read > n_blocks_throttled)
+				throttle_consume((size_t) (n_blocks_read - n_blocks_throttled) * BLCKSZ);
+
 			/* receive headers if any */
 			if (hdr.size > 0)
 			{
-				*headers = pgut_malloc(hdr.size);
+				*headers = header_arena_reserve(hdr.size / sizeof(BackupPageHeader2));
 				IO_CHECK(fio_read_all(fio_stdin, *headers, hdr.size), hdr.size);
 				file->n_headers = (hdr.size / sizeof(BackupPageHeader2)) -1;
 			}
@@ -1998,6 +2174,9 @@ fio_send_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			Assert(hdr.size <= sizeof(buf));
 			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
 
+			throttle_consume(BLCKSZ);
+			n_blocks_throttled++;
+
 			COMP_FILE_CRC32(true, file->crc, buf, hdr.size);
 
 			/* lazily open backup file */
@@ -2053,6 +2232,7 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 		fio_send_request arg;
 	} req;
 	BlockNumber	n_blocks_read = 0;
+	BlockNumber	n_blocks_throttled = 0;
 	BlockNumber blknum = 0;
 
 	/* send message with header
@@ -2088,6 +2268,7 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 	req.arg.calg = calg;
 	req.arg.clevel = clevel;
 	req.arg.path_len = strlen(from_fullpath) + 1;
+	req.arg.direct_io = direct_io;
 
 	file->compress_alg = calg; /* TODO: wtf? why here? */
 
@@ -2169,6 +2350,10 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			/* n_blocks_read reported by EOF */
 			n_blocks_read = hdr.arg;
 
+			/* agent has also read the pages, which were not sent */
+			if (n_blocks_read > n_blocks_throttled)
+				throttle_consume((size_t) (n_blocks_read - n_blocks_throttled) * BLCKSZ);
+
 			/* receive headers if any */
 			if (hdr.size > 0)
 			{
@@ -2186,6 +2371,9 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 			Assert(hdr.size <= sizeof(buf));
 			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
 
+			throttle_consume(BLCKSZ);
+			n_blocks_throttled++;
+
 			COMP_FILE_CRC32(true, file->crc, buf, hdr.size);
 
 			if (fio_fseek(out, blknum * BLCKSZ) < 0)
@@ -2193,9 +2381,22 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 				elog(ERROR, "Cannot seek block %u of \"%s\": %s",
 					blknum, to_fullpath, strerror(errno));
 			}
+			/* zeroed page comes without data, but must overwrite the block */
+			if (hdr.size == sizeof(BackupPageHeader))
+			{
+				char	zero_page[BLCKSZ];
+
+				memset(zero_page, 0, BLCKSZ);
+				if (fio_fwrite(out, zero_page, BLCKSZ) != BLCKSZ)
+				{
+					fio_fclose(out);
+					*err_blknum = blknum;
+					return WRITE_FAILED;
+				}
+			}
 			// должен прилетать некомпрессированный блок с заголовком
 			// Вставить assert?
-			if (fio_fwrite(out, buf + sizeof(BackupPageHeader), hdr.size - sizeof(BackupPageHeader)) != BLCKSZ)
+			else if (fio_fwrite(out, buf + sizeof(BackupPageHeader), hdr.size - sizeof(BackupPageHeader)) != BLCKSZ)
 			{
 				fio_fclose(out);
 				*err_blknum = blknum;
@@ -2215,6 +2416,51 @@ fio_copy_pages(const char *to_fullpath, const char *from_fullpath, pgFile *file,
 	return n_blocks_read;
 }
 
+/*
+ * Read the next range of changed blocks of the pagemap below nblocks
+ * by a single pread(). Errors and the end of file are not reported here,
+ * blocks, which are not read, are left to per-block reads.
+ * Returns false if the pagemap is exhausted.
+ */
+static bool
+fio_read_pagemap_range(FILE *in, datapagemap_iterator_t *iter,
+					   BlockNumber nblocks, char *range_buf,
+					   BlockNumber *range_start, BlockNumber *range_nblocks,
+					   BlockNumber *range_nread, fio_cache_range *cache_range)
+{
+	size_t		len;
+	size_t		read_len = 0;
+
+	if (!datapagemap_next_range(iter, PAGEMAP_GAP_BLOCKS, BACKUP_EXTENT_BLOCKS,
+								range_start, range_nblocks))
+		return false;
+
+	if (*range_start >= nblocks)
+		return false;
+
+	*range_nblocks = Min(*range_nblocks, nblocks - *range_start);
+
+	len = (size_t) *range_nblocks * BLCKSZ;
+	while (read_len < len)
+	{
+		ssize_t		rc = pread(fileno(in), range_buf + read_len, len - read_len,
+							   (off_t) *range_start * BLCKSZ + read_len);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0)
+			break;
+		read_len += rc;
+	}
+	*range_nread = read_len / BLCKSZ;
+
+	/* the range is in range_buf now, kernel can forget it */
+	if (cache_range && read_len > 0)
+		fio_drop_cache_add(cache_range, (off_t) *range_start * BLCKSZ, read_len);
+
+	return true;
+}
+
 /* TODO: read file using large buffer
  * Return codes:
  *  FIO_ERROR:
@@ -2244,10 +2490,17 @@ fio_send_pages_impl(int out, char* buf)
 	/* parse buffer */
 	datapagemap_t *map = NULL;
 	datapagemap_iterator_t *iter = NULL;
-	/* page headers */
+	/* page headers, collected in the arena */
 	int32       hdr_num = -1;
 	int32       cur_pos_out = 0;
 	BackupPageHeader2 *headers = NULL;
+	/* pages read so far, to be dropped from page cache */
+	fio_cache_range cache_range = {-1, 0, 0};
+	/* range of changed blocks, read at once */
+	char        *range_buf = NULL;
+	BlockNumber  range_start = 0;
+	BlockNumber  range_nblocks = 0;
+	BlockNumber  range_nread = 0;
 
 	/* open source file */
 	in = fopen(from_fullpath, PG_BINARY_R);
@@ -2282,17 +2535,25 @@ fio_send_pages_impl(int out, char* buf)
 		goto cleanup;
 	}
 
+	cache_range.fd = fileno(in);
+
 	if (with_pagemap)
 	{
 		map = pgut_malloc(sizeof(datapagemap_t));
 		map->bitmapsize = req->bitmapsize;
 		map->bitmap = (char*) buf + sizeof(fio_send_request) + req->path_len;
 
-		/* get first block */
-		iter = datapagemap_iterate(map);
-		datapagemap_next(iter, &blknum);
-
 		setvbuf(in, NULL, _IONBF, BUFSIZ);
+
+		/* read the first range of changed blocks */
+		iter = datapagemap_iterate(map);
+		range_buf = pgut_malloc(BACKUP_EXTENT_SIZE);
+		if (fio_read_pagemap_range(in, iter, req->nblocks, range_buf,
+								   &range_start, &range_nblocks, &range_nread,
+								   req->direct_io ? &cache_range : NULL))
+			blknum = range_start;
+		else
+			blknum = req->nblocks;
 	}
 	else
 		setvbuf(in, in_buf, _IOFBF, STDIO_BUFSIZE);
@@ -2313,21 +2574,31 @@ fio_send_pages_impl(int out, char* buf)
 		/* read page, check header and validate checksumms */
 		for (;;)
 		{
-			/*
-			 * Optimize stdio buffer usage, fseek only when current position
-			 * does not match the position of requested block.
-			 */
-			if (current_pos != blknum*BLCKSZ)
+			/* first attempt is served from the range, retries read the file */
+			if (with_pagemap && retry_attempts == PAGE_READ_ATTEMPTS &&
+				blknum < range_start + range_nread)
 			{
-				current_pos = blknum*BLCKSZ;
-				if (fseek(in, current_pos, SEEK_SET) != 0)
-					elog(ERROR, "fseek to position %u is failed on remote file '%s': %s",
-							current_pos, from_fullpath, strerror(errno));
+				memcpy(read_buffer, range_buf + (blknum - range_start) * BLCKSZ, BLCKSZ);
+				read_len = BLCKSZ;
 			}
+			else
+			{
+				/*
+				 * Optimize stdio buffer usage, fseek only when current position
+				 * does not match the position of requested block.
+				 */
+				if (current_pos != blknum*BLCKSZ)
+				{
+					current_pos = blknum*BLCKSZ;
+					if (fseek(in, current_pos, SEEK_SET) != 0)
+						elog(ERROR, "fseek to position %u is failed on remote file '%s': %s",
+								current_pos, from_fullpath, strerror(errno));
+				}
 
-			read_len = fread(read_buffer, 1, BLCKSZ, in);
+				read_len = fread(read_buffer, 1, BLCKSZ, in);
 
-			current_pos += read_len;
+				current_pos += read_len;
+			}
 
 			/* report error */
 			if (ferror(in))
@@ -2353,7 +2624,6 @@ fio_send_pages_impl(int out, char* buf)
 										   InvalidXLogRecPtr, &page_st,
 										   req->checksumVersion);
 
-				/* TODO: optimize copy of zeroed page */
 				if (rc == PAGE_IS_ZEROED)
 					break;
 				else if (rc == PAGE_IS_VALID)
@@ -2395,6 +2665,10 @@ fio_send_pages_impl(int out, char* buf)
 
 		n_blocks_read++;
 
+		/* the page is in read_buffer now, kernel can forget it */
+		if (req->direct_io && !with_pagemap)
+			fio_drop_cache_add(&cache_range, (off_t) blknum * BLCKSZ, BLCKSZ);
+
 		/*
 		 * horizonLsn is not 0 only in case of delta and ptrack backup.
 		 * As far as unsigned number are always greater or equal than zero,
@@ -2412,32 +2686,40 @@ fio_send_pages_impl(int out, char* buf)
 			hdr.cop = FIO_PAGE;
 			hdr.arg = blknum;
 
-			compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
-										  sizeof(write_buffer) - sizeof(BackupPageHeader),
-										  read_buffer, BLCKSZ, req->calg, req->clevel,
-										  NULL);
-
-			if (compressed_size <= 0 || compressed_size >= BLCKSZ)
+			/* zeroed page is sent as a header only */
+			if (rc == PAGE_IS_ZEROED)
 			{
-				/* Do not compress page */
-				memcpy(write_buffer + sizeof(BackupPageHeader), read_buffer, BLCKSZ);
-				compressed_size = BLCKSZ;
+				bph->block = blknum;
+				bph->compressed_size = PageIsZeroed;
+				hdr.size = sizeof(BackupPageHeader);
 			}
-			bph->block = blknum;
-			bph->compressed_size = compressed_size;
+			else
+			{
+				compressed_size = do_compress(write_buffer + sizeof(BackupPageHeader),
+											  sizeof(write_buffer) - sizeof(BackupPageHeader),
+											  read_buffer, BLCKSZ, req->calg, req->clevel,
+											  NULL);
+
+				if (compressed_size <= 0 || compressed_size >= BLCKSZ)
+				{
+					/* Do not compress page */
+					memcpy(write_buffer + sizeof(BackupPageHeader), read_buffer, BLCKSZ);
+					compressed_size = BLCKSZ;
+				}
+				bph->block = blknum;
+				bph->compressed_size = compressed_size;
 
-			hdr.size = compressed_size + sizeof(BackupPageHeader);
+				hdr.size = compressed_size + sizeof(BackupPageHeader);
+			}
 
 			IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
 			IO_CHECK(fio_write_all(out, write_buffer, hdr.size), hdr.size);
 
-			/* set page header for this file */
+			/* set page header for this file, reserve room for the dummy one */
 			hdr_num++;
-			if (!headers)
-				headers = (BackupPageHeader2 *) pgut_malloc(sizeof(BackupPageHeader2));
-			else
-				headers = (BackupPageHeader2 *) pgut_realloc(headers, (hdr_num+1) * sizeof(BackupPageHeader2));
+			headers = header_arena_reserve(hdr_num + 2);
 
+			MemSet(&headers[hdr_num], 0, sizeof(BackupPageHeader2));
 			headers[hdr_num].block = blknum;
 			headers[hdr_num].lsn = page_st.lsn;
 			headers[hdr_num].checksum = page_st.checksum;
@@ -2449,9 +2731,21 @@ fio_send_pages_impl(int out, char* buf)
 		/* next block */
 		if (with_pagemap)
 		{
-			/* exit if pagemap is exhausted */
-			if (!datapagemap_next(iter, &blknum))
-				break;
+			/* skip unchanged blocks in the middle of the range */
+			do
+				blknum++;
+			while (blknum < range_start + range_nblocks &&
+				   !datapagemap_is_set(map, blknum));
+
+			if (blknum >= range_start + range_nblocks)
+			{
+				/* exit if pagemap is exhausted */
+				if (!fio_read_pagemap_range(in, iter, req->nblocks, range_buf,
+											&range_start, &range_nblocks, &range_nread,
+											req->direct_io ? &cache_range : NULL))
+					break;
+				blknum = range_start;
+			}
 		}
 		else
 			blknum++;
@@ -2468,7 +2762,7 @@ eof:
 		hdr.size = (hdr_num+2) * sizeof(BackupPageHeader2);
 
 		/* add dummy header */
-		headers = (BackupPageHeader2 *) pgut_realloc(headers, (hdr_num+2) * sizeof(BackupPageHeader2));
+		MemSet(&headers[hdr_num+1], 0, sizeof(BackupPageHeader2));
 		headers[hdr_num+1].pos = cur_pos_out;
 	}
 	IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
@@ -2477,10 +2771,11 @@ eof:
 		IO_CHECK(fio_write_all(out, headers, hdr.size), hdr.size);
 
 cleanup:
+	fio_drop_cache_flush(&cache_range);
 	pg_free(map);
 	pg_free(iter);
+	pg_free(range_buf);
 	pg_free(errormsg);
-	pg_free(headers);
 	if (in)
 		fclose(in);
 	return;
@@ -2795,6 +3090,8 @@ fio_send_file(const char *from_fullpath, FILE* out, bool cut_zero_tail,
 
 	hdr.cop = FIO_SEND_FILE;
 	hdr.size = path_len;
+	/* ask agent to drop the file from page cache after reading */
+	hdr.arg = direct_io;
 
 //	elog(VERBOSE, "Thread [%d]: Attempting to open remote WAL file '%s'",
 //			thread_num, from_fullpath);
@@ -2858,6 +3155,7 @@ fio_send_file(const char *from_fullpath, FILE* out, bool cut_zero_tail,
 		{
 			Assert(hdr.size <= CHUNK_SIZE);
 			IO_CHECK(fio_read_all(fio_stdin, buf, hdr.size), hdr.size);
+			throttle_consume(hdr.size);
 
 			/* We have received a chunk of data data, lets write it out */
 			fio_send_file_crc(&st, buf, hdr.size);
@@ -2877,6 +3175,7 @@ fio_send_file(const char *from_fullpath, FILE* out, bool cut_zero_tail,
 			 * wrote it.
 			 */
 			st.read_size += hdr.arg;
+			throttle_consume(hdr.arg);
 		}
 		else
 		{
@@ -2942,6 +3241,8 @@ fio_send_file_local(const char *from_fullpath, FILE* out, bool cut_zero_tail,
 			goto cleanup;
 		}
 
+		throttle_consume(read_len);
+
 		if (read_len > 0)
 		{
 			non_zero_len = find_zero_tail(buf, read_len);
@@ -2970,6 +3271,10 @@ fio_send_file_local(const char *from_fullpath, FILE* out, bool cut_zero_tail,
 				/* Just pretend we wrote it. */
 				st.read_size += read_len - non_zero_len;
 			}
+
+			/* the chunk is consumed, kernel can forget it */
+			if (direct_io)
+				fio_drop_cache(fileno(in), st.read_size - read_len, read_len);
 		}
 
 		if (feof(in))
@@ -3026,7 +3331,7 @@ cleanup:
  *
  */
 static void
-fio_send_file_impl(int out, char const* path)
+fio_send_file_impl(int out, char const* path, bool drop_cache)
 {
 	FILE      *fp;
 	fio_header hdr;
@@ -3125,6 +3430,9 @@ fio_send_file_impl(int out, char const* path)
 				IO_CHECK(fio_write_all(out, &hdr, sizeof(hdr)), sizeof(hdr));
 			}
 
+			if (drop_cache)
+				fio_drop_cache(fileno(fp), read_size, read_len);
+
 			read_size += read_len;
 		}
 
@@ -3348,6 +3656,45 @@ pgFileGetCRCgz(const char *file_path, bool use_crc32c, bool missing_ok)
 	return crc;
 }
 
+/*
+ * Read the local compressed file to compute CRC of its content.
+ * Files compressed with zstd or lz4 are recognized by suffix,
+ * gzip is assumed otherwise.
+ */
+pg_crc32
+pgFileGetCRCCompressed(const char *file_path, bool use_crc32c, bool missing_ok)
+{
+	CompressAlg	alg = wal_suffix_compress_alg(file_path);
+	pg_crc32	crc = 0;
+	char	   *content = NULL;
+	size_t		size = 0;
+	const char *errormsg = NULL;
+	int			rc;
+
+	if (alg == NOT_DEFINED_COMPRESS)
+		return pgFileGetCRCgz(file_path, use_crc32c, missing_ok);
+
+	INIT_FILE_CRC32(use_crc32c, crc);
+
+	rc = read_compressed_frame(file_path, alg, FIO_LOCAL_HOST,
+							   &content, &size, &errormsg);
+	if (rc == FILE_MISSING && missing_ok)
+	{
+		FIN_FILE_CRC32(use_crc32c, crc);
+		return crc;
+	}
+	else if (rc == ZLIB_ERROR)
+		elog(ERROR, "Cannot decompress file \"%s\": %s", file_path, errormsg);
+	else if (rc != SEND_OK)
+		elog(ERROR, "Cannot read file \"%s\": %s", file_path, strerror(errno));
+
+	COMP_FILE_CRC32(use_crc32c, crc, content, size);
+	FIN_FILE_CRC32(use_crc32c, crc);
+	pg_free(content);
+
+	return crc;
+}
+
 /* Compile the array of files located on remote machine in directory root */
 static void
 fio_list_dir_internal(parray *files, const char *root, bool exclude,
@@ -3367,6 +3714,7 @@ fio_list_dir_internal(parray *files, const char *root, bool exclude,
 	req.exclusive_backup = exclusive_backup;
 	req.skip_hidden = skip_hidden;
 	req.external_dir_num = external_dir_num;
+	req.num_threads = num_threads;
 
 	hdr.cop = FIO_LIST_DIR;
 	hdr.size = sizeof(req);
@@ -3458,6 +3806,8 @@ fio_list_dir_impl(int out, char* buf)
 	 */
 	instance_config.logger.log_level_console = ERROR;
 	exclusive_backup = req->exclusive_backup;
+	/* list the directory on as many threads as the main process has */
+	num_threads = req->num_threads;
 
 	dir_list_file(file_files, req->path, req->exclude, req->follow_symlink,
 				  req->add_root, req->backup_logs, req->skip_hidden,
@@ -3860,6 +4210,9 @@ fio_communicate(int in, int out)
 		  case FIO_WRITE_COMPRESSED_ASYNC: /* Write to the current position in file */
 			fio_write_compressed_impl(fd[hdr.handle], buf, hdr.size, hdr.arg);
 			break;
+		  case FIO_WRITE_PAGES_ASYNC: /* Write pages at their blocks */
+			fio_write_pages_impl(fd[hdr.handle], buf, hdr.size);
+			break;
 		  case FIO_READ: /* Read from the current position in file */
 			if ((size_t)hdr.arg > buf_size) {
 				buf_size = hdr.arg;
@@ -3935,7 +4288,7 @@ fio_communicate(int in, int out)
 			fio_send_pages_impl(out, buf);
 			break;
 		  case FIO_SEND_FILE:
-			fio_send_file_impl(out, buf);
+			fio_send_file_impl(out, buf, hdr.arg != 0);
 			break;
 		  case FIO_SYNC:
 			/* open file and fsync it */
@@ -3958,7 +4311,7 @@ fio_communicate(int in, int out)
 				   (hdr.arg & (GET_CRC32_TRUNCATED|GET_CRC32_DECOMPRESS)) == GET_CRC32_TRUNCATED);
 			/* calculate crc32 for a file */
 			if ((hdr.arg & GET_CRC32_DECOMPRESS))
-				crc = pgFileGetCRCgz(buf, true, (hdr.arg & GET_CRC32_MISSING_OK) != 0);
+				crc = pgFileGetCRCCompressed(buf, true, (hdr.arg & GET_CRC32_MISSING_OK) != 0);
 			else if ((hdr.arg & GET_CRC32_TRUNCATED))
 				crc = pgFileGetCRCTruncated(buf, true, (hdr.arg & GET_CRC32_MISSING_OK) != 0);
 			else
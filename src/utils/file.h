@@ -57,7 +57,9 @@ typedef enum
 	FIO_GET_ASYNC_ERROR,
 	FIO_WRITE_ASYNC,
 	FIO_READLINK,
-	FIO_PAGE_ZERO
+	FIO_PAGE_ZERO,
+	/* used for restore of data files */
+	FIO_WRITE_PAGES_ASYNC
 } fio_operations;
 
 typedef enum
@@ -84,6 +86,22 @@ typedef struct
 	unsigned arg;
 } fio_header;
 
+/* Page of FIO_WRITE_PAGES_ASYNC message, followed by its data */
+typedef struct
+{
+	uint32		blknum;
+	uint32		size;			/* size of data, 0 for zeroed page */
+	int32		compress_alg;	/* NONE_COMPRESS if data is not compressed */
+} fio_page_entry;
+
+/* Range of a file already read, whose pages are to be dropped from page cache */
+typedef struct
+{
+	int		fd;
+	off_t	offset;
+	off_t	len;
+} fio_cache_range;
+
 extern fio_location MyLocation;
 
 /* Check if FILE handle is local or remote (created by FIO) */
@@ -97,6 +115,7 @@ extern FILE*   fio_fopen(char const* name, char const* mode, fio_location locati
 extern size_t  fio_fwrite(FILE* f, void const* buf, size_t size);
 extern ssize_t fio_fwrite_async_compressed(FILE* f, void const* buf, size_t size, int compress_alg);
 extern size_t  fio_fwrite_async(FILE* f, void const* buf, size_t size);
+extern void    fio_fwrite_pages_async(FILE* f, void const* buf, size_t size);
 extern int     fio_check_error_file(FILE* f, char **errmsg);
 extern int     fio_check_error_fd(int fd, char **errmsg);
 extern int     fio_check_error_fd_gz(gzFile f, char **errmsg);
@@ -121,6 +140,10 @@ extern int     fio_truncate(int fd, off_t size);
 extern int     fio_close(int fd);
 extern void    fio_disconnect(void);
 extern int     fio_sync(char const* path, fio_location location);
+extern int     fio_open_direct(char const* path);
+extern void    fio_drop_cache(int fd, off_t offset, off_t len);
+extern void    fio_drop_cache_add(fio_cache_range *range, off_t offset, off_t len);
+extern void    fio_drop_cache_flush(fio_cache_range *range);
 extern pg_crc32 fio_get_crc32(const char *file_path, fio_location location,
 							  bool decompress, bool missing_ok);
 extern pg_crc32 fio_get_crc32_truncated(const char *file_path, fio_location location,
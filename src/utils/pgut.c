@@ -589,6 +589,69 @@ pgut_execute_extended(PGconn* conn, const char *query, int nParams,
 	return res;
 }
 
+/*
+ * Execute query and pass every row of the result to the callback as soon as
+ * the row is received, in a PGresult of its own. Unlike pgut_execute(),
+ * the whole result is never kept in memory.
+ */
+void
+pgut_execute_foreach_row(PGconn* conn, const char *query, int nParams,
+						 const char **params, bool text_result,
+						 pgut_row_callback callback, void *arg)
+{
+	PGresult   *res;
+
+	if (interrupted && !in_cleanup)
+		elog(ERROR, "interrupted");
+
+	/* write query to elog if verbose */
+	if (logger_config.log_level_console <= VERBOSE ||
+		logger_config.log_level_file <= VERBOSE)
+	{
+		int		i;
+
+		if (strchr(query, '\n'))
+			elog(VERBOSE, "(query)\n%s", query);
+		else
+			elog(VERBOSE, "(query) %s", query);
+		for (i = 0; i < nParams; i++)
+			elog(VERBOSE, "\t(param:%d) = %s", i, params[i] ? params[i] : "(null)");
+	}
+
+	if (conn == NULL)
+		elog(ERROR, "not connected");
+
+	on_before_exec(conn, NULL);
+
+	if (PQsendQueryParams(conn, query, nParams, NULL, params, NULL, NULL,
+						  (text_result) ? 0 : 1) != 1)
+		elog(ERROR, "query failed: %squery was: %s",
+			 PQerrorMessage(conn), query);
+
+	if (PQsetSingleRowMode(conn) != 1)
+		elog(ERROR, "cannot set single-row mode for query: %s", query);
+
+	while ((res = PQgetResult(conn)) != NULL)
+	{
+		switch (PQresultStatus(res))
+		{
+			case PGRES_SINGLE_TUPLE:
+				callback(res, arg);
+				break;
+			case PGRES_TUPLES_OK:
+				/* the end of rows */
+				break;
+			default:
+				elog(ERROR, "query failed: %squery was: %s",
+					 PQerrorMessage(conn), query);
+				break;
+		}
+		PQclear(res);
+	}
+
+	on_after_exec(NULL);
+}
+
 bool
 pgut_send(PGconn* conn, const char *query, int nParams, const char **params, int elevel)
 {
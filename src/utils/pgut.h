@@ -52,6 +52,11 @@ extern PGresult *pgut_execute_parallel(PGconn* conn, PGcancel* thread_cancel_con
 							  const char *query, int nParams,
 							  const char **params, bool text_result, bool ok_error, bool async);
 extern bool pgut_send(PGconn* conn, const char *query, int nParams, const char **params, int elevel);
+
+typedef void (*pgut_row_callback) (PGresult *res, void *arg);
+extern void pgut_execute_foreach_row(PGconn* conn, const char *query, int nParams,
+									 const char **params, bool text_result,
+									 pgut_row_callback callback, void *arg);
 extern void pgut_cancel(PGconn* conn);
 extern int pgut_wait(int num, PGconn *connections[], struct timeval *timeout);
 
@@ -111,3 +111,148 @@ pthread_lock(pthread_mutex_t *mp)
 #endif
 	return pthread_mutex_lock(mp);
 }
+
+/*
+ * Fork/join of worker threads with work-stealing.
+ *
+ * This is not a persistent thread pool: fork_join_run() creates the threads
+ * and joins them before it returns, as the commands did by hand before.
+ * Commands run one parallel phase at a time, each far longer than starting
+ * a few threads, so idle threads are not kept between phases.
+ *
+ * Tasks are dealt to the workers round-robin, so that worker w owns tasks
+ * w, w + n_workers, w + 2 * n_workers and so on. Such a queue is described
+ * by a pair of counters, so submission of any number of tasks takes
+ * O(n_workers) time and memory. Once its own queue is exhausted, the worker
+ * steals tasks one by one from the other queues.
+ * Both the owner and the thieves take tasks from the head of the queue,
+ * so tasks are started approximately in the order of the list: file lists
+ * are sorted by size in descending order for load balancing, and WAL
+ * segments of archive-push and archive-get must go in ascending order.
+ * Every task is handed out exactly once, so scheduling of the whole list
+ * takes O(n_tasks) time, regardless of the number of workers.
+ */
+typedef struct ForkJoinQueue
+{
+	pthread_mutex_t mutex;
+	size_t		head;		/* ordinal of the next task to take */
+	size_t		tail;		/* ordinal of the task after the last one */
+} ForkJoinQueue;
+
+struct ForkJoin
+{
+	int			n_workers;
+	size_t		n_tasks;
+	ForkJoinQueue *queues;
+};
+
+ForkJoin *
+fork_join_create(int n_workers, size_t n_tasks)
+{
+	ForkJoin   *fork_join;
+	int			i;
+
+	Assert(n_workers > 0);
+
+	fork_join = (ForkJoin *) pg_malloc(sizeof(ForkJoin));
+	fork_join->n_workers = n_workers;
+	fork_join->n_tasks = n_tasks;
+	fork_join->queues = (ForkJoinQueue *) pg_malloc(n_workers * sizeof(ForkJoinQueue));
+
+	for (i = 0; i < n_workers; i++)
+	{
+		ForkJoinQueue *queue = &fork_join->queues[i];
+
+		pthread_mutex_init(&queue->mutex, NULL);
+		queue->head = 0;
+		queue->tail = (n_tasks > (size_t) i) ? (n_tasks - i + n_workers - 1) / n_workers : 0;
+	}
+
+	return fork_join;
+}
+
+/*
+ * Start n_workers threads running the worker function and wait for them.
+ * worker_args is an array of n_workers arguments of arg_size bytes each.
+ */
+void
+fork_join_run(ForkJoin *fork_join, void *(*worker) (void *),
+			  void *worker_args, size_t arg_size)
+{
+	pthread_t  *threads;
+	int			i;
+
+	threads = (pthread_t *) pg_malloc(fork_join->n_workers * sizeof(pthread_t));
+
+	for (i = 0; i < fork_join->n_workers; i++)
+		pthread_create(&threads[i], NULL, worker, (char *) worker_args + i * arg_size);
+
+	for (i = 0; i < fork_join->n_workers; i++)
+		pthread_join(threads[i], NULL);
+
+	pg_free(threads);
+}
+
+/* Take the next task from the queue of the worker */
+static bool
+fork_join_take(ForkJoin *fork_join, int worker_num, size_t *task)
+{
+	ForkJoinQueue *queue = &fork_join->queues[worker_num];
+	size_t		ordinal;
+
+	pthread_lock(&queue->mutex);
+
+	if (queue->head >= queue->tail)
+	{
+		pthread_mutex_unlock(&queue->mutex);
+		return false;
+	}
+
+	ordinal = queue->head++;
+
+	pthread_mutex_unlock(&queue->mutex);
+
+	*task = worker_num + ordinal * fork_join->n_workers;
+	return true;
+}
+
+/*
+ * Get the next task for the worker. Returns false, when there are
+ * no tasks left.
+ */
+bool
+fork_join_next_task(ForkJoin *fork_join, int worker_num, size_t *task)
+{
+	int			i;
+
+	if (fork_join_take(fork_join, worker_num, task))
+		return true;
+
+	/* own tasks are exhausted, steal from the others */
+	for (i = 1; i < fork_join->n_workers; i++)
+	{
+		if (fork_join_take(fork_join, (worker_num + i) % fork_join->n_workers, task))
+			return true;
+	}
+
+	return false;
+}
+
+void
+fork_join_free(ForkJoin *fork_join)
+{
+	if (fork_join == NULL)
+		return;
+
+#ifndef WIN32
+	{
+		int			i;
+
+		for (i = 0; i < fork_join->n_workers; i++)
+			pthread_mutex_destroy(&fork_join->queues[i].mutex);
+	}
+#endif
+
+	pg_free(fork_join->queues);
+	pg_free(fork_join);
+}
@@ -38,4 +38,17 @@ extern bool			thread_interrupted;
 
 extern int pthread_lock(pthread_mutex_t *mp);
 
+/*
+ * Fork/join helper: fork_join_run() starts n_workers threads, which take
+ * tasks numbered from 0 to n_tasks - 1, and joins them. Tasks are usually
+ * indexes in a parray of files. No threads are kept between runs.
+ */
+typedef struct ForkJoin ForkJoin;
+
+extern ForkJoin *fork_join_create(int n_workers, size_t n_tasks);
+extern void fork_join_run(ForkJoin *fork_join, void *(*worker) (void *),
+						  void *worker_args, size_t arg_size);
+extern bool fork_join_next_task(ForkJoin *fork_join, int worker_num, size_t *task);
+extern void fork_join_free(ForkJoin *fork_join);
+
 #endif   /* PROBACKUP_THREAD_H */
@@ -34,6 +34,9 @@ typedef struct
 	const char	*external_prefix;
 	HeaderMap   *hdr_map;
 
+	ForkJoin   *fork_join;
+	int			thread_num;
+
 	/*
 	 * Return value from the thread.
 	 * 0 means there is no error, 1 - there is an error.
@@ -52,8 +55,8 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	parray	   *files = NULL;
 	bool		corrupted = false;
 	bool		validation_isok = true;
-	/* arrays with meta info for multi threaded validate */
-	pthread_t  *threads;
+	/* meta info for multi threaded validate */
+	ForkJoin   *fork_join;
 	validate_files_arg *threads_args;
 	int			i;
 //	parray		*dbOid_exclude_list = NULL;
@@ -65,6 +68,12 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 			"Please upgrade pg_probackup binary.",
 				PROGRAM_VERSION, backup_id_of(backup), backup->program_version);
 
+	/* Check backup compression algorithm */
+	if (!compress_alg_supported(backup->compress_alg))
+		elog(ERROR, "Backup %s is compressed with %s, but current pg_probackup binary "
+					"is built without its support",
+				backup_id_of(backup), deparse_compress_alg(backup->compress_alg));
+
 	/* Check backup server version */
 	if (strcmp(backup->server_version, PG_MAJORVERSION) != 0)
         elog(ERROR, "Backup %s has server version %s, but current pg_probackup binary "
@@ -129,11 +138,8 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 //		dbOid_exclude_list = get_dbOid_exclude_list(backup, files, params->partial_db_list,
 //														params->partial_restore_type);
 
-	/* setup threads */
-	pfilearray_clear_locks(files);
-
 	/* init thread args with own file lists */
-	threads = (pthread_t *) palloc(sizeof(pthread_t) * num_threads);
+	fork_join = fork_join_create(num_threads, parray_num(files));
 	threads_args = (validate_files_arg *)
 		palloc(sizeof(validate_files_arg) * num_threads);
 
@@ -153,18 +159,19 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 		arg->external_prefix = external_prefix;
 		arg->hdr_map = &(backup->hdr_map);
 //		arg->dbOid_exclude_list = dbOid_exclude_list;
+		arg->fork_join = fork_join;
+		arg->thread_num = i + 1;
 		/* By default there are some error */
 		threads_args[i].ret = 1;
-
-		pthread_create(&threads[i], NULL, pgBackupValidateFiles, arg);
 	}
 
-	/* Wait theads */
+	fork_join_run(fork_join, pgBackupValidateFiles, threads_args,
+					sizeof(validate_files_arg));
+
 	for (i = 0; i < num_threads; i++)
 	{
 		validate_files_arg *arg = &(threads_args[i]);
 
-		pthread_join(threads[i], NULL);
 		if (arg->corrupted)
 			corrupted = true;
 		if (arg->ret == 1)
@@ -173,7 +180,7 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 	if (!validation_isok)
 		elog(ERROR, "Data files validation failed");
 
-	pfree(threads);
+	fork_join_free(fork_join);
 	pfree(threads_args);
 
 	/* cleanup */
@@ -224,12 +231,12 @@ pgBackupValidate(pgBackup *backup, pgRestoreParams *params)
 static void *
 pgBackupValidateFiles(void *arg)
 {
-	int			i;
+	size_t		i;
 	validate_files_arg *arguments = (validate_files_arg *)arg;
 	int			num_files = parray_num(arguments->files);
 	pg_crc32	crc;
 
-	for (i = 0; i < num_files; i++)
+	while (fork_join_next_task(arguments->fork_join, arguments->thread_num - 1, &i))
 	{
 		struct stat st;
 		pgFile	   *file = (pgFile *) parray_get(arguments->files, i);
@@ -255,11 +262,8 @@ pgBackupValidateFiles(void *arg)
 		//	continue;
 		//}
 
-		if (!pg_atomic_test_set_flag(&file->lock))
-			continue;
-
 		if (progress)
-			elog(INFO, "Progress: (%d/%d). Validate file \"%s\"",
+			elog(INFO, "Progress: (%zu/%d). Validate file \"%s\"",
 				 i + 1, num_files, file->rel_path);
 
 		/*
@@ -0,0 +1,352 @@
+/*-------------------------------------------------------------------------
+ *
+ * walsummary.c
+ *	  Functions for reading WAL summaries of the server
+ *
+ * Portions Copyright (c) 2015-2025, Postgres Professional
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "pg_probackup.h"
+
+/*
+ * Since PostgreSQL 17 the server itself can summarize WAL (summarize_wal),
+ * that is, keep track of blocks modified by each range of WAL.
+ * If the summaries cover the whole range from the start of the parent backup
+ * to the start of the current one, blocks changed in this range are taken
+ * from the summaries, and archived WAL is not read at all.
+ *
+ * Summaries contain changed blocks of all forks and "limit blocks" of
+ * truncated relations. Only the main fork is tracked, just as in
+ * extractPageMap(), and truncation is ignored: the size of the file shows
+ * whether its tail must be copied.
+ *
+ * Functions, which give access to the summaries, are revoked from PUBLIC,
+ * so a backup role without privileges on them falls back to WAL reading.
+ */
+
+/*
+ * How long to wait for the summarizer to reach start LSN of the backup.
+ * The wait is stopped earlier, if the summarizer makes no progress.
+ */
+#define WAL_SUMMARY_WAIT_SEC	10
+
+#if PG_VERSION_NUM >= 170000
+
+static bool wal_summary_functions_granted(PGconn *backup_conn);
+static bool wal_summaries_cover(PGconn *backup_conn, TimeLineID tli,
+								XLogRecPtr start_lsn, XLogRecPtr end_lsn);
+static bool wait_wal_summarizer(PGconn *backup_conn, TimeLineID tli,
+								XLogRecPtr lsn);
+static void add_summary_blocks(datapagemap_t *pagemap, const char *blocks);
+
+/*
+ * Build pagemaps of the files from WAL summaries, kept by the server, for WAL
+ * from 'start_lsn' up to 'end_lsn'.
+ *
+ * Returns false without touching the pagemaps if WAL summarization is
+ * disabled or the summaries do not cover the range. The caller must get
+ * changed blocks from WAL then.
+ */
+bool
+make_pagemap_from_wal_summaries(PGconn *backup_conn,
+								XLogRecPtr start_lsn, TimeLineID start_tli,
+								XLogRecPtr end_lsn, TimeLineID end_tli)
+{
+	PGresult   *res;
+	char		tli_buf[16];
+	char		start_lsn_buf[20];
+	char		end_lsn_buf[20];
+	char		relseg_size_buf[16];
+	const char *params[4];
+	int			i;
+
+	res = pgut_execute(backup_conn,
+					   "SELECT pg_catalog.current_setting('summarize_wal')",
+					   0, NULL);
+	if (strcmp(PQgetvalue(res, 0, 0), "on") != 0)
+	{
+		PQclear(res);
+		elog(LOG, "WAL summarization is disabled on the server");
+		return false;
+	}
+	PQclear(res);
+
+	if (!wal_summary_functions_granted(backup_conn))
+	{
+		elog(LOG, "Current user has no privileges to read WAL summaries");
+		return false;
+	}
+
+	/* A summary does not know whether its blocks belong to our timeline */
+	if (start_tli != end_tli)
+	{
+		elog(LOG, "WAL summaries are not used across timelines");
+		return false;
+	}
+
+	if (!wait_wal_summarizer(backup_conn, end_tli, end_lsn))
+		return false;
+
+	if (!wal_summaries_cover(backup_conn, end_tli, start_lsn, end_lsn))
+		return false;
+
+	elog(INFO, "Building pagemap from WAL summaries of the server");
+
+	snprintf(tli_buf, sizeof(tli_buf), "%u", end_tli);
+	snprintf(start_lsn_buf, sizeof(start_lsn_buf), "%X/%X",
+			 (uint32) (start_lsn >> 32), (uint32) start_lsn);
+	snprintf(end_lsn_buf, sizeof(end_lsn_buf), "%X/%X",
+			 (uint32) (end_lsn >> 32), (uint32) end_lsn);
+	snprintf(relseg_size_buf, sizeof(relseg_size_buf), "%u", RELSEG_SIZE);
+	params[0] = tli_buf;
+	params[1] = start_lsn_buf;
+	params[2] = end_lsn_buf;
+	params[3] = relseg_size_buf;
+
+	/* Changed blocks are grouped by relation segment on the server */
+	res = pgut_execute(backup_conn,
+					   "SELECT c.reltablespace, c.reldatabase, c.relfilenode, "
+					   "c.relblocknumber / $4::int8 AS segno, "
+					   "pg_catalog.array_agg(DISTINCT c.relblocknumber % $4::int8) "
+					   "FROM pg_catalog.pg_available_wal_summaries() s, "
+					   "LATERAL pg_catalog.pg_wal_summary_contents(s.tli, s.start_lsn, s.end_lsn) c "
+					   "WHERE s.tli = $1::int8 AND s.end_lsn > $2::pg_lsn "
+					   "AND s.start_lsn < $3::pg_lsn "
+					   "AND c.relforknumber = 0 AND NOT c.is_limit_block "
+					   "GROUP BY 1, 2, 3, 4",
+					   4, params);
+
+	if (PQnfields(res) != 5)
+		elog(ERROR, "Cannot get contents of WAL summaries");
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		RelFileNode	rnode;
+		BlockNumber	segno;
+		datapagemap_t pagemap = {NULL, 0};
+
+		rnode.spcOid = atooid(PQgetvalue(res, i, 0));
+		rnode.dbOid = atooid(PQgetvalue(res, i, 1));
+		rnode.relNumber = atooid(PQgetvalue(res, i, 2));
+		segno = (BlockNumber) strtoul(PQgetvalue(res, i, 3), NULL, 10);
+
+		add_summary_blocks(&pagemap, PQgetvalue(res, i, 4));
+
+		process_block_change(MAIN_FORKNUM, rnode, segno, &pagemap);
+		pg_free(pagemap.bitmap);
+	}
+
+	elog(LOG, "Changed blocks of %i relation segments are taken from WAL summaries",
+		 PQntuples(res));
+
+	PQclear(res);
+
+	return true;
+}
+
+/*
+ * Check that the current user may execute the functions, which give
+ * access to WAL summaries.
+ */
+static bool
+wal_summary_functions_granted(PGconn *backup_conn)
+{
+	PGresult   *res;
+	bool		granted;
+
+	res = pgut_execute(backup_conn,
+					   "SELECT pg_catalog.has_function_privilege("
+					   "'pg_catalog.pg_available_wal_summaries()', 'EXECUTE') "
+					   "AND pg_catalog.has_function_privilege("
+					   "'pg_catalog.pg_wal_summary_contents(bigint, pg_lsn, pg_lsn)', 'EXECUTE') "
+					   "AND pg_catalog.has_function_privilege("
+					   "'pg_catalog.pg_get_wal_summarizer_state()', 'EXECUTE')",
+					   0, NULL);
+	granted = strcmp(PQgetvalue(res, 0, 0), "t") == 0;
+	PQclear(res);
+
+	return granted;
+}
+
+/*
+ * Wait until the summarizer processes WAL up to 'lsn'.
+ * Gives up, if the summarizer is not running, or it has not read WAL up to
+ * 'lsn' yet and makes no progress, or WAL_SUMMARY_WAIT_SEC are over.
+ */
+static bool
+wait_wal_summarizer(PGconn *backup_conn, TimeLineID tli, XLogRecPtr lsn)
+{
+	int			attempts = 0;
+	XLogRecPtr	prev_pending_lsn = InvalidXLogRecPtr;
+
+	for (;;)
+	{
+		PGresult   *res;
+		TimeLineID	summarized_tli;
+		uint32		lsn_hi;
+		uint32		lsn_lo;
+		XLogRecPtr	summarized_lsn;
+		XLogRecPtr	pending_lsn;
+		bool		summarizer_running;
+
+		if (interrupted)
+			elog(ERROR, "Interrupted during waiting for WAL summarization");
+
+		res = pgut_execute(backup_conn,
+						   "SELECT summarized_tli, summarized_lsn, pending_lsn, "
+						   "summarizer_pid IS NOT NULL "
+						   "FROM pg_catalog.pg_get_wal_summarizer_state()",
+						   0, NULL);
+
+		summarized_tli = (TimeLineID) atoi(PQgetvalue(res, 0, 0));
+		XLogDataFromLSN(PQgetvalue(res, 0, 1), &lsn_hi, &lsn_lo);
+		summarized_lsn = ((uint64) lsn_hi) << 32 | lsn_lo;
+		XLogDataFromLSN(PQgetvalue(res, 0, 2), &lsn_hi, &lsn_lo);
+		pending_lsn = ((uint64) lsn_hi) << 32 | lsn_lo;
+		summarizer_running = strcmp(PQgetvalue(res, 0, 3), "t") == 0;
+		PQclear(res);
+
+		if (summarized_tli > tli ||
+			(summarized_tli == tli && summarized_lsn >= lsn))
+			return true;
+
+		if (!summarizer_running)
+		{
+			elog(LOG, "WAL summarizer is not running, "
+				 "changed blocks are taken from WAL archive");
+			return false;
+		}
+
+		/* summarizer is behind 'lsn' and has not moved since the last check */
+		if (attempts > 0 && pending_lsn < lsn && pending_lsn <= prev_pending_lsn)
+		{
+			elog(WARNING, "WAL summarizer makes no progress at %X/%X, "
+				 "changed blocks are taken from WAL archive",
+				 (uint32) (pending_lsn >> 32), (uint32) pending_lsn);
+			return false;
+		}
+
+		if (attempts++ >= WAL_SUMMARY_WAIT_SEC)
+		{
+			elog(WARNING, "WAL is summarized only up to %X/%X after %d seconds, "
+				 "changed blocks are taken from WAL archive",
+				 (uint32) (summarized_lsn >> 32), (uint32) summarized_lsn,
+				 WAL_SUMMARY_WAIT_SEC);
+			return false;
+		}
+
+		if (attempts == 1)
+			elog(INFO, "Wait for WAL summarization up to %X/%X",
+				 (uint32) (lsn >> 32), (uint32) lsn);
+		prev_pending_lsn = pending_lsn;
+		sleep(1);
+	}
+}
+
+/*
+ * Check that WAL summaries of timeline 'tli' available on the server
+ * cover the whole range from 'start_lsn' to 'end_lsn' without gaps.
+ */
+static bool
+wal_summaries_cover(PGconn *backup_conn, TimeLineID tli,
+					XLogRecPtr start_lsn, XLogRecPtr end_lsn)
+{
+	PGresult   *res;
+	char		tli_buf[16];
+	char		start_lsn_buf[20];
+	char		end_lsn_buf[20];
+	const char *params[3];
+	XLogRecPtr	covered_lsn = start_lsn;
+	int			i;
+
+	snprintf(tli_buf, sizeof(tli_buf), "%u", tli);
+	snprintf(start_lsn_buf, sizeof(start_lsn_buf), "%X/%X",
+			 (uint32) (start_lsn >> 32), (uint32) start_lsn);
+	snprintf(end_lsn_buf, sizeof(end_lsn_buf), "%X/%X",
+			 (uint32) (end_lsn >> 32), (uint32) end_lsn);
+	params[0] = tli_buf;
+	params[1] = start_lsn_buf;
+	params[2] = end_lsn_buf;
+
+	res = pgut_execute(backup_conn,
+					   "SELECT start_lsn, end_lsn "
+					   "FROM pg_catalog.pg_available_wal_summaries() "
+					   "WHERE tli = $1::int8 AND end_lsn > $2::pg_lsn "
+					   "AND start_lsn < $3::pg_lsn "
+					   "ORDER BY start_lsn",
+					   3, params);
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		uint32		lsn_hi;
+		uint32		lsn_lo;
+		XLogRecPtr	summary_start;
+		XLogRecPtr	summary_end;
+
+		XLogDataFromLSN(PQgetvalue(res, i, 0), &lsn_hi, &lsn_lo);
+		summary_start = ((uint64) lsn_hi) << 32 | lsn_lo;
+		XLogDataFromLSN(PQgetvalue(res, i, 1), &lsn_hi, &lsn_lo);
+		summary_end = ((uint64) lsn_hi) << 32 | lsn_lo;
+
+		/* There is a gap between summaries */
+		if (summary_start > covered_lsn)
+			break;
+
+		if (summary_end > covered_lsn)
+			covered_lsn = summary_end;
+	}
+	PQclear(res);
+
+	if (covered_lsn < end_lsn)
+	{
+		elog(LOG, "WAL summaries cover range from %X/%X only up to %X/%X, "
+			 "changed blocks are taken from WAL archive",
+			 (uint32) (start_lsn >> 32), (uint32) start_lsn,
+			 (uint32) (covered_lsn >> 32), (uint32) covered_lsn);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Add block numbers, listed in the text form of int8 array, to the pagemap.
+ */
+static void
+add_summary_blocks(datapagemap_t *pagemap, const char *blocks)
+{
+	const char *p = blocks;
+
+	if (*p == '{')
+		p++;
+
+	while (*p != '\0' && *p != '}')
+	{
+		char	   *end;
+		unsigned long blkno = strtoul(p, &end, 10);
+
+		if (end == p)
+			elog(ERROR, "Invalid list of changed blocks: \"%s\"", blocks);
+
+		datapagemap_add(pagemap, (BlockNumber) blkno);
+
+		p = end;
+		if (*p == ',')
+			p++;
+	}
+}
+
+#else
+
+/* WAL summaries are available since PostgreSQL 17 */
+bool
+make_pagemap_from_wal_summaries(PGconn *backup_conn,
+								XLogRecPtr start_lsn, TimeLineID start_tli,
+								XLogRecPtr end_lsn, TimeLineID end_tli)
+{
+	return false;
+}
+
+#endif
@@ -1585,6 +1585,46 @@ class BackupTest(ProbackupTest, unittest.TestCase):
             self.show_pb(backup_dir, 'node', backup_id)['status'],
             'Backup STATUS should be "ERROR"')
 
+    # @unittest.skip("skip")
+    def test_backup_filelist_journal(self):
+        """
+        Files copied by a running backup are journaled next to
+        the file list, and the journal is removed on completion
+        """
+        self._check_gdb_flag_or_skip_test()
+
+        backup_dir = os.path.join(self.tmp_path, self.module_name, self.fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        node.slow_start()
+
+        gdb = self.backup_node(
+            backup_dir, 'node', node, gdb=True,
+            options=['--stream', '--log-level-file=LOG'])
+
+        gdb.set_breakpoint('backup_non_data_file')
+        gdb.run_until_break()
+
+        backup_id = self.show_pb(backup_dir, 'node')[0]['id']
+        journal = os.path.join(
+            backup_dir, 'backups', 'node', backup_id, 'backup_content.journal')
+
+        self.assertTrue(os.path.exists(journal))
+
+        gdb.remove_all_breakpoints()
+        gdb.continue_execution_until_exit()
+
+        self.assertEqual(
+            'OK', self.show_pb(backup_dir, 'node', backup_id)['status'])
+        self.assertFalse(os.path.exists(journal))
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
     # @unittest.skip("skip")
     def test_sigterm_handling(self):
         """"""
@@ -3658,3 +3698,283 @@ class BackupTest(ProbackupTest, unittest.TestCase):
         self.assertFalse(
             os.path.exists(conf_file),
             "File should not exist: {0}".format(conf_file))
+
+    def test_backup_io_queue_depth(self):
+        """
+        FULL and DELTA backups with asynchronous reads must be
+        the same as with synchronous ones
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            pg_options={"fsync": "off", "synchronous_commit": "off"})
+
+        node.pgbench_init(scale=20, no_vacuum=True)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j2', '--io-queue-depth=8'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j2', '--io-queue-depth=8'])
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_backup_large_relation_by_ranges(self):
+        """
+        Data files larger than two block ranges are backed up
+        by several threads at once, check that such backups
+        are valid and restorable
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            pg_options={"fsync": "off", "synchronous_commit": "off"})
+
+        # pgbench_accounts exceeds 256MB
+        node.pgbench_init(scale=30, no_vacuum=True)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j4'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j4', '--compress'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_backup_zeroed_pages(self):
+        """
+        Zeroed pages are stored as headers only
+        and restored as holes in the data file
+        """
+        node, backup_dir = self.make_node_and_catalog()
+
+        node.safe_psql(
+            "postgres",
+            "create table t_heap as select i from generate_series(0,1000) i")
+
+        relpath = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('t_heap')").decode('utf-8').rstrip()
+
+        node.stop()
+
+        # extend relation with 1000 zeroed pages
+        with open(os.path.join(node.data_dir, relpath), 'ab') as f:
+            f.write(b'\0' * 8192 * 1000)
+
+        node.slow_start()
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream'])
+
+        filelist = self.get_backup_filelist(backup_dir, 'node', backup_id)
+        self.assertLess(
+            int(filelist[relpath]['size']), 8192 * 100)
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+        # zeroed pages are not written
+        self.assert_file_has_holes(os.path.join(node.data_dir, relpath))
+
+        node.slow_start()
+        self.assertEqual(
+            node.safe_psql("postgres", "select count(*) from t_heap").decode('utf-8').rstrip(),
+            '1001')
+
+    def test_backup_direct_io(self):
+        """
+        FULL and DELTA backups reading files past the page cache
+        must be the same as ordinary ones
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            pg_options={"fsync": "off", "synchronous_commit": "off"})
+
+        node.pgbench_init(scale=10, no_vacuum=True)
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j2', '--direct-io'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '-j2', '--direct-io'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_backup_direct_io_fallback(self):
+        """
+        --direct-io falls back to dropping pages from page cache
+        on filesystems without O_DIRECT, such as tmpfs, both locally
+        and in remote mode
+        """
+        if not os.path.isdir('/dev/shm'):
+            self.skipTest('tmpfs is not mounted at /dev/shm')
+
+        node, backup_dir = self.make_node_and_catalog()
+
+        tblspc_path = os.path.join('/dev/shm', self.module_name, self.fname)
+        shutil.rmtree(tblspc_path, ignore_errors=True)
+        self.addCleanup(shutil.rmtree, tblspc_path, True)
+        self.create_tblspace_in_node(node, 'tmpfs_tblspc', tblspc_path)
+
+        # kernels since 6.6 allow O_DIRECT on tmpfs
+        probe = os.path.join(tblspc_path, 'probe')
+        open(probe, 'wb').close()
+        try:
+            os.close(os.open(probe, os.O_RDONLY | os.O_DIRECT))
+            direct_io_supported = True
+        except OSError:
+            direct_io_supported = False
+        os.remove(probe)
+
+        # the last extent of 1MB is not full
+        node.safe_psql(
+            'postgres',
+            'create table t_heap tablespace tmpfs_tblspc as '
+            'select i, md5(i::text) from generate_series(0, 30000) i')
+
+        output = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--direct-io', '--log-level-console=VERBOSE'],
+            return_id=False)
+
+        if direct_io_supported:
+            self.assertNotIn('for direct reads', output)
+        else:
+            self.assertIn('for direct reads', output)
+
+        node.safe_psql(
+            'postgres',
+            'insert into t_heap select i, md5(i::text) '
+            'from generate_series(30001, 40000) i')
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--direct-io'] + self.remote_options())
+
+        self.validate_pb(backup_dir, 'node')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored,
+            options=['-T', '{0}={1}'.format(
+                tblspc_path,
+                os.path.join(node_restored.base_dir, 'tblspc'))])
+
+    def test_backup_parallel_listing(self):
+        """
+        PGDATA with tablespaces listed on several threads, locally and
+        by the remote agent, gives the same file list as listing it
+        on a single thread
+        """
+        node, backup_dir = self.make_node_and_catalog()
+
+        self.create_tblspace_in_node(node, 'tblspc1')
+        self.create_tblspace_in_node(node, 'tblspc2')
+
+        node.safe_psql(
+            'postgres',
+            'create database db1 tablespace tblspc2')
+
+        for i in range(20):
+            node.safe_psql(
+                'postgres' if i % 2 else 'db1',
+                'create table t_{0} tablespace tblspc{1} as '
+                'select i from generate_series(0, 1000) i'.format(
+                    i, i % 2 + 1))
+
+        node.safe_psql('postgres', 'checkpoint')
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, options=['--stream', '-j1'])
+        filelist = self.get_backup_filelist(backup_dir, 'node', backup_id)
+
+        for options in [['-j4'], ['-j4'] + self.remote_options()]:
+            backup_id = self.backup_node(
+                backup_dir, 'node', node, options=['--stream'] + options)
+            filelist_parallel = self.get_backup_filelist(
+                backup_dir, 'node', backup_id)
+
+            self.assertEqual(
+                sorted(filelist.keys()), sorted(filelist_parallel.keys()))
+
+            for path, file in filelist.items():
+                if int(file['is_datafile']) == 1:
+                    self.assertEqual(
+                        int(file['size']), int(filelist_parallel[path]['size']),
+                        'Size of "{0}" differs'.format(path))
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored,
+            options=[
+                '-T', '{0}={1}'.format(
+                    self.get_tblspace_path(node, 'tblspc1'),
+                    self.get_tblspace_path(node_restored, 'tblspc1')),
+                '-T', '{0}={1}'.format(
+                    self.get_tblspace_path(node, 'tblspc2'),
+                    self.get_tblspace_path(node_restored, 'tblspc2'))])
+
+    def test_backup_adaptive_rate_without_max_rate(self):
+        """
+        --adaptive-rate is rejected without --max-rate
+        """
+        node, backup_dir = self.make_node_and_catalog()
+
+        with self.assertRaises(ProbackupException) as ctx:
+            self.backup_node(
+                backup_dir, 'node', node,
+                options=['--stream', '--adaptive-rate'])
+        self.assertIn(
+            "ERROR: Option '--adaptive-rate' must be used with '--max-rate' option",
+            ctx.exception.message)
+
+    def test_backup_max_rate(self):
+        """
+        Backup with the reading rate limited must not read faster
+        than the limit and must be restorable
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            pg_options={"track_io_timing": "on"})
+
+        node.pgbench_init(scale=2, no_vacuum=True)
+
+        pgdata_size = int(node.safe_psql(
+            'postgres',
+            'select pg_catalog.pg_database_size(oid) '
+            'from pg_catalog.pg_database '
+            'where datname = \'postgres\'').decode('utf-8').rstrip())
+
+        start = time()
+        backup_id = self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '-j4', '--max-rate=8MB', '--adaptive-rate'])
+        elapsed = time() - start
+
+        # generous bound: reading at twice the limit would still pass
+        self.assertGreaterEqual(elapsed, pgdata_size / (16 * 1024 * 1024))
+
+        # unthrottled backup of the same data is faster
+        start = time()
+        self.backup_node(backup_dir, 'node', node, options=['--stream', '-j4'])
+        self.assertLess(time() - start, elapsed)
+
+        self.restore_and_compare(
+            backup_dir, 'node', node, backup_id=backup_id)
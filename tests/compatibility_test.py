@@ -1105,10 +1105,20 @@ class CompatibilityTest(ProbackupTest, unittest.TestCase):
         # merge chain created by old binary with new binary
         output = self.merge_backup(backup_dir, "node", backup_id)
 
-        # check that in-place is disabled
-        self.assertNotIn(
-            "WARNING: In-place merge is disabled "
-            "because of storage format incompatibility", output)
+        # in-place merge is possible only for the current storage format
+        if self.version_to_num(self.old_probackup_version) < self.version_to_num('2.6.0'):
+            self.assertIn(
+                "WARNING: In-place merge is disabled "
+                "because of storage format incompatibility", output)
+        else:
+            self.assertNotIn(
+                "WARNING: In-place merge is disabled "
+                "because of storage format incompatibility", output)
+
+        # merged backup is converted to the current format
+        self.assertEqual(
+            self.show_pb(backup_dir, 'node', backup_id)['program-version'],
+            self.probackup_version)
 
         # restore merged backup
         node_restored = self.make_simple_node(
@@ -1501,3 +1511,40 @@ class CompatibilityTest(ProbackupTest, unittest.TestCase):
         if self.paranoia:
             pgdata_restored = self.pgdata_content(node_restored.data_dir)
             self.compare_pgdata(pgdata, pgdata_restored)
+
+    def test_backward_compatibility_chain_mixed(self):
+        """
+        Restore FULL and DELTA backups, taken by OLD binary,
+        and PAGE backup on top of them, taken by new binary,
+        each compressed differently
+        """
+        backup_dir = os.path.join(self.tmp_path, self.module_name, self.fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node'),
+            set_replication=True,
+            initdb_params=['--data-checksums'])
+
+        self.init_pb(backup_dir, old_binary=True)
+        self.add_instance(backup_dir, 'node', node, old_binary=True)
+        self.set_archiving(backup_dir, 'node', node, old_binary=True)
+        node.slow_start()
+
+        node.pgbench_init(scale=2)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+
+        for backup_type, old_binary, options in [
+                ('full', True, ['--compress-algorithm=zlib']),
+                ('delta', True, []),
+                ('page', False, ['--compress-algorithm=pglz'])]:
+            backup_id = self.backup_node(
+                backup_dir, 'node', node, backup_type=backup_type,
+                old_binary=old_binary, options=options)
+
+            self.restore_and_compare(
+                backup_dir, 'node', node, node_restored,
+                backup_id=backup_id, options=['-j', '4'])
+
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2', '--no-vacuum'])
+            pgbench.wait()
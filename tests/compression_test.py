@@ -493,3 +493,69 @@ class CompressionTest(ProbackupTest, unittest.TestCase):
             self.compare_pgdata(pgdata, pgdata_restored)
 
         node.slow_start()
+
+    # @unittest.skip("skip")
+    def test_compression_zstd_lz4(self):
+        """
+        make archive node with WAL compressed by zstd or lz4,
+        make full, page and delta backups compressed by the same algorithm,
+        merge them, restore and check data correctness
+        """
+        configure = subprocess.run(
+            [os.environ['PG_CONFIG'], '--configure'],
+            stdout=subprocess.PIPE, check=True).stdout
+
+        for alg in ['zstd', 'lz4']:
+            if '--with-{0}'.format(alg).encode() not in configure:
+                continue
+
+            backup_dir = os.path.join(
+                self.tmp_path, self.module_name, self.fname, alg, 'backup')
+            node = self.make_simple_node(
+                base_dir=os.path.join(self.module_name, self.fname, alg, 'node'),
+                set_replication=True,
+                initdb_params=['--data-checksums'])
+
+            self.init_pb(backup_dir)
+            self.add_instance(backup_dir, 'node', node)
+            self.set_config(
+                backup_dir, 'node',
+                options=['--compress-algorithm={0}'.format(alg)])
+            self.set_archiving(backup_dir, 'node', node, compress=False)
+            node.slow_start()
+
+            node.pgbench_init(scale=2)
+            self.backup_node(backup_dir, 'node', node)
+
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+            pgbench.wait()
+            self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2'])
+            pgbench.wait()
+            backup_id = self.backup_node(
+                backup_dir, 'node', node, backup_type='delta')
+
+            self.assertEqual(
+                alg, self.show_pb(backup_dir, 'node', backup_id)['compress-alg'])
+
+            wal_files = os.listdir(os.path.join(backup_dir, 'wal', 'node'))
+            suffix = '.zst' if alg == 'zstd' else '.lz4'
+            self.assertTrue(
+                any(f.endswith(suffix) for f in wal_files),
+                'Expecting WAL segments compressed with {0}'.format(alg))
+
+            pgdata = self.pgdata_content(node.data_dir)
+            self.validate_pb(backup_dir)
+            self.merge_backup(backup_dir, 'node', backup_id)
+
+            node.cleanup()
+            self.restore_node(backup_dir, 'node', node)
+
+            # Physical comparison
+            if self.paranoia:
+                pgdata_restored = self.pgdata_content(node.data_dir)
+                self.compare_pgdata(pgdata, pgdata_restored)
+
+            node.slow_start()
+            node.stop()
@@ -53,7 +53,7 @@ class ConfigTest(ProbackupTest, unittest.TestCase):
     # @unittest.expectedFailure
     # @unittest.skip("skip")
     def test_corrupt_backup_content(self):
-        """corrupt backup_content.control"""
+        """corrupt backup_content.index"""
         backup_dir = os.path.join(self.tmp_path, self.module_name, self.fname, 'backup')
         node = self.make_simple_node(
             base_dir=os.path.join(self.module_name, self.fname, 'node'),
@@ -74,10 +74,10 @@ class ConfigTest(ProbackupTest, unittest.TestCase):
         fulle2_id = self.backup_node(backup_dir, 'node', node)
 
         fulle1_conf_file = os.path.join(
-            backup_dir, 'backups','node', full1_id, 'backup_content.control')
+            backup_dir, 'backups','node', full1_id, 'backup_content.index')
 
         fulle2_conf_file = os.path.join(
-            backup_dir, 'backups','node', fulle2_id, 'backup_content.control')
+            backup_dir, 'backups','node', fulle2_id, 'backup_content.index')
 
         copyfile(fulle2_conf_file, fulle1_conf_file)
 
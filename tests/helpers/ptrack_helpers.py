@@ -557,6 +557,30 @@ class ProbackupTest(object):
                 node, {}, 'postgresql.conf', ['wal_keep_segments'])
 
         return node
+
+    def make_node_and_catalog(
+            self, set_replication=False, archive=False,
+            block_summary=False, ptrack_enable=False, pg_options={}):
+        """
+        Make node with data checksums and backup catalog
+        with instance 'node', then start the node
+        """
+        backup_dir = os.path.join(self.tmp_path, self.module_name, self.fname, 'backup')
+        node = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node'),
+            set_replication=set_replication,
+            ptrack_enable=ptrack_enable,
+            initdb_params=['--data-checksums'],
+            pg_options=pg_options)
+
+        self.init_pb(backup_dir)
+        self.add_instance(backup_dir, 'node', node)
+        if archive:
+            self.set_archiving(
+                backup_dir, 'node', node, block_summary=block_summary)
+        node.slow_start()
+
+        return node, backup_dir
     
     def simple_bootstrap(self, node, role) -> None:
 
@@ -892,17 +916,14 @@ class ProbackupTest(object):
 
     def get_backup_filelist(self, backup_dir, instance, backup_id):
 
-        filelist_path = os.path.join(
-            backup_dir, 'backups',
-            instance, backup_id, 'backup_content.control')
-
-        with open(filelist_path, 'r') as f:
-                filelist_raw = f.read()
-
-        filelist_splitted = filelist_raw.splitlines()
+        filelist_raw = self.run_pb([
+            'show', '-B', backup_dir, '--instance', instance,
+            '-i', backup_id, '--files'])
 
         filelist = {}
-        for line in filelist_splitted:
+        for line in filelist_raw.splitlines():
+            if not line.startswith('{'):
+                continue
             line = json.loads(line)
             filelist[line['path']] = line
 
@@ -1475,7 +1496,7 @@ class ProbackupTest(object):
             self, backup_dir, instance, node, replica=False,
             overwrite=False, compress=True, old_binary=False,
             log_level=False, archive_timeout=False,
-            custom_archive_command=None):
+            custom_archive_command=None, block_summary=False):
 
         # parse postgresql.auto.conf
         options = {}
@@ -1506,6 +1527,9 @@ class ProbackupTest(object):
             if overwrite:
                 options['archive_command'] += '--overwrite '
 
+            if block_summary:
+                options['archive_command'] += '--block-summary '
+
             options['archive_command'] += '--log-level-console=VERBOSE '
             options['archive_command'] += '-j 5 '
             options['archive_command'] += '--batch-size 10 '
@@ -2024,6 +2048,42 @@ class ProbackupTest(object):
 
         self.assertFalse(fail, error_message)
 
+    def remote_options(self):
+        """
+        Options of an explicit remote run, which is implied
+        by the helpers when tests are run in remote mode
+        """
+        if self.remote:
+            return []
+        return ['--remote-proto=ssh', '--remote-host=localhost']
+
+    def restore_and_compare(
+            self, backup_dir, instance, node, node_restored=None,
+            backup_id=None, options=[]):
+        """
+        Restore backup into node_restored, or into node itself,
+        and compare the result with the current content of node
+        """
+        pgdata = self.pgdata_content(node.data_dir)
+
+        if node_restored is None:
+            node_restored = node
+        node_restored.cleanup()
+
+        self.restore_node(
+            backup_dir, instance, node_restored,
+            backup_id=backup_id, options=options)
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+    def assert_file_has_holes(self, path):
+        """ Check that some blocks of the file are not allocated """
+        st = os.stat(path)
+        self.assertLess(
+            st.st_blocks * 512, st.st_size,
+            'File "{0}" is expected to be sparse'.format(path))
+
     def gdb_attach(self, pid):
         return GDBobj([str(pid)], self, attach=True)
 
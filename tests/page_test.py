@@ -1462,3 +1462,217 @@ class PageTest(ProbackupTest, unittest.TestCase):
         show_backup = self.show_pb(backup_dir,'node')[1]
         self.assertEqual(show_backup['status'], "OK")
         self.assertEqual(show_backup['backup-mode'], "PAGE")
+
+    def test_page_block_summary(self):
+        """
+        archive-push with --block-summary writes summaries of changed
+        blocks, PAGE backup takes the pagemap from them and reads
+        the segments which summaries are corrupted
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True, block_summary=True)
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        self.switch_wal_segment(node)
+
+        wal_dir = os.path.join(backup_dir, 'wal', 'node')
+        summaries = sorted(
+            f for f in os.listdir(wal_dir) if f.endswith('.bsum'))
+        self.assertTrue(summaries, 'No block summaries in the archive')
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--log-level-console=LOG'], return_id=False)
+        self.assertIn('are taken from block summaries', output)
+        self.assertNotIn('the segment will be read', output)
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        self.switch_wal_segment(node)
+
+        # Segments of corrupted summaries are read instead
+        for summary in os.listdir(wal_dir):
+            if not summary.endswith('.bsum'):
+                continue
+            with open(os.path.join(wal_dir, summary), 'r+b') as f:
+                f.seek(-1, 2)
+                last = f.read(1)
+                f.seek(-1, 2)
+                f.write(bytes([last[0] ^ 0xFF]))
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--log-level-console=LOG'], return_id=False)
+        self.assertIn('is corrupted, the segment will be read', output)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_page_block_summary_stale_part(self):
+        """
+        archive-push with --block-summary reuses the temp summary left
+        by a crashed archive-push, PAGE backup reads the segment which
+        summary has invalid magic
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True, block_summary=True)
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # temp summary of the current segment, left an hour ago
+        wal_dir = os.path.join(backup_dir, 'wal', 'node')
+        segment = node.safe_psql(
+            'postgres',
+            'select pg_walfile_name(pg_current_wal_lsn())').decode('utf-8').rstrip()
+        part = os.path.join(wal_dir, segment + '.bsum.part')
+        with open(part, 'wb') as f:
+            f.write(b'garbage')
+        stale_time = time.time() - 3600
+        os.utime(part, (stale_time, stale_time))
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        self.switch_wal_segment(node)
+
+        summary = os.path.join(wal_dir, segment + '.bsum')
+        start = time.time()
+        while not os.path.exists(summary) and time.time() - start < 60:
+            time.sleep(0.5)
+
+        self.assertTrue(os.path.exists(summary), 'Stale temp summary is not reused')
+        self.assertFalse(os.path.exists(part))
+
+        # summary of unknown format is not trusted
+        with open(summary, 'r+b') as f:
+            f.write(b'XXXX')
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--log-level-console=LOG'], return_id=False)
+        self.assertIn('has invalid format, the segment will be read', output)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_page_wal_summaries(self):
+        """
+        PAGE backup takes changed blocks from WAL summaries
+        of the server when summarize_wal is enabled
+        """
+        if self.pg_config_version < self.version_to_num('17.0'):
+            self.skipTest('You need PostgreSQL >= 17 for this test')
+
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True,
+            pg_options={'summarize_wal': 'on'})
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--log-level-console=LOG'], return_id=False)
+        self.assertIn('Building pagemap from WAL summaries of the server', output)
+        self.assertIn('are taken from WAL summaries', output)
+        self.assertNotIn('Extracting pagemap from tli', output)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_page_wal_summaries_not_granted(self):
+        """
+        PAGE backup by a role without EXECUTE privilege on functions
+        of WAL summaries reads changed blocks from WAL
+        """
+        if self.pg_config_version < self.version_to_num('17.0'):
+            self.skipTest('You need PostgreSQL >= 17 for this test')
+
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True,
+            pg_options={'summarize_wal': 'on'})
+
+        self.simple_bootstrap(node, 'backup')
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node, options=['-U', 'backup'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['-U', 'backup', '--log-level-console=LOG'],
+            return_id=False)
+        self.assertIn('Current user has no privileges to read WAL summaries', output)
+        self.assertIn('Extracting pagemap from tli', output)
+        self.assertNotIn('Building pagemap from WAL summaries of the server', output)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_page_wal_summaries_disabled(self):
+        """
+        PAGE backup reads changed blocks from WAL
+        when summarize_wal is off
+        """
+        if self.pg_config_version < self.version_to_num('17.0'):
+            self.skipTest('You need PostgreSQL >= 17 for this test')
+
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True,
+            pg_options={'summarize_wal': 'off'})
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        output = self.backup_node(
+            backup_dir, 'node', node, backup_type='page',
+            options=['--log-level-console=LOG'], return_id=False)
+        self.assertIn('WAL summarization is disabled on the server', output)
+        self.assertIn('Extracting pagemap from tli', output)
+        self.assertNotIn('Building pagemap from WAL summaries of the server', output)
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_page_pagemap_gaps(self):
+        """
+        PAGE backup reads changed blocks by ranges, which include
+        unchanged gaps shorter than PAGEMAP_GAP_BLOCKS, check that
+        blocks around gaps of every length are restored
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap with (fillfactor=50) as '
+            'select i, md5(i::text) t from generate_series(0, 20000) i')
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # gaps of 0 to 5 blocks around PAGEMAP_GAP_BLOCKS of 4, and
+        # a gap across the boundary of 1MB extent, read at once
+        blocks = [0, 1, 3, 6, 10, 15, 21, 100, 126, 129, 200]
+        node.safe_psql(
+            'postgres',
+            "update t_heap set t = md5(t) where ctid = any(array[{0}]::tid[])".format(
+                ', '.join("'({0},1)'".format(blk) for blk in blocks)))
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='page', options=['-j2'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        self.restore_and_compare(backup_dir, 'node', node)
@@ -4396,3 +4396,104 @@ class PtrackTest(ProbackupTest, unittest.TestCase):
 
         # make sure that backup size is exactly the same
         self.assertEqual(delta_bytes, ptrack_bytes)
+
+    def test_ptrack_pagemap_gaps(self):
+        """
+        PTRACK backup reads changed blocks by ranges, which include
+        unchanged gaps shorter than PAGEMAP_GAP_BLOCKS, check that
+        blocks around gaps of every length are restored
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True,
+            ptrack_enable=True)
+
+        node.safe_psql(
+            "postgres",
+            "CREATE EXTENSION ptrack")
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap with (fillfactor=50) as '
+            'select i, md5(i::text) t from generate_series(0, 20000) i')
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # gaps of 0 to 5 blocks around PAGEMAP_GAP_BLOCKS of 4, and
+        # a gap across the boundary of 1MB extent, read at once
+        blocks = [0, 1, 3, 6, 10, 15, 21, 100, 126, 129, 200]
+        node.safe_psql(
+            'postgres',
+            "update t_heap set t = md5(t) where ctid = any(array[{0}]::tid[])".format(
+                ', '.join("'({0},1)'".format(blk) for blk in blocks)))
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='ptrack', options=['-j2'])
+
+        self.validate_pb(backup_dir, 'node')
+
+        self.restore_and_compare(backup_dir, 'node', node)
+
+    def test_ptrack_many_relations(self):
+        """
+        PTRACK backup of thousands of changed relations fails, if the
+        connection is lost while the pagemapset is streamed, and the next
+        PTRACK backup does not depend on the failed one
+        """
+        self._check_gdb_flag_or_skip_test()
+
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, ptrack_enable=True)
+
+        node.safe_psql(
+            "postgres",
+            "CREATE EXTENSION ptrack")
+
+        # tables with indexes make 4000 relations, in batches to fit
+        # into the lock table
+        for batch in range(0, 2000, 500):
+            node.safe_psql(
+                'postgres',
+                "do $$ begin for i in {0}..{1} loop "
+                "execute format('create table t_%s (i int primary key)', i); "
+                "execute format('insert into t_%s values (1)', i); "
+                "end loop; end $$".format(batch, batch + 499))
+
+        self.backup_node(backup_dir, 'node', node, options=['--stream'])
+
+        for batch in range(0, 2000, 500):
+            node.safe_psql(
+                'postgres',
+                "do $$ begin for i in {0}..{1} loop "
+                "execute format('insert into t_%s values (2)', i); "
+                "end loop; end $$".format(batch, batch + 499))
+
+        gdb = self.backup_node(
+            backup_dir, 'node', node, backup_type='ptrack', gdb=True,
+            options=['--stream', '--log-level-file=LOG'])
+
+        # lose the connection after the first row of pagemapset,
+        # rows are not buffered by libpq beyond a few kilobytes
+        gdb.set_breakpoint('ptrack_pagemap_row')
+        gdb.run_until_break()
+        gdb._execute('up')
+        gdb._execute('call (int) close((int) PQsocket(conn))')
+        gdb.remove_all_breakpoints()
+        gdb.continue_execution_until_error()
+
+        failed_backup = self.show_pb(backup_dir, 'node')[1]
+        self.assertEqual(failed_backup['status'], 'ERROR')
+
+        with open(os.path.join(backup_dir, 'log', 'pg_probackup.log')) as f:
+            self.assertIn('query failed', f.read())
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='ptrack',
+            options=['--stream'])
+
+        self.assertEqual(
+            self.show_pb(backup_dir, 'node', backup_id)['parent-backup-id'],
+            self.show_pb(backup_dir, 'node')[0]['id'])
+
+        self.validate_pb(backup_dir, 'node', backup_id)
+
+        self.restore_and_compare(backup_dir, 'node', node)
@@ -3930,3 +3930,259 @@ class RestoreTest(ProbackupTest, unittest.TestCase):
                 self.assertIn(
                     "PANIC:  could not read from control file",
                     f.read())
+
+    def test_restore_compressed_chain_with_holes(self):
+        """
+        Restore and merge of compressed chain, whose data files
+        have runs of changed pages separated by zeroed pages
+        """
+        node, backup_dir = self.make_node_and_catalog()
+
+        node.pgbench_init(scale=2)
+
+        relpath = node.safe_psql(
+            "postgres",
+            "select pg_relation_filepath('pgbench_accounts')").decode('utf-8').rstrip()
+
+        node.stop()
+
+        # extend relation with zeroed pages
+        with open(os.path.join(node.data_dir, relpath), 'ab') as f:
+            f.write(b'\0' * 8192 * 500)
+
+        node.slow_start()
+
+        self.backup_node(
+            backup_dir, 'node', node,
+            options=['--stream', '--compress-algorithm=zlib'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream', '--compress-algorithm=pglz'])
+
+        pgbench = node.pgbench(options=['-T', '10', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta',
+            options=['--stream'])
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, options=['-j', '4'])
+
+        # zeroed pages are not written
+        self.assert_file_has_holes(os.path.join(node_restored.data_dir, relpath))
+
+        self.merge_backup(backup_dir, 'node', backup_id)
+
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, options=['-j', '4'])
+
+        self.assert_file_has_holes(os.path.join(node_restored.data_dir, relpath))
+
+    def test_restore_chain_mixed_compression(self):
+        """
+        Restore FULL, DELTA and PAGE backups of the chain,
+        each compressed by different algorithm
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        node.pgbench_init(scale=2)
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+
+        for backup_type, alg in [
+                ('full', 'zlib'), ('delta', 'pglz'), ('page', 'none')]:
+            backup_id = self.backup_node(
+                backup_dir, 'node', node, backup_type=backup_type,
+                options=['--compress-algorithm={0}'.format(alg)])
+
+            self.restore_and_compare(
+                backup_dir, 'node', node, node_restored,
+                backup_id=backup_id, options=['-j', '4'])
+
+            pgbench = node.pgbench(options=['-T', '5', '-c', '2', '--no-vacuum'])
+            pgbench.wait()
+
+    def test_restore_chain_truncated_in_middle(self):
+        """
+        Restore FULL, DELTA and PAGE backups of the chain,
+        whose relation is truncated before DELTA and grows
+        again before PAGE backup
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as '
+            'select i, md5(i::text) t from generate_series(0, 100000) i')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+
+        backup_id = self.backup_node(backup_dir, 'node', node)
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, backup_id=backup_id)
+
+        # vacuum cuts empty pages off the tail of the relation
+        node.safe_psql('postgres', 'delete from t_heap where i > 1000')
+        node.safe_psql('postgres', 'vacuum t_heap')
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta')
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, backup_id=backup_id)
+
+        node.safe_psql(
+            'postgres',
+            'insert into t_heap select i, md5(i::text) '
+            'from generate_series(1001, 50000) i')
+
+        backup_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, backup_id=backup_id)
+
+    def test_restore_chain_incremental_mode(self):
+        """
+        Incremental restore of FULL, DELTA and PAGE chain
+        in checksum and lsn modes
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        node.pgbench_init(scale=2)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        # stale copy of the instance to restore into
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+        node_restored.cleanup()
+        self.restore_node(backup_dir, 'node', node_restored)
+        self.set_auto_conf(
+            node_restored,
+            {'port': node_restored.port, 'archive_mode': 'off'})
+        node_restored.slow_start()
+        pgbench = node_restored.pgbench(
+            options=['-T', '5', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        node_restored.stop()
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        self.backup_node(backup_dir, 'node', node, backup_type='delta')
+
+        pgbench = node.pgbench(options=['-T', '5', '-c', '2', '--no-vacuum'])
+        pgbench.wait()
+        self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+        pgdata = self.pgdata_content(node.data_dir)
+
+        self.restore_node(
+            backup_dir, 'node', node_restored,
+            options=['-j', '4', '--incremental-mode=checksum'])
+
+        pgdata_restored = self.pgdata_content(node_restored.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+        node.stop()
+
+        self.restore_node(
+            backup_dir, 'node', node,
+            options=['-j', '4', '--incremental-mode=lsn'])
+
+        pgdata_restored = self.pgdata_content(node.data_dir)
+        self.compare_pgdata(pgdata, pgdata_restored)
+
+    def test_restore_chain_file_only_in_middle(self):
+        """
+        File, which exists only in the middle backup of the chain,
+        is restored from it and is not restored from the latest backup
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        node.pgbench_init(scale=1)
+
+        self.backup_node(backup_dir, 'node', node)
+
+        extra_file = os.path.join(node.data_dir, 'extra_file')
+        with open(extra_file, 'w') as f:
+            f.write('written before DELTA backup')
+
+        delta_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='delta')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, backup_id=delta_id)
+
+        os.remove(extra_file)
+
+        page_id = self.backup_node(
+            backup_dir, 'node', node, backup_type='page')
+
+        self.restore_and_compare(
+            backup_dir, 'node', node, node_restored, backup_id=page_id)
+        self.assertFalse(
+            os.path.exists(os.path.join(node_restored.data_dir, 'extra_file')))
+
+    def test_restore_chain_file_recreated(self):
+        """
+        Files, which are dropped and created again within the chain,
+        are restored with their latest content
+        """
+        node, backup_dir = self.make_node_and_catalog(
+            set_replication=True, archive=True)
+
+        extra_file = os.path.join(node.data_dir, 'extra_file')
+        with open(extra_file, 'w') as f:
+            f.write('written before FULL backup, longer than the later one')
+
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as '
+            'select i, md5(i::text) t from generate_series(0, 10000) i')
+
+        self.backup_node(backup_dir, 'node', node)
+
+        os.remove(extra_file)
+        node.safe_psql('postgres', 'drop table t_heap')
+
+        self.backup_node(backup_dir, 'node', node, backup_type='delta')
+
+        with open(extra_file, 'w') as f:
+            f.write('written before PAGE')
+        node.safe_psql(
+            'postgres',
+            'create table t_heap as '
+            'select i, md5(i::text) t from generate_series(0, 100) i')
+
+        self.backup_node(backup_dir, 'node', node, backup_type='page')
+
+        node_restored = self.make_simple_node(
+            base_dir=os.path.join(self.module_name, self.fname, 'node_restored'))
+        self.restore_and_compare(backup_dir, 'node', node, node_restored)
+
+        with open(os.path.join(node_restored.data_dir, 'extra_file')) as f:
+            self.assertEqual(f.read(), 'written before PAGE')
+
+        self.set_auto_conf(
+            node_restored,
+            {'port': node_restored.port, 'archive_mode': 'off'})
+        node_restored.slow_start()
+        self.assertEqual(
+            node_restored.safe_psql(
+                'postgres', 'select count(*) from t_heap').decode('utf-8').rstrip(),
+            '101')